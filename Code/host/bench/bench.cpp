@@ -0,0 +1,682 @@
+/**
+ * @file     bench.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Host benchmarks of the protocol stack hot paths.
+ *           Reports ns/op and allocations/op for each benchmark and
+ *           compares them against a stored baseline. The AES-CCM shim is
+ *           first checked against the NIST SP 800-38C example vectors.
+ * 
+ *           Usage: program [-n iterations] [-b baseline.csv] [-w baseline.csv]
+ *                  [-t tolerance %] [-f filter]
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "typedefs.h"
+#include "L1.h"
+#include "L2.h"
+#include "L3.h"
+#include "fec.h"
+#include "crypto.h"
+#include "message.h"
+#include "webpage.h"
+#include "mbedtls/ccm.h"
+
+#define BENCHMAX 32
+
+/**
+ * @brief    Benchmark definition
+ * 
+ */
+typedef struct
+{
+  const char *name;
+  void (*setup)();
+  void (*run)();
+  void (*cleanup)();
+} bench_case_struct;
+
+/**
+ * @brief    AES-CCM test vector, the inputs are counting bytes
+ * 
+ */
+typedef struct
+{
+  uint8_t nonce_size;
+  uint8_t add_size;
+  uint8_t plain_size;
+  uint8_t tag_size;
+  uint8_t cipher[40];
+} bench_vector_struct;
+
+/**
+ * @brief    Benchmark result
+ * 
+ */
+typedef struct
+{
+  char name[48];
+  double ns_per_op;
+  double allocs_per_op;
+} bench_result_struct;
+
+// Imported functions (firmware)
+void setup();
+return_type L1_packSend(pack_struct packet);
+extern bool L1_flag_received;
+extern int L1_outBuffer_left;
+
+// Allocation counting: malloc family interposed over glibc
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t number, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+static uint64_t bench_allocs = 0;
+
+extern "C" void *malloc(size_t size)
+{
+  bench_allocs++;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t number, size_t size)
+{
+  bench_allocs++;
+  return __libc_calloc(number, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+  bench_allocs++;
+  return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr)
+{
+  __libc_free(ptr);
+}
+
+// Private variables
+static uint8_t frame[256];
+static size_t frame_size;
+static uint8_t plain_frame[256];
+static size_t plain_size;
+static uint32_t frame_id = 1;
+static pack_struct bench_packet;
+static char bench_text[] = "The quick brown fox jumps over the lazy dog, benchmarking the LoRaMessenger stack";
+static uint8_t page_buffer[1460];
+static uint8_t coded_frame[256];
+static uint8_t coded_received[256];
+static int coded_size;
+
+// Private functions
+
+/**
+ * @brief    Returns a monotonic timestamp (ns)
+ * 
+ */
+static uint64_t bench_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief    Transmit hook: frames are dropped and no airtime is spent
+ * 
+ */
+static void bench_transmit(const uint8_t *data, size_t size, uint32_t airtime)
+{
+}
+
+/**
+ * @brief    Encrypts the plain frame as sent on air
+ * 
+ */
+static void bench_sealFrame()
+{
+  memcpy(frame, plain_frame, plain_size);
+  frame_size = plain_size;
+  crypto_seal(frame, &frame_size);
+}
+
+/**
+ * @brief    Builds a raw frame as sent on air
+ * 
+ */
+static void bench_buildFrame(uint8_t ttl, uint8_t receiver, uint8_t sender, uint8_t last_node, uint8_t next_node, uint32_t id, uint8_t type, const uint8_t *payload, size_t payload_size)
+{
+  uint8_t header[7] = {NETID, ttl, receiver, sender, last_node, next_node};
+  memcpy(plain_frame, header, 6);
+  memcpy(plain_frame + 6, &id, 4);
+  plain_frame[10] = type;
+  memcpy(plain_frame + 11, payload, payload_size);
+  plain_size = 11 + payload_size;
+  bench_sealFrame();
+}
+
+/**
+ * @brief    Builds a message frame
+ * 
+ */
+static void bench_messageFrame(uint8_t receiver, uint8_t sender, uint8_t last_node, uint32_t id)
+{
+  uint8_t payload[200];
+  payload[0] = strlen(bench_text);
+  memcpy(payload + 1, bench_text, payload[0]);
+  bench_buildFrame(TTL, receiver, sender, last_node, NODENUMBER, id, payload_msg, payload, payload[0] + 1);
+}
+
+/**
+ * @brief    Empties the sending queue, outside of the timed section
+ * 
+ */
+static void bench_drainQueue()
+{
+  while (L1_outBuffer_left)
+  {
+    host_advanceMicros(1000000);
+    L1_send_outPacket();
+  }
+}
+
+/**
+ * @brief    Receives the prepared frame
+ * 
+ */
+static void bench_receive()
+{
+  host_radioDeliver(frame, frame_size, -60, 9.5);
+  L1_flag_received = 0;
+  L1_receive();
+}
+
+// Benchmarks
+
+static void bench_receiveMessageSetup()
+{
+  bench_messageFrame(NODENUMBER, 2, 2, frame_id);
+}
+
+static void bench_receiveMessageCleanup()
+{
+  bench_drainQueue();
+  memcpy(plain_frame + 6, &(++frame_id), 4);
+  bench_sealFrame();
+}
+
+static void bench_receiveRelaySetup()
+{
+  bench_messageFrame(3, 2, 2, frame_id);
+}
+
+static void bench_receiveAnnounceSetup()
+{
+  uint8_t payload[9] = {0, 0, 0, 0, 0, 0, 1, NODENUMBER, 250};
+  uint16_t name_version = L3_getNameVersion(2);
+  memcpy(payload, &name_version, 2);
+  bench_buildFrame(TTL, BROADCASTADDR, 2, 2, BROADCASTADDR, frame_id, payload_ann, payload, 9);
+}
+
+static void bench_packSendSetup()
+{
+  bench_packet.ttl = TTL;
+  bench_packet.hops = 0;
+  bench_packet.receiver = 2;
+  bench_packet.sender = NODENUMBER;
+  bench_packet.last_node = NODENUMBER;
+  bench_packet.next_node = 2;
+  bench_packet.id = 1;
+  bench_packet.type = payload_msg;
+  bench_packet.payload = L2_setPayloadMessage(bench_text);
+}
+
+static void bench_packSend()
+{
+  L1_packSend(bench_packet);
+}
+
+static void bench_handleRelaySetup()
+{
+  bench_packet.ttl = TTL;
+  bench_packet.hops = 0;
+  bench_packet.receiver = 3;
+  bench_packet.sender = 2;
+  bench_packet.last_node = 2;
+  bench_packet.next_node = NODENUMBER;
+  bench_packet.id = frame_id;
+  bench_packet.type = payload_msg;
+  bench_packet.payload = L2_setPayloadMessage(bench_text);
+}
+
+static void bench_handleRelay()
+{
+  L2_handleMessage(bench_packet);
+}
+
+static void bench_handleRelayCleanup()
+{
+  bench_drainQueue();
+  bench_handleRelaySetup();
+}
+
+static void bench_handleAnnounceSetup()
+{
+  static payload_announce_struct payload_announce;
+  payload_announce.name_version = L3_getNameVersion(2);
+
+  bench_packet.ttl = TTL;
+  bench_packet.hops = 0;
+  bench_packet.receiver = BROADCASTADDR;
+  bench_packet.sender = 2;
+  bench_packet.last_node = 2;
+  bench_packet.next_node = BROADCASTADDR;
+  bench_packet.id = frame_id;
+  bench_packet.type = payload_ann;
+  bench_packet.rssi = -70;
+  bench_packet.payload = &payload_announce;
+}
+
+static void bench_handleAnnounce()
+{
+  bench_packet.id++;
+  L3_handleAnnounce(bench_packet);
+}
+
+static void bench_messageSave()
+{
+  message_save(2, NODENUMBER, bench_text, frame_id++);
+}
+
+static void bench_checkDuplicate()
+{
+  message_checkDuplicate(2, 0xFFFFFFFF);
+}
+
+static void bench_ackBroadcastSetup()
+{
+  // Merged acknowledgment of every other node
+  static payload_acknowledgment_struct ack_payload;
+  ack_payload.nodes_count = 0;
+  for (int node = 1; node <= MAXNODES; node++)
+  {
+    if (node != NODENUMBER)
+      ack_payload.nodes[ack_payload.nodes_count++] = node;
+  }
+
+  bench_packet.ttl = TTL;
+  bench_packet.hops = 0;
+  bench_packet.receiver = NODENUMBER;
+  bench_packet.sender = 2;
+  bench_packet.last_node = 2;
+  bench_packet.next_node = NODENUMBER;
+  bench_packet.type = payload_ack;
+  bench_packet.rssi = -80;
+  bench_packet.payload = &ack_payload;
+}
+
+static void bench_ackBroadcast()
+{
+  // A broadcast message acknowledged by the whole network
+  payload_acknowledgment_struct *ack_payload = (payload_acknowledgment_struct *)bench_packet.payload;
+  ack_payload->packet_id = 0x100000 + frame_id++;
+  bench_packet.id = ack_payload->packet_id;
+  message_save(BROADCASTADDR, NODENUMBER, bench_text, ack_payload->packet_id);
+  L2_handleacknowledgment(bench_packet);
+}
+
+static void bench_indexPageSetup()
+{
+  // Full routing table with known names and full message history
+  for (int node = 2; node <= MAXNODES; node++)
+  {
+    char name[16];
+    payload_name_struct name_payload;
+    sprintf(name, "Node %d", node);
+    name_payload.name_size = strlen(name);
+    name_payload.name_ptr = name;
+    name_payload.name_version = node;
+
+    pack_struct packet;
+    packet.ttl = TTL;
+    packet.hops = 0;
+    packet.receiver = BROADCASTADDR;
+    packet.sender = node;
+    packet.last_node = node;
+    packet.next_node = BROADCASTADDR;
+    packet.id = node;
+    packet.type = payload_name;
+    packet.rssi = -80;
+    packet.payload = &name_payload;
+    L3_handlePacket(packet);
+    L3_handleName(packet);
+  }
+
+  for (int i = 0; i < KEEPNMESSAGES; i++)
+  {
+    message_save(BROADCASTADDR, NODENUMBER, bench_text, 0x1000 + i);
+    for (int node = 2; node <= MAXNODES; node++)
+      message_saveAck(node, 0x1000 + i);
+  }
+  bench_drainQueue();
+}
+
+static void bench_indexPage()
+{
+  webpage_render_struct render;
+  webpage_begin(&render, webpage_index, 0);
+  while (webpage_fill(&render, page_buffer, sizeof(page_buffer)) > 0)
+    ;
+}
+
+static void bench_codecSetup()
+{
+  bench_messageFrame(3, 2, 2, frame_id);
+}
+
+static void bench_fecEncode()
+{
+  memcpy(coded_frame, frame, frame_size);
+  coded_size = fec_encode(coded_frame, frame_size);
+}
+
+static void bench_fecDecodeCleanSetup()
+{
+  bench_codecSetup();
+  bench_fecEncode();
+  memcpy(coded_received, coded_frame, coded_size);
+}
+
+static void bench_fecDecodeErrorsSetup()
+{
+  // As many corrupted bytes as the code corrects, spread over the frame
+  bench_fecDecodeCleanSetup();
+  for (int i = 0; i < FECPARITY / 2; i++)
+    coded_received[i * coded_size / (FECPARITY / 2)] ^= 0x5A + i;
+}
+
+static void bench_fecDecode()
+{
+  int corrected;
+  memcpy(coded_frame, coded_received, coded_size);
+  fec_decode(coded_frame, coded_size, &corrected);
+}
+
+static void bench_cryptoSeal()
+{
+  memcpy(coded_frame, plain_frame, plain_size);
+  size_t size = plain_size;
+  crypto_seal(coded_frame, &size);
+}
+
+static void bench_cryptoOpen()
+{
+  // Own frames skip the replay check
+  memcpy(coded_frame, frame, frame_size);
+  size_t size = frame_size;
+  crypto_open(coded_frame, &size);
+}
+
+static void bench_cryptoOpenSetup()
+{
+  bench_messageFrame(3, NODENUMBER, NODENUMBER, frame_id);
+}
+
+static const bench_case_struct bench_cases[] = {
+    {"L1_receive_message", bench_receiveMessageSetup, bench_receive, bench_receiveMessageCleanup},
+    {"L1_receive_relay", bench_receiveRelaySetup, bench_receive, bench_receiveMessageCleanup},
+    {"L1_receive_announce", bench_receiveAnnounceSetup, bench_receive, bench_receiveMessageCleanup},
+    {"L1_packSend_message", bench_packSendSetup, bench_packSend, NULL},
+    {"L2_handleMessage_relay", bench_handleRelaySetup, bench_handleRelay, bench_handleRelayCleanup},
+    {"L3_handleAnnounce", bench_handleAnnounceSetup, bench_handleAnnounce, NULL},
+    {"message_save", NULL, bench_messageSave, NULL},
+    {"message_checkDuplicate", NULL, bench_checkDuplicate, NULL},
+    {"message_ack_broadcast", bench_ackBroadcastSetup, bench_ackBroadcast, NULL},
+    {"webpage_index", bench_indexPageSetup, bench_indexPage, NULL},
+    {"crypto_seal", bench_codecSetup, bench_cryptoSeal, NULL},
+    {"crypto_open", bench_cryptoOpenSetup, bench_cryptoOpen, NULL},
+    {"fec_encode", bench_codecSetup, bench_fecEncode, NULL},
+    {"fec_decode_clean", bench_fecDecodeCleanSetup, bench_fecDecode, NULL},
+    {"fec_decode_errors", bench_fecDecodeErrorsSetup, bench_fecDecode, NULL},
+};
+
+// NIST SP 800-38C appendix C examples 1 to 3: key 40..4f, nonce from 10,
+// additional data from 00, plaintext from 20, ciphertext then tag
+static const bench_vector_struct bench_vectors[] = {
+    {7, 8, 4, 4, {0x71, 0x62, 0x01, 0x5b, 0x4d, 0xac, 0x25, 0x5d}},
+    {8, 16, 16, 6, {0xd2, 0xa1, 0xf0, 0xe0, 0x51, 0xea, 0x5f, 0x62, 0x08, 0x1a, 0x77, 0x92, 0x07, 0x3d, 0x59, 0x3d, 0x1f, 0xc6, 0x4f, 0xbf, 0xac, 0xcd}},
+    {12, 20, 24, 8, {0xe3, 0xb2, 0x01, 0xa9, 0xf5, 0xb7, 0x1a, 0x7a, 0x9b, 0x1c, 0xea, 0xec, 0xcd, 0x97, 0xe7, 0x0b, 0x61, 0x76, 0xaa, 0xd9, 0xa4, 0x42, 0x8a, 0xa5, 0x48, 0x43, 0x92, 0xfb, 0xc1, 0xb0, 0x99, 0x51}},
+};
+
+/**
+ * @brief    Checks the AES-CCM shim against the test vectors, encryption
+ *           and authenticated decryption
+ * 
+ * @return   int number of failed vectors
+ */
+static int bench_checkVectors()
+{
+  uint8_t key[16], nonce[13], add[20], plain[24];
+  for (int i = 0; i < 24; i++)
+  {
+    if (i < 16)
+      key[i] = 0x40 + i;
+    if (i < 13)
+      nonce[i] = 0x10 + i;
+    if (i < 20)
+      add[i] = i;
+    plain[i] = 0x20 + i;
+  }
+
+  mbedtls_ccm_context ccm;
+  mbedtls_ccm_init(&ccm);
+  mbedtls_ccm_setkey(&ccm, MBEDTLS_CIPHER_ID_AES, key, 128);
+
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(bench_vectors) / sizeof(bench_vectors[0]); i++)
+  {
+    const bench_vector_struct *vector = &bench_vectors[i];
+    uint8_t output[40], decrypted[24];
+
+    bool valid = mbedtls_ccm_encrypt_and_tag(&ccm, vector->plain_size, nonce, vector->nonce_size, add, vector->add_size, plain, output,
+                                             output + vector->plain_size, vector->tag_size) == 0 &&
+                 memcmp(output, vector->cipher, vector->plain_size + vector->tag_size) == 0 &&
+                 mbedtls_ccm_auth_decrypt(&ccm, vector->plain_size, nonce, vector->nonce_size, add, vector->add_size, vector->cipher, decrypted,
+                                          vector->cipher + vector->plain_size, vector->tag_size) == 0 &&
+                 memcmp(decrypted, plain, vector->plain_size) == 0;
+
+    // A changed tag needs to fail the authentication
+    output[vector->plain_size] ^= 1;
+    valid = valid && mbedtls_ccm_auth_decrypt(&ccm, vector->plain_size, nonce, vector->nonce_size, add, vector->add_size, output, decrypted,
+                                              output + vector->plain_size, vector->tag_size) == MBEDTLS_ERR_CCM_AUTH_FAILED;
+    if (!valid)
+    {
+      fprintf(stderr, "AES-CCM test vector %d failed\n", (int)i + 1);
+      failed++;
+    }
+  }
+
+  mbedtls_ccm_free(&ccm);
+  return failed;
+}
+
+/**
+ * @brief    Runs a benchmark
+ * 
+ *           Benchmarks without cleanup are timed as a whole loop, the others
+ *           are timed one operation at a time so the cleanup is excluded.
+ */
+static void bench_run(const bench_case_struct *bench, long iterations, bench_result_struct *result)
+{
+  uint64_t elapsed = 0;
+  uint64_t allocs = 0;
+
+  if (bench->setup != NULL)
+    bench->setup();
+
+  if (bench->cleanup == NULL)
+  {
+    uint64_t allocs_start = bench_allocs;
+    uint64_t start = bench_now();
+    for (long i = 0; i < iterations; i++)
+      bench->run();
+    elapsed = bench_now() - start;
+    allocs = bench_allocs - allocs_start;
+  }
+  else
+  {
+    for (long i = 0; i < iterations; i++)
+    {
+      uint64_t allocs_start = bench_allocs;
+      uint64_t start = bench_now();
+      bench->run();
+      elapsed += bench_now() - start;
+      allocs += bench_allocs - allocs_start;
+      bench->cleanup();
+    }
+  }
+
+  snprintf(result->name, sizeof(result->name), "%s", bench->name);
+  result->ns_per_op = (double)elapsed / iterations;
+  result->allocs_per_op = (double)allocs / iterations;
+}
+
+/**
+ * @brief    Loads a baseline file (CSV: benchmark,ns_per_op,allocs_per_op)
+ * 
+ * @return   int number of loaded results, -1 on error
+ */
+static int bench_loadBaseline(const char *path, bench_result_struct *baseline)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return -1;
+
+  char line[128];
+  int count = 0;
+  while (fgets(line, sizeof(line), file) != NULL && count < BENCHMAX)
+  {
+    if (sscanf(line, "%47[^,],%lf,%lf", baseline[count].name, &baseline[count].ns_per_op, &baseline[count].allocs_per_op) == 3)
+      count++;
+  }
+  fclose(file);
+  return count;
+}
+
+/**
+ * @brief    Benchmarks entry point
+ * 
+ */
+int main(int argc, char **argv)
+{
+  long iterations = 100000;
+  const char *baseline_path = NULL;
+  const char *write_path = NULL;
+  const char *filter = NULL;
+  double tolerance = 25;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:b:w:t:f:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      iterations = atol(optarg);
+      break;
+    case 'b':
+      baseline_path = optarg;
+      break;
+    case 'w':
+      write_path = optarg;
+      break;
+    case 't':
+      tolerance = atof(optarg);
+      break;
+    case 'f':
+      filter = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n iterations] [-b baseline.csv] [-w baseline.csv] [-t tolerance %%] [-f filter]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  bench_result_struct baseline[BENCHMAX];
+  int baseline_count = 0;
+  if (baseline_path != NULL && (baseline_count = bench_loadBaseline(baseline_path, baseline)) < 0)
+  {
+    fprintf(stderr, "Cannot read baseline %s\n", baseline_path);
+    return 2;
+  }
+
+  if (bench_checkVectors())
+    return 1;
+
+  host_serialOutput(NULL);
+  host_transmitHook = bench_transmit;
+  setup();
+  bench_drainQueue();
+
+  int count = sizeof(bench_cases) / sizeof(bench_cases[0]);
+  bench_result_struct results[BENCHMAX];
+  int regressions = 0;
+
+  printf("benchmark,ns_per_op,allocs_per_op,baseline_ns_per_op,baseline_allocs_per_op,status\n");
+  for (int i = 0; i < count; i++)
+  {
+    if (filter != NULL && strstr(bench_cases[i].name, filter) == NULL)
+    {
+      results[i].name[0] = 0;
+      continue;
+    }
+
+    bench_run(&bench_cases[i], iterations, &results[i]);
+
+    const char *status = "new";
+    double baseline_ns = 0, baseline_allocs = 0;
+    for (int j = 0; j < baseline_count; j++)
+    {
+      if (strcmp(baseline[j].name, results[i].name) == 0)
+      {
+        baseline_ns = baseline[j].ns_per_op;
+        baseline_allocs = baseline[j].allocs_per_op;
+        if (results[i].ns_per_op > baseline_ns * (1 + tolerance / 100) || results[i].allocs_per_op > baseline_allocs + 0.01)
+        {
+          status = "REGRESSION";
+          regressions++;
+        }
+        else
+          status = "ok";
+      }
+    }
+
+    printf("%s,%.1f,%.2f,%.1f,%.2f,%s\n", results[i].name, results[i].ns_per_op, results[i].allocs_per_op, baseline_ns, baseline_allocs, status);
+  }
+
+  if (write_path != NULL)
+  {
+    FILE *file = fopen(write_path, "w");
+    if (file == NULL)
+    {
+      fprintf(stderr, "Cannot write baseline %s\n", write_path);
+      return 2;
+    }
+    fprintf(file, "benchmark,ns_per_op,allocs_per_op\n");
+    for (int i = 0; i < count; i++)
+    {
+      if (results[i].name[0])
+        fprintf(file, "%s,%.1f,%.2f\n", results[i].name, results[i].ns_per_op, results[i].allocs_per_op);
+    }
+    fclose(file);
+  }
+
+  return regressions ? 1 : 0;
+}
@@ -0,0 +1,701 @@
+/**
+ * @file     gateway.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Serial gateway host program (Linux).
+ *           Talks to a node over its serial port, or to a simulated node
+ *           over the pseudo-terminal printed by the simulator (-G):
+ *           - send: sends the messages read from stdin, one per line as
+ *             "receiver text", batched in as few frames as possible and
+ *             sent again while the node queue or congestion window is
+ *             full. Prints receiver, packet id and status of each
+ *             message.
+ *           - nodes: prints the active nodes.
+ *           - stats: prints the metrics snapshot.
+ *           - conversations: prints the conversations.
+ *           - thread peer: prints a conversation page by page, newest
+ *             message first, and marks it read.
+ *           - listen: prints the messages and acknowledgments received.
+ *           - ota file version key: uploads a firmware image signed with
+ *             the private key (PEM file), the node stages it and
+ *             distributes it to the mesh.
+ *           The frame format is described in src/gateway.cpp.
+ * 
+ *           Usage: program -d device [-b baud] [-t timeout ms] send|nodes|stats|conversations|thread peer|listen|ota file version key
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include "config.h"
+#include "typedefs.h"
+#include "metrics.h"
+
+#define HOSTRETRYMS 500 // Wait before sending again the messages refused by a full queue or window (ms)
+#define HOSTOTACHUNK 256 // Image bytes per upload frame (bytes)
+
+/**
+ * @brief    Message read from stdin
+ * 
+ */
+typedef struct
+{
+  uint8_t receiver;
+  uint8_t size;
+  char text[256];
+} host_message_struct;
+
+// Private variables
+static int serial = -1;
+static uint32_t timeout = 5000;
+static uint8_t sequence = 0;
+static uint8_t rx_buffer[2 * GATEWAYFRAME];
+static size_t rx_size = 0;
+
+// Private functions
+
+/**
+ * @brief    Returns the monotonic clock (ms)
+ * 
+ */
+static uint64_t host_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000ull + now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief    CRC16 of the frames, same as crc16_le of the ESP32 ROM
+ * 
+ */
+static uint16_t host_crc16(const uint8_t *buffer, size_t size)
+{
+  uint16_t crc = 0xFFFF;
+  while (size--)
+  {
+    crc ^= *buffer++;
+    for (int i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0x8408 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+/**
+ * @brief    COBS decodes a segment
+ * 
+ * @param    input: Encoded data, without the 0 delimiters
+ * @param    size: Encoded size
+ * @param    output: Decoded data, GATEWAYFRAME bytes
+ * @return   int decoded size, -1 if the data is not valid
+ */
+static int host_decode(const uint8_t *input, size_t size, uint8_t *output)
+{
+  size_t read = 0, write = 0;
+
+  while (read < size)
+  {
+    uint8_t code = input[read++];
+    if (code == 0 || read + code - 1 > size || write + code > GATEWAYFRAME)
+      return -1;
+
+    for (int i = 1; i < code; i++)
+      output[write++] = input[read++];
+    if (code < 0xFF && read < size)
+      output[write++] = 0;
+  }
+
+  return write;
+}
+
+/**
+ * @brief    Writes a frame
+ * 
+ * @param    type: Frame type
+ * @param    data: Data
+ * @param    size: Data size
+ * @return   uint8_t sequence number of the frame
+ */
+static uint8_t host_write(uint8_t type, const uint8_t *data, size_t size)
+{
+  uint8_t frame[GATEWAYFRAME];
+  uint8_t encoded[GATEWAYFRAME + GATEWAYFRAME / 254 + 3];
+
+  frame[0] = type;
+  frame[1] = ++sequence;
+  memcpy(frame + 2, data, size);
+  size += 2;
+  uint16_t crc = host_crc16(frame, size);
+  memcpy(frame + size, &crc, 2);
+  size += 2;
+
+  // COBS
+  size_t code_index = 1, index = 2;
+  uint8_t code = 1;
+  encoded[0] = 0;
+  for (size_t i = 0; i < size; i++)
+  {
+    if (frame[i] != 0)
+    {
+      encoded[index++] = frame[i];
+      code++;
+    }
+    if (frame[i] == 0 || code == 0xFF)
+    {
+      encoded[code_index] = code;
+      code = 1;
+      code_index = index++;
+    }
+  }
+  encoded[code_index] = code;
+  encoded[index++] = 0;
+
+  if (write(serial, encoded, index) != (ssize_t)index)
+  {
+    perror("write");
+    exit(1);
+  }
+  return sequence;
+}
+
+/**
+ * @brief    Reads the next valid frame, the log lines are skipped
+ * 
+ * @param    frame: Decoded frame (type, sequence number, data)
+ * @param    wait: Timeout (ms)
+ * @return   int data size, -1 on timeout
+ */
+static int host_read(uint8_t *frame, uint32_t wait)
+{
+  uint64_t deadline = host_now() + wait;
+
+  while (1)
+  {
+    // Complete segments between two 0 bytes
+    uint8_t *end = (uint8_t *)memchr(rx_buffer, 0, rx_size);
+    while (end != NULL)
+    {
+      size_t encoded_size = end - rx_buffer;
+      int size = host_decode(rx_buffer, encoded_size, frame);
+
+      rx_size -= encoded_size + 1;
+      memmove(rx_buffer, end + 1, rx_size);
+
+      uint16_t crc = 0;
+      if (size >= 4)
+        memcpy(&crc, frame + size - 2, 2);
+      if (size >= 4 && crc == host_crc16(frame, size - 2))
+        return size - 4;
+
+      end = (uint8_t *)memchr(rx_buffer, 0, rx_size);
+    }
+
+    // A segment too long is a log line, not a frame
+    if (rx_size == sizeof(rx_buffer))
+      rx_size = 0;
+
+    uint64_t now = host_now();
+    if (now >= deadline)
+      return -1;
+
+    struct pollfd descriptor = {serial, POLLIN, 0};
+    if (poll(&descriptor, 1, deadline - now) > 0)
+    {
+      ssize_t count = read(serial, rx_buffer + rx_size, sizeof(rx_buffer) - rx_size);
+      if (count > 0)
+        rx_size += count;
+    }
+  }
+}
+
+/**
+ * @brief    Prints a streamed message or acknowledgment
+ * 
+ */
+static void host_printEvent(const uint8_t *frame, int size)
+{
+  uint32_t packet_id;
+
+  if (frame[0] == gateway_message && size >= 7)
+  {
+    memcpy(&packet_id, frame + 4, 4);
+    printf("message %u %u %08x %.*s\n", frame[2], frame[3], packet_id, frame[8] < size - 7 ? frame[8] : size - 7, (const char *)frame + 9);
+  }
+  else if (frame[0] == gateway_ack && size >= 5)
+  {
+    memcpy(&packet_id, frame + 3, 4);
+    printf("ack %u %08x\n", frame[2], packet_id);
+  }
+  fflush(stdout);
+}
+
+/**
+ * @brief    Sends a command and waits for its reply, streamed events are
+ *           printed meanwhile
+ * 
+ * @param    type: Command
+ * @param    data: Data
+ * @param    size: Data size
+ * @param    reply: Reply frame
+ * @return   int reply data size, exits on timeout
+ */
+static int host_command(uint8_t type, const uint8_t *data, size_t size, uint8_t *reply)
+{
+  uint8_t number = host_write(type, data, size);
+
+  while (1)
+  {
+    int reply_size = host_read(reply, timeout);
+    if (reply_size < 0)
+    {
+      fprintf(stderr, "No reply from the node\n");
+      exit(1);
+    }
+
+    if (reply[0] == type + gateway_reply && reply[1] == number && reply_size >= 1)
+      return reply_size;
+
+    host_printEvent(reply, reply_size);
+  }
+}
+
+/**
+ * @brief    Sends the messages read from stdin
+ * 
+ */
+static int host_send()
+{
+  static host_message_struct messages[1024];
+  int count = 0, sent = 0, failed = 0;
+  char line[512];
+
+  while (count < 1024 && fgets(line, sizeof(line), stdin) != NULL)
+  {
+    char *text;
+    long receiver = strtol(line, &text, 10);
+    text += strspn(text, " \t");
+    text[strcspn(text, "\r\n")] = 0;
+    if (receiver <= 0 || receiver > 255 || *text == 0)
+      continue;
+
+    messages[count].receiver = receiver;
+    messages[count].size = strlen(text) > 255 ? 255 : strlen(text);
+    memcpy(messages[count].text, text, messages[count].size);
+    count++;
+  }
+
+  while (sent < count)
+  {
+    uint8_t data[GATEWAYFRAME];
+    uint8_t reply[GATEWAYFRAME];
+    size_t size = 0;
+    int batch = 0;
+
+    while (sent + batch < count && size + 2 + messages[sent + batch].size <= GATEWAYFRAME - 4)
+    {
+      host_message_struct *message = &messages[sent + batch++];
+      data[size++] = message->receiver;
+      data[size++] = message->size;
+      memcpy(data + size, message->text, message->size);
+      size += message->size;
+    }
+
+    int reply_size = host_command(gateway_send, data, size, reply);
+    int results = (reply_size - 2) / 5;
+    bool full = 0;
+
+    for (int i = 0; i < results && !full; i++)
+    {
+      uint8_t ret = reply[4 + 5 * i];
+      uint32_t packet_id;
+      memcpy(&packet_id, reply + 5 + 5 * i, 4);
+
+      // Sent again after the queue drains or acknowledgments arrive
+      if (ret == ret_buffer_full || ret == ret_congested)
+      {
+        full = 1;
+        break;
+      }
+
+      printf("%u %08x %u\n", messages[sent].receiver, packet_id, ret);
+      failed += ret != ret_ok;
+      sent++;
+    }
+
+    if (results == 0 && reply[2] != ret_ok)
+    {
+      fprintf(stderr, "Send error %u\n", reply[2]);
+      return 1;
+    }
+
+    if (full || results == 0)
+      usleep(HOSTRETRYMS * 1000);
+  }
+
+  fflush(stdout);
+  return failed ? 1 : 0;
+}
+
+/**
+ * @brief    Prints the active nodes
+ * 
+ */
+static int host_nodes()
+{
+  uint8_t node = 1;
+
+  printf("node,hops,next_node,rssi,link_pct,low_power,name\n");
+  do
+  {
+    uint8_t reply[GATEWAYFRAME];
+    int size = host_command(gateway_nodes, &node, 1, reply);
+    int index = 4;
+
+    while (index + 7 <= size + 2)
+    {
+      uint8_t *item = reply + index;
+      printf("%u,%u,%u,%d,%u,%u,%.*s\n", item[0], item[1], item[2], (int8_t)item[3], item[4], item[5] & 1, item[6], (const char *)item + 7);
+      index += 7 + item[6];
+    }
+    node = reply[3];
+  } while (node != 0);
+
+  return 0;
+}
+
+/**
+ * @brief    Prints the conversations
+ * 
+ */
+static int host_conversations()
+{
+  uint8_t peer = 0;
+
+  printf("peer,messages,unread,newest\n");
+  do
+  {
+    uint8_t reply[GATEWAYFRAME];
+    int size = host_command(gateway_conversations, &peer, 1, reply);
+    int index = 4;
+
+    while (index + 9 <= size + 2)
+    {
+      uint8_t *item = reply + index;
+      uint16_t count, unread;
+      uint32_t newest;
+      memcpy(&count, item + 1, 2);
+      memcpy(&unread, item + 3, 2);
+      memcpy(&newest, item + 5, 4);
+      printf("%u,%u,%u,%u\n", item[0], count, unread, newest);
+      index += 9;
+    }
+    peer = size >= 2 ? reply[3] : 0;
+  } while (peer != 0);
+
+  return 0;
+}
+
+/**
+ * @brief    Prints a conversation, newest message first
+ * 
+ * @param    peer: Node, group or broadcast address
+ */
+static int host_thread(uint8_t peer)
+{
+  uint32_t cursor = 0;
+  bool first = 1;
+
+  printf("number,sender,receiver,packet_id,acks,text\n");
+  do
+  {
+    uint8_t data[6] = {peer};
+    memcpy(data + 1, &cursor, 4);
+    data[5] = first;
+
+    uint8_t reply[GATEWAYFRAME];
+    int size = host_command(gateway_thread, data, sizeof(data), reply);
+    if (size < 7 || reply[2] != ret_ok)
+      return 1;
+
+    if (first)
+    {
+      uint16_t unread;
+      memcpy(&unread, reply + 7, 2);
+      fprintf(stderr, "%u unread\n", unread);
+      first = 0;
+    }
+
+    int index = 9;
+    while (index + 12 <= size + 2)
+    {
+      uint8_t *item = reply + index;
+      uint32_t number, packet_id;
+      memcpy(&number, item, 4);
+      memcpy(&packet_id, item + 6, 4);
+      printf("%u,%u,%u,%08x,%u,%.*s\n", number, item[4], item[5], packet_id, item[10], item[11], (const char *)item + 12);
+      index += 12 + item[11];
+    }
+    memcpy(&cursor, reply + 3, 4);
+  } while (cursor != 0);
+
+  return 0;
+}
+
+/**
+ * @brief    Prints the metrics snapshot
+ * 
+ */
+static int host_stats()
+{
+  uint8_t reply[GATEWAYFRAME];
+  int size = host_command(gateway_stats, NULL, 0, reply);
+  uint8_t *snapshot = reply + 3;
+
+  if (size < 1 + 5 || snapshot[0] != 'L' || snapshot[1] != 'M')
+  {
+    fprintf(stderr, "Invalid snapshot\n");
+    return 1;
+  }
+
+  uint8_t counters = snapshot[3];
+  uint32_t values[256];
+  memcpy(values, snapshot + 5, 4 * counters + 20);
+
+  const char *gauges[5] = {"queue_depth", "queue_depth_max", "free_heap", "max_alloc_heap", "uptime_s"};
+  for (int i = 0; i < counters; i++)
+  {
+    if (i < metric_packets_out)
+      printf("packets_in{type=%d} %u\n", i - metric_packets_in, values[i]);
+    else if (i < metric_drops)
+      printf("packets_out{type=%d} %u\n", i - metric_packets_out, values[i]);
+    else if (i < metric_airtime_ms)
+      printf("drops{reason=%d} %u\n", i - metric_drops, values[i]);
+    else
+      printf("counter{index=%d} %u\n", i, values[i]);
+  }
+  for (int i = 0; i < 5; i++)
+    printf("%s %u\n", gauges[i], values[counters + i]);
+
+  return 0;
+}
+
+/**
+ * @brief    Prints the messages and acknowledgments received
+ * 
+ */
+static int host_listen()
+{
+  uint8_t on = 1;
+  uint8_t frame[GATEWAYFRAME];
+  host_command(gateway_stream, &on, 1, frame);
+
+  while (1)
+  {
+    int size = host_read(frame, 1000);
+    if (size >= 0)
+      host_printEvent(frame, size);
+  }
+}
+
+/**
+ * @brief    Signs an image: ECDSA P-256 signature of the SHA-256 hash of
+ *           version (uint16), image size (uint32) and image hash, as
+ *           checked by the nodes
+ * 
+ * @param    file: Image file
+ * @param    version: Image version
+ * @param    image_size: Image size (bytes)
+ * @param    key_path: Private key (PEM file)
+ * @param    signature: Output signature (r and s, OTASIGNATURE bytes)
+ * @return   bool 1 if signed
+ */
+static bool host_sign(FILE *file, uint16_t version, uint32_t image_size, const char *key_path, uint8_t *signature)
+{
+  FILE *key_file = fopen(key_path, "r");
+  if (key_file == NULL)
+  {
+    perror(key_path);
+    return 0;
+  }
+  EVP_PKEY *key = PEM_read_PrivateKey(key_file, NULL, NULL, NULL);
+  fclose(key_file);
+
+  uint8_t message[6 + OTADIGEST];
+  uint8_t data[HOSTOTACHUNK];
+  unsigned int digest_size = 0;
+  size_t length;
+  EVP_MD_CTX *context = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(context, EVP_sha256(), NULL);
+  while ((length = fread(data, 1, sizeof(data), file)) > 0)
+    EVP_DigestUpdate(context, data, length);
+  EVP_DigestFinal_ex(context, message + 6, &digest_size);
+  fseek(file, 0, SEEK_SET);
+  memcpy(message, &version, 2);
+  memcpy(message + 2, &image_size, 4);
+
+  uint8_t der[80];
+  size_t der_size = sizeof(der);
+  bool signed_message = key != NULL && EVP_PKEY_base_id(key) == EVP_PKEY_EC && EVP_PKEY_bits(key) == 256 && EVP_DigestSignInit(context, NULL, EVP_sha256(), NULL, key) == 1 &&
+                        EVP_DigestSign(context, der, &der_size, message, sizeof(message)) == 1;
+  EVP_MD_CTX_free(context);
+  EVP_PKEY_free(key);
+
+  const uint8_t *cursor = der;
+  ECDSA_SIG *parsed = signed_message ? d2i_ECDSA_SIG(NULL, &cursor, der_size) : NULL;
+  if (parsed == NULL)
+  {
+    fprintf(stderr, "%s is not a P-256 private key\n", key_path);
+    return 0;
+  }
+  BN_bn2binpad(ECDSA_SIG_get0_r(parsed), signature, OTASIGNATURE / 2);
+  BN_bn2binpad(ECDSA_SIG_get0_s(parsed), signature + OTASIGNATURE / 2, OTASIGNATURE / 2);
+  ECDSA_SIG_free(parsed);
+  return 1;
+}
+
+/**
+ * @brief    Uploads a firmware image
+ * 
+ * @param    path: Image file
+ * @param    version: Image version, higher than the one of the node
+ * @param    key_path: Private key of the signatures (PEM file)
+ */
+static int host_ota(const char *path, uint16_t version, const char *key_path)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    perror(path);
+    return 2;
+  }
+
+  fseek(file, 0, SEEK_END);
+  uint32_t image_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  uint8_t signature[OTASIGNATURE];
+  if (!host_sign(file, version, image_size, key_path, signature))
+  {
+    fclose(file);
+    return 2;
+  }
+
+  uint32_t offset = 0;
+  while (offset < image_size)
+  {
+    // The first part carries the signature
+    uint8_t data[10 + OTASIGNATURE + HOSTOTACHUNK];
+    size_t header = offset == 0 ? 10 + OTASIGNATURE : 10;
+    size_t length = fread(data + header, 1, HOSTOTACHUNK, file);
+    if (length == 0)
+      break;
+    memcpy(data, &version, 2);
+    memcpy(data + 2, &image_size, 4);
+    memcpy(data + 6, &offset, 4);
+    memcpy(data + 10, signature, header - 10);
+
+    uint8_t reply[GATEWAYFRAME];
+    int size = host_command(gateway_ota, data, header + length, reply);
+    if (size < 5 || reply[2] != ret_ok)
+    {
+      fprintf(stderr, "Upload error %u at %u\n", size >= 1 ? reply[2] : 0, offset);
+      fclose(file);
+      return 1;
+    }
+
+    offset += length;
+    fprintf(stderr, "\r%u/%u", offset, image_size);
+  }
+  fprintf(stderr, "\n");
+  fclose(file);
+
+  if (offset < image_size)
+  {
+    fprintf(stderr, "Read error\n");
+    return 1;
+  }
+  printf("version %u staged, %u bytes\n", version, image_size);
+  return 0;
+}
+
+// Functions
+
+int main(int argc, char **argv)
+{
+  const char *device = NULL;
+  speed_t baud = B115200;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:b:t:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'd':
+      device = optarg;
+      break;
+    case 'b':
+      baud = atoi(optarg) == 921600 ? B921600 : atoi(optarg) == 460800 ? B460800 : atoi(optarg) == 230400 ? B230400 : B115200;
+      break;
+    case 't':
+      timeout = atoi(optarg);
+      break;
+    }
+  }
+
+  const char *command = optind < argc ? argv[optind] : NULL;
+  if (device == NULL || command == NULL)
+  {
+    fprintf(stderr, "Usage: %s -d device [-b baud] [-t timeout ms] send|nodes|stats|conversations|thread peer|listen|ota file version key\n", argv[0]);
+    return 2;
+  }
+
+  serial = open(device, O_RDWR | O_NOCTTY);
+  if (serial < 0)
+  {
+    perror(device);
+    return 2;
+  }
+
+  struct termios attributes;
+  if (tcgetattr(serial, &attributes) == 0)
+  {
+    cfmakeraw(&attributes);
+    cfsetspeed(&attributes, baud);
+    tcsetattr(serial, TCSANOW, &attributes);
+  }
+
+  // Starts the node in frame mode
+  uint8_t delimiter = 0;
+  if (write(serial, &delimiter, 1) != 1)
+  {
+    perror("write");
+    return 1;
+  }
+
+  if (strcmp(command, "send") == 0)
+    return host_send();
+  if (strcmp(command, "nodes") == 0)
+    return host_nodes();
+  if (strcmp(command, "stats") == 0)
+    return host_stats();
+  if (strcmp(command, "conversations") == 0)
+    return host_conversations();
+  if (strcmp(command, "thread") == 0 && optind + 1 < argc)
+    return host_thread(atoi(argv[optind + 1]));
+  if (strcmp(command, "listen") == 0)
+    return host_listen();
+  if (strcmp(command, "ota") == 0 && optind + 3 < argc)
+    return host_ota(argv[optind + 1], atoi(argv[optind + 2]), argv[optind + 3]);
+
+  fprintf(stderr, "Unknown command %s\n", command);
+  return 2;
+}
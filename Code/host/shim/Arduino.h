@@ -0,0 +1,77 @@
+/**
+ * @file     Arduino.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Host shim: the subset of the Arduino core used by LoRaMessenger,
+ *           so the protocol stack can be built and run on Linux.
+ */
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include "host.h"
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define PI 3.1415926535897932384626433832795
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// Time
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void yield();
+
+// Random
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+/**
+ * @brief    Serial port, output goes to the host serial sink
+ * 
+ */
+class HardwareSerial
+{
+public:
+  void begin(unsigned long baud);
+  int available();
+  int read();
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  size_t print(const char *string);
+  size_t println(const char *string);
+  int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  void flush();
+};
+
+/**
+ * @brief    Chip information
+ * 
+ */
+class EspClass
+{
+public:
+  uint32_t getFreeHeap();
+  uint32_t getMaxAllocHeap();
+  void restart();
+};
+
+extern HardwareSerial Serial;
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ * @file     LoRa.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Host shim: SX127x LoRa radio.
+ *           Sent frames are passed to the host transmit hook, received
+ *           frames are injected with host_radioDeliver(). Receive mode
+ *           changes and channel activity detections go through the host
+ *           radio and CAD hooks.
+ */
+
+#ifndef LORA_H
+#define LORA_H
+
+#include <Arduino.h>
+
+class LoRaClass
+{
+public:
+  int begin(long frequency);
+  void setPins(int ss, int reset, int dio0) {}
+  void setTxPower(int level) { tx_power = level; }
+  void setSpreadingFactor(int sf) { spreading_factor = sf; }
+  void setSignalBandwidth(long sbw) { bandwidth = sbw; }
+  void setPreambleLength(long length) { preamble_length = length; }
+  void enableCrc() { crc = true; }
+  void disableCrc() { crc = false; }
+
+  int beginPacket(int implicit_header = false);
+  int endPacket(bool async = false);
+  size_t write(uint8_t byte);
+  size_t write(const uint8_t *buffer, size_t size);
+  size_t print(const char *string);
+
+  int available();
+  int read();
+  int peek();
+  size_t readBytes(uint8_t *buffer, size_t length);
+  int packetRssi() { return rx_rssi; }
+  float packetSnr() { return rx_snr; }
+
+  void onReceive(void (*callback)(int)) { receive_callback = callback; }
+  void onTxDone(void (*callback)()) { tx_done_callback = callback; }
+  void onCadDone(void (*callback)(boolean)) { cad_done_callback = callback; }
+  void receive(int size = 0);
+  void idle();
+  void sleep();
+  void channelActivityDetection();
+
+  // Host state
+  int tx_power = 17;
+  int spreading_factor = 7;
+  long bandwidth = 125E3;
+  long preamble_length = 8;
+  bool crc = false;
+  bool receiving = false;
+
+  uint8_t tx_buffer[256];
+  size_t tx_size = 0;
+
+  uint8_t rx_buffer[256];
+  size_t rx_size = 0;
+  size_t rx_index = 0;
+  int rx_rssi = 0;
+  float rx_snr = 0;
+
+  void (*receive_callback)(int) = NULL;
+  void (*tx_done_callback)() = NULL;
+  void (*cad_done_callback)(boolean) = NULL;
+};
+
+extern LoRaClass LoRa;
+
+#endif
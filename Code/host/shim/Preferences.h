@@ -0,0 +1,27 @@
+/**
+ * @file     Preferences.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Host shim: ESP32 non-volatile storage, kept in memory for the
+ *           life of the process.
+ */
+
+#ifndef PREFERENCES_H
+#define PREFERENCES_H
+
+#include <Arduino.h>
+
+class Preferences
+{
+public:
+  bool begin(const char *name, bool read_only = false) { return true; }
+  void end() {}
+  uint32_t getUInt(const char *key, uint32_t default_value = 0);
+  size_t putUInt(const char *key, uint32_t value);
+  size_t getBytes(const char *key, void *buffer, size_t size);
+  size_t putBytes(const char *key, const void *value, size_t size);
+};
+
+#endif
@@ -0,0 +1,23 @@
+/**
+ * @file     SPI.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Host shim: SPI bus (no-op)
+ */
+
+#ifndef SPI_H
+#define SPI_H
+
+#include <Arduino.h>
+
+class SPIClass
+{
+public:
+  void begin(int sck = -1, int miso = -1, int mosi = -1, int ss = -1) {}
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * @file     U8x8lib.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Host shim: SSD1306 display (no-op)
+ */
+
+#ifndef U8X8LIB_H
+#define U8X8LIB_H
+
+#include <Arduino.h>
+
+class U8X8
+{
+public:
+  void begin() {}
+  void setFont(const uint8_t *font) {}
+  void setFlipMode(uint8_t mode) {}
+  void setPowerSave(uint8_t is_enable) {}
+  void setBusClock(uint32_t clock) {}
+  void setInverseFont(uint8_t value) {}
+  void clear() {}
+  void clearLine(uint8_t line) {}
+  void drawString(uint8_t x, uint8_t y, const char *string) {}
+  void drawGlyph(uint8_t x, uint8_t y, uint8_t encoding) {}
+};
+
+class U8X8_SSD1306_128X64_NONAME_SW_I2C : public U8X8
+{
+public:
+  U8X8_SSD1306_128X64_NONAME_SW_I2C(uint8_t clock, uint8_t data, uint8_t reset) {}
+};
+
+class U8X8_SSD1306_128X64_NONAME_HW_I2C : public U8X8
+{
+public:
+  U8X8_SSD1306_128X64_NONAME_HW_I2C(uint8_t reset = 255, uint8_t clock = 255, uint8_t data = 255) {}
+};
+
+extern const uint8_t u8x8_font_artossans8_r[];
+
+#endif
@@ -0,0 +1,37 @@
+/**
+ * @file     WiFiUdp.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Host shim: Arduino UDP socket, bound to the loopback interface
+ *           so that the bridges of several simulators can reach each other.
+ */
+
+#ifndef WIFIUDP_H
+#define WIFIUDP_H
+
+#include <Arduino.h>
+
+class WiFiUDP
+{
+public:
+  uint8_t begin(uint16_t port);
+  void stop();
+  int beginPacket(const char *host, uint16_t port);
+  size_t write(const uint8_t *buffer, size_t size);
+  int endPacket();
+  int parsePacket();
+  int read(uint8_t *buffer, size_t size);
+
+private:
+  int socket_fd = -1;
+  uint8_t tx_buffer[1472];
+  size_t tx_size = 0;
+  char tx_host[64];
+  uint16_t tx_port = 0;
+  uint8_t rx_buffer[1472];
+  int rx_size = 0;
+};
+
+#endif
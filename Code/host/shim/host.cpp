@@ -0,0 +1,1521 @@
+/**
+ * @file     host.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Host shim implementation: Arduino core, LoRa radio, ROM CRC,
+ *           preferences, loopback UDP, mbed TLS AES-CCM, SHA-256 and
+ *           ECDSA, and virtual clock.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include <SPI.h>
+#include <LoRa.h>
+#include <U8x8lib.h>
+#include <malloc.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <WiFiUdp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "rom/crc.h"
+#include "mbedtls/ccm.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/ecdsa.h"
+#include "host.h"
+
+// Exported variables
+HardwareSerial Serial;
+EspClass ESP;
+SPIClass SPI;
+LoRaClass LoRa;
+const uint8_t u8x8_font_artossans8_r[1] = {0};
+
+uint8_t host_nodeNumber = 1;
+bool host_lowPowerListen = 0;
+bool host_fecEnabled = 1;
+void (*host_delayHook)(uint32_t ms) = NULL;
+void (*host_transmitHook)(const uint8_t *frame, size_t size, uint32_t airtime) = NULL;
+void (*host_radioHook)(bool receiving) = NULL;
+bool (*host_cadHook)() = NULL;
+uint32_t host_heapSize = 320 * 1024;
+bool host_bridgeEnabled = 0;
+uint8_t host_bridgeMesh = 1;
+uint16_t host_bridgePort = 4210;
+const char *host_bridgePeers = "";
+bool host_routeDiscovery = 0;
+bool host_geoEnabled = 0;
+int16_t host_geoX = 0;
+int16_t host_geoY = 0;
+const char *host_otaFile = NULL;
+const uint8_t host_otaPrivateKey[32] = {0x8c, 0x15, 0xc8, 0xda, 0xb3, 0x35, 0x62, 0x10, 0xaf, 0xe5, 0x6c, 0x39, 0x85, 0xf4, 0xc6, 0xef,
+                                        0x48, 0xca, 0xc1, 0x1c, 0xcf, 0x15, 0xd2, 0x8c, 0x3f, 0xcb, 0xf4, 0xb7, 0x3c, 0x61, 0x43, 0xcf};
+
+// Private variables
+static uint64_t host_micros = 0;
+static uint32_t random_state = 2463534242u;
+static FILE *serial_output = stdout;
+static int serial_input = -1;
+
+// Clock
+
+/**
+ * @brief    Sets the virtual clock
+ * 
+ * @param    time: Time (us)
+ */
+void host_setMicros(uint64_t time)
+{
+  host_micros = time;
+}
+
+/**
+ * @brief    Returns the virtual clock
+ * 
+ * @return   uint64_t time (us)
+ */
+uint64_t host_getMicros()
+{
+  return host_micros;
+}
+
+/**
+ * @brief    Moves the virtual clock forward
+ * 
+ * @param    time: Time to add (us)
+ */
+void host_advanceMicros(uint64_t time)
+{
+  host_micros += time;
+}
+
+uint32_t millis()
+{
+  return host_micros / 1000;
+}
+
+uint32_t micros()
+{
+  return host_micros;
+}
+
+void delay(uint32_t ms)
+{
+  if (host_delayHook != NULL)
+    host_delayHook(ms);
+  else
+    host_micros += (uint64_t)ms * 1000;
+}
+
+void yield()
+{
+}
+
+// Random (xorshift32, deterministic for a given seed)
+
+void randomSeed(unsigned long seed)
+{
+  random_state = seed ? seed : 2463534242u;
+}
+
+long random(long max)
+{
+  if (max <= 0)
+    return 0;
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state % max;
+}
+
+long random(long min, long max)
+{
+  if (max <= min)
+    return min;
+  return min + random(max - min);
+}
+
+// Serial
+
+/**
+ * @brief    Sets where the serial port output goes, NULL discards it
+ * 
+ * @param    stream: Output stream
+ */
+void host_serialOutput(FILE *stream)
+{
+  serial_output = stream;
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+}
+
+/**
+ * @brief    Sets where the serial port input comes from, -1 for no input
+ * 
+ * @param    fd: Input file descriptor
+ */
+void host_serialInput(int fd)
+{
+  serial_input = fd;
+}
+
+int HardwareSerial::available()
+{
+  int count = 0;
+  if (serial_input < 0 || ioctl(serial_input, FIONREAD, &count) != 0)
+    return 0;
+  return count;
+}
+
+int HardwareSerial::read()
+{
+  uint8_t c;
+  if (serial_input < 0 || ::read(serial_input, &c, 1) != 1)
+    return -1;
+  return c;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  if (serial_output != NULL)
+    fputc(c, serial_output);
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  if (serial_output != NULL)
+    fwrite(buffer, 1, size, serial_output);
+  return size;
+}
+
+size_t HardwareSerial::print(const char *string)
+{
+  return write((const uint8_t *)string, strlen(string));
+}
+
+size_t HardwareSerial::println(const char *string)
+{
+  return print(string) + print("\r\n");
+}
+
+int HardwareSerial::printf(const char *format, ...)
+{
+  if (serial_output == NULL)
+    return 0;
+
+  va_list args;
+  va_start(args, format);
+  int ret = vfprintf(serial_output, format, args);
+  va_end(args);
+  return ret;
+}
+
+void HardwareSerial::flush()
+{
+  if (serial_output != NULL)
+    fflush(serial_output);
+}
+
+// ESP
+
+uint32_t EspClass::getFreeHeap()
+{
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks < host_heapSize ? host_heapSize - info.uordblks : 0;
+}
+
+uint32_t EspClass::getMaxAllocHeap()
+{
+  return getFreeHeap();
+}
+
+void EspClass::restart()
+{
+  // The host keeps running the same program
+}
+
+// LoRa
+
+/**
+ * @brief    Changes the receive mode and calls the radio hook
+ * 
+ * @param    state: 1 if the radio is receiving
+ */
+static void host_radioReceiving(bool state)
+{
+  if (LoRa.receiving == state)
+    return;
+
+  LoRa.receiving = state;
+  if (host_radioHook != NULL)
+    host_radioHook(state);
+}
+
+int LoRaClass::begin(long frequency)
+{
+  receiving = false;
+  return 1;
+}
+
+void LoRaClass::receive(int size)
+{
+  host_radioReceiving(true);
+}
+
+void LoRaClass::idle()
+{
+  host_radioReceiving(false);
+}
+
+void LoRaClass::sleep()
+{
+  host_radioReceiving(false);
+}
+
+void LoRaClass::channelActivityDetection()
+{
+  host_radioReceiving(false);
+
+  bool detected = host_cadHook != NULL ? host_cadHook() : false;
+  if (cad_done_callback != NULL)
+    cad_done_callback(detected);
+}
+
+int LoRaClass::beginPacket(int implicit_header)
+{
+  tx_size = 0;
+  host_radioReceiving(false);
+  return 1;
+}
+
+int LoRaClass::endPacket(bool async)
+{
+  uint32_t airtime = host_airtime(tx_size);
+
+  if (host_transmitHook != NULL)
+    host_transmitHook(tx_buffer, tx_size, airtime);
+  else
+    host_micros += airtime;
+
+  if (tx_done_callback != NULL)
+    tx_done_callback();
+  return 1;
+}
+
+size_t LoRaClass::write(uint8_t byte)
+{
+  return write(&byte, 1);
+}
+
+size_t LoRaClass::write(const uint8_t *buffer, size_t size)
+{
+  if (size > sizeof(tx_buffer) - tx_size)
+    size = sizeof(tx_buffer) - tx_size;
+  memcpy(tx_buffer + tx_size, buffer, size);
+  tx_size += size;
+  return size;
+}
+
+size_t LoRaClass::print(const char *string)
+{
+  return write((const uint8_t *)string, strlen(string));
+}
+
+int LoRaClass::available()
+{
+  return rx_size - rx_index;
+}
+
+int LoRaClass::read()
+{
+  if (rx_index >= rx_size)
+    return -1;
+  return rx_buffer[rx_index++];
+}
+
+int LoRaClass::peek()
+{
+  if (rx_index >= rx_size)
+    return -1;
+  return rx_buffer[rx_index];
+}
+
+size_t LoRaClass::readBytes(uint8_t *buffer, size_t length)
+{
+  size_t i;
+  for (i = 0; i < length && rx_index < rx_size; i++)
+    buffer[i] = rx_buffer[rx_index++];
+  return i;
+}
+
+/**
+ * @brief    Returns the time on air of a frame with the current radio
+ *           settings (Semtech SX127x formula, explicit header, CR 4/5)
+ * 
+ * @param    size: Frame size (bytes)
+ * @return   uint32_t airtime (us)
+ */
+uint32_t host_airtime(size_t size)
+{
+  double symbol = (double)(1 << LoRa.spreading_factor) / LoRa.bandwidth * 1e6;
+  int low_datarate = symbol > 16000 ? 1 : 0;
+  double payload = 8 * (double)size - 4 * LoRa.spreading_factor + 28 + (LoRa.crc ? 16 : 0);
+  double symbols = ceil(payload / (4 * (LoRa.spreading_factor - 2 * low_datarate))) * 5;
+
+  if (symbols < 0)
+    symbols = 0;
+
+  return (LoRa.preamble_length + 4.25 + 8 + symbols) * symbol;
+}
+
+/**
+ * @brief    Delivers a received frame to the radio and calls the receive
+ *           callback, as the DIO0 interrupt would
+ * 
+ * @param    frame: Frame data
+ * @param    size: Frame size
+ * @param    rssi: Received signal strength (dBm)
+ * @param    snr: Signal to noise ratio (dB)
+ */
+void host_radioDeliver(const uint8_t *frame, size_t size, int rssi, float snr)
+{
+  if (size > sizeof(LoRa.rx_buffer))
+    size = sizeof(LoRa.rx_buffer);
+
+  memcpy(LoRa.rx_buffer, frame, size);
+  LoRa.rx_size = size;
+  LoRa.rx_index = 0;
+  LoRa.rx_rssi = rssi;
+  LoRa.rx_snr = snr;
+
+  if (LoRa.receive_callback != NULL)
+    LoRa.receive_callback(size);
+}
+
+// ROM CRC
+
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+  crc = ~crc;
+  while (len--)
+  {
+    crc ^= *buf++;
+    for (int i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+uint16_t crc16_le(uint16_t crc, const uint8_t *buf, uint32_t len)
+{
+  crc = ~crc;
+  while (len--)
+  {
+    crc ^= *buf++;
+    for (int i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0x8408 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+// Preferences
+
+static struct
+{
+  char key[16];
+  uint32_t value;
+} preferences[16];
+static int preferences_count = 0;
+
+uint32_t Preferences::getUInt(const char *key, uint32_t default_value)
+{
+  for (int i = 0; i < preferences_count; i++)
+  {
+    if (strcmp(preferences[i].key, key) == 0)
+      return preferences[i].value;
+  }
+  return default_value;
+}
+
+size_t Preferences::putUInt(const char *key, uint32_t value)
+{
+  int i;
+  for (i = 0; i < preferences_count && strcmp(preferences[i].key, key) != 0; i++)
+    ;
+  if (i == preferences_count)
+  {
+    if (preferences_count == 16 || strlen(key) > 15)
+      return 0;
+    strcpy(preferences[preferences_count++].key, key);
+  }
+  preferences[i].value = value;
+  return 4;
+}
+
+static struct
+{
+  char key[16];
+  uint8_t *data;
+  size_t size;
+} preference_blobs[8];
+static int preference_blobs_count = 0;
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t size)
+{
+  for (int i = 0; i < preference_blobs_count; i++)
+  {
+    if (strcmp(preference_blobs[i].key, key) == 0)
+    {
+      if (preference_blobs[i].size > size)
+        return 0;
+      memcpy(buffer, preference_blobs[i].data, preference_blobs[i].size);
+      return preference_blobs[i].size;
+    }
+  }
+  return 0;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t size)
+{
+  int i;
+  for (i = 0; i < preference_blobs_count && strcmp(preference_blobs[i].key, key) != 0; i++)
+    ;
+  if (i == preference_blobs_count)
+  {
+    if (preference_blobs_count == 8 || strlen(key) > 15)
+      return 0;
+    strcpy(preference_blobs[preference_blobs_count++].key, key);
+  }
+  preference_blobs[i].data = (uint8_t *)realloc(preference_blobs[i].data, size);
+  memcpy(preference_blobs[i].data, value, size);
+  preference_blobs[i].size = size;
+  return size;
+}
+
+// OTA partitions (two app partitions of a 4 MB flash)
+
+#define HOSTOTASIZE 0x140000 // App partition size (bytes)
+
+static const esp_partition_t ota_partitions[2] = {{0x10000, HOSTOTASIZE, "app0"}, {0x150000, HOSTOTASIZE, "app1"}};
+static FILE *ota_file = NULL;
+
+/**
+ * @brief    Returns the file of the app partitions, created erased on
+ *           first use
+ * 
+ */
+static FILE *host_otaOpen()
+{
+  if (ota_file != NULL)
+    return ota_file;
+
+  ota_file = host_otaFile != NULL ? fopen(host_otaFile, "w+b") : tmpfile();
+  if (ota_file == NULL)
+  {
+    perror("OTA partitions");
+    exit(2);
+  }
+
+  uint8_t erased[4096];
+  memset(erased, 0xFF, sizeof(erased));
+  for (int i = 0; i < 2 * HOSTOTASIZE / 4096; i++)
+    fwrite(erased, 1, sizeof(erased), ota_file);
+  fflush(ota_file);
+  return ota_file;
+}
+
+/**
+ * @brief    Returns the file offset of a partition range, -1 if it is not
+ *           one of the app partitions or the range does not fit
+ * 
+ */
+static long host_otaOffset(const esp_partition_t *partition, size_t offset, size_t size)
+{
+  for (int i = 0; i < 2; i++)
+  {
+    if (partition == &ota_partitions[i])
+      return offset + size <= HOSTOTASIZE ? (long)i * HOSTOTASIZE + offset : -1;
+  }
+  return -1;
+}
+
+const esp_partition_t *esp_ota_get_running_partition()
+{
+  return &ota_partitions[0];
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+  return &ota_partitions[1];
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+  return host_otaOffset(partition, 0, 0) < 0 ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+  long offset = host_otaOffset(partition, src_offset, size);
+  if (offset < 0)
+    return ESP_ERR_INVALID_SIZE;
+
+  FILE *file = host_otaOpen();
+  fseek(file, offset, SEEK_SET);
+  return fread(dst, 1, size, file) == size ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+  long offset = host_otaOffset(partition, dst_offset, size);
+  if (offset < 0)
+    return ESP_ERR_INVALID_SIZE;
+
+  // Like NOR flash, writing only clears bits
+  uint8_t *data = (uint8_t *)malloc(size);
+  esp_partition_read(partition, dst_offset, data, size);
+  for (size_t i = 0; i < size; i++)
+    data[i] &= ((const uint8_t *)src)[i];
+
+  FILE *file = host_otaOpen();
+  fseek(file, offset, SEEK_SET);
+  size_t written = fwrite(data, 1, size, file);
+  fflush(file);
+  free(data);
+  return written == size ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+  long file_offset = host_otaOffset(partition, offset, size);
+  if (file_offset < 0 || offset % 4096 || size % 4096)
+    return ESP_ERR_INVALID_ARG;
+
+  uint8_t erased[4096];
+  memset(erased, 0xFF, sizeof(erased));
+  FILE *file = host_otaOpen();
+  fseek(file, file_offset, SEEK_SET);
+  for (size_t done = 0; done < size; done += sizeof(erased))
+  {
+    if (fwrite(erased, 1, sizeof(erased), file) != sizeof(erased))
+      return ESP_FAIL;
+  }
+  fflush(file);
+  return ESP_OK;
+}
+
+// WiFi UDP (loopback)
+
+/**
+ * @brief    Opens a non-blocking socket on a loopback port
+ * 
+ * @param    port: Local port
+ * @return   uint8_t 1 if open
+ */
+uint8_t WiFiUDP::begin(uint16_t port)
+{
+  stop();
+  socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (socket_fd < 0)
+    return 0;
+
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(socket_fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+  {
+    stop();
+    return 0;
+  }
+
+  fcntl(socket_fd, F_SETFL, fcntl(socket_fd, F_GETFL) | O_NONBLOCK);
+  return 1;
+}
+
+void WiFiUDP::stop()
+{
+  if (socket_fd >= 0)
+    close(socket_fd);
+  socket_fd = -1;
+}
+
+int WiFiUDP::beginPacket(const char *host, uint16_t port)
+{
+  strncpy(tx_host, host, sizeof(tx_host) - 1);
+  tx_host[sizeof(tx_host) - 1] = 0;
+  tx_port = port;
+  tx_size = 0;
+  return 1;
+}
+
+size_t WiFiUDP::write(const uint8_t *buffer, size_t size)
+{
+  if (size > sizeof(tx_buffer) - tx_size)
+    size = sizeof(tx_buffer) - tx_size;
+  memcpy(tx_buffer + tx_size, buffer, size);
+  tx_size += size;
+  return size;
+}
+
+int WiFiUDP::endPacket()
+{
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(tx_port);
+  if (socket_fd < 0 || inet_pton(AF_INET, tx_host, &address.sin_addr) != 1)
+    return 0;
+
+  return sendto(socket_fd, tx_buffer, tx_size, 0, (struct sockaddr *)&address, sizeof(address)) == (ssize_t)tx_size;
+}
+
+/**
+ * @brief    Receives the next datagram, if any
+ * 
+ * @return   int datagram size, 0 if none
+ */
+int WiFiUDP::parsePacket()
+{
+  rx_size = socket_fd < 0 ? -1 : recv(socket_fd, rx_buffer, sizeof(rx_buffer), 0);
+  if (rx_size < 0)
+    rx_size = 0;
+  return rx_size;
+}
+
+int WiFiUDP::read(uint8_t *buffer, size_t size)
+{
+  if (size > (size_t)rx_size)
+    size = rx_size;
+  memcpy(buffer, rx_buffer, size);
+  rx_size = 0;
+  return size;
+}
+
+// mbed TLS AES-CCM (software AES)
+
+static const uint8_t aes_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16};
+
+static inline uint8_t aes_xtime(uint8_t x)
+{
+  return (x << 1) ^ (x & 0x80 ? 0x1b : 0);
+}
+
+static void aes_encryptBlock(const mbedtls_ccm_context *ctx, const uint8_t *input, uint8_t *output)
+{
+  uint8_t state[16];
+  for (int i = 0; i < 16; i++)
+    state[i] = input[i] ^ ctx->round_keys[i];
+
+  for (int round = 1; round <= ctx->rounds; round++)
+  {
+    // SubBytes and ShiftRows (column major state)
+    uint8_t shifted[16];
+    for (int i = 0; i < 16; i++)
+      shifted[i] = aes_sbox[state[(i + 4 * (i % 4)) % 16]];
+
+    // MixColumns, skipped in the last round
+    if (round != ctx->rounds)
+    {
+      for (int c = 0; c < 4; c++)
+      {
+        uint8_t *column = shifted + 4 * c;
+        uint8_t all = column[0] ^ column[1] ^ column[2] ^ column[3];
+        uint8_t first = column[0];
+        column[0] ^= all ^ aes_xtime(column[0] ^ column[1]);
+        column[1] ^= all ^ aes_xtime(column[1] ^ column[2]);
+        column[2] ^= all ^ aes_xtime(column[2] ^ column[3]);
+        column[3] ^= all ^ aes_xtime(column[3] ^ first);
+      }
+    }
+
+    for (int i = 0; i < 16; i++)
+      state[i] = shifted[i] ^ ctx->round_keys[16 * round + i];
+  }
+  memcpy(output, state, 16);
+}
+
+/**
+ * @brief    CBC-MAC of the CCM blocks and first counter block
+ * 
+ */
+static int ccm_mac(mbedtls_ccm_context *ctx, size_t length, const unsigned char *iv, size_t iv_len, const unsigned char *add, size_t add_len,
+                   const unsigned char *plain, size_t tag_len, uint8_t *mac, uint8_t *counter)
+{
+  if (iv_len < 7 || iv_len > 13 || tag_len < 4 || tag_len > 16 || tag_len % 2 || add_len >= 0xFF00)
+    return MBEDTLS_ERR_CCM_BAD_INPUT;
+
+  size_t q = 15 - iv_len;
+  uint8_t block[16] = {0};
+  block[0] = (add_len ? 0x40 : 0) | ((tag_len - 2) / 2) << 3 | (q - 1);
+  memcpy(block + 1, iv, iv_len);
+  for (size_t i = 0, len = length; i < q; i++, len >>= 8)
+    block[15 - i] = len & 0xFF;
+  aes_encryptBlock(ctx, block, mac);
+
+  // Additional data, prefixed with its length
+  if (add_len)
+  {
+    uint8_t chunk[16] = {(uint8_t)(add_len >> 8), (uint8_t)add_len};
+    size_t used = 2;
+    for (size_t i = 0; i < add_len; i++)
+    {
+      chunk[used++] = add[i];
+      if (used == 16 || i == add_len - 1)
+      {
+        for (int j = 0; j < 16; j++)
+          mac[j] ^= chunk[j];
+        aes_encryptBlock(ctx, mac, mac);
+        memset(chunk, 0, 16);
+        used = 0;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < length; i += 16)
+  {
+    for (size_t j = 0; j < 16 && i + j < length; j++)
+      mac[j] ^= plain[i + j];
+    aes_encryptBlock(ctx, mac, mac);
+  }
+
+  memset(counter, 0, 16);
+  counter[0] = q - 1;
+  memcpy(counter + 1, iv, iv_len);
+  return 0;
+}
+
+/**
+ * @brief    CTR mode from counter 1, the keystream block of counter 0
+ *           encrypts the tag
+ * 
+ */
+static void ccm_ctr(mbedtls_ccm_context *ctx, size_t length, const uint8_t *counter_zero, const unsigned char *input, unsigned char *output, uint8_t *tag_stream)
+{
+  uint8_t counter[16], stream[16];
+  memcpy(counter, counter_zero, 16);
+  aes_encryptBlock(ctx, counter, tag_stream);
+
+  for (size_t i = 0; i < length; i += 16)
+  {
+    for (int k = 15; k > 0 && ++counter[k] == 0; k--)
+      ;
+    aes_encryptBlock(ctx, counter, stream);
+    for (size_t j = 0; j < 16 && i + j < length; j++)
+      output[i + j] = input[i + j] ^ stream[j];
+  }
+}
+
+void mbedtls_ccm_init(mbedtls_ccm_context *ctx)
+{
+  memset(ctx, 0, sizeof(mbedtls_ccm_context));
+}
+
+int mbedtls_ccm_setkey(mbedtls_ccm_context *ctx, mbedtls_cipher_id_t cipher, const unsigned char *key, unsigned int keybits)
+{
+  if (cipher != MBEDTLS_CIPHER_ID_AES || (keybits != 128 && keybits != 192 && keybits != 256))
+    return MBEDTLS_ERR_CCM_BAD_INPUT;
+
+  int nk = keybits / 32;
+  ctx->rounds = nk + 6;
+  memcpy(ctx->round_keys, key, 4 * nk);
+
+  uint8_t rcon = 1;
+  for (int i = nk; i < 4 * (ctx->rounds + 1); i++)
+  {
+    uint8_t word[4];
+    memcpy(word, ctx->round_keys + 4 * (i - 1), 4);
+    if (i % nk == 0)
+    {
+      uint8_t first = word[0];
+      word[0] = aes_sbox[word[1]] ^ rcon;
+      word[1] = aes_sbox[word[2]];
+      word[2] = aes_sbox[word[3]];
+      word[3] = aes_sbox[first];
+      rcon = aes_xtime(rcon);
+    }
+    else if (nk > 6 && i % nk == 4)
+    {
+      for (int j = 0; j < 4; j++)
+        word[j] = aes_sbox[word[j]];
+    }
+    for (int j = 0; j < 4; j++)
+      ctx->round_keys[4 * i + j] = ctx->round_keys[4 * (i - nk) + j] ^ word[j];
+  }
+  return 0;
+}
+
+void mbedtls_ccm_free(mbedtls_ccm_context *ctx)
+{
+  memset(ctx, 0, sizeof(mbedtls_ccm_context));
+}
+
+int mbedtls_ccm_encrypt_and_tag(mbedtls_ccm_context *ctx, size_t length, const unsigned char *iv, size_t iv_len, const unsigned char *add, size_t add_len,
+                                const unsigned char *input, unsigned char *output, unsigned char *tag, size_t tag_len)
+{
+  uint8_t mac[16], counter[16], tag_stream[16];
+  int ret = ccm_mac(ctx, length, iv, iv_len, add, add_len, input, tag_len, mac, counter);
+  if (ret != 0)
+    return ret;
+
+  ccm_ctr(ctx, length, counter, input, output, tag_stream);
+  for (size_t i = 0; i < tag_len; i++)
+    tag[i] = mac[i] ^ tag_stream[i];
+  return 0;
+}
+
+int mbedtls_ccm_auth_decrypt(mbedtls_ccm_context *ctx, size_t length, const unsigned char *iv, size_t iv_len, const unsigned char *add, size_t add_len,
+                             const unsigned char *input, unsigned char *output, const unsigned char *tag, size_t tag_len)
+{
+  uint8_t mac[16], counter[16], tag_stream[16];
+  if (iv_len < 7 || iv_len > 13)
+    return MBEDTLS_ERR_CCM_BAD_INPUT;
+
+  memset(counter, 0, 16);
+  counter[0] = 14 - iv_len;
+  memcpy(counter + 1, iv, iv_len);
+  ccm_ctr(ctx, length, counter, input, output, tag_stream);
+
+  int ret = ccm_mac(ctx, length, iv, iv_len, add, add_len, output, tag_len, mac, counter);
+  if (ret != 0)
+    return ret;
+
+  uint8_t diff = 0;
+  for (size_t i = 0; i < tag_len; i++)
+    diff |= (mac[i] ^ tag_stream[i]) ^ tag[i];
+  if (diff)
+  {
+    memset(output, 0, length);
+    return MBEDTLS_ERR_CCM_AUTH_FAILED;
+  }
+  return 0;
+}
+
+// mbed TLS SHA-256
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t sha256_rotate(uint32_t x, int n)
+{
+  return x >> n | x << (32 - n);
+}
+
+static void sha256_block(mbedtls_sha256_context *ctx, const uint8_t *block)
+{
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++)
+    w[i] = (uint32_t)block[4 * i] << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3];
+  for (int i = 16; i < 64; i++)
+    w[i] = w[i - 16] + (sha256_rotate(w[i - 15], 7) ^ sha256_rotate(w[i - 15], 18) ^ w[i - 15] >> 3) + w[i - 7] +
+           (sha256_rotate(w[i - 2], 17) ^ sha256_rotate(w[i - 2], 19) ^ w[i - 2] >> 10);
+
+  uint32_t s[8];
+  memcpy(s, ctx->state, sizeof(s));
+  for (int i = 0; i < 64; i++)
+  {
+    uint32_t t1 = s[7] + (sha256_rotate(s[4], 6) ^ sha256_rotate(s[4], 11) ^ sha256_rotate(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+    uint32_t t2 = (sha256_rotate(s[0], 2) ^ sha256_rotate(s[0], 13) ^ sha256_rotate(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+    memmove(s + 1, s, 7 * sizeof(uint32_t));
+    s[4] += t1;
+    s[0] = t1 + t2;
+  }
+  for (int i = 0; i < 8; i++)
+    ctx->state[i] += s[i];
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx)
+{
+  memset(ctx, 0, sizeof(mbedtls_sha256_context));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx)
+{
+  memset(ctx, 0, sizeof(mbedtls_sha256_context));
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224)
+{
+  static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  if (is224)
+    return MBEDTLS_ERR_ECP_FEATURE_UNAVAILABLE;
+
+  memcpy(ctx->state, initial, sizeof(initial));
+  ctx->length = 0;
+  ctx->used = 0;
+  return 0;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen)
+{
+  ctx->length += ilen;
+  while (ilen > 0)
+  {
+    size_t chunk = 64 - ctx->used < ilen ? 64 - ctx->used : ilen;
+    memcpy(ctx->block + ctx->used, input, chunk);
+    ctx->used += chunk;
+    input += chunk;
+    ilen -= chunk;
+    if (ctx->used == 64)
+    {
+      sha256_block(ctx, ctx->block);
+      ctx->used = 0;
+    }
+  }
+  return 0;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char output[32])
+{
+  // Padding: one bit, zeros, then the message length in bits
+  uint64_t bits = ctx->length * 8;
+  uint8_t padding[72] = {0x80};
+  size_t padding_size = (ctx->used < 56 ? 56 : 120) - ctx->used;
+  for (int i = 0; i < 8; i++)
+    padding[padding_size + i] = bits >> (56 - 8 * i);
+  mbedtls_sha256_update(ctx, padding, padding_size + 8);
+
+  for (int i = 0; i < 32; i++)
+    output[i] = ctx->state[i / 4] >> (24 - 8 * (i % 4));
+  return 0;
+}
+
+// mbed TLS ECDSA (P-256, not constant time)
+
+/**
+ * @brief    Modulus of the Montgomery arithmetic: the field prime or the
+ *           group order
+ * 
+ */
+typedef struct
+{
+  uint32_t modulus[8];
+  uint32_t inverse; // -modulus^-1 mod 2^32
+  uint32_t square;  // Set when rr is computed
+  uint32_t rr[8];   // R^2 mod modulus, R = 2^256
+} ecc_modulus_struct;
+
+/**
+ * @brief    Point in Jacobian coordinates, Montgomery form, infinity if
+ *           z is 0
+ * 
+ */
+typedef struct
+{
+  uint32_t x[8];
+  uint32_t y[8];
+  uint32_t z[8];
+} ecc_point_struct;
+
+static ecc_modulus_struct ecc_p = {{0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0, 0, 0, 1, 0xFFFFFFFF}, 0, 0, {0}};
+static ecc_modulus_struct ecc_n = {{0xFC632551, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD, 0xFFFFFFFF, 0xFFFFFFFF, 0, 0xFFFFFFFF}, 0, 0, {0}};
+static const uint32_t ecc_b[8] = {0x27D2604B, 0x3BCE3C3E, 0xCC53B0F6, 0x651D06B0, 0x769886BC, 0xB3EBBD55, 0xAA3A93E7, 0x5AC635D8};
+static const uint32_t ecc_gx[8] = {0xD898C296, 0xF4A13945, 0x2DEB33A0, 0x77037D81, 0x63A440F2, 0xF8BCE6E5, 0xE12C4247, 0x6B17D1F2};
+static const uint32_t ecc_gy[8] = {0x37BF51F5, 0xCBB64068, 0x6B315ECE, 0x2BCE3357, 0x7C0F9E16, 0x8EE7EB4A, 0xFE1A7F9B, 0x4FE342E2};
+
+static bool ecc_isZero(const uint32_t *a)
+{
+  uint32_t all = 0;
+  for (int i = 0; i < 8; i++)
+    all |= a[i];
+  return all == 0;
+}
+
+static int ecc_compare(const uint32_t *a, const uint32_t *b)
+{
+  for (int i = 7; i >= 0; i--)
+  {
+    if (a[i] != b[i])
+      return a[i] > b[i] ? 1 : -1;
+  }
+  return 0;
+}
+
+static uint32_t ecc_add(uint32_t *r, const uint32_t *a, const uint32_t *b)
+{
+  uint64_t carry = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    carry += (uint64_t)a[i] + b[i];
+    r[i] = carry;
+    carry >>= 32;
+  }
+  return carry;
+}
+
+static uint32_t ecc_sub(uint32_t *r, const uint32_t *a, const uint32_t *b)
+{
+  int64_t borrow = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    borrow += (int64_t)a[i] - b[i];
+    r[i] = borrow;
+    borrow >>= 32;
+  }
+  return borrow != 0;
+}
+
+static void ecc_modAdd(uint32_t *r, const uint32_t *a, const uint32_t *b, const ecc_modulus_struct *m)
+{
+  if (ecc_add(r, a, b) || ecc_compare(r, m->modulus) >= 0)
+    ecc_sub(r, r, m->modulus);
+}
+
+static void ecc_modSub(uint32_t *r, const uint32_t *a, const uint32_t *b, const ecc_modulus_struct *m)
+{
+  if (ecc_sub(r, a, b))
+    ecc_add(r, r, m->modulus);
+}
+
+/**
+ * @brief    Montgomery product a * b / R mod m, a and b below m
+ * 
+ */
+static void ecc_montMul(uint32_t *r, const uint32_t *a, const uint32_t *b, const ecc_modulus_struct *m)
+{
+  uint32_t t[10] = {0};
+  for (int i = 0; i < 8; i++)
+  {
+    uint64_t carry = 0;
+    for (int j = 0; j < 8; j++)
+    {
+      carry += t[j] + (uint64_t)a[j] * b[i];
+      t[j] = carry;
+      carry >>= 32;
+    }
+    carry += t[8];
+    t[8] = carry;
+    t[9] = carry >> 32;
+
+    uint32_t q = t[0] * m->inverse;
+    carry = (t[0] + (uint64_t)q * m->modulus[0]) >> 32;
+    for (int j = 1; j < 8; j++)
+    {
+      carry += t[j] + (uint64_t)q * m->modulus[j];
+      t[j - 1] = carry;
+      carry >>= 32;
+    }
+    carry += t[8];
+    t[7] = carry;
+    t[8] = t[9] + (carry >> 32);
+  }
+
+  if (t[8] || ecc_compare(t, m->modulus) >= 0)
+    ecc_sub(t, t, m->modulus);
+  memcpy(r, t, 32);
+}
+
+/**
+ * @brief    Computes the constants of a modulus on first use
+ * 
+ */
+static void ecc_prepare(ecc_modulus_struct *m)
+{
+  if (m->square)
+    return;
+
+  uint32_t x = 1;
+  for (int i = 0; i < 5; i++)
+    x *= 2 - m->modulus[0] * x;
+  m->inverse = -x;
+
+  memset(m->rr, 0, 32);
+  m->rr[0] = 1;
+  for (int i = 0; i < 512; i++)
+    ecc_modAdd(m->rr, m->rr, m->rr, m);
+  m->square = 1;
+}
+
+static void ecc_toMont(uint32_t *r, const uint32_t *a, const ecc_modulus_struct *m)
+{
+  ecc_montMul(r, a, m->rr, m);
+}
+
+static void ecc_fromMont(uint32_t *r, const uint32_t *a, const ecc_modulus_struct *m)
+{
+  const uint32_t one[8] = {1};
+  ecc_montMul(r, a, one, m);
+}
+
+/**
+ * @brief    Inverse of a Montgomery number, a^(m - 2) since m is prime
+ * 
+ */
+static void ecc_montInverse(uint32_t *r, const uint32_t *a, const ecc_modulus_struct *m)
+{
+  const uint32_t one[8] = {1}, two[8] = {2};
+  uint32_t exponent[8], result[8];
+  ecc_sub(exponent, m->modulus, two);
+  ecc_toMont(result, one, m);
+
+  for (int i = 255; i >= 0; i--)
+  {
+    ecc_montMul(result, result, result, m);
+    if (exponent[i / 32] >> (i % 32) & 1)
+      ecc_montMul(result, result, a, m);
+  }
+  memcpy(r, result, 32);
+}
+
+/**
+ * @brief    Point doubling, a = -3 (dbl-2001-b)
+ * 
+ */
+static void ecc_double(ecc_point_struct *r, const ecc_point_struct *a)
+{
+  if (ecc_isZero(a->z))
+  {
+    *r = *a;
+    return;
+  }
+
+  uint32_t delta[8], gamma[8], beta[8], alpha[8], t1[8], t2[8];
+  ecc_montMul(delta, a->z, a->z, &ecc_p);
+  ecc_montMul(gamma, a->y, a->y, &ecc_p);
+  ecc_montMul(beta, a->x, gamma, &ecc_p);
+  ecc_modSub(t1, a->x, delta, &ecc_p);
+  ecc_modAdd(t2, a->x, delta, &ecc_p);
+  ecc_montMul(alpha, t1, t2, &ecc_p);
+  ecc_modAdd(t1, alpha, alpha, &ecc_p);
+  ecc_modAdd(alpha, t1, alpha, &ecc_p);
+
+  // Z3 = (Y + Z)^2 - gamma - delta, before Y and Z change
+  ecc_modAdd(t1, a->y, a->z, &ecc_p);
+  ecc_montMul(t1, t1, t1, &ecc_p);
+  ecc_modSub(t1, t1, gamma, &ecc_p);
+  ecc_modSub(r->z, t1, delta, &ecc_p);
+
+  // X3 = alpha^2 - 8 beta
+  ecc_modAdd(beta, beta, beta, &ecc_p);
+  ecc_modAdd(beta, beta, beta, &ecc_p);
+  ecc_modAdd(t2, beta, beta, &ecc_p);
+  ecc_montMul(t1, alpha, alpha, &ecc_p);
+  ecc_modSub(r->x, t1, t2, &ecc_p);
+
+  // Y3 = alpha (4 beta - X3) - 8 gamma^2
+  ecc_modSub(t1, beta, r->x, &ecc_p);
+  ecc_montMul(t1, alpha, t1, &ecc_p);
+  ecc_montMul(gamma, gamma, gamma, &ecc_p);
+  ecc_modAdd(gamma, gamma, gamma, &ecc_p);
+  ecc_modAdd(gamma, gamma, gamma, &ecc_p);
+  ecc_modAdd(gamma, gamma, gamma, &ecc_p);
+  ecc_modSub(r->y, t1, gamma, &ecc_p);
+}
+
+/**
+ * @brief    Point addition (add-1998-cmo-2)
+ * 
+ */
+static void ecc_addPoints(ecc_point_struct *r, const ecc_point_struct *a, const ecc_point_struct *b)
+{
+  if (ecc_isZero(a->z))
+  {
+    *r = *b;
+    return;
+  }
+  if (ecc_isZero(b->z))
+  {
+    *r = *a;
+    return;
+  }
+
+  uint32_t z1z1[8], z2z2[8], u1[8], u2[8], s1[8], s2[8], h[8], rr[8], hh[8], hhh[8], t[8];
+  ecc_montMul(z1z1, a->z, a->z, &ecc_p);
+  ecc_montMul(z2z2, b->z, b->z, &ecc_p);
+  ecc_montMul(u1, a->x, z2z2, &ecc_p);
+  ecc_montMul(u2, b->x, z1z1, &ecc_p);
+  ecc_montMul(s1, a->y, b->z, &ecc_p);
+  ecc_montMul(s1, s1, z2z2, &ecc_p);
+  ecc_montMul(s2, b->y, a->z, &ecc_p);
+  ecc_montMul(s2, s2, z1z1, &ecc_p);
+  ecc_modSub(h, u2, u1, &ecc_p);
+  ecc_modSub(rr, s2, s1, &ecc_p);
+
+  if (ecc_isZero(h))
+  {
+    if (ecc_isZero(rr))
+      ecc_double(r, a);
+    else
+      memset(r, 0, sizeof(ecc_point_struct));
+    return;
+  }
+
+  ecc_montMul(hh, h, h, &ecc_p);
+  ecc_montMul(hhh, hh, h, &ecc_p);
+  ecc_montMul(u1, u1, hh, &ecc_p);
+
+  // X3 = r^2 - H^3 - 2 U1 H^2
+  ecc_montMul(t, rr, rr, &ecc_p);
+  ecc_modSub(t, t, hhh, &ecc_p);
+  ecc_modSub(t, t, u1, &ecc_p);
+  ecc_modSub(t, t, u1, &ecc_p);
+
+  // Y3 = r (U1 H^2 - X3) - S1 H^3, Z3 = Z1 Z2 H
+  ecc_modSub(u1, u1, t, &ecc_p);
+  ecc_montMul(u1, rr, u1, &ecc_p);
+  ecc_montMul(s1, s1, hhh, &ecc_p);
+  ecc_montMul(z1z1, a->z, b->z, &ecc_p);
+  ecc_montMul(r->z, z1z1, h, &ecc_p);
+  ecc_modSub(r->y, u1, s1, &ecc_p);
+  memcpy(r->x, t, 32);
+}
+
+static void ecc_multiply(ecc_point_struct *r, const uint32_t *k, const ecc_point_struct *a)
+{
+  ecc_point_struct result;
+  memset(&result, 0, sizeof(result));
+
+  for (int i = 255; i >= 0; i--)
+  {
+    ecc_double(&result, &result);
+    if (k[i / 32] >> (i % 32) & 1)
+      ecc_addPoints(&result, &result, a);
+  }
+  *r = result;
+}
+
+/**
+ * @brief    Converts affine coordinates to a Jacobian point
+ * 
+ */
+static void ecc_fromAffine(ecc_point_struct *r, const uint32_t *x, const uint32_t *y)
+{
+  const uint32_t one[8] = {1};
+  ecc_toMont(r->x, x, &ecc_p);
+  ecc_toMont(r->y, y, &ecc_p);
+  ecc_toMont(r->z, one, &ecc_p);
+}
+
+/**
+ * @brief    Returns the affine x coordinate of a point, not in Montgomery
+ *           form
+ * 
+ */
+static void ecc_affineX(uint32_t *x, const ecc_point_struct *a)
+{
+  uint32_t zinv[8];
+  ecc_montInverse(zinv, a->z, &ecc_p);
+  ecc_montMul(zinv, zinv, zinv, &ecc_p);
+  ecc_montMul(x, a->x, zinv, &ecc_p);
+  ecc_fromMont(x, x, &ecc_p);
+}
+
+static void ecc_read(uint32_t *r, const uint8_t *bytes)
+{
+  for (int i = 0; i < 8; i++)
+    r[i] = (uint32_t)bytes[28 - 4 * i] << 24 | bytes[29 - 4 * i] << 16 | bytes[30 - 4 * i] << 8 | bytes[31 - 4 * i];
+}
+
+static void ecc_write(uint8_t *bytes, const uint32_t *a)
+{
+  for (int i = 0; i < 32; i++)
+    bytes[i] = a[7 - i / 4] >> (24 - 8 * (i % 4));
+}
+
+/**
+ * @brief    Reads a hash as a number below the group order
+ * 
+ */
+static void ecc_readHash(uint32_t *e, const uint8_t *hash, size_t size)
+{
+  uint8_t bytes[32] = {0};
+  memcpy(bytes + 32 - (size < 32 ? size : 32), hash, size < 32 ? size : 32);
+  ecc_read(e, bytes);
+  if (ecc_compare(e, ecc_n.modulus) >= 0)
+    ecc_sub(e, e, ecc_n.modulus);
+}
+
+void mbedtls_mpi_init(mbedtls_mpi *X)
+{
+  memset(X, 0, sizeof(mbedtls_mpi));
+}
+
+void mbedtls_mpi_free(mbedtls_mpi *X)
+{
+  memset(X, 0, sizeof(mbedtls_mpi));
+}
+
+int mbedtls_mpi_read_binary(mbedtls_mpi *X, const unsigned char *buf, size_t buflen)
+{
+  uint8_t bytes[32] = {0};
+  for (size_t i = 0; i + 32 < buflen; i++)
+  {
+    if (buf[i] != 0)
+      return MBEDTLS_ERR_MPI_BUFFER_TOO_SMALL;
+  }
+  size_t used = buflen < 32 ? buflen : 32;
+  memcpy(bytes + 32 - used, buf + buflen - used, used);
+  ecc_read(X->words, bytes);
+  return 0;
+}
+
+void mbedtls_ecp_group_init(mbedtls_ecp_group *grp)
+{
+  grp->id = MBEDTLS_ECP_DP_NONE;
+}
+
+void mbedtls_ecp_group_free(mbedtls_ecp_group *grp)
+{
+  grp->id = MBEDTLS_ECP_DP_NONE;
+}
+
+int mbedtls_ecp_group_load(mbedtls_ecp_group *grp, mbedtls_ecp_group_id id)
+{
+  if (id != MBEDTLS_ECP_DP_SECP256R1)
+    return MBEDTLS_ERR_ECP_FEATURE_UNAVAILABLE;
+
+  ecc_prepare(&ecc_p);
+  ecc_prepare(&ecc_n);
+  grp->id = id;
+  return 0;
+}
+
+void mbedtls_ecp_point_init(mbedtls_ecp_point *pt)
+{
+  memset(pt, 0, sizeof(mbedtls_ecp_point));
+}
+
+void mbedtls_ecp_point_free(mbedtls_ecp_point *pt)
+{
+  memset(pt, 0, sizeof(mbedtls_ecp_point));
+}
+
+int mbedtls_ecp_point_read_binary(const mbedtls_ecp_group *grp, mbedtls_ecp_point *P, const unsigned char *buf, size_t ilen)
+{
+  if (grp->id != MBEDTLS_ECP_DP_SECP256R1 || ilen != 65 || buf[0] != 0x04)
+    return MBEDTLS_ERR_ECP_BAD_INPUT_DATA;
+
+  ecc_read(P->x, buf + 1);
+  ecc_read(P->y, buf + 33);
+  return 0;
+}
+
+int mbedtls_ecdsa_verify(mbedtls_ecp_group *grp, const unsigned char *buf, size_t blen, const mbedtls_ecp_point *Q, const mbedtls_mpi *r, const mbedtls_mpi *s)
+{
+  if (grp->id != MBEDTLS_ECP_DP_SECP256R1)
+    return MBEDTLS_ERR_ECP_BAD_INPUT_DATA;
+
+  // The key needs to be a point of the curve: y^2 = x^3 - 3x + b
+  uint32_t x[8], y[8], left[8], right[8], b[8];
+  if (ecc_compare(Q->x, ecc_p.modulus) >= 0 || ecc_compare(Q->y, ecc_p.modulus) >= 0)
+    return MBEDTLS_ERR_ECP_BAD_INPUT_DATA;
+  ecc_toMont(x, Q->x, &ecc_p);
+  ecc_toMont(y, Q->y, &ecc_p);
+  ecc_toMont(b, ecc_b, &ecc_p);
+  ecc_montMul(left, y, y, &ecc_p);
+  ecc_montMul(right, x, x, &ecc_p);
+  ecc_montMul(right, right, x, &ecc_p);
+  ecc_modSub(right, right, x, &ecc_p);
+  ecc_modSub(right, right, x, &ecc_p);
+  ecc_modSub(right, right, x, &ecc_p);
+  ecc_modAdd(right, right, b, &ecc_p);
+  if (ecc_compare(left, right) != 0)
+    return MBEDTLS_ERR_ECP_BAD_INPUT_DATA;
+
+  if (ecc_isZero(r->words) || ecc_isZero(s->words) || ecc_compare(r->words, ecc_n.modulus) >= 0 || ecc_compare(s->words, ecc_n.modulus) >= 0)
+    return MBEDTLS_ERR_ECP_VERIFY_FAILED;
+
+  // u1 = e / s, u2 = r / s (mod n)
+  uint32_t e[8], w[8], u1[8], u2[8];
+  ecc_readHash(e, buf, blen);
+  ecc_toMont(w, s->words, &ecc_n);
+  ecc_montInverse(w, w, &ecc_n);
+  ecc_montMul(u1, e, w, &ecc_n);
+  ecc_montMul(u2, r->words, w, &ecc_n);
+
+  ecc_point_struct g, q, sum;
+  ecc_fromAffine(&g, ecc_gx, ecc_gy);
+  ecc_fromAffine(&q, Q->x, Q->y);
+  ecc_multiply(&g, u1, &g);
+  ecc_multiply(&q, u2, &q);
+  ecc_addPoints(&sum, &g, &q);
+  if (ecc_isZero(sum.z))
+    return MBEDTLS_ERR_ECP_VERIFY_FAILED;
+
+  ecc_affineX(x, &sum);
+  if (ecc_compare(x, ecc_n.modulus) >= 0)
+    ecc_sub(x, x, ecc_n.modulus);
+  return ecc_compare(x, r->words) == 0 ? 0 : MBEDTLS_ERR_ECP_VERIFY_FAILED;
+}
+
+bool host_ecdsaSign(const uint8_t *private_key, const uint8_t *hash, uint8_t *signature)
+{
+  ecc_prepare(&ecc_p);
+  ecc_prepare(&ecc_n);
+
+  uint32_t d[8], e[8], k[8], r[8], s[8];
+  ecc_read(d, private_key);
+  ecc_readHash(e, hash, 32);
+  if (ecc_isZero(d) || ecc_compare(d, ecc_n.modulus) >= 0)
+    return 0;
+
+  // Deterministic nonce: hash of the key, the message hash and a counter
+  for (uint8_t counter = 0;; counter++)
+  {
+    uint8_t nonce[32];
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, private_key, 32);
+    mbedtls_sha256_update(&sha, hash, 32);
+    mbedtls_sha256_update(&sha, &counter, 1);
+    mbedtls_sha256_finish(&sha, nonce);
+    ecc_readHash(k, nonce, 32);
+    if (ecc_isZero(k))
+      continue;
+
+    ecc_point_struct point;
+    ecc_fromAffine(&point, ecc_gx, ecc_gy);
+    ecc_multiply(&point, k, &point);
+    ecc_affineX(r, &point);
+    if (ecc_compare(r, ecc_n.modulus) >= 0)
+      ecc_sub(r, r, ecc_n.modulus);
+    if (ecc_isZero(r))
+      continue;
+
+    // s = (e + r d) / k (mod n)
+    uint32_t t[8];
+    ecc_montMul(t, r, d, &ecc_n);
+    ecc_montMul(t, t, ecc_n.rr, &ecc_n);
+    ecc_modAdd(t, t, e, &ecc_n);
+    ecc_toMont(k, k, &ecc_n);
+    ecc_montInverse(k, k, &ecc_n);
+    ecc_montMul(s, t, k, &ecc_n);
+    if (!ecc_isZero(s))
+      break;
+  }
+
+  ecc_write(signature, r);
+  ecc_write(signature + 32, s);
+  return 1;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file     host.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Host shim control interface: virtual clock, radio and serial
+ *           hooks used by the benchmarks and the simulator.
+ */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Node number, low-power listening and FEC, used as NODENUMBER, LPLENABLED and FECENABLED by the simulator builds
+extern uint8_t host_nodeNumber;
+extern bool host_lowPowerListen;
+extern bool host_fecEnabled;
+
+// Bridge settings, used as BRIDGEENABLED, BRIDGEMESH, BRIDGEPORT and BRIDGEPEERS by the simulator builds
+extern bool host_bridgeEnabled;
+extern uint8_t host_bridgeMesh;
+extern uint16_t host_bridgePort;
+extern const char *host_bridgePeers;
+
+// On-demand routes, used as ROUTEDISCOVERY by the simulator builds
+extern bool host_routeDiscovery;
+
+// Geographic forwarding and node position, used as GEOENABLED, GEOX and GEOY by the simulator builds
+extern bool host_geoEnabled;
+extern int16_t host_geoX;
+extern int16_t host_geoY;
+
+// Network key of the host builds, used as CRYPTOKEY
+#define HOSTCRYPTOKEY 0x4c, 0x6f, 0x52, 0x61, 0x4d, 0x65, 0x73, 0x73, 0x65, 0x6e, 0x67, 0x65, 0x72, 0x4b, 0x65, 0x79
+
+// File keeping the two app partitions (OTA), NULL for a temporary file
+extern const char *host_otaFile;
+
+// Firmware signature key pair of the simulator, HOSTOTAPUBLICKEY is used as OTAPUBLICKEY by the simulator builds (host/sim/ota.pem)
+#define HOSTOTAPUBLICKEY 0x04, 0x75, 0xf0, 0x6f, 0x7f, 0x01, 0xa4, 0x52, 0xae, 0x66, 0x6c, 0x4b, 0x7b, 0xbc, 0x6e, 0x06, \
+  0x85, 0xcf, 0x6d, 0x9a, 0x14, 0xf3, 0x6f, 0x71, 0x42, 0x57, 0x01, 0x3f, 0x14, 0x36, 0xf7, 0xca, \
+  0x49, 0x33, 0x86, 0x58, 0x33, 0x22, 0xad, 0xc9, 0x79, 0x84, 0x6d, 0x3b, 0xb1, 0x52, 0xeb, 0x77, \
+  0x3f, 0xc9, 0x26, 0xf9, 0xdf, 0x5e, 0xd7, 0x24, 0xfe, 0xa9, 0x91, 0x5f, 0x3b, 0x9b, 0x66, 0x1c, \
+  0xf2
+extern const uint8_t host_otaPrivateKey[32];
+
+// Clock
+void host_setMicros(uint64_t time);
+uint64_t host_getMicros();
+void host_advanceMicros(uint64_t time);
+
+// Hooks, NULL restores the default behaviour
+extern void (*host_delayHook)(uint32_t ms);
+extern void (*host_transmitHook)(const uint8_t *frame, size_t size, uint32_t airtime);
+extern void (*host_radioHook)(bool receiving);
+extern bool (*host_cadHook)();
+
+// Radio
+uint32_t host_airtime(size_t size);
+void host_radioDeliver(const uint8_t *frame, size_t size, int rssi, float snr);
+
+// Serial
+void host_serialOutput(FILE *stream);
+void host_serialInput(int fd);
+
+// Heap
+extern uint32_t host_heapSize;
+
+// Firmware signatures: ECDSA P-256 signature (r and s) of a SHA-256 hash
+bool host_ecdsaSign(const uint8_t *private_key, const uint8_t *hash, uint8_t *signature);
+
+#endif
@@ -0,0 +1,39 @@
+/**
+ * @file     ccm.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Host shim: mbed TLS AES-CCM, the subset used by LoRaMessenger.
+ *           Software AES, on the ESP32 mbed TLS uses the AES accelerator.
+ */
+
+#ifndef MBEDTLS_CCM_H
+#define MBEDTLS_CCM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MBEDTLS_ERR_CCM_BAD_INPUT -0x000D
+#define MBEDTLS_ERR_CCM_AUTH_FAILED -0x000F
+
+typedef enum
+{
+  MBEDTLS_CIPHER_ID_AES = 2
+} mbedtls_cipher_id_t;
+
+typedef struct
+{
+  uint8_t round_keys[240];
+  int rounds;
+} mbedtls_ccm_context;
+
+void mbedtls_ccm_init(mbedtls_ccm_context *ctx);
+int mbedtls_ccm_setkey(mbedtls_ccm_context *ctx, mbedtls_cipher_id_t cipher, const unsigned char *key, unsigned int keybits);
+void mbedtls_ccm_free(mbedtls_ccm_context *ctx);
+int mbedtls_ccm_encrypt_and_tag(mbedtls_ccm_context *ctx, size_t length, const unsigned char *iv, size_t iv_len, const unsigned char *add, size_t add_len,
+                                const unsigned char *input, unsigned char *output, unsigned char *tag, size_t tag_len);
+int mbedtls_ccm_auth_decrypt(mbedtls_ccm_context *ctx, size_t length, const unsigned char *iv, size_t iv_len, const unsigned char *add, size_t add_len,
+                             const unsigned char *input, unsigned char *output, const unsigned char *tag, size_t tag_len);
+
+#endif
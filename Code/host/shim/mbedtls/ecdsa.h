@@ -0,0 +1,58 @@
+/**
+ * @file     ecdsa.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Host shim: mbed TLS ECDSA, the subset used by LoRaMessenger.
+ *           Signature check on the P-256 curve only, numbers and points
+ *           are kept as 32-bit words.
+ */
+
+#ifndef MBEDTLS_ECDSA_H
+#define MBEDTLS_ECDSA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MBEDTLS_ERR_MPI_BUFFER_TOO_SMALL -0x0008
+#define MBEDTLS_ERR_ECP_BAD_INPUT_DATA -0x4F80
+#define MBEDTLS_ERR_ECP_FEATURE_UNAVAILABLE -0x4E80
+#define MBEDTLS_ERR_ECP_VERIFY_FAILED -0x4E00
+
+typedef enum
+{
+  MBEDTLS_ECP_DP_NONE = 0,
+  MBEDTLS_ECP_DP_SECP256R1 = 3
+} mbedtls_ecp_group_id;
+
+typedef struct
+{
+  uint32_t words[8]; // Little endian
+} mbedtls_mpi;
+
+typedef struct
+{
+  mbedtls_ecp_group_id id;
+} mbedtls_ecp_group;
+
+typedef struct
+{
+  uint32_t x[8];
+  uint32_t y[8];
+} mbedtls_ecp_point;
+
+void mbedtls_mpi_init(mbedtls_mpi *X);
+void mbedtls_mpi_free(mbedtls_mpi *X);
+int mbedtls_mpi_read_binary(mbedtls_mpi *X, const unsigned char *buf, size_t buflen);
+
+void mbedtls_ecp_group_init(mbedtls_ecp_group *grp);
+void mbedtls_ecp_group_free(mbedtls_ecp_group *grp);
+int mbedtls_ecp_group_load(mbedtls_ecp_group *grp, mbedtls_ecp_group_id id);
+void mbedtls_ecp_point_init(mbedtls_ecp_point *pt);
+void mbedtls_ecp_point_free(mbedtls_ecp_point *pt);
+int mbedtls_ecp_point_read_binary(const mbedtls_ecp_group *grp, mbedtls_ecp_point *P, const unsigned char *buf, size_t ilen);
+
+int mbedtls_ecdsa_verify(mbedtls_ecp_group *grp, const unsigned char *buf, size_t blen, const mbedtls_ecp_point *Q, const mbedtls_mpi *r, const mbedtls_mpi *s);
+
+#endif
@@ -0,0 +1,18 @@
+/**
+ * @file     crc.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Host shim: ESP32 ROM CRC functions
+ */
+
+#ifndef ROM_CRC_H
+#define ROM_CRC_H
+
+#include <stdint.h>
+
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+uint16_t crc16_le(uint16_t crc, const uint8_t *buf, uint32_t len);
+
+#endif
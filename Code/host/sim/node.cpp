@@ -0,0 +1,346 @@
+/**
+ * @file     node.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Mesh simulator: node process.
+ *           Runs the firmware setup() and loop() on commands from the
+ *           coordinator and reports transmissions, deliveries,
+ *           acknowledgments and staged firmware images back to it.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include <LoRa.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "config.h"
+#include "typedefs.h"
+#include "L2.h"
+#include "L3.h"
+#include "crypto.h"
+#include "log.h"
+#include "message.h"
+#include "scheduler.h"
+#include "power.h"
+#include "gateway.h"
+#include "ota.h"
+#include "host.h"
+#include "sim.h"
+#include "mbedtls/sha256.h"
+
+// Imported functions (firmware)
+void setup();
+void loop();
+
+// Imported variables
+extern message_struct message_list[KEEPNMESSAGES];
+
+// Private variables
+static int sim_fd;
+static uint32_t reported_update = 0;
+static uint16_t reported_version = 0;
+
+// Private functions
+
+/**
+ * @brief    Sends a command to the coordinator, exits if it is gone
+ * 
+ * @param    message: Command
+ */
+static void sim_nodeWrite(sim_message_struct *message)
+{
+  if (send(sim_fd, message, sizeof(sim_message_struct), 0) != sizeof(sim_message_struct))
+    _exit(1);
+}
+
+/**
+ * @brief    Reads a command from the coordinator, exits if it is gone
+ * 
+ * @param    message: Command
+ */
+static void sim_nodeRead(sim_message_struct *message)
+{
+  if (recv(sim_fd, message, sizeof(sim_message_struct), 0) != sizeof(sim_message_struct))
+    _exit(1);
+}
+
+/**
+ * @brief    Answers a quit command with the power statistics and exits
+ * 
+ */
+static void sim_nodeQuit()
+{
+  sim_message_struct message = {};
+  message.command = sim_stats;
+  message.id = power_getWakeups();
+  message.value = power_getMahPerDay();
+  message.time = power_getAwakeMs();
+  message.rssi = L3_getRouteStateSize();
+  sim_nodeWrite(&message);
+  _exit(0);
+}
+
+/**
+ * @brief    Transmit hook: hands the frame to the coordinator and waits
+ *           until it is on air, the radio is half duplex
+ * 
+ */
+static void sim_nodeTransmit(const uint8_t *frame, size_t size, uint32_t airtime)
+{
+  sim_message_struct message = {};
+  message.command = sim_tx;
+  message.size = size;
+  message.crc = LoRa.crc;
+  message.value = airtime;
+  message.id = (LoRa.preamble_length + 4.25 - SIMLOCK) * (1 << LoRa.spreading_factor) / LoRa.bandwidth * 1e6;
+  message.time = host_getMicros();
+  memcpy(message.data, frame, size);
+  sim_nodeWrite(&message);
+
+  // The run can end while the frame is on air
+  do
+  {
+    sim_nodeRead(&message);
+    if (message.command == sim_quit)
+      sim_nodeQuit();
+  } while (message.command != sim_resume);
+
+  host_setMicros(message.time);
+}
+
+/**
+ * @brief    Radio hook: reports receive mode changes, frames are delivered
+ *           only to receiving radios
+ * 
+ */
+static void sim_nodeRadio(bool receiving)
+{
+  sim_message_struct message = {};
+  message.command = sim_radio;
+  message.value = receiving;
+  message.time = host_getMicros();
+  sim_nodeWrite(&message);
+}
+
+/**
+ * @brief    CAD hook: asks the coordinator if a preamble is on air
+ * 
+ */
+static bool sim_nodeCad()
+{
+  sim_message_struct message = {};
+  message.command = sim_cad;
+  message.time = host_getMicros();
+  sim_nodeWrite(&message);
+
+  do
+  {
+    sim_nodeRead(&message);
+    if (message.command == sim_quit)
+      sim_nodeQuit();
+  } while (message.command != sim_cad_result);
+
+  return message.value;
+}
+
+/**
+ * @brief    Reports messages received or acknowledged since the last call
+ * 
+ */
+static void sim_nodeReport()
+{
+  uint32_t update = reported_update;
+
+  for (int i = 0; i < KEEPNMESSAGES; i++)
+  {
+    if (message_list[i].message == NULL || message_list[i].update <= reported_update)
+      continue;
+
+    if (message_list[i].update > update)
+      update = message_list[i].update;
+
+    sim_message_struct message = {};
+    message.id = message_list[i].id;
+
+    if (message_list[i].sender == NODENUMBER)
+    {
+      uint8_t acks = message_countAcks(&message_list[i]);
+      if (acks == 0)
+        continue;
+      message.command = sim_acked;
+      message.node = message_list[i].receiver;
+      message.value = acks;
+    }
+    else
+    {
+      message.command = sim_delivered;
+      message.node = message_list[i].sender;
+      message.size = strlen(message_list[i].message);
+    }
+    sim_nodeWrite(&message);
+  }
+
+  reported_update = update;
+
+  if (ota_isStaged() && ota_getVersion() != reported_version)
+  {
+    reported_version = ota_getVersion();
+
+    sim_message_struct message = {};
+    message.command = sim_staged;
+    message.value = reported_version;
+    sim_nodeWrite(&message);
+  }
+}
+
+/**
+ * @brief    Uploads a firmware image as the serial gateway does, signed
+ *           with the key pair of the simulator
+ * 
+ * @param    path: Image file
+ * @param    version: Image version
+ */
+static void sim_nodeUpload(const char *path, uint16_t version)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    perror(path);
+    return;
+  }
+
+  fseek(file, 0, SEEK_END);
+  uint32_t size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  // Signature of version, size and image hash
+  uint8_t data[256];
+  uint8_t message[6 + OTADIGEST], hash[32], signature[OTASIGNATURE];
+  size_t length;
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  while ((length = fread(data, 1, sizeof(data), file)) > 0)
+    mbedtls_sha256_update(&sha, data, length);
+  mbedtls_sha256_finish(&sha, message + 6);
+  memcpy(message, &version, 2);
+  memcpy(message + 2, &size, 4);
+  mbedtls_sha256_starts(&sha, 0);
+  mbedtls_sha256_update(&sha, message, sizeof(message));
+  mbedtls_sha256_finish(&sha, hash);
+  mbedtls_sha256_free(&sha);
+  host_ecdsaSign(host_otaPrivateKey, hash, signature);
+  fseek(file, 0, SEEK_SET);
+
+  uint32_t offset = 0;
+  while ((length = fread(data, 1, sizeof(data), file)) > 0)
+  {
+    if (ota_upload(version, size, offset, offset == 0 ? signature : NULL, data, length) != ret_ok)
+    {
+      fprintf(stderr, "Node %d: upload error at %u\n", NODENUMBER, offset);
+      break;
+    }
+    offset += length;
+  }
+  fclose(file);
+}
+
+// Functions
+
+/**
+ * @brief    Node process main loop, never returns
+ * 
+ * @param    fd: Coordinator socket
+ * @param    node: Node number
+ * @param    seed: Random seed
+ * @param    low_power: 1 to run the node as a low-power listening leaf
+ * @param    fec: 1 to enable forward error correction
+ * @param    verbose: 1 to print the node log to stderr
+ * @param    serial: Pseudo-terminal of the serial gateway, -1 if none
+ */
+void sim_nodeMain(int fd, uint8_t node, uint32_t seed, bool low_power, bool fec, bool verbose, int serial)
+{
+  sim_fd = fd;
+  host_nodeNumber = node;
+  host_lowPowerListen = low_power;
+  host_fecEnabled = fec;
+  host_transmitHook = sim_nodeTransmit;
+  host_radioHook = sim_nodeRadio;
+  host_cadHook = sim_nodeCad;
+  host_serialOutput(verbose ? stderr : NULL);
+  if (serial >= 0)
+  {
+    host_serialInput(serial);
+    host_serialOutput(fdopen(serial, "w"));
+  }
+  randomSeed(seed * 2654435761u + node);
+
+  bool booted = 0;
+  sim_message_struct message;
+
+  while (1)
+  {
+    sim_nodeRead(&message);
+    host_setMicros(message.time);
+
+    switch (message.command)
+    {
+    case sim_run:
+      if (!booted)
+      {
+        setup();
+        booted = 1;
+      }
+      if (serial >= 0)
+        gateway_poll();
+      loop();
+      break;
+
+    case sim_deliver:
+      host_radioDeliver(message.data, message.size, message.rssi, message.snr);
+      loop();
+      break;
+
+    case sim_send:
+    {
+      char text[SIMFRAME];
+      memcpy(text, message.data, message.size);
+      text[message.size] = 0;
+
+      sim_message_struct sent = {};
+      sent.command = sim_sent;
+      sent.node = message.node;
+      sent.value = L2_sendMessage(message.node, text, 0);
+      sent.id = crypto_getLastId();
+      sim_nodeWrite(&sent);
+      loop();
+      break;
+    }
+
+    case sim_upload:
+    {
+      char path[SIMFRAME];
+      memcpy(path, message.data, message.size);
+      path[message.size] = 0;
+
+      sim_nodeUpload(path, message.value);
+      loop();
+      break;
+    }
+
+    case sim_quit:
+      sim_nodeQuit();
+    }
+
+    log_drain();
+    sim_nodeReport();
+    Serial.flush();
+
+    message = {};
+    message.command = sim_idle;
+    message.time = host_getMicros() + (uint64_t)scheduler_nextDeadline() * 1000;
+    sim_nodeWrite(&message);
+  }
+}
\ No newline at end of file
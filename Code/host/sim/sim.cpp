@@ -0,0 +1,1255 @@
+/**
+ * @file     sim.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Mesh simulator: coordinator.
+ *           Forks one process per node running the firmware, moves the
+ *           frames between them over a simulated channel (log-distance
+ *           path loss with shadowing, SNR based byte errors, collisions
+ *           with capture, half duplex radios that receive only frames whose
+ *           preamble they catch, channel activity detection) and injects
+ *           Poisson message traffic. Reports delivery ratio, latency, acknowledgment round
+ *           trip, airtime per delivered byte, duty cycle, wake-ups, awake
+ *           time and estimated consumption, as CSV or JSON.
+ *           With -G the serial port of a node is a pseudo-terminal running
+ *           the serial gateway, and the simulation runs in real time, so a
+ *           host program can send and receive traffic through it.
+ *           With -B a node is the bridge of mesh id, with a UDP socket on a
+ *           loopback port and the other bridges on the peer ports, so
+ *           several simulators can run linked meshes (also in real time).
+ *           With -A the nodes discover the routes on demand instead of
+ *           flooding the announces, with -P they forward geographically.
+ *           With -O an image uploaded to node 1 after the warmup is
+ *           distributed through the mesh, the staged partitions are checked
+ *           against it. With -O old,image every node starts from the old
+ *           image, so only the pages changed are sent.
+ * 
+ *           Usage: program [-t line|star|grid|random] [-n nodes] [-d spacing m]
+ *                  [-r rate msg/min] [-S rate,rate,...] [-l length] [-T duration s]
+ *                  [-w warmup s] [-D drain s] [-p threshold]
+ *                  [-L node,first-last,...] [-F] [-A] [-P] [-G node]
+ *                  [-B node,mesh,port,peer port,...] [-O [old,]image]
+ *                  [-s seed] [-j] [-v]
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include <math.h>
+#include <algorithm>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "typedefs.h"
+#include "sim.h"
+
+#define SIMSWEEPMAX 32       // Maximum rates in a sweep
+#define SIMTRANSMISSIONS 256 // Transmissions kept for collision checks
+#define SIMPATHLOSS 40.0     // Path loss at 1 m (dB)
+#define SIMEXPONENT 3.0      // Path loss exponent
+#define SIMSHADOWING 4.0     // Shadowing standard deviation (dB)
+#define SIMNOISE -117.0      // Noise floor, 125 kHz bandwidth and 6 dB noise figure (dBm)
+#define SIMCAPTURE 6.0       // Capture threshold (dB)
+#define SIMREFERENCE 32      // Frame size of the SNR frame error curve (bytes)
+#define SIMDETECT 3.0        // Preambles are not detected this far below the demodulation limit (dB)
+#define SIMSERIALUS 10000    // Serial gateway polling interval (us)
+#define SIMRETRYUS 10000000  // Wait before sending again a message refused by the congestion control (us)
+#define SIMOTAPARTITION 0x140000 // Offset of the update partition in the partition files of the nodes (host.cpp)
+
+/**
+ * @brief    Simulator event types
+ * 
+ */
+typedef enum
+{
+  sim_event_wake,    // Node main loop (arg: wake generation)
+  sim_event_tx_end,  // End of a transmission (arg: transmission index)
+  sim_event_traffic, // New message to send
+  sim_event_serial,  // Serial gateway and bridge polling
+  sim_event_retry,   // Message refused sent again (arg: record index)
+  sim_event_upload,  // Firmware image upload (arg: version)
+} sim_event_type;
+
+/**
+ * @brief    Simulator event
+ * 
+ */
+typedef struct
+{
+  uint64_t time;
+  uint64_t sequence;
+  uint8_t type;
+  uint8_t node;
+  uint32_t arg;
+} sim_event_struct;
+
+/**
+ * @brief    Simulated node
+ * 
+ */
+typedef struct
+{
+  double x;
+  double y;
+  pid_t pid;
+  int fd;
+  bool transmitting;
+  bool receiving;
+  uint64_t receive_start;
+  uint32_t wake_generation;
+  uint64_t airtime;
+  uint32_t wakeups;
+  uint32_t awake;
+  uint32_t mah_per_day;
+  int route_bytes;
+  uint16_t ota_version;
+  uint64_t ota_staged;
+} sim_node_struct;
+
+/**
+ * @brief    Frame on air
+ * 
+ */
+typedef struct
+{
+  uint8_t sender;
+  uint8_t size;
+  bool crc;
+  uint64_t start;
+  uint64_t lock;
+  uint64_t end;
+  uint8_t frame[SIMFRAME];
+} sim_transmission_struct;
+
+/**
+ * @brief    Message sent by the traffic generator
+ * 
+ */
+typedef struct
+{
+  uint8_t sender;
+  uint8_t receiver;
+  uint8_t size;
+  uint32_t id;
+  uint64_t sent;
+  uint64_t delivered;
+  uint64_t acked;
+} sim_record_struct;
+
+/**
+ * @brief    Results of a run
+ * 
+ */
+typedef struct
+{
+  double rate;
+  int offered;
+  int delivered;
+  int acked;
+  double delivery_ratio;
+  double latency_p50;
+  double latency_p99;
+  double ack_p50;
+  double ack_p99;
+  double airtime_per_byte;
+  double duty_max;
+  double wakeups_per_hour;
+  double awake_pct;
+  uint32_t mah_per_day_max;
+  uint32_t lpl_mah_per_day_max;
+  double route_bytes;
+  int ota_nodes;
+  double ota_time;
+  bool saturated;
+} sim_result_struct;
+
+/**
+ * @brief    Simulator options
+ * 
+ */
+typedef struct
+{
+  const char *topology;
+  int nodes;
+  double spacing;
+  double rates[SIMSWEEPMAX];
+  int rates_count;
+  int length;
+  uint64_t duration;
+  uint64_t warmup;
+  uint64_t drain;
+  double threshold;
+  bool low_power[SIMMAXNODES + 1];
+  bool fec;
+  uint8_t gateway;
+  uint8_t bridge;
+  const char *ota_image;
+  const char *ota_base;
+  uint32_t seed;
+  bool json;
+  bool verbose;
+} sim_options_struct;
+
+// Private variables
+static sim_options_struct options;
+static char bridge_peers[SIMMAXNODES * 16];
+static sim_node_struct nodes[SIMMAXNODES + 1];
+static double path_loss[SIMMAXNODES + 1][SIMMAXNODES + 1];
+
+static sim_transmission_struct transmissions[SIMTRANSMISSIONS];
+static uint32_t transmissions_count = 0;
+
+static sim_event_struct *events = NULL;
+static size_t events_count = 0;
+static size_t events_size = 0;
+static uint64_t events_sequence = 0;
+
+static sim_record_struct *records = NULL;
+static size_t records_count = 0;
+static size_t records_size = 0;
+static size_t records_sending = 0;
+
+static uint64_t sim_now = 0;
+static uint64_t random_state;
+
+// Private functions
+
+/**
+ * @brief    Returns a uniform random number in [0, 1) (xorshift64*)
+ * 
+ */
+static double sim_random()
+{
+  random_state ^= random_state >> 12;
+  random_state ^= random_state << 25;
+  random_state ^= random_state >> 27;
+  return ((random_state * 2685821657736338717ull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @brief    Returns a normal random number (Box-Muller)
+ * 
+ */
+static double sim_gaussian()
+{
+  double u = sim_random();
+  while (u <= 0)
+    u = sim_random();
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * sim_random());
+}
+
+/**
+ * @brief    Adds an event to the queue (binary min heap on time, then
+ *           insertion order)
+ * 
+ */
+static void sim_schedule(uint64_t time, uint8_t type, uint8_t node, uint32_t arg)
+{
+  if (events_count == events_size)
+  {
+    events_size = events_size ? events_size * 2 : 256;
+    events = (sim_event_struct *)realloc(events, events_size * sizeof(sim_event_struct));
+  }
+
+  sim_event_struct event = {time, events_sequence++, type, node, arg};
+  size_t i = events_count++;
+  while (i > 0)
+  {
+    size_t parent = (i - 1) / 2;
+    if (events[parent].time < time || (events[parent].time == time && events[parent].sequence < event.sequence))
+      break;
+    events[i] = events[parent];
+    i = parent;
+  }
+  events[i] = event;
+}
+
+/**
+ * @brief    Removes the first event from the queue
+ * 
+ */
+static sim_event_struct sim_nextEvent()
+{
+  sim_event_struct first = events[0];
+  sim_event_struct last = events[--events_count];
+  size_t i = 0;
+
+  while (1)
+  {
+    size_t child = 2 * i + 1;
+    if (child >= events_count)
+      break;
+    if (child + 1 < events_count && (events[child + 1].time < events[child].time || (events[child + 1].time == events[child].time && events[child + 1].sequence < events[child].sequence)))
+      child++;
+    if (last.time < events[child].time || (last.time == events[child].time && last.sequence < events[child].sequence))
+      break;
+    events[i] = events[child];
+    i = child;
+  }
+  events[i] = last;
+  return first;
+}
+
+/**
+ * @brief    Returns the record of a message, NULL if not found
+ * 
+ */
+static sim_record_struct *sim_findRecord(uint8_t sender, uint32_t id)
+{
+  for (size_t i = records_count; i > 0; i--)
+  {
+    if (records[i - 1].sender == sender && records[i - 1].id == id)
+      return &records[i - 1];
+  }
+  return NULL;
+}
+
+/**
+ * @brief    Returns the SNR demodulation limit of the spreading factor (dB)
+ * 
+ */
+static double sim_snrLimit()
+{
+  return -7.5 - 2.5 * (SPREADINGFACTOR - 7);
+}
+
+/**
+ * @brief    Returns the probability of receiving a frame without errors
+ *           (logistic around the demodulation limit)
+ * 
+ * @param    snr: Signal to noise ratio (dB)
+ */
+static double sim_receiveProbability(double snr)
+{
+  return 1 / (1 + exp(-(snr - sim_snrLimit()) / 0.5));
+}
+
+/**
+ * @brief    Returns the probability of a corrupted byte, errors are
+ *           independent and a SIMREFERENCE bytes frame is received without
+ *           errors with sim_receiveProbability()
+ * 
+ * @param    snr: Signal to noise ratio (dB)
+ */
+static double sim_byteErrorProbability(double snr)
+{
+  return 1 - pow(sim_receiveProbability(snr), 1.0 / SIMREFERENCE);
+}
+
+/**
+ * @brief    Places the nodes and computes the path loss between them
+ * 
+ * @return   bool 1 if the topology is connected
+ */
+static bool sim_placeNodes()
+{
+  int n = options.nodes;
+  double d = options.spacing;
+
+  for (int i = 1; i <= n; i++)
+  {
+    int k = i - 1;
+    if (strcmp(options.topology, "line") == 0)
+    {
+      nodes[i].x = k * d;
+      nodes[i].y = 0;
+    }
+    else if (strcmp(options.topology, "star") == 0)
+    {
+      nodes[i].x = k ? d * cos(2 * M_PI * k / (n - 1)) : 0;
+      nodes[i].y = k ? d * sin(2 * M_PI * k / (n - 1)) : 0;
+    }
+    else if (strcmp(options.topology, "grid") == 0)
+    {
+      int side = ceil(sqrt(n));
+      nodes[i].x = (k % side) * d;
+      nodes[i].y = (k / side) * d;
+    }
+    else
+    {
+      double side = d * sqrt(n);
+      nodes[i].x = sim_random() * side;
+      nodes[i].y = sim_random() * side;
+    }
+  }
+
+  for (int i = 1; i <= n; i++)
+  {
+    for (int j = 1; j < i; j++)
+    {
+      double distance = hypot(nodes[i].x - nodes[j].x, nodes[i].y - nodes[j].y);
+      if (distance < 1)
+        distance = 1;
+      path_loss[i][j] = path_loss[j][i] = SIMPATHLOSS + 10 * SIMEXPONENT * log10(distance) + SIMSHADOWING * sim_gaussian();
+    }
+  }
+
+  // Connectivity over links with a 3 dB margin
+  bool reached[SIMMAXNODES + 1] = {0, 1};
+  int stack[SIMMAXNODES], top = 0, count = 1;
+  stack[top++] = 1;
+  while (top)
+  {
+    int i = stack[--top];
+    for (int j = 1; j <= n; j++)
+    {
+      if (!reached[j] && TXDBM - path_loss[i][j] - SIMNOISE > sim_snrLimit() + 3)
+      {
+        reached[j] = 1;
+        stack[top++] = j;
+        count++;
+      }
+    }
+  }
+  return count == n;
+}
+
+/**
+ * @brief    Returns 1 if a node detects a preamble on air, frames are
+ *           detected with the same probability as they are received
+ * 
+ * @param    node: Node number
+ * @param    time: Detection start (us)
+ */
+static bool sim_channelActivity(uint8_t node, uint64_t time)
+{
+  uint32_t first = transmissions_count > SIMTRANSMISSIONS ? transmissions_count - SIMTRANSMISSIONS : 0;
+
+  for (uint32_t i = first; i < transmissions_count; i++)
+  {
+    sim_transmission_struct *other = &transmissions[i % SIMTRANSMISSIONS];
+    if (other->sender == node || other->start > time + LPLCADMS * 1000 || other->lock < time)
+      continue;
+
+    if (sim_random() < sim_receiveProbability(TXDBM - path_loss[other->sender][node] - SIMNOISE))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief    Sends a command to a node and processes its answers until it
+ *           is idle or transmitting
+ * 
+ * @param    node: Node number
+ * @param    message: Command
+ */
+static void sim_nodeCommand(uint8_t node, sim_message_struct *message)
+{
+  message->time = sim_now;
+  if (send(nodes[node].fd, message, sizeof(sim_message_struct), 0) != sizeof(sim_message_struct))
+  {
+    fprintf(stderr, "Node %d: send failed\n", node);
+    exit(2);
+  }
+
+  sim_message_struct answer;
+  while (1)
+  {
+    if (recv(nodes[node].fd, &answer, sizeof(answer), 0) != sizeof(answer))
+    {
+      fprintf(stderr, "Node %d: process exited\n", node);
+      exit(2);
+    }
+
+    switch (answer.command)
+    {
+    case sim_tx:
+    {
+      uint32_t index = transmissions_count++ % SIMTRANSMISSIONS;
+      sim_transmission_struct *transmission = &transmissions[index];
+      transmission->sender = node;
+      transmission->size = answer.size;
+      transmission->crc = answer.crc;
+      transmission->start = answer.time;
+      transmission->lock = answer.time + answer.id;
+      transmission->end = answer.time + answer.value;
+      memcpy(transmission->frame, answer.data, answer.size);
+
+      if (answer.time >= options.warmup)
+        nodes[node].airtime += answer.value;
+      nodes[node].transmitting = 1;
+      sim_schedule(transmission->end, sim_event_tx_end, node, index);
+      return;
+    }
+
+    case sim_radio:
+      if (answer.value && !nodes[node].receiving)
+        nodes[node].receive_start = answer.time;
+      nodes[node].receiving = answer.value;
+      break;
+
+    case sim_cad:
+    {
+      sim_message_struct result = {};
+      result.command = sim_cad_result;
+      result.value = sim_channelActivity(node, answer.time);
+      result.time = answer.time;
+      if (send(nodes[node].fd, &result, sizeof(result), 0) != sizeof(result))
+      {
+        fprintf(stderr, "Node %d: send failed\n", node);
+        exit(2);
+      }
+      break;
+    }
+
+    case sim_sent:
+      // Messages refused by the congestion control are sent again later,
+      // like a client does, and keep their first send time
+      if (answer.value == ret_congested || answer.value == ret_buffer_full)
+        sim_schedule(sim_now + SIMRETRYUS, sim_event_retry, node, records_sending);
+      else
+        records[records_sending].id = answer.id;
+      break;
+
+    case sim_delivered:
+    {
+      sim_record_struct *record = sim_findRecord(answer.node, answer.id);
+      if (record != NULL && record->receiver == node && record->delivered == 0)
+        record->delivered = sim_now;
+      break;
+    }
+
+    case sim_acked:
+    {
+      sim_record_struct *record = sim_findRecord(node, answer.id);
+      if (record != NULL && record->acked == 0)
+        record->acked = sim_now;
+      break;
+    }
+
+    case sim_staged:
+      nodes[node].ota_version = answer.value;
+      nodes[node].ota_staged = sim_now;
+      break;
+
+    case sim_idle:
+      nodes[node].wake_generation++;
+      sim_schedule(answer.time, sim_event_wake, node, nodes[node].wake_generation);
+      return;
+    }
+  }
+}
+
+/**
+ * @brief    Returns 1 if the node transmitted during the interval
+ * 
+ */
+static bool sim_transmittedDuring(uint8_t node, uint64_t start, uint64_t end, uint32_t skip)
+{
+  uint32_t first = transmissions_count > SIMTRANSMISSIONS ? transmissions_count - SIMTRANSMISSIONS : 0;
+  for (uint32_t i = first; i < transmissions_count; i++)
+  {
+    sim_transmission_struct *other = &transmissions[i % SIMTRANSMISSIONS];
+    if (i % SIMTRANSMISSIONS != skip && other->sender == node && other->start < end && other->end > start)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief    Ends a transmission: delivers the frame to every node that
+ *           receives it, then resumes the sender
+ * 
+ * @param    index: Transmission index
+ */
+static void sim_endTransmission(uint32_t index)
+{
+  sim_transmission_struct transmission = transmissions[index];
+  uint32_t first = transmissions_count > SIMTRANSMISSIONS ? transmissions_count - SIMTRANSMISSIONS : 0;
+
+  for (int node = 1; node <= options.nodes; node++)
+  {
+    if (node == transmission.sender || nodes[node].transmitting)
+      continue;
+
+    // The radio must be receiving before the end of the preamble
+    if (!nodes[node].receiving || nodes[node].receive_start > transmission.lock)
+      continue;
+
+    double rssi = TXDBM - path_loss[transmission.sender][node];
+    double snr = rssi - SIMNOISE;
+    if (snr < sim_snrLimit() - SIMDETECT)
+      continue;
+
+    // Half duplex
+    if (sim_transmittedDuring(node, transmission.start, transmission.end, index))
+      continue;
+
+    // Collisions: every overlapping frame must be weaker by the capture threshold
+    bool collided = 0;
+    for (uint32_t i = first; i < transmissions_count && !collided; i++)
+    {
+      sim_transmission_struct *other = &transmissions[i % SIMTRANSMISSIONS];
+      if (i % SIMTRANSMISSIONS == index || other->sender == node || other->start >= transmission.end || other->end <= transmission.start)
+        continue;
+      if (TXDBM - path_loss[other->sender][node] > rssi - SIMCAPTURE)
+        collided = 1;
+    }
+    if (collided)
+      continue;
+
+    sim_message_struct message = {};
+    message.command = sim_deliver;
+    message.size = transmission.size;
+    message.rssi = round(rssi);
+    message.snr = snr;
+    memcpy(message.data, transmission.frame, transmission.size);
+
+    // Byte errors, the radio drops frames with a wrong CRC
+    double error = sim_byteErrorProbability(snr);
+    int corrupted = 0;
+    for (int i = 0; i < transmission.size; i++)
+    {
+      if (sim_random() < error)
+      {
+        message.data[i] ^= 1 + (uint8_t)(sim_random() * 255);
+        corrupted++;
+      }
+    }
+    if (corrupted && transmission.crc)
+      continue;
+
+    sim_nodeCommand(node, &message);
+  }
+
+  nodes[transmission.sender].transmitting = 0;
+  sim_message_struct message = {};
+  message.command = sim_resume;
+  sim_nodeCommand(transmission.sender, &message);
+}
+
+/**
+ * @brief    Sends the message of a record, if the sender is on air the
+ *           message waits until it ends
+ * 
+ * @param    index: Record index
+ */
+static void sim_sendRecord(size_t index)
+{
+  sim_record_struct *record = &records[index];
+
+  if (nodes[record->sender].transmitting)
+  {
+    sim_schedule(sim_now + 1000, sim_event_retry, record->sender, index);
+    return;
+  }
+
+  sim_message_struct message = {};
+  message.command = sim_send;
+  message.node = record->receiver;
+  message.size = snprintf((char *)message.data, SIMFRAME, "%u:%llu:", (unsigned)index, (unsigned long long)record->sent);
+  while (message.size < options.length && message.size < SIMFRAME - 1)
+  {
+    message.data[message.size] = 'a' + message.size % 26;
+    message.size++;
+  }
+  record->size = message.size;
+
+  records_sending = index;
+  sim_nodeCommand(record->sender, &message);
+}
+
+/**
+ * @brief    Sends a message between two random nodes and schedules the next
+ *           one, if the sender is on air the message waits until it ends
+ * 
+ * @param    rate: Messages per minute
+ */
+static void sim_traffic(double rate, uint8_t sender)
+{
+  uint64_t traffic_end = options.duration - options.drain;
+
+  if (sender == 0)
+  {
+    uint64_t next = sim_now - log(1 - sim_random()) * 60e6 / rate;
+    if (next < traffic_end)
+      sim_schedule(next, sim_event_traffic, 0, 0);
+
+    sender = 1 + sim_random() * options.nodes;
+  }
+
+  if (nodes[sender].transmitting)
+  {
+    sim_schedule(sim_now + 1000, sim_event_traffic, sender, 0);
+    return;
+  }
+
+  uint8_t receiver = 1 + sim_random() * (options.nodes - 1);
+  if (receiver >= sender)
+    receiver++;
+
+  if (records_count == records_size)
+  {
+    records_size = records_size ? records_size * 2 : 1024;
+    records = (sim_record_struct *)realloc(records, records_size * sizeof(sim_record_struct));
+  }
+  sim_record_struct *record = &records[records_count++];
+  *record = {};
+  record->sender = sender;
+  record->receiver = receiver;
+  record->sent = sim_now;
+
+  sim_sendRecord(records_count - 1);
+}
+
+/**
+ * @brief    Uploads a firmware image to a node, if the node is on air the
+ *           upload waits until it ends
+ * 
+ * @param    node: Node number
+ * @param    version: Image version, the base image is version 1
+ */
+static void sim_uploadImage(uint8_t node, uint16_t version)
+{
+  if (nodes[node].transmitting)
+  {
+    sim_schedule(sim_now + 1000, sim_event_upload, node, version);
+    return;
+  }
+
+  const char *path = options.ota_base != NULL && version == 1 ? options.ota_base : options.ota_image;
+  sim_message_struct message = {};
+  message.command = sim_upload;
+  message.value = version;
+  message.size = strlen(path) < SIMFRAME ? strlen(path) : SIMFRAME - 1;
+  memcpy(message.data, path, message.size);
+  sim_nodeCommand(node, &message);
+}
+
+/**
+ * @brief    Returns 1 if the update partition of a node holds the image
+ * 
+ * @param    path: Partition file of the node
+ * @param    image: Image file
+ */
+static bool sim_checkStaged(const char *path, const char *image)
+{
+  FILE *staged = fopen(path, "rb");
+  FILE *expected = fopen(image, "rb");
+  bool equal = staged != NULL && expected != NULL && fseek(staged, SIMOTAPARTITION, SEEK_SET) == 0;
+
+  int byte;
+  while (equal && (byte = fgetc(expected)) != EOF)
+    equal = fgetc(staged) == byte;
+
+  if (staged != NULL)
+    fclose(staged);
+  if (expected != NULL)
+    fclose(expected);
+  return equal;
+}
+
+/**
+ * @brief    Returns the p-th percentile of values (ms), 0 if empty
+ * 
+ */
+static double sim_percentile(uint64_t *values, int count, double p)
+{
+  if (count == 0)
+    return 0;
+
+  std::sort(values, values + count);
+  return values[(int)(p * (count - 1) + 0.5)] / 1000.0;
+}
+
+/**
+ * @brief    Opens the pseudo-terminal of the serial gateway in raw mode
+ * 
+ * @param    slave: Terminal side, kept open so the node output is dropped
+ *           instead of failing while no host program is connected
+ * @return   int node side, -1 if it cannot be opened
+ */
+static int sim_openSerial(int *slave)
+{
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    return -1;
+
+  *slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  if (*slave < 0)
+    return -1;
+
+  struct termios attributes;
+  tcgetattr(*slave, &attributes);
+  cfmakeraw(&attributes);
+  tcsetattr(*slave, TCSANOW, &attributes);
+
+  fprintf(stderr, "Node %d serial gateway on %s\n", options.gateway, ptsname(master));
+  return master;
+}
+
+/**
+ * @brief    Waits until the wall clock reaches a simulation time
+ * 
+ * @param    start: Wall clock time of the simulation start (us)
+ * @param    time: Simulation time (us)
+ */
+static void sim_waitRealTime(uint64_t start, uint64_t time)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t elapsed = now.tv_sec * 1000000ull + now.tv_nsec / 1000 - start;
+  if (time > elapsed)
+    usleep(time - elapsed);
+}
+
+/**
+ * @brief    Runs one simulation at a message rate
+ * 
+ * @param    rate: Messages per minute over the whole network
+ * @param    result: Run results
+ */
+static void sim_runRate(double rate, sim_result_struct *result)
+{
+  random_state = options.seed * 0x9E3779B97F4A7C15ull + 1;
+  int attempts = 0;
+  while (!sim_placeNodes())
+  {
+    if (++attempts == 1000)
+    {
+      fprintf(stderr, "Topology not connected, reduce the spacing\n");
+      exit(2);
+    }
+  }
+
+  sim_now = 0;
+  transmissions_count = 0;
+  events_count = 0;
+  records_count = 0;
+
+  // Each node keeps its app partitions in a file
+  char ota_directory[] = "/tmp/simota.XXXXXX";
+  if (options.ota_image != NULL && mkdtemp(ota_directory) == NULL)
+  {
+    perror("mkdtemp");
+    exit(2);
+  }
+
+  int serial = -1, serial_slave = -1;
+  if (options.gateway)
+  {
+    serial = sim_openSerial(&serial_slave);
+    if (serial < 0)
+    {
+      perror("posix_openpt");
+      exit(2);
+    }
+  }
+
+  // Nodes boot at random times during the first 10 s
+  fflush(NULL);
+  for (int node = 1; node <= options.nodes; node++)
+  {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) != 0)
+    {
+      perror("socketpair");
+      exit(2);
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      for (int other = 1; other < node; other++)
+        close(nodes[other].fd);
+      close(fds[0]);
+      if (serial >= 0)
+      {
+        close(serial_slave);
+        if (node != options.gateway)
+          close(serial);
+      }
+      host_bridgeEnabled = node == options.bridge;
+      host_geoX = lround(nodes[node].x / GEOUNITM);
+      host_geoY = lround(nodes[node].y / GEOUNITM);
+      if (options.ota_image != NULL)
+      {
+        static char ota_file[sizeof(ota_directory) + 8];
+        snprintf(ota_file, sizeof(ota_file), "%s/%d", ota_directory, node);
+        host_otaFile = ota_file;
+      }
+      sim_nodeMain(fds[1], node, options.seed, options.low_power[node], options.fec, options.verbose, node == options.gateway ? serial : -1);
+    }
+    close(fds[1]);
+
+    nodes[node].pid = pid;
+    nodes[node].fd = fds[0];
+    nodes[node].transmitting = 0;
+    nodes[node].receiving = 0;
+    nodes[node].wake_generation = 0;
+    nodes[node].airtime = 0;
+    nodes[node].ota_version = 0;
+    nodes[node].ota_staged = 0;
+    sim_schedule(sim_random() * 10e6, sim_event_wake, node, 0);
+
+    // The base image is staged on every node after the boot
+    if (options.ota_base != NULL)
+      sim_schedule(11e6, sim_event_upload, node, 1);
+  }
+
+  uint16_t ota_version = options.ota_base != NULL ? 2 : 1;
+  if (options.ota_image != NULL)
+    sim_schedule(options.warmup, sim_event_upload, 1, ota_version);
+
+  sim_schedule(options.warmup - log(1 - sim_random()) * 60e6 / rate, sim_event_traffic, 0, 0);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (options.gateway)
+    sim_schedule(10e6, sim_event_serial, options.gateway, 0);
+  if (options.bridge && options.bridge != options.gateway)
+    sim_schedule(10e6, sim_event_serial, options.bridge, 0);
+
+  while (events_count)
+  {
+    sim_event_struct event = sim_nextEvent();
+    if (event.time > options.duration)
+      break;
+    if (options.gateway || options.bridge)
+      sim_waitRealTime(start.tv_sec * 1000000ull + start.tv_nsec / 1000, event.time);
+    sim_now = event.time;
+
+    switch (event.type)
+    {
+    case sim_event_wake:
+      if (event.arg == nodes[event.node].wake_generation && !nodes[event.node].transmitting)
+      {
+        sim_message_struct message = {};
+        message.command = sim_run;
+        sim_nodeCommand(event.node, &message);
+      }
+      break;
+
+    case sim_event_tx_end:
+      sim_endTransmission(event.arg);
+      break;
+
+    case sim_event_traffic:
+      sim_traffic(rate, event.node);
+      break;
+
+    case sim_event_retry:
+      sim_sendRecord(event.arg);
+      break;
+
+    case sim_event_upload:
+      sim_uploadImage(event.node, event.arg);
+      break;
+
+    case sim_event_serial:
+      if (!nodes[event.node].transmitting)
+      {
+        sim_message_struct message = {};
+        message.command = sim_run;
+        sim_nodeCommand(event.node, &message);
+      }
+      sim_schedule(sim_now + SIMSERIALUS, sim_event_serial, event.node, 0);
+      break;
+    }
+  }
+
+  for (int node = 1; node <= options.nodes; node++)
+  {
+    sim_message_struct message = {};
+    message.command = sim_quit;
+    message.time = options.duration;
+    if (send(nodes[node].fd, &message, sizeof(message), 0) != sizeof(message) || recv(nodes[node].fd, &message, sizeof(message), 0) != sizeof(message) || message.command != sim_stats)
+    {
+      fprintf(stderr, "Node %d: no statistics\n", node);
+      exit(2);
+    }
+    nodes[node].wakeups = message.id;
+    nodes[node].mah_per_day = message.value;
+    nodes[node].awake = message.time;
+    nodes[node].route_bytes = message.rssi;
+    close(nodes[node].fd);
+    waitpid(nodes[node].pid, NULL, 0);
+    nodes[node].pid = 0;
+  }
+
+  if (serial >= 0)
+  {
+    close(serial);
+    close(serial_slave);
+  }
+
+  // Results
+  uint64_t *latencies = (uint64_t *)malloc((records_count + 1) * sizeof(uint64_t));
+  uint64_t *rtts = (uint64_t *)malloc((records_count + 1) * sizeof(uint64_t));
+  uint64_t delivered_bytes = 0;
+  *result = {};
+  result->rate = rate;
+  result->offered = records_count;
+
+  for (size_t i = 0; i < records_count; i++)
+  {
+    if (records[i].delivered)
+    {
+      latencies[result->delivered++] = records[i].delivered - records[i].sent;
+      delivered_bytes += records[i].size;
+    }
+    if (records[i].acked)
+      rtts[result->acked++] = records[i].acked - records[i].sent;
+  }
+
+  uint64_t airtime = 0, window = options.duration - options.warmup;
+  for (int node = 1; node <= options.nodes; node++)
+  {
+    airtime += nodes[node].airtime;
+    double duty = 100.0 * nodes[node].airtime / window;
+    if (duty > result->duty_max)
+      result->duty_max = duty;
+
+    result->wakeups_per_hour += nodes[node].wakeups * 3600e6 / options.duration / options.nodes;
+    result->awake_pct += 100.0 * nodes[node].awake * 1000 / options.duration / options.nodes;
+    if (nodes[node].mah_per_day > result->mah_per_day_max)
+      result->mah_per_day_max = nodes[node].mah_per_day;
+    if (options.low_power[node] && nodes[node].mah_per_day > result->lpl_mah_per_day_max)
+      result->lpl_mah_per_day_max = nodes[node].mah_per_day;
+    result->route_bytes += (double)nodes[node].route_bytes / options.nodes;
+  }
+
+  // Low-power listening leaves do not take part in the distribution
+  if (options.ota_image != NULL)
+  {
+    int ota_expected = 0;
+    for (int node = 1; node <= options.nodes; node++)
+    {
+      char path[sizeof(ota_directory) + 8];
+      snprintf(path, sizeof(path), "%s/%d", ota_directory, node);
+      ota_expected += !options.low_power[node];
+
+      if (nodes[node].ota_version == ota_version && sim_checkStaged(path, options.ota_image))
+      {
+        result->ota_nodes++;
+        if ((nodes[node].ota_staged - options.warmup) / 1e6 > result->ota_time)
+          result->ota_time = (nodes[node].ota_staged - options.warmup) / 1e6;
+      }
+      else if (nodes[node].ota_version == ota_version)
+        fprintf(stderr, "Node %d: staged image differs\n", node);
+      unlink(path);
+    }
+    rmdir(ota_directory);
+
+    if (result->ota_nodes < ota_expected)
+      result->ota_time = 0;
+  }
+
+  result->delivery_ratio = records_count ? (double)result->delivered / records_count : 0;
+  result->latency_p50 = sim_percentile(latencies, result->delivered, 0.5);
+  result->latency_p99 = sim_percentile(latencies, result->delivered, 0.99);
+  result->ack_p50 = sim_percentile(rtts, result->acked, 0.5);
+  result->ack_p99 = sim_percentile(rtts, result->acked, 0.99);
+  result->airtime_per_byte = delivered_bytes ? airtime / 1000.0 / delivered_bytes : 0;
+  result->saturated = result->delivery_ratio < options.threshold;
+
+  free(latencies);
+  free(rtts);
+}
+
+/**
+ * @brief    Prints the results as CSV or JSON
+ * 
+ */
+static void sim_print(sim_result_struct *results, int count)
+{
+  int saturation = -1;
+  for (int i = 0; i < count && saturation < 0; i++)
+  {
+    if (results[i].saturated)
+      saturation = i;
+  }
+
+  if (!options.json)
+  {
+    printf("topology,nodes,rate_per_min,offered,delivered,delivery_ratio,latency_p50_ms,latency_p99_ms,acked,ack_rtt_p50_ms,ack_rtt_p99_ms,airtime_ms_per_byte,duty_max_pct,wakeups_per_hour,awake_pct,mah_per_day_max,lpl_mah_per_day_max,route_bytes,ota_nodes,ota_time_s,saturated\n");
+    for (int i = 0; i < count; i++)
+    {
+      sim_result_struct *r = &results[i];
+      printf("%s,%d,%g,%d,%d,%.3f,%.1f,%.1f,%d,%.1f,%.1f,%.3f,%.3f,%.1f,%.2f,%u,%u,%.1f,%d,%.1f,%d\n", options.topology, options.nodes, r->rate, r->offered, r->delivered, r->delivery_ratio, r->latency_p50, r->latency_p99, r->acked, r->ack_p50, r->ack_p99, r->airtime_per_byte, r->duty_max, r->wakeups_per_hour, r->awake_pct, r->mah_per_day_max, r->lpl_mah_per_day_max, r->route_bytes, r->ota_nodes, r->ota_time, r->saturated);
+    }
+    if (count > 1)
+    {
+      if (saturation >= 0)
+        fprintf(stderr, "Saturation at %g msg/min (delivery ratio %.3f < %.2f)\n", results[saturation].rate, results[saturation].delivery_ratio, options.threshold);
+      else
+        fprintf(stderr, "No saturation up to %g msg/min\n", results[count - 1].rate);
+    }
+    return;
+  }
+
+  printf("{\"topology\":\"%s\",\"nodes\":%d,\"spacing_m\":%g,\"seed\":%u,\"duration_s\":%llu,\"runs\":[", options.topology, options.nodes, options.spacing, options.seed, (unsigned long long)(options.duration / 1000000));
+  for (int i = 0; i < count; i++)
+  {
+    sim_result_struct *r = &results[i];
+    printf("%s{\"rate_per_min\":%g,\"offered\":%d,\"delivered\":%d,\"delivery_ratio\":%.3f,\"latency_p50_ms\":%.1f,\"latency_p99_ms\":%.1f,\"acked\":%d,\"ack_rtt_p50_ms\":%.1f,\"ack_rtt_p99_ms\":%.1f,\"airtime_ms_per_byte\":%.3f,\"duty_max_pct\":%.3f,\"wakeups_per_hour\":%.1f,\"awake_pct\":%.2f,\"mah_per_day_max\":%u,\"lpl_mah_per_day_max\":%u,\"route_bytes\":%.1f,\"ota_nodes\":%d,\"ota_time_s\":%.1f,\"saturated\":%s}",
+           i ? "," : "", r->rate, r->offered, r->delivered, r->delivery_ratio, r->latency_p50, r->latency_p99, r->acked, r->ack_p50, r->ack_p99, r->airtime_per_byte, r->duty_max, r->wakeups_per_hour, r->awake_pct, r->mah_per_day_max, r->lpl_mah_per_day_max, r->route_bytes, r->ota_nodes, r->ota_time, r->saturated ? "true" : "false");
+  }
+  if (saturation >= 0)
+    printf("],\"saturation_rate_per_min\":%g}\n", results[saturation].rate);
+  else
+    printf("],\"saturation_rate_per_min\":null}\n");
+}
+
+// Functions
+
+int main(int argc, char **argv)
+{
+  options.topology = "line";
+  options.nodes = 5;
+  options.spacing = 2000;
+  options.rates[0] = 1;
+  options.rates_count = 1;
+  options.length = 32;
+  options.duration = 1800;
+  options.warmup = 300;
+  options.drain = 120;
+  options.threshold = 0.9;
+  options.fec = 1;
+  options.seed = 1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:n:d:r:S:l:T:w:D:p:L:FAPG:B:O:s:jv")) != -1)
+  {
+    switch (opt)
+    {
+    case 't':
+      options.topology = optarg;
+      break;
+    case 'n':
+      options.nodes = atoi(optarg);
+      break;
+    case 'd':
+      options.spacing = atof(optarg);
+      break;
+    case 'r':
+      options.rates[0] = atof(optarg);
+      options.rates_count = 1;
+      break;
+    case 'S':
+      options.rates_count = 0;
+      for (char *rate = strtok(optarg, ","); rate != NULL && options.rates_count < SIMSWEEPMAX; rate = strtok(NULL, ","))
+        options.rates[options.rates_count++] = atof(rate);
+      break;
+    case 'l':
+      options.length = atoi(optarg);
+      break;
+    case 'T':
+      options.duration = atoll(optarg);
+      break;
+    case 'w':
+      options.warmup = atoll(optarg);
+      break;
+    case 'D':
+      options.drain = atoll(optarg);
+      break;
+    case 'p':
+      options.threshold = atof(optarg);
+      break;
+    case 'L':
+      for (char *item = strtok(optarg, ","); item != NULL; item = strtok(NULL, ","))
+      {
+        int first = atoi(item), last = first;
+        if (strchr(item, '-') != NULL)
+          last = atoi(strchr(item, '-') + 1);
+        for (int node = first; node <= last; node++)
+        {
+          if (node >= 1 && node <= SIMMAXNODES)
+            options.low_power[node] = 1;
+        }
+      }
+      break;
+    case 'F':
+      options.fec = 0;
+      break;
+    case 'A':
+      host_routeDiscovery = 1;
+      break;
+    case 'P':
+      host_geoEnabled = 1;
+      break;
+    case 'G':
+      options.gateway = atoi(optarg);
+      break;
+    case 'B':
+    {
+      options.bridge = atoi(strtok(optarg, ","));
+      char *item = strtok(NULL, ",");
+      host_bridgeMesh = item != NULL ? atoi(item) : 0;
+      item = strtok(NULL, ",");
+      host_bridgePort = item != NULL ? atoi(item) : 0;
+      bridge_peers[0] = 0;
+      while ((item = strtok(NULL, ",")) != NULL && strlen(bridge_peers) + 17 < sizeof(bridge_peers))
+        sprintf(bridge_peers + strlen(bridge_peers), "%s127.0.0.1:%d", bridge_peers[0] ? "," : "", atoi(item));
+      host_bridgePeers = bridge_peers;
+    }
+    break;
+    case 'O':
+      options.ota_image = optarg;
+      if (strchr(optarg, ',') != NULL)
+      {
+        options.ota_base = optarg;
+        options.ota_image = strchr(optarg, ',') + 1;
+        *strchr(optarg, ',') = 0;
+      }
+      break;
+    case 's':
+      options.seed = atoi(optarg);
+      break;
+    case 'j':
+      options.json = 1;
+      break;
+    case 'v':
+      options.verbose = 1;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-t line|star|grid|random] [-n nodes] [-d spacing m] [-r rate msg/min] [-S rate,rate,...] [-l length] [-T duration s] [-w warmup s] [-D drain s] [-p threshold] [-L node,first-last,...] [-F] [-A] [-P] [-G node] [-B node,mesh,port,peer port,...] [-O [old,]image] [-s seed] [-j] [-v]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  const char *topologies[] = {"line", "star", "grid", "random"};
+  bool known = 0;
+  for (int i = 0; i < 4; i++)
+    known |= strcmp(options.topology, topologies[i]) == 0;
+
+  if (!known || options.nodes < 2 || options.nodes > SIMMAXNODES || options.nodes > MAXNODES || options.length < 1 || options.length > 161 ||
+      options.warmup + options.drain >= options.duration || options.rates_count == 0 || options.gateway > options.nodes ||
+      options.bridge > options.nodes || (options.bridge && (host_bridgeMesh == 0 || host_bridgePort == 0)))
+  {
+    fprintf(stderr, "Invalid options (nodes 2-%d, length 1-161, warmup + drain < duration, gateway and bridge node <= nodes, bridge mesh and port)\n", MAXNODES < SIMMAXNODES ? MAXNODES : SIMMAXNODES);
+    return 2;
+  }
+  for (int i = 0; i < options.rates_count; i++)
+  {
+    if (options.rates[i] <= 0)
+    {
+      fprintf(stderr, "Invalid rate %g\n", options.rates[i]);
+      return 2;
+    }
+  }
+
+  options.duration *= 1000000;
+  options.warmup *= 1000000;
+  options.drain *= 1000000;
+  signal(SIGPIPE, SIG_IGN);
+
+  sim_result_struct results[SIMSWEEPMAX];
+  for (int i = 0; i < options.rates_count; i++)
+  {
+    sim_runRate(options.rates[i], &results[i]);
+    if (!options.json)
+      fprintf(stderr, "Rate %g msg/min: delivery ratio %.3f\n", options.rates[i], results[i].delivery_ratio);
+  }
+
+  sim_print(results, options.rates_count);
+  return 0;
+}
\ No newline at end of file
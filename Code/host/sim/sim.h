@@ -0,0 +1,70 @@
+/**
+ * @file     sim.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Mesh simulator: coordinator <-> node process protocol.
+ *           Each node runs the firmware in its own process and is driven
+ *           by the coordinator over a SOCK_SEQPACKET socket, one command
+ *           at a time, on a shared virtual clock.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#define SIMMAXNODES 64 // Maximum simulated nodes
+#define SIMFRAME 256   // Maximum frame size
+#define SIMLOCK 5      // Preamble symbols needed to lock on a frame
+
+/**
+ * @brief    Simulator command types
+ * 
+ */
+typedef enum
+{
+  // Coordinator -> node
+  sim_run,        // Runs the main loop (the first one boots the node)
+  sim_deliver,    // Delivers a received frame and runs the main loop
+  sim_send,       // Sends a message (node: receiver, data: text)
+  sim_resume,     // Ends a transmission started with sim_tx
+  sim_cad_result, // Ends a channel activity detection (value: 1 if detected)
+  sim_upload,     // Uploads a firmware image (data: image path, value: version)
+  sim_quit,       // Answers with sim_stats and exits
+
+  // Node -> coordinator
+  sim_tx,        // Transmission started (data: frame, value: airtime us, id: lock time us, crc: radio CRC on), waits for sim_resume
+  sim_radio,     // Receive mode changed (value: 1 if receiving)
+  sim_cad,       // Channel activity detection started, waits for sim_cad_result
+  sim_sent,      // Message sent (node: receiver, id: packet id, value: return_type)
+  sim_delivered, // Message received (node: sender, id: packet id, size: text size)
+  sim_acked,     // Message acknowledged (node: receiver, id: packet id, value: acks)
+  sim_staged,    // Firmware image staged (value: version)
+  sim_idle,      // Command done (time: next wake up)
+  sim_stats      // Power and routing statistics (id: wake-ups, value: mAh/day, time: awake ms, rssi: route state bytes)
+} sim_command_type;
+
+/**
+ * @brief    Simulator command
+ * 
+ */
+typedef struct
+{
+  uint8_t command;
+  uint8_t node;
+  uint8_t size;
+  uint8_t crc;
+  int16_t rssi;
+  float snr;
+  uint32_t id;
+  uint32_t value;
+  uint64_t time;
+  uint8_t data[SIMFRAME];
+} sim_message_struct;
+
+// Node process entry point
+void sim_nodeMain(int fd, uint8_t node, uint32_t seed, bool low_power, bool fec, bool verbose, int serial);
+
+#endif
\ No newline at end of file
@@ -19,7 +19,9 @@ void L1_init();
 return_type L1_enqueue_outPacket(pack_struct packet);
 return_type L1_send_outPacket();
 return_type L1_receive();
+uint32_t L1_airtime(uint8_t size);
 
-void L1_printPacket(pack_struct packet);
+void L1_printPacket(pack_struct packet, bool sent);
+void L1_freePayload(pack_struct packet);
 
 #endif
\ No newline at end of file
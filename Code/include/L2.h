@@ -19,13 +19,33 @@
 return_type L2_handleMessage(pack_struct packet);
 return_type L2_handleacknowledgment(pack_struct packet);
 return_type L2_handleAnnounce(pack_struct packet);
+return_type L2_handleNameRequest(pack_struct packet);
+return_type L2_handleName(pack_struct packet);
+return_type L2_handleRouteRequest(pack_struct packet);
+return_type L2_handleRouteReply(pack_struct packet);
+return_type L2_handleOtaSummary(pack_struct packet);
+return_type L2_handleOtaRequest(pack_struct packet);
+return_type L2_handleOtaData(pack_struct packet);
+return_type L2_relayPacket(pack_struct original_packet);
 
-return_type L2_sendMessage(uint8_t receiver, char *message);
-return_type L2_sendacknowledgment(uint8_t receiver, uint32_t packet_id);
+return_type L2_sendMessage(uint8_t receiver, char *message, uint8_t ttl);
+return_type L2_sendacknowledgment(uint8_t receiver, uint32_t packet_id, const uint8_t *nodes, uint8_t nodes_count, uint8_t ttl);
 return_type L2_sendAnnounce();
+return_type L2_sendNameRequest(uint8_t receiver);
+return_type L2_sendName(uint8_t receiver);
+return_type L2_sendRouteRequest(uint8_t receiver);
+return_type L2_sendRouteReply(uint8_t receiver);
+return_type L2_sendOtaSummary(uint16_t version, uint32_t profile_crc, uint16_t pages, uint16_t complete);
+return_type L2_sendOtaRequest(uint8_t receiver, uint16_t version, uint16_t page, uint32_t missing);
+return_type L2_sendOtaData(uint16_t version, uint16_t page, uint8_t packet_number, const uint8_t *data, uint8_t size);
 
 void *L2_setPayloadMessage(char *message);
-void *L2_setPayloadacknowledgment(uint32_t packet_id);
-void *L2_setPayloadAnnounce(char *name, uint8_t name_size);
+void *L2_setPayloadacknowledgment(uint32_t packet_id, const uint8_t *nodes, uint8_t nodes_count);
+void *L2_setPayloadAnnounce(uint16_t name_version, uint8_t flags, uint16_t wake_offset, uint16_t groups, uint8_t load, int16_t x, int16_t y);
+void *L2_setPayloadName(uint16_t name_version, char *name);
+void *L2_setPayloadRoute(uint16_t name_version, int16_t x, int16_t y);
+void *L2_setPayloadOtaSummary(uint16_t version, uint32_t profile_crc, uint16_t pages, uint16_t complete);
+void *L2_setPayloadOtaRequest(uint16_t version, uint16_t page, uint32_t missing);
+void *L2_setPayloadOtaData(uint16_t version, uint16_t page, uint8_t packet_number, const uint8_t *data, uint8_t size);
 
 #endif
\ No newline at end of file
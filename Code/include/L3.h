@@ -22,14 +22,27 @@ int elapsedSeconds(uint32_t timestamp);
 
 int L3_getActive(uint8_t destination);
 int L3_getNextNode(uint8_t destination);
+void L3_setNextNode(pack_struct *packet, uint8_t from);
+uint8_t L3_getTTL(uint8_t destination);
+uint8_t L3_getPathTTL(int hops);
+int L3_getGroupNextNode(uint8_t group, uint8_t sender, uint8_t last_node, uint8_t ttl);
 int L3_getHops(uint8_t destination);
 int L3_getRssi(uint8_t destination);
 int L3_getLastID(uint8_t destination);
+int L3_getRouteStateSize();
 char *L3_getNodeName(uint8_t destination);
 int L3_getNodeNumber(char *name);
+uint16_t L3_getNameVersion(uint8_t destination);
+int L3_getLowPower(uint8_t destination);
+uint32_t L3_getWakeReference(uint8_t destination);
+uint32_t L3_getWakeSync(uint8_t destination);
 
 return_type L3_handlePacket(pack_struct packet);
 return_type L3_handleAnnounce(pack_struct packet);
-String L3_getStringNodeList();
+return_type L3_handleRoute(pack_struct packet);
+return_type L3_handleName(pack_struct packet);
+int L3_fillNodeItem(int index, uint32_t arg, char *buffer, size_t size);
+int L3_fillNodeJson(int index, uint32_t arg, char *buffer, size_t size);
+uint32_t L3_getVersion();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,26 @@
+/**
+ * @file     bridge.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Mesh bridge.
+ *           A bridge node links its mesh with the meshes of other sites
+ *           over a UDP backhaul. The nodes of the other meshes are given
+ *           local node numbers (proxies) routed through the bridge, so the
+ *           other nodes reach them as any other node.
+ */
+
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+#include "typedefs.h"
+
+// Functions
+void bridge_init();
+void bridge_poll();
+
+bool bridge_isProxy(uint8_t node);
+bool bridge_export(pack_struct packet);
+
+#endif
\ No newline at end of file
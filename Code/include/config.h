@@ -11,35 +11,202 @@
 #define LORABAND 868E6    // LoRa frequency: 433E6, 866E6, 915E6
 #define SPREADINGFACTOR 7 // Spreading factor
 #define TXDBM 20          // TX power of the radio.
+#define LORAPREAMBLE 8    // Preamble length (symbols)
 
 #define LORADUTY 1 // TX max duty cycle
 #define NETID 121  // Network id
+#define FECNETID (NETID ^ 0x80) // Network id of the frames coded with FEC
 
 // L1 config (needs to be the same on each node!)
 #define L1BUFFER 20       // Packet queue, increase if using high spreading factor
-#define TTL 2             // Packet Time To Live (maximum number of hops)
+#ifndef TTL
+#define TTL 2             // Default packet Time To Live (maximum number of hops): announces, broadcasts and nodes without a known route
+#endif
+#define TTLMAX 15         // Largest packet TTL, the hops done and the TTL share a header byte
+#define TTLMARGIN 1       // Hops added to the known route length for the TTL of unicast packets
 #define BROADCASTADDR 255 // Broadcast address
 
+// FEC config (needs to be the same on each node!)
+#ifndef FECENABLED
+#define FECENABLED 1      // Reed-Solomon coding on the links with frame errors
+#endif
+#define FECPARITY 8       // Parity bytes per coded frame, corrects FECPARITY / 2 bytes
+#define FECONPERMILLE 200 // Link frame error rate that turns coding on (1/1000)
+#define FECOFFPERMILLE 50 // Link frame error rate that turns coding off (1/1000)
+
+// Crypto config (needs to be the same on each node!)
+#ifndef CRYPTOENABLED
+#define CRYPTOENABLED 0 // AES-CCM authenticated encryption of the packets, needs CRYPTOKEY
+#endif
+// Network key (AES-128), made for each network, encryption and the bridge need it:
+// #define CRYPTOKEY 0x.., 0x.., ... (16 bytes)
+#define CRYPTOTAG 8     // Authentication tag size (bytes)
+#define CRYPTOWINDOW 64 // Packets more than CRYPTOWINDOW ids older than the last one from a node are replays
+
 // L3 config
+#ifndef NODENUMBER
 #define NODENUMBER 1                  // Node number (1-n)
+#endif
+#ifndef MAXNODES
 #define MAXNODES 10                   // Maximum nodes in network
+#endif
 #define ANNOUNCEMINS 1                // Availability announce interval (min)
 #define INACTIVEMINS 3                // Inactivity time needed to consider a node offline (min)
 #define INACTIVESECONDSREMOVECHECK 10 // Interval for checking inactive nodes (sec)
 
+// Route discovery config
+#ifndef ROUTEDISCOVERY
+#define ROUTEDISCOVERY 0    // On-demand routes: announces only reach the neighbours, other routes are requested, needs to be the same on each node!
+#endif
+#define ROUTETIMEOUTSECS 20 // Wait for a route reply, doubled on each retry (sec)
+#define ROUTERETRIES 2      // Route requests sent again without reply
+#define ROUTEPENDING 4      // Destinations being discovered at the same time
+#define ROUTEHOLD 8         // Packets held while their route is discovered
+#define ROUTECACHE 16       // Last route requests kept for the duplicate check
+#define ROUTEEXPIRYMINS 10  // Discovered routes not used by their node for this time are removed (min)
+
+// Geographic forwarding config
+#ifndef GEOENABLED
+#define GEOENABLED 0 // Greedy geographic forwarding with perimeter fallback, every node needs a position, needs to be the same on each node!
+#endif
+#ifndef GEOX
+#define GEOX 0       // Node position east of the network origin (GEOUNITM)
+#endif
+#ifndef GEOY
+#define GEOY 0       // Node position north of the network origin (GEOUNITM)
+#endif
+#define GEOUNITM 10  // Position unit, positions reach 327 km from the origin (m)
+
+// Neighbour config
+#define NEIGHBOURWEIGHT 8   // RSSI, SNR and reception ratio averaging weight (packets)
+#define NEIGHBOURMAXGAP 32  // Longest sequence gap counted as lost packets (packets)
+#define NEIGHBOURMINPRR 300 // Link quality below which a neighbour is not used as next hop (1/1000)
+#define NEIGHBOURREPORT 16  // Neighbours reported in the announces, needs to be the same on each node!
+
+// Congestion config
+#define CONGESTIONWINDOW 4       // Initial window: unicast messages of this node waiting for their acknowledgment
+#define CONGESTIONMAXWINDOW 16   // Largest window (messages)
+#define CONGESTIONTIMEOUTSECS 60 // A message not acknowledged in this time halves the window (sec)
+#define CONGESTIONLOAD 75        // Send queue occupancy from which a node is congested, its neighbours prefer other next hops with as many hops (%)
+#define CONGESTIONRETRYSECS 10   // Retry time suggested to the web clients when the send queue is full (sec)
+
+// Groups config
+#define GROUPADDR 240                          // First group address (after the node numbers), needs to be the same on each node!
+#define GROUPCOUNT (BROADCASTADDR - GROUPADDR) // Number of group addresses, at most 16
+#define GROUPACKMS 5000                        // Acknowledgment merging time for each hop (ms)
+#define GROUPACKPENDING 8                      // Acknowledgments being merged
+#define GROUPCACHE 16                          // Last group packets kept for the duplicate check
+
+// Bridge config
+#ifndef BRIDGEENABLED
+#define BRIDGEENABLED 0                 // Bridge between this mesh and the meshes of other sites over UDP, needs CRYPTOKEY
+#endif
+#ifndef BRIDGEMESH
+#define BRIDGEMESH 1                    // Mesh id of this site (1-255), different on each site
+#endif
+#ifndef BRIDGEPORT
+#define BRIDGEPORT 4210                 // UDP port of the bridges
+#endif
+#ifndef BRIDGEPEERS
+#define BRIDGEPEERS "192.168.4.2:4210"  // Other bridges (host:port, comma separated)
+#endif
+#define BRIDGESSID ""                   // Wi-Fi network of the backhaul, "" if the bridges use the access point
+#define BRIDGEPASSWORD ""               // Wi-Fi network password
+#define BRIDGEPROXIES 4                 // Last node numbers, standing for the nodes of other meshes, not usable by local nodes
+#define BRIDGERATE 30                   // Packets per minute from the backhaul to the radio
+#define BRIDGEBURST 5                   // Packets from the backhaul sent in a burst
+#define BRIDGECACHE 32                  // Last packets forwarded kept for the duplicate check, and last messages from the backhaul for their acknowledgments
+#define BRIDGEPOLLMS 50                 // Backhaul polling interval (ms)
+
+// Firmware distribution config
+#ifndef OTAENABLED
+#define OTAENABLED 0          // Firmware images distributed through the mesh and staged into the OTA partition, needs OTAPUBLICKEY
+#endif
+// Public key of the image signatures (ECDSA P-256 point: 0x04, x, y), its private key signs the images, see Firmware distribution:
+// #define OTAPUBLICKEY 0x04, 0x.., ...
+#define OTAPAGESIZE 4096      // Image page, one flash sector, needs to be the same on each node! (bytes)
+#define OTAPACKETSIZE 128     // Image bytes per data packet, at most 32 packets per page, needs to be the same on each node! (bytes)
+#define OTAMAXPAGES 320       // Largest image, the size of an OTA partition (pages)
+#define OTASHARE 50           // Part of the duty cycle the distribution can use, it sends only when the queue is empty (%)
+#define OTAADVMINSECS 10      // Shortest summary interval, after a change among the neighbours (sec)
+#define OTAADVMAXSECS 1800    // Longest summary interval, doubled from the shortest while the neighbours agree (sec)
+#define OTAADVREDUNDANCY 1    // Same summaries heard in an interval that suppress the summary of this node
+#define OTAREQUESTSECS 60     // Wait for the data of a page before requesting the missing packets again (sec)
+#define OTARETRIES 3          // Requests without data before giving up on a neighbour
+#define OTAUPLOADSECS 60      // Upload abandoned after this time without data from the serial gateway (sec)
+#ifndef OTAREBOOTSECS
+#define OTAREBOOTSECS 3600    // Restart on the staged image after serving it this long, 0 to wait for the next reset (sec)
+#endif
+
 // Messages config
 #define SHOWNMESSAGES 5  // Number of messages to display on web interface
 #define KEEPNMESSAGES 20 // Number of messages to keep in memory
+#define MESSAGEHASH 32   // Message id hash buckets, power of 2
+#define MESSAGEPAGE 10   // Messages of a conversation per API page
+
+// Metrics config
+#define METRICSBUCKETS 10 // Histograms buckets (+Inf bucket excluded)
+
+// Gateway config
+#define GATEWAYFRAME 384 // Largest serial gateway frame before COBS encoding (bytes)
+
+// Log config
+#ifndef LOGLEVEL
+#define LOGLEVEL LOG_LEVEL_INFO // Compiled log level: LOG_LEVEL_NONE, ERROR, WARN, INFO, DEBUG
+#endif
+#define LOGBUFFER 32            // Deferred log records queue
+#define LOGTEXTSIZE 40          // Text copied into each log record (bytes)
+#define LOGDRAINMS 20           // Log queue drain interval (ms)
+
+// Scheduler config
+#define SCHEDULERMAXSLEEPMS 1000 // Longest main loop sleep without timers or interrupts (ms)
+#ifndef SERIALPOLLMS
+#define SERIALPOLLMS 100         // Serial commands polling interval, 0 disables it (ms)
+#endif
+#define WEBSERVERPOLLMS 10       // DNS server and live updates polling interval (ms)
+
+// Power config
+#ifndef LOWPOWER
+#define LOWPOWER 0          // Low-power relay: light sleep between radio events, Wi-Fi and display off
+#endif
+#define POWERMINSLEEPMS 2   // Shortest light sleep (ms)
+#define POWERCPUMHZ 80      // CPU frequency in low-power mode (MHz)
+#define POWERREPORTMINS 60  // Estimated consumption log interval (min)
+#define POWERAWAKEMA 30     // CPU awake current at POWERCPUMHZ (mA)
+#define POWERSLEEPMA 0.8    // CPU light sleep current (mA)
+#define POWERRXMA 11.5      // Radio receive current (mA)
+#define POWERTXMA 120       // Radio transmit current at TXDBM (mA)
+#define POWERWIFIMA 100     // Wi-Fi access point current (mA)
+#define POWERRADIOSLEEPMA 0.002 // Radio sleep current (mA)
+
+// Low-power listening config
+#ifndef LPLENABLED
+#define LPLENABLED 0        // Low-power listening leaf: the radio sleeps and samples the channel, the node does not relay
+#endif
+#define LPLINTERVALMS 1000  // Channel sampling interval (ms), needs to be the same on each node!
+#define LPLCADMS 3          // Channel activity detection time (ms)
+#define LPLRXMS 400         // Receive window after the longest preamble, covers a full frame (ms)
+#define LPLGUARDMS 10       // Guard time around a neighbour's wake-up (ms)
+#define LPLDRIFTPPM 40      // Clock drift allowed between two nodes (ppm)
+#define LPLSYNCMINS 60      // Interval of the continuous receive windows used to find neighbours (min)
 
 // Display config
-#define DISPLAYSTBYSECS 10 // Display standby time (sec)
+#define DISPLAYSTBYSECS 10    // Display standby time (sec)
+#define DISPLAYI2CHZ 400000   // Display I2C bus clock (Hz)
+#define DISPLAYREFRESHMS 100  // Delay before a refresh, merges bursts of messages (ms)
+#define DISPLAYSTATUSMS 1000  // Status bar and inbox scrolling interval while the display is on (ms)
+#define DISPLAYINBOX 5        // Messages kept in the inbox
+#define DISPLAYEVENTS 4       // Messages waiting for the refresh, the oldest are dropped
 
 // Network config
-#define WIFIENABLED 1            // Wi-Fi enabled
+#ifndef WIFIENABLED
+#define WIFIENABLED !LOWPOWER // Wi-Fi enabled (disabled on low-power relays)
+#endif
 #define NODENAMEOVERRIDEEN 0     // Node name override enable (ex: relay without Wi-Fi)
 #define NODENAMEOVERRIDE "Home"  // Node name override
 #define WIFISSID "LoRaMessenger" // Wi-Fi prefix (ex: LoRaMessenger 1)
 #define DNSPORT 53               // DNS port
+#define WEBLINEBUFFER 512        // Web page render buffer, bounds heap used per request (bytes)
 
 // Pinout
 #define SCK 5
@@ -0,0 +1,31 @@
+/**
+ * @file     congestion.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Congestion control.
+ *           The announces carry the send queue occupancy of their sender,
+ *           so congested neighbours are avoided as next hops. The messages
+ *           of this node are limited by an additive increase, multiplicative
+ *           decrease window of messages waiting for their acknowledgment.
+ */
+
+#ifndef CONGESTION_H
+#define CONGESTION_H
+
+#include "typedefs.h"
+
+// Functions
+void congestion_init();
+
+return_type congestion_check(uint8_t receiver);
+void congestion_sent(uint8_t receiver, uint32_t id);
+void congestion_acknowledged(uint32_t id);
+
+uint8_t congestion_getLoad();
+int congestion_getWindow();
+int congestion_getRoom();
+uint32_t congestion_getWait();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+/**
+ * @file     crypto.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Packet encryption and packet ids.
+ *           Payloads are encrypted with AES-CCM and the network key, the
+ *           header is authenticated so relays can still route. Packet ids
+ *           are sequence numbers that only grow, also across reboots, and
+ *           are used as nonces and for the replay check.
+ */
+
+#ifndef CRYPTO_H
+#define CRYPTO_H
+
+#include "typedefs.h"
+
+// Functions
+void crypto_init();
+
+uint32_t crypto_newId();
+uint32_t crypto_getLastId();
+
+return_type crypto_seal(uint8_t *frame, size_t *size);
+return_type crypto_open(uint8_t *frame, size_t *size);
+return_type crypto_sealDatagram(uint8_t *datagram, size_t *size);
+return_type crypto_openDatagram(uint8_t *datagram, size_t *size);
+
+#endif
\ No newline at end of file
@@ -14,6 +14,6 @@
 void display_init();
 void display_turnOff();
 void display_printWelcome();
-void display_printLastMessage(char *message, uint8_t sender_node);
+void display_printLastMessage(const char *message, uint8_t sender_node);
 
 #endif
\ No newline at end of file
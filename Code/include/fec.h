@@ -0,0 +1,28 @@
+/**
+ * @file     fec.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Forward error correction.
+ *           Reed-Solomon code over GF(256) with a CRC16 and FECPARITY
+ *           parity bytes appended to the frame, it corrects up to
+ *           FECPARITY / 2 corrupted bytes. Coding is turned on per link
+ *           when the frame error rate of the neighbour link is high.
+ */
+
+#ifndef FEC_H
+#define FEC_H
+
+#include "typedefs.h"
+
+// Functions
+void fec_init();
+
+int fec_encode(uint8_t *frame, int size);
+int fec_decode(uint8_t *frame, int size, int *corrected);
+
+bool fec_linkEnabled(uint8_t next_node);
+uint16_t fec_getLinkErrorRate(uint8_t node);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,26 @@
+/**
+ * @file     gateway.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Serial gateway.
+ *           Binary host protocol on the serial port, COBS framed: batched
+ *           message sending, node list, metrics snapshot and a stream of
+ *           the messages and acknowledgments received, so a host computer
+ *           can send and receive traffic without the web interface.
+ */
+
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+#include "typedefs.h"
+
+// Functions
+void gateway_init();
+void gateway_poll();
+
+void gateway_messageReceived(uint8_t sender, uint8_t receiver, uint32_t packet_id, const char *message);
+void gateway_ackReceived(uint8_t node, uint32_t packet_id);
+
+#endif
\ No newline at end of file
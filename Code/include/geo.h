@@ -0,0 +1,27 @@
+/**
+ * @file     geo.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Geographic forwarding.
+ *           With GEOENABLED, the announces carry the node positions and
+ *           unicast packets carry the receiver position, they are forwarded
+ *           to the neighbour closest to it, with a perimeter fallback
+ *           around the voids.
+ */
+
+#ifndef GEO_H
+#define GEO_H
+
+#include "typedefs.h"
+
+// Functions
+void geo_init();
+
+void geo_setPosition(uint8_t node, int16_t x, int16_t y);
+bool geo_getPosition(uint8_t node, int16_t *x, int16_t *y);
+uint8_t geo_getNextNode(pack_struct *packet, uint8_t from);
+int geo_countPositions();
+
+#endif
\ No newline at end of file
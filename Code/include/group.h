@@ -0,0 +1,36 @@
+/**
+ * @file     group.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Group channels.
+ *           A group name (ex: #hiking) is hashed to one of GROUPCOUNT
+ *           addresses from GROUPADDR. Nodes advertise the groups they joined
+ *           in their announces, so group packets are relayed only towards
+ *           branches with members. Acknowledgments of group and broadcast
+ *           messages are merged on their way back to the sender.
+ */
+
+#ifndef GROUP_H
+#define GROUP_H
+
+#include "typedefs.h"
+
+// Functions
+void group_init();
+
+bool group_isAddress(uint8_t address);
+uint8_t group_getAddress(const char *name);
+uint8_t group_getTag(uint8_t address);
+bool group_checkTag(uint8_t address, uint8_t tag);
+uint16_t group_getMask(uint8_t address);
+return_type group_join(const char *name);
+bool group_isMember(uint8_t address);
+uint16_t group_getMemberships();
+char *group_getName(uint8_t address);
+
+bool group_checkDuplicate(uint8_t sender, uint32_t id);
+void group_addAck(uint8_t receiver, uint32_t packet_id, const uint8_t *nodes, uint8_t count, uint8_t ttl, uint32_t delay);
+
+#endif
\ No newline at end of file
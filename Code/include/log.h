@@ -0,0 +1,90 @@
+/**
+ * @file     log.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Deferred logging.
+ *           Log calls below LOGLEVEL compile to nothing. Enabled calls only
+ *           store the format pointer, up to 4 integer arguments and an
+ *           optional short text into a queue that is printed later by a low
+ *           priority task, so the radio path never waits on the serial port.
+ *           Formats must be string literals and only use integer conversions,
+ *           the text is printed after the formatted arguments.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include "typedefs.h"
+
+// Levels
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Functions
+void log_init();
+void log_write(uint8_t level, const char *format, const char *text, uint32_t arg0 = 0, uint32_t arg1 = 0, uint32_t arg2 = 0, uint32_t arg3 = 0);
+int log_drain();
+
+// Macros
+#if LOGLEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) log_write(LOG_LEVEL_ERROR, format, NULL, ##__VA_ARGS__)
+#define LOG_ERROR_TEXT(text, format, ...) log_write(LOG_LEVEL_ERROR, format, text, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) \
+  do                           \
+  {                            \
+  } while (0)
+#define LOG_ERROR_TEXT(text, format, ...) \
+  do                                      \
+  {                                       \
+  } while (0)
+#endif
+
+#if LOGLEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) log_write(LOG_LEVEL_WARN, format, NULL, ##__VA_ARGS__)
+#define LOG_WARN_TEXT(text, format, ...) log_write(LOG_LEVEL_WARN, format, text, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) \
+  do                          \
+  {                           \
+  } while (0)
+#define LOG_WARN_TEXT(text, format, ...) \
+  do                                     \
+  {                                      \
+  } while (0)
+#endif
+
+#if LOGLEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) log_write(LOG_LEVEL_INFO, format, NULL, ##__VA_ARGS__)
+#define LOG_INFO_TEXT(text, format, ...) log_write(LOG_LEVEL_INFO, format, text, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) \
+  do                          \
+  {                           \
+  } while (0)
+#define LOG_INFO_TEXT(text, format, ...) \
+  do                                     \
+  {                                      \
+  } while (0)
+#endif
+
+#if LOGLEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) log_write(LOG_LEVEL_DEBUG, format, NULL, ##__VA_ARGS__)
+#define LOG_DEBUG_TEXT(text, format, ...) log_write(LOG_LEVEL_DEBUG, format, text, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) \
+  do                           \
+  {                            \
+  } while (0)
+#define LOG_DEBUG_TEXT(text, format, ...) \
+  do                                      \
+  {                                       \
+  } while (0)
+#endif
+
+#endif
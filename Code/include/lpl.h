@@ -0,0 +1,34 @@
+/**
+ * @file     lpl.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Low-power listening.
+ *           Leaf nodes (LPLENABLED) keep the radio asleep and sample the
+ *           channel with CAD every LPLINTERVALMS, a detected preamble opens
+ *           a receive window. Their announces carry the time of the next
+ *           sample, so neighbours transmit just before it with a short
+ *           preamble, or cover a whole interval when the schedule is
+ *           unknown.
+ */
+
+#ifndef LPL_H
+#define LPL_H
+
+#include "typedefs.h"
+
+// Functions
+void lpl_init();
+
+void lpl_radioReceive();
+void lpl_radioStandby();
+void lpl_packetReceived();
+void lpl_synced();
+
+uint32_t lpl_sendDelay(uint8_t next_node);
+long lpl_preambleLength(uint8_t next_node);
+uint16_t lpl_getWakeOffset(uint32_t airtime);
+uint32_t lpl_getReceiveMs();
+
+#endif
\ No newline at end of file
@@ -20,9 +20,22 @@ return_type message_saveAck(uint8_t sender, uint32_t id);
 
 uint8_t message_getAckNode(uint8_t sender, uint32_t id, uint8_t ack_number);
 uint8_t message_getAckNum(uint8_t sender, uint32_t id);
+uint8_t message_countAcks(const message_struct *message);
+int message_getNextAck(const message_struct *message, int node);
+message_struct *message_find(uint8_t sender, uint32_t id);
 
 void message_printLastN(int number);
 
 int message_checkDuplicate(uint8_t sender, uint32_t id);
-String message_getStringMessageList();
+int message_fillMessageItem(int index, uint32_t arg, char *buffer, size_t size);
+int message_fillMessageJson(int index, uint32_t since, char *buffer, size_t size);
+int message_fillThreadJson(int index, uint32_t arg, char *buffer, size_t size);
+int message_fillConversationItem(int index, uint32_t arg, char *buffer, size_t size);
+uint32_t message_getThreadArg(uint8_t peer, uint32_t before);
+uint32_t message_getUpdate();
+
+int message_getThread(uint8_t peer, uint32_t before, message_struct **messages, int count);
+int message_getNextConversation(int peer);
+const conversation_struct *message_getConversation(uint8_t peer);
+void message_markRead(uint8_t peer);
 #endif
\ No newline at end of file
@@ -0,0 +1,51 @@
+/**
+ * @file     metrics.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Runtime metrics: counters and histograms updated by the
+ *           protocol stack, exported as Prometheus text or binary snapshot
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "typedefs.h"
+
+/**
+ * @brief    Metrics counters
+ * 
+ */
+typedef enum metrics_counter
+{
+  metric_packets_in = 0,
+  metric_packets_out = metric_packets_in + payload_count,
+  metric_drops = metric_packets_out + payload_count,
+  metric_airtime_ms = metric_drops + ret_count,
+  metric_duplicates,
+  metric_log_drops,
+  metric_fec_frames_in,
+  metric_fec_frames_out,
+  metric_fec_corrected_bytes,
+  metric_counters_count
+} metrics_counter;
+
+#define METRICSSNAPSHOT (5 + 4 * metric_counters_count + 20 + 8 * (METRICSBUCKETS + 3) + 4) // Binary snapshot size (bytes)
+
+// Functions
+void metrics_count(int counter);
+void metrics_add(int counter, uint32_t value);
+void metrics_packetIn(uint8_t type);
+void metrics_packetOut(uint8_t type, uint32_t airtime);
+void metrics_drop(return_type reason);
+void metrics_queueDepth(int depth);
+void metrics_relayLatency(uint32_t latency);
+
+uint32_t metrics_get(int counter);
+
+int metrics_fillPrometheus(int index, uint32_t arg, char *buffer, size_t size);
+int metrics_fillSnapshot(uint8_t *buffer);
+void metrics_printSnapshot();
+
+#endif
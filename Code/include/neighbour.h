@@ -0,0 +1,42 @@
+/**
+ * @file     neighbour.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Neighbour table.
+ *           Link statistics of the nodes heard directly, kept apart from
+ *           the routing destinations: averaged RSSI and SNR, packet
+ *           reception ratio from the gaps in the neighbour's packet ids,
+ *           and the reception ratio the neighbour reports for this node in
+ *           its announces. Routing and FEC use the averaged link quality
+ *           instead of the last packet.
+ */
+
+#ifndef NEIGHBOUR_H
+#define NEIGHBOUR_H
+
+#include "typedefs.h"
+
+// Functions
+void neighbour_init();
+
+void neighbour_handlePacket(pack_struct packet, float snr);
+void neighbour_handleReport(uint8_t node, const uint8_t *report, uint8_t count);
+void neighbour_handleLoad(uint8_t node, uint8_t load);
+uint8_t neighbour_fillReport(uint8_t *report);
+int neighbour_removeInactive();
+
+int neighbour_getActive(uint8_t node);
+int neighbour_getRssi(uint8_t node);
+int neighbour_getSnr(uint8_t node);
+uint16_t neighbour_getPrr(uint8_t node);
+int neighbour_getReversePrr(uint8_t node);
+uint16_t neighbour_getQuality(uint8_t node);
+bool neighbour_isUsable(uint8_t node);
+int neighbour_getLoad(uint8_t node);
+bool neighbour_isCongested(uint8_t node);
+
+void neighbour_print();
+
+#endif
\ No newline at end of file
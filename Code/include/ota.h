@@ -0,0 +1,32 @@
+/**
+ * @file     ota.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Firmware distribution.
+ *           A firmware image uploaded to one node through the serial
+ *           gateway is pulled page by page by its neighbours, then by
+ *           theirs, and staged into the OTA partition of every node.
+ */
+
+#ifndef OTA_H
+#define OTA_H
+
+#include "typedefs.h"
+
+// Functions
+void ota_init();
+
+return_type ota_upload(uint16_t version, uint32_t size, uint32_t offset, const uint8_t *signature, const uint8_t *data, size_t length);
+
+void ota_handleSummary(pack_struct packet);
+void ota_handleRequest(pack_struct packet);
+void ota_handleData(pack_struct packet);
+
+uint16_t ota_getVersion();
+uint16_t ota_getPages();
+uint16_t ota_getComplete();
+bool ota_isStaged();
+
+#endif
\ No newline at end of file
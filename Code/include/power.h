@@ -0,0 +1,28 @@
+/**
+ * @file     power.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Power management.
+ *           In low-power mode (LOWPOWER) the CPU light sleeps between
+ *           radio events and timers while the radio keeps receiving, Wi-Fi,
+ *           Bluetooth and the display stay off. Sleep and wake-ups are
+ *           accounted in every mode to estimate the daily consumption.
+ */
+
+#ifndef POWER_H
+#define POWER_H
+
+#include "typedefs.h"
+
+// Functions
+void power_init();
+void power_sleep(uint32_t wait);
+void power_wake();
+
+uint32_t power_getWakeups();
+uint32_t power_getAwakeMs();
+uint32_t power_getMahPerDay();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,25 @@
+/**
+ * @file     route.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    On-demand route discovery.
+ *           With ROUTEDISCOVERY, the announces only reach the neighbours
+ *           and the routes to the other nodes are found with a route
+ *           request and reply when a packet needs them.
+ */
+
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include "typedefs.h"
+
+// Functions
+void route_init();
+
+return_type route_hold(pack_struct packet);
+void route_check();
+bool route_checkDuplicate(uint8_t sender, uint32_t id);
+
+#endif
\ No newline at end of file
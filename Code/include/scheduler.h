@@ -0,0 +1,31 @@
+/**
+ * @file     scheduler.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Timer scheduler.
+ *           Subsystems register a callback for their timer and arm it with
+ *           a deadline, the main loop runs the expired callbacks and sleeps
+ *           until the next deadline or until an interrupt wakes it up.
+ *           Deadlines are kept in a min-heap on a pluggable clock (ms).
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "typedefs.h"
+
+// Functions
+void scheduler_init(uint32_t (*clock)());
+void scheduler_register(timer_type timer, scheduler_callback callback, uint32_t period);
+void scheduler_set(timer_type timer, uint32_t delay);
+void scheduler_cancel(timer_type timer);
+bool scheduler_isSet(timer_type timer);
+uint32_t scheduler_getRemaining(timer_type timer);
+void scheduler_run();
+uint32_t scheduler_nextDeadline();
+void scheduler_sleep();
+void scheduler_wake();
+
+#endif
\ No newline at end of file
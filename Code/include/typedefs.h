@@ -20,7 +20,15 @@ typedef enum payload_type
 {
   payload_msg = 0,
   payload_ack,
-  payload_ann
+  payload_ann,
+  payload_name_req,
+  payload_name,
+  payload_rreq,
+  payload_rrep,
+  payload_ota_summary,
+  payload_ota_request,
+  payload_ota_data,
+  payload_count
 } payload_type;
 
 /**
@@ -35,26 +43,50 @@ typedef enum return_type
   ret_buffer_full,
   ret_send_duty_error,
   ret_send_anticollision_error,
+  ret_send_wake_wait,
   ret_send_error,
   ret_send_size_error,
   ret_receive_netid_error,
   ret_receive_wrong_node,
   ret_receive_duplicate,
+  ret_receive_fec_error,
+  ret_receive_auth_error,
+  ret_receive_replay,
   ret_ttl_error,
   ret_routing_worse,
   ret_routing_better,
   ret_routing_updated,
   ret_message_not_found,
-  ret_message_found
+  ret_message_found,
+  ret_bridge_limited,
+  ret_no_route,
+  ret_congested,
+  ret_count
 } return_type;
 
+/**
+ * @brief    Node position
+ * 
+ */
+typedef struct
+{
+  int16_t x; // East of the network origin (GEOUNITM)
+  int16_t y; // North of the network origin (GEOUNITM)
+  bool valid;
+} geo_position_struct;
+
 /**
  * @brief    Packet structure
  * 
  */
+#define L1HEADER 11       // Packet header size on air (bytes)
+#define GEOHEADER 6       // Geographic forwarding fields after the header, with GEOENABLED (bytes)
+#define GEOUNKNOWN 0xFFFF // Perimeter field on air when the receiver position is not known
+
 typedef struct
 {
-  uint8_t ttl;
+  uint8_t ttl;  // Hops left
+  uint8_t hops; // Hops done, relays only
   uint8_t receiver;
   uint8_t sender;
   uint8_t last_node;
@@ -62,7 +94,11 @@ typedef struct
   uint32_t id;
   uint8_t type;
   void *payload;
+  uint8_t raw_size;           // Payload size if relayed as received, 0 if parsed
+  uint16_t perimeter;         // Geographic forwarding: distance to the receiver where perimeter mode started (GEOUNITM), 0 in greedy mode
+  geo_position_struct target; // Geographic forwarding: receiver position, carried by the packet
   int rssi;
+  uint32_t timestamp;
 } pack_struct;
 
 /**
@@ -73,6 +109,7 @@ typedef struct
 {
   uint8_t message_size;
   char *message_ptr;
+  uint8_t group_tag; // Group name hash of group messages, 0 if not known
 } payload_message_struct;
 
 /**
@@ -82,17 +119,86 @@ typedef struct
 typedef struct
 {
   uint32_t packet_id;
+  uint8_t nodes_count; // Merged group acknowledgment: nodes that received the message, 0 for the sender only
+  uint8_t nodes[MAXNODES];
 } payload_acknowledgment_struct;
 
 /**
  * @brief    Announce payload structure
  * 
  */
+#define ANNOUNCELOWPOWER 0x01   // Announce flag: the sender is a low-power listening leaf
+#define ANNOUNCENEIGHBOURS 0x02 // Announce flag: for the neighbours only, not relayed (on-demand routes)
+#define ANNOUNCEPOSITION 0x04   // Announce flag: the sender position follows the groups
+
+typedef struct
+{
+  uint16_t name_version;
+  uint8_t flags;
+  uint16_t wake_offset; // Time from the end of the announce to the next channel sample (ms)
+  uint16_t groups;      // Joined groups, bit n for group address GROUPADDR + n
+  uint8_t load;         // Send queue occupancy of the sender (%)
+  int16_t x;            // Sender position with ANNOUNCEPOSITION (GEOUNITM)
+  int16_t y;
+} payload_announce_struct;
+
+/**
+ * @brief    Node name payload structure
+ * 
+ */
 typedef struct
 {
+  uint16_t name_version;
   uint8_t name_size;
   char *name_ptr;
-} payload_announce_struct;
+} payload_name_struct;
+
+/**
+ * @brief    Route request and route reply payload structure
+ * 
+ */
+typedef struct
+{
+  uint16_t name_version;
+  int16_t x; // Sender position with GEOENABLED (GEOUNITM)
+  int16_t y;
+} payload_route_struct;
+
+/**
+ * @brief    Firmware summary payload structure
+ * 
+ */
+typedef struct
+{
+  uint16_t version;     // Image version, 0 if none
+  uint32_t profile_crc; // CRC32 of the profile (page 0)
+  uint16_t pages;       // Pages of the image, profile included
+  uint16_t complete;    // Pages received, in order
+} payload_ota_summary_struct;
+
+/**
+ * @brief    Firmware page request payload structure
+ * 
+ */
+typedef struct
+{
+  uint16_t version;
+  uint16_t page;
+  uint32_t missing; // Packets of the page requested, bit n for packet n
+} payload_ota_request_struct;
+
+/**
+ * @brief    Firmware data payload structure
+ * 
+ */
+typedef struct
+{
+  uint16_t version;
+  uint16_t page;
+  uint8_t packet;
+  uint8_t size;
+  uint8_t data[OTAPACKETSIZE];
+} payload_ota_data_struct;
 
 /**
  * @brief    Routing table structure
@@ -103,12 +209,36 @@ typedef struct
   uint8_t active;
   uint8_t next_node;
   uint8_t hops;
-  int8_t rssi;
   uint32_t last_id;
   char name[16];
+  uint16_t name_version;
   uint32_t timestamp;
+  uint8_t low_power;
+  uint32_t wake_reference;
+  uint32_t wake_sync;
+  uint16_t groups;
 } routing_table_struct;
 
+/**
+ * @brief    Neighbour structure
+ * 
+ */
+typedef struct
+{
+  uint8_t active;
+  int16_t rssi;               // Averaged RSSI (1/16 dBm)
+  int16_t snr;                // Averaged SNR (1/16 dB)
+  uint16_t prr;               // Packet reception ratio from the neighbour (1/1000)
+  int16_t reverse_prr;        // Reception ratio reported by the neighbour (1/1000), -1 if unknown
+  uint32_t reverse_timestamp;
+  uint8_t load;               // Send queue occupancy reported by the neighbour (%)
+  uint32_t load_timestamp;
+  uint32_t last_id;
+  bool sequence_valid;
+  uint32_t since;
+  uint32_t timestamp;
+} neighbour_struct;
+
 /**
  * @brief    Message structure
  * 
@@ -118,9 +248,292 @@ typedef struct
   uint8_t receiver;
   uint8_t sender;
   uint32_t id;
+  uint32_t update;
+  uint32_t number; // Save order, conversation cursor
   char *message;
-  uint8_t acks;
-  uint8_t acks_nodes[MAXNODES - 1];
+  uint32_t acks[(MAXNODES + 31) / 32]; // Nodes that received the message, bit n - 1 for node n
+  uint8_t peer;        // Conversation: other node, group or broadcast address
+  int16_t thread_prev; // Previous message of the conversation, -1 if none
+  int16_t thread_next; // Next message of the conversation, -1 if none
+  int16_t hash_next;   // Next message of the id hash bucket, -1 if none
 } message_struct;
 
+/**
+ * @brief    Conversation with a node, a group or the broadcast address
+ * 
+ */
+typedef struct
+{
+  int16_t newest; // Newest message, -1 if none
+  uint16_t count;
+  uint16_t unread;
+} conversation_struct;
+
+/**
+ * @brief    Web page list item renderer
+ * 
+ *           Writes the item number index into buffer and returns its length,
+ *           0 if the item is skipped or -1 after the last item.
+ */
+typedef int (*webpage_fill_function)(int index, uint32_t arg, char *buffer, size_t size);
+
+/**
+ * @brief    Web page section: static PROGMEM text or a list of items,
+ *           optionally separated by a string (ex: JSON arrays)
+ * 
+ */
+typedef struct
+{
+  const char *text;
+  webpage_fill_function fill;
+  const char *separator;
+} webpage_section_struct;
+
+/**
+ * @brief    Web page chunked render state
+ * 
+ */
+typedef struct
+{
+  const webpage_section_struct *page;
+  uint32_t arg;
+  uint8_t section;
+  int item;
+  int items_written;
+  const char *chunk;
+  size_t chunk_size;
+  size_t chunk_offset;
+  bool chunk_progmem;
+  char line[WEBLINEBUFFER];
+} webpage_render_struct;
+
+/**
+ * @brief    Fixed buckets histogram
+ * 
+ */
+typedef struct
+{
+  const uint32_t *bounds;
+  uint32_t buckets[METRICSBUCKETS + 1];
+  uint32_t count;
+  uint32_t sum;
+} metrics_histogram_struct;
+
+/**
+ * @brief    Deferred log record
+ * 
+ */
+typedef struct
+{
+  uint32_t timestamp;
+  const char *format;
+  uint8_t level;
+  uint32_t args[4];
+  char text[LOGTEXTSIZE];
+} log_record_struct;
+
+/**
+ * @brief    Scheduler timers
+ * 
+ */
+typedef enum
+{
+  timer_L1_send,
+  timer_announce,
+  timer_inactive_check,
+  timer_display_standby,
+  timer_display_refresh,
+  timer_serial,
+  timer_webserver,
+  timer_power_report,
+  timer_lpl_sample,
+  timer_lpl_cad,
+  timer_lpl_listen,
+  timer_lpl_sync,
+  timer_group_ack,
+  timer_bridge,
+  timer_route,
+  timer_congestion,
+  timer_ota,
+  timer_count
+} timer_type;
+
+/**
+ * @brief    Serial gateway frame types
+ * 
+ */
+typedef enum
+{
+  // Host -> node
+  gateway_send = 1,      // Sends messages (data: receiver, size, text, repeated)
+  gateway_nodes,         // Lists the active nodes (data: first node)
+  gateway_stats,         // Metrics snapshot
+  gateway_stream,        // Received messages and acknowledgments stream (data: 1 on, 0 off)
+  gateway_conversations, // Lists the conversations (data: first peer)
+  gateway_thread,        // Pages a conversation, newest first (data: peer, cursor, 1 to mark read)
+  gateway_ota,           // Uploads a firmware image in order (data: version, image size, offset, signature of the first part, bytes)
+
+  // Node -> host
+  gateway_reply = 0x80,   // Added to the type of the command answered
+  gateway_message = 0xC0, // Message received (data: sender, receiver, packet id, size, text)
+  gateway_ack             // Acknowledgment received (data: node, packet id)
+} gateway_frame_type;
+
+/**
+ * @brief    Scheduler timer callback
+ * 
+ */
+typedef void (*scheduler_callback)();
+
+/**
+ * @brief    Scheduler timer
+ * 
+ */
+typedef struct
+{
+  scheduler_callback callback;
+  uint32_t deadline;
+  uint32_t period;
+  int8_t position;
+} scheduler_timer_struct;
+
+/**
+ * @brief    Crypto peer structure, for the replay check
+ * 
+ */
+typedef struct
+{
+  uint32_t last_id;
+  uint32_t timestamp; // Last packet accepted (ms)
+  bool valid;
+} crypto_peer_struct;
+
+/**
+ * @brief    Group packet, for the duplicate check
+ * 
+ */
+typedef struct
+{
+  uint8_t sender;
+  uint32_t id;
+} group_packet_struct;
+
+/**
+ * @brief    Bridge datagram
+ * 
+ */
+#define BRIDGEHEADER 10 // Datagram header size (bytes)
+
+/**
+ * @brief    Node of another mesh, reached through a local proxy node number
+ * 
+ */
+typedef struct
+{
+  uint8_t mesh;
+  uint8_t node;
+  uint32_t timestamp;
+} bridge_proxy_struct;
+
+/**
+ * @brief    Packet forwarded by the bridge, for the duplicate check
+ * 
+ */
+typedef struct
+{
+  uint8_t mesh;
+  uint8_t sender;
+  uint8_t type;
+  uint32_t id;
+} bridge_packet_struct;
+
+/**
+ * @brief    Message from the backhaul, for the acknowledgment ids
+ * 
+ */
+typedef struct
+{
+  uint32_t id;        // Id in this mesh
+  uint32_t remote_id; // Id in the mesh of the sender
+} bridge_message_struct;
+
+/**
+ * @brief    Group acknowledgment being merged
+ * 
+ */
+typedef struct
+{
+  uint8_t receiver;
+  uint32_t packet_id;
+  uint32_t deadline;
+  uint8_t ttl; // Hops left to the receiver
+  uint8_t count;
+  uint8_t nodes[MAXNODES];
+} group_ack_struct;
+
+/**
+ * @brief    Route being discovered
+ * 
+ */
+typedef struct
+{
+  uint8_t destination;
+  uint8_t retries;
+  uint32_t deadline;
+} route_discovery_struct;
+
+/**
+ * @brief    Route request, for the duplicate check
+ * 
+ */
+typedef struct
+{
+  uint8_t sender;
+  uint32_t id;
+} route_request_struct;
+
+/**
+ * @brief    Message of this node waiting for its acknowledgment
+ * 
+ */
+typedef struct
+{
+  uint32_t id;
+  uint32_t sent;
+} congestion_message_struct;
+
+/**
+ * @brief    Firmware image profile: page 0 of the distributed object, the
+ *           image pages follow. Each page has the version of the image
+ *           that last changed it (version vector) and its CRC32. The
+ *           version, size and SHA-256 hash of the image are signed.
+ * 
+ */
+#define OTADIGEST 32                                    // Image hash size (SHA-256, bytes)
+#define OTASIGNATURE 64                                 // Image signature size (ECDSA P-256, r and s, bytes)
+#define OTAPROFILEHEADER (8 + OTADIGEST + OTASIGNATURE) // Profile size before the pages (bytes)
+
+typedef struct
+{
+  uint16_t version;
+  uint32_t size; // Image size (bytes)
+  uint16_t pages;
+  uint8_t digest[OTADIGEST];
+  uint8_t signature[OTASIGNATURE];
+  uint16_t page_versions[OTAMAXPAGES];
+  uint32_t page_crcs[OTAMAXPAGES];
+} ota_profile_struct;
+
+/**
+ * @brief    Message waiting to be shown, or shown in the display inbox
+ * 
+ */
+#define DISPLAYTEXT 48 // Message characters shown (3 lines)
+
+typedef struct
+{
+  uint8_t sender;
+  char text[DISPLAYTEXT + 1];
+} display_message_struct;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,32 @@
+/**
+ * @file     webpage.h
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Web page rendering functions
+ */
+
+#ifndef WEBPAGE_H
+#define WEBPAGE_H
+
+#include "typedefs.h"
+
+// Pages
+extern const webpage_section_struct webpage_index[];
+extern const webpage_section_struct webpage_nodes[];
+extern const webpage_section_struct webpage_messages[];
+extern const webpage_section_struct webpage_thread[];
+extern const webpage_section_struct webpage_status[];
+extern const webpage_section_struct webpage_metrics[];
+
+// Functions
+void webpage_begin(webpage_render_struct *render, const webpage_section_struct *page, uint32_t arg);
+size_t webpage_fill(webpage_render_struct *render, uint8_t *buffer, size_t max_len);
+
+int webpage_append(char *buffer, size_t size, int length, const char *format, ...);
+int webpage_appendJson(char *buffer, size_t size, int length, const char *string);
+size_t webpage_jsonSize(const char *string);
+bool webpage_fits(size_t size, int length, size_t added, size_t tail);
+
+#endif
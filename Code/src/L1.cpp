@@ -15,8 +15,23 @@
 #include "L1.h"
 #include "L2.h"
 #include "L3.h"
+#include "metrics.h"
+#include "log.h"
 #include <SPI.h>
 #include <LoRa.h>
+#include "scheduler.h"
+#include "lpl.h"
+#include "fec.h"
+#include "crypto.h"
+#include "neighbour.h"
+#include "bridge.h"
+#include "route.h"
+#include "congestion.h"
+#include "group.h"
+
+#if TTL > TTLMAX
+#error "TTL needs to be at most TTLMAX"
+#endif
 
 // Exported variables
 int L1_outBuffer_left = 0;
@@ -30,6 +45,10 @@ extern uint8_t spreading_factor;
 static pack_struct outBuffer[L1BUFFER];
 static int outBuffer_front = 0;
 static int outBuffer_rear = 0;
+static uint8_t rx_frame[256];
+static size_t rx_size = 0;
+static size_t rx_index = 0;
+static void *rx_payload = NULL;
 
 uint32_t transmit_duration = 0;
 uint32_t last_transmit_timestamp = 0;
@@ -38,8 +57,13 @@ uint32_t anticollision_time;
 
 // Private functions
 void L1_onReceive(int packetSize);
+void L1_sendTimer();
+uint32_t L1_sendDelay();
 return_type L1_packSend(pack_struct packet);
 void L1_emptyBuffer();
+uint8_t L1_read();
+void L1_readBytes(uint8_t *buffer, size_t length);
+bool L1_isRelayOnly(pack_struct packet);
 
 // Functions
 
@@ -50,38 +74,80 @@ void L1_emptyBuffer();
 void L1_init()
 {
   anticollision_time = 500 * NODENUMBER; // WARNING: may need to be adusted if SF > 7 is used
+  fec_init();
 
   SPI.begin(SCK, MISO, MOSI, SS);
   LoRa.setPins(SS, RST, DI0);
   LoRa.setTxPower(tx_dbm);
 
   if (LoRa.begin(LORABAND))
-    Serial.println("LoRa module started correctly");
+    LOG_INFO("LoRa module started correctly");
   else
   {
-    Serial.println("Error starting LoRa module");
+    LOG_ERROR("Error starting LoRa module");
+    log_drain();
     exit(0);
   }
   LoRa.setSpreadingFactor(spreading_factor);
+  LoRa.setPreambleLength(LORAPREAMBLE);
   LoRa.enableCrc();
   LoRa.onReceive(L1_onReceive);
-  LoRa.receive();
+  lpl_radioReceive();
+
+  scheduler_register(timer_L1_send, L1_sendTimer, 0);
 }
 
 /**
- * @brief    Adds a packet to the sending queue
+ * @brief    Adds a packet to the sending queue, the queue owns the payload
+ *           and frees it after sending or if the queue is full
  * 
  * @param    packet: Packet to be enqueued
  * @return   return_type status
  */
 return_type L1_enqueue_outPacket(pack_struct packet)
 {
+  // Packets to the nodes of other meshes go over the backhaul, the payload
+  // of the packet being received is freed by L1_receive
+  if (BRIDGEENABLED && bridge_export(packet))
+  {
+    if (packet.payload != rx_payload)
+      L1_freePayload(packet);
+    return ret_ok;
+  }
+
+  // Packets to a node without route wait for its discovery
+  if (ROUTEDISCOVERY && packet.next_node == 0)
+  {
+    return_type ret = route_hold(packet);
+    if (ret != ret_ok)
+    {
+      if (packet.payload != rx_payload)
+        L1_freePayload(packet);
+      metrics_drop(ret);
+      return ret;
+    }
+
+    if (packet.payload == rx_payload)
+      rx_payload = NULL;
+    return ret_ok;
+  }
+
   if (outBuffer_rear == L1BUFFER)
+  {
+    if (packet.payload != rx_payload)
+      L1_freePayload(packet);
+    metrics_drop(ret_buffer_full);
     return ret_buffer_full;
+  }
 
   else
   {
+    // The payload of the packet being received is now the queue's
+    if (packet.payload == rx_payload)
+      rx_payload = NULL;
+
     outBuffer[outBuffer_rear].ttl = packet.ttl;
+    outBuffer[outBuffer_rear].hops = packet.hops;
     outBuffer[outBuffer_rear].receiver = packet.receiver;
     outBuffer[outBuffer_rear].sender = packet.sender;
     outBuffer[outBuffer_rear].last_node = packet.last_node;
@@ -89,8 +155,19 @@ return_type L1_enqueue_outPacket(pack_struct packet)
     outBuffer[outBuffer_rear].id = packet.id;
     outBuffer[outBuffer_rear].type = packet.type;
     outBuffer[outBuffer_rear].payload = packet.payload;
+    outBuffer[outBuffer_rear].raw_size = packet.raw_size;
+    outBuffer[outBuffer_rear].perimeter = packet.perimeter;
+    outBuffer[outBuffer_rear].target = packet.target;
+    outBuffer[outBuffer_rear].timestamp = packet.timestamp;
     outBuffer_rear++;
     L1_outBuffer_left++;
+    metrics_queueDepth(L1_outBuffer_left);
+
+    if (!scheduler_isSet(timer_L1_send))
+    {
+      scheduler_set(timer_L1_send, L1_sendDelay());
+      scheduler_wake();
+    }
   }
   return ret_ok;
 }
@@ -111,19 +188,16 @@ return_type L1_send_outPacket()
   else if ((millis() - last_receive_timestamp) < anticollision_time)
     return ret_send_anticollision_error;
 
+  else if (lpl_sendDelay(outBuffer[outBuffer_front].next_node))
+    return ret_send_wake_wait;
+
   else
   {
     pack_struct packet = outBuffer[outBuffer_front];
 
     return_type ret = L1_packSend(packet);
 
-    if (packet.type == payload_msg)
-      free(((payload_message_struct *)packet.payload)->message_ptr);
-
-    else if (packet.type == payload_ann)
-      free(((payload_announce_struct *)packet.payload)->name_ptr);
-
-    free(packet.payload);
+    L1_freePayload(packet);
 
     for (int i = 0; i < outBuffer_rear - 1; i++)
       outBuffer[i] = outBuffer[i + 1];
@@ -134,6 +208,65 @@ return_type L1_send_outPacket()
   }
 }
 
+/**
+ * @brief    Send timer: sends the first enqueued packet and arms itself
+ *           again after the duty cycle and anticollision times
+ * 
+ */
+void L1_sendTimer()
+{
+  L1_send_outPacket();
+
+  if (L1_outBuffer_left)
+    scheduler_set(timer_L1_send, L1_sendDelay());
+}
+
+/**
+ * @brief    Returns the time left before the duty cycle and anticollision
+ *           times allow sending, and before the next channel sample if the
+ *           first packet goes to a low-power listening neighbour
+ * 
+ * @return   uint32_t time (ms)
+ */
+uint32_t L1_sendDelay()
+{
+  uint32_t now = millis();
+  uint32_t duty_time = (100 - LORADUTY) * transmit_duration;
+  uint32_t wait = 0;
+
+  if ((now - last_transmit_timestamp) < duty_time)
+    wait = duty_time - (now - last_transmit_timestamp);
+
+  if ((now - last_receive_timestamp) < anticollision_time && anticollision_time - (now - last_receive_timestamp) > wait)
+    wait = anticollision_time - (now - last_receive_timestamp);
+
+  uint32_t wake_wait = lpl_sendDelay(outBuffer[outBuffer_front].next_node);
+  if (wake_wait > wait)
+    wait = wake_wait;
+
+  return wait;
+}
+
+/**
+ * @brief    Returns the time on air of a packet with the default preamble
+ *           (Semtech SX127x formula, 125 kHz, explicit header, CR 4/5, CRC)
+ * 
+ * @param    size: Packet size (bytes)
+ * @return   uint32_t airtime (ms)
+ */
+uint32_t L1_airtime(uint8_t size)
+{
+  uint32_t symbol = (1 << spreading_factor) * 8;
+  int low_datarate = symbol > 16000 ? 1 : 0;
+  int bits = 8 * size - 4 * spreading_factor + 28 + 16;
+  int symbols = 8;
+
+  if (bits > 0)
+    symbols += (bits + 4 * (spreading_factor - 2 * low_datarate) - 1) / (4 * (spreading_factor - 2 * low_datarate)) * 5;
+
+  return ((4 * (LORAPREAMBLE + symbols) + 17) * symbol) / 4000;
+}
+
 /**
  * @brief    Creates a LoRa packet and sends it
  * 
@@ -142,46 +275,188 @@ return_type L1_send_outPacket()
  */
 return_type L1_packSend(pack_struct packet)
 {
-  int ret = LoRa.beginPacket();
-  if (ret)
+  uint8_t frame[256];
+  size_t size = 0;
+
+  frame[size++] = NETID;
+  frame[size++] = packet.hops << 4 | packet.ttl;
+  frame[size++] = packet.receiver;
+  frame[size++] = packet.sender;
+  frame[size++] = packet.last_node;
+  frame[size++] = packet.next_node;
+  memcpy(frame + size, &packet.id, 4);
+  size += 4;
+  frame[size++] = packet.type;
+  if (GEOENABLED)
   {
-    LoRa.write(NETID);
-    LoRa.write(packet.ttl);
-    LoRa.write(packet.receiver);
-    LoRa.write(packet.sender);
-    LoRa.write(packet.last_node);
-    LoRa.write(packet.next_node);
-    LoRa.write((uint8_t *)&(packet.id), 4);
-    LoRa.write(packet.type);
+    uint16_t perimeter = packet.target.valid ? packet.perimeter : GEOUNKNOWN;
+    int16_t x = packet.target.valid ? packet.target.x : 0;
+    int16_t y = packet.target.valid ? packet.target.y : 0;
+    memcpy(frame + size, &perimeter, 2);
+    memcpy(frame + size + 2, &x, 2);
+    memcpy(frame + size + 4, &y, 2);
+    size += GEOHEADER;
+  }
 
+  // Relayed frames keep the payload as received
+  if (packet.raw_size)
+  {
+    memcpy(frame + size, packet.payload, packet.raw_size);
+    size += packet.raw_size;
+  }
+  else
+  {
     switch (packet.type)
     {
     case payload_msg:
     {
       payload_message_struct *payload_message = (payload_message_struct *)packet.payload;
-      LoRa.write(payload_message->message_size);
-
-      char message_temp[payload_message->message_size + 1];
-      strcpy(message_temp, payload_message->message_ptr);
-      LoRa.print(message_temp);
+      bool group = group_isAddress(packet.receiver);
+      uint8_t message_size = payload_message->message_size;
+      if (message_size > 255 - size - 1 - group - (CRYPTOENABLED ? CRYPTOTAG : 0))
+        message_size = 255 - size - 1 - group - (CRYPTOENABLED ? CRYPTOTAG : 0);
+
+      frame[size++] = message_size;
+      memcpy(frame + size, payload_message->message_ptr, message_size);
+      size += message_size;
+
+      // Group messages end with the tag of the group name
+      if (group)
+        frame[size++] = payload_message->group_tag;
     }
     break;
     case payload_ack:
     {
       payload_acknowledgment_struct *payload_acknowledgment = (payload_acknowledgment_struct *)packet.payload;
-      LoRa.write((uint8_t *)&(payload_acknowledgment->packet_id), 4);
+      uint8_t nodes_count = payload_acknowledgment->nodes_count;
+      if (nodes_count > 255 - size - 5 - (CRYPTOENABLED ? CRYPTOTAG : 0))
+        nodes_count = 255 - size - 5 - (CRYPTOENABLED ? CRYPTOTAG : 0);
+
+      memcpy(frame + size, &payload_acknowledgment->packet_id, 4);
+      frame[size + 4] = nodes_count;
+      memcpy(frame + size + 5, payload_acknowledgment->nodes, nodes_count);
+      size += 5 + nodes_count;
     }
     break;
     case payload_ann:
     {
       payload_announce_struct *payload_announce = (payload_announce_struct *)packet.payload;
-      LoRa.write(payload_announce->name_size);
-
-      char *message_temp = (char *)malloc(payload_announce->name_size + 1);
-      strcpy(message_temp, payload_announce->name_ptr);
-      LoRa.print(message_temp);
+      memcpy(frame + size, &payload_announce->name_version, 2);
+      frame[size + 2] = payload_announce->flags;
+      memcpy(frame + size + 3, &payload_announce->groups, 2);
+      // The load of this node is the one when the announce leaves
+      frame[size + 5] = packet.sender == NODENUMBER ? congestion_getLoad() : payload_announce->load;
+      size += 6;
+      // Only the low-power listening leaves have a wake-up offset
+      if (payload_announce->flags & ANNOUNCELOWPOWER)
+      {
+        memcpy(frame + size, &payload_announce->wake_offset, 2);
+        size += 2;
+      }
+      if (payload_announce->flags & ANNOUNCEPOSITION)
+      {
+        memcpy(frame + size, &payload_announce->x, 2);
+        memcpy(frame + size + 2, &payload_announce->y, 2);
+        size += 4;
+      }
+
+      // The reception ratio report is only for the neighbours of the sender
+      frame[size] = packet.sender == NODENUMBER ? neighbour_fillReport(frame + size + 1) : 0;
+      size += 1 + 2 * frame[size];
+    }
+    break;
+    case payload_name:
+    {
+      payload_name_struct *payload_name = (payload_name_struct *)packet.payload;
+      memcpy(frame + size, &payload_name->name_version, 2);
+      frame[size + 2] = payload_name->name_size;
+      memcpy(frame + size + 3, payload_name->name_ptr, payload_name->name_size);
+      size += 3 + payload_name->name_size;
+    }
+    break;
+    case payload_rreq:
+    case payload_rrep:
+    {
+      payload_route_struct *payload_route = (payload_route_struct *)packet.payload;
+      memcpy(frame + size, &payload_route->name_version, 2);
+      size += 2;
+      if (GEOENABLED)
+      {
+        memcpy(frame + size, &payload_route->x, 2);
+        memcpy(frame + size + 2, &payload_route->y, 2);
+        size += 4;
+      }
     }
+    break;
+    case payload_ota_summary:
+    {
+      payload_ota_summary_struct *payload_summary = (payload_ota_summary_struct *)packet.payload;
+      memcpy(frame + size, &payload_summary->version, 2);
+      memcpy(frame + size + 2, &payload_summary->profile_crc, 4);
+      memcpy(frame + size + 6, &payload_summary->pages, 2);
+      memcpy(frame + size + 8, &payload_summary->complete, 2);
+      size += 10;
     }
+    break;
+    case payload_ota_request:
+    {
+      payload_ota_request_struct *payload_request = (payload_ota_request_struct *)packet.payload;
+      memcpy(frame + size, &payload_request->version, 2);
+      memcpy(frame + size + 2, &payload_request->page, 2);
+      memcpy(frame + size + 4, &payload_request->missing, 4);
+      size += 8;
+    }
+    break;
+    case payload_ota_data:
+    {
+      payload_ota_data_struct *payload_data = (payload_ota_data_struct *)packet.payload;
+      memcpy(frame + size, &payload_data->version, 2);
+      memcpy(frame + size + 2, &payload_data->page, 2);
+      frame[size + 4] = payload_data->packet;
+      frame[size + 5] = payload_data->size;
+      memcpy(frame + size + 6, payload_data->data, payload_data->size);
+      size += 6 + payload_data->size;
+    }
+    break;
+    default:
+      break;
+    }
+  }
+
+  // Coded frames replace the radio CRC with their own
+  size_t sealed_size = size + (CRYPTOENABLED ? CRYPTOTAG : 0);
+  bool coded = fec_linkEnabled(packet.next_node) && sealed_size + 2 + FECPARITY <= 255;
+
+  // The wake-up offset is counted from the end of the transmission
+  if (packet.type == payload_ann && packet.sender == NODENUMBER && (((payload_announce_struct *)packet.payload)->flags & ANNOUNCELOWPOWER))
+  {
+    payload_announce_struct *payload_announce = (payload_announce_struct *)packet.payload;
+    payload_announce->wake_offset = lpl_getWakeOffset(L1_airtime(coded ? sealed_size + 2 + FECPARITY : sealed_size));
+    memcpy(frame + L1HEADER + (GEOENABLED ? GEOHEADER : 0) + 6, &payload_announce->wake_offset, 2);
+  }
+
+  if (crypto_seal(frame, &size) != ret_ok)
+  {
+    metrics_drop(ret_send_size_error);
+    return ret_send_size_error;
+  }
+
+  if (coded)
+  {
+    frame[0] = FECNETID;
+    size = fec_encode(frame, size);
+    LoRa.disableCrc();
+  }
+
+  long preamble = lpl_preambleLength(packet.next_node);
+  if (preamble != LORAPREAMBLE)
+    LoRa.setPreambleLength(preamble);
+
+  lpl_radioStandby();
+  int ret = LoRa.beginPacket();
+  if (ret)
+  {
+    LoRa.write(frame, size);
 
     transmit_duration = millis();
     LoRa.endPacket();
@@ -189,15 +464,24 @@ return_type L1_packSend(pack_struct packet)
     transmit_duration = current_millis - transmit_duration;
     last_transmit_timestamp = current_millis;
 
-    Serial.printf("--- Sent ");
-    L1_printPacket(packet);
+    metrics_packetOut(packet.type, transmit_duration);
+    if (coded)
+      metrics_count(metric_fec_frames_out);
+    if (packet.sender != NODENUMBER)
+      metrics_relayLatency(current_millis - packet.timestamp);
 
-    LoRa.receive();
-    return ret_ok;
+    L1_printPacket(packet, 1);
   }
+  else
+    metrics_drop(ret_send_error);
+
+  if (coded)
+    LoRa.enableCrc();
+  if (preamble != LORAPREAMBLE)
+    LoRa.setPreambleLength(LORAPREAMBLE);
+  lpl_radioReceive();
 
-  LoRa.receive();
-  return ret_error;
+  return ret ? ret_ok : ret_error;
 }
 
 /**
@@ -208,6 +492,7 @@ return_type L1_packSend(pack_struct packet)
 void L1_onReceive(int packetSize)
 {
   L1_flag_received = 1;
+  scheduler_wake();
   return;
 }
 
@@ -219,53 +504,135 @@ void L1_onReceive(int packetSize)
 return_type L1_receive()
 {
   pack_struct packet;
+  packet.timestamp = millis();
+  packet.payload = NULL;
+  packet.raw_size = 0;
+  packet.perimeter = 0;
+  packet.target.valid = 0;
+
+  size_t available = LoRa.available();
+  rx_size = LoRa.readBytes(rx_frame, available < sizeof(rx_frame) ? available : sizeof(rx_frame));
+  rx_index = 0;
+  L1_emptyBuffer();
+
+  // Coded frames have no radio CRC, a corrupted byte can also be the netid
+  int corrected = 0;
+  bool coded = 0;
+  if (FECENABLED && rx_size > 0 && rx_frame[0] != NETID)
+  {
+    uint8_t netid = rx_frame[0];
+    int size = fec_decode(rx_frame, rx_size, &corrected);
+    if (size < 0 || rx_frame[0] != FECNETID)
+    {
+      return_type ret = netid == FECNETID ? ret_receive_fec_error : ret_receive_netid_error;
+      metrics_drop(ret);
+      return ret;
+    }
 
-  uint8_t netid = LoRa.read();
-  if (netid != NETID)
+    coded = 1;
+    rx_size = size;
+    metrics_count(metric_fec_frames_in);
+    metrics_add(metric_fec_corrected_bytes, corrected);
+  }
+
+  uint8_t netid = L1_read();
+  if (netid != NETID && !coded)
   {
-    L1_emptyBuffer();
+    metrics_drop(ret_receive_netid_error);
     return ret_receive_netid_error;
   }
 
-  packet.ttl = LoRa.read();
+  uint8_t ttl = L1_read();
+  packet.hops = ttl >> 4;
+  packet.ttl = ttl & 0x0F;
   if (packet.ttl == 0)
   {
-    L1_emptyBuffer();
+    metrics_drop(ret_ttl_error);
     return ret_ttl_error;
   }
 
-  packet.receiver = LoRa.read();
-  packet.sender = LoRa.read();
-  packet.last_node = LoRa.read();
-  packet.next_node = LoRa.read();
+  packet.receiver = L1_read();
+  packet.sender = L1_read();
+  packet.last_node = L1_read();
+  packet.next_node = L1_read();
+
+  return_type ret = crypto_open(rx_frame, &rx_size);
+  if (ret != ret_ok)
+  {
+    metrics_drop(ret);
+    return ret;
+  }
+
+  L1_readBytes((uint8_t *)&packet.id, 4);
+  packet.type = L1_read();
+  if (GEOENABLED)
+  {
+    L1_readBytes((uint8_t *)&packet.perimeter, 2);
+    L1_readBytes((uint8_t *)&packet.target.x, 2);
+    L1_readBytes((uint8_t *)&packet.target.y, 2);
+    packet.target.valid = packet.perimeter != GEOUNKNOWN;
+    if (!packet.target.valid)
+      packet.perimeter = 0;
+  }
+  packet.rssi = LoRa.packetRssi();
+
+  // Frames to other nodes still count for the link statistics
+  neighbour_handlePacket(packet, LoRa.packetSnr());
 
   if (packet.next_node != NODENUMBER && packet.next_node != BROADCASTADDR)
   {
-    L1_emptyBuffer();
+    metrics_drop(ret_receive_wrong_node);
     return ret_receive_wrong_node;
   }
 
-  LoRa.readBytes((uint8_t *)&packet.id, 4);
-  packet.type = LoRa.read();
-  packet.rssi = LoRa.packetRssi();
+  metrics_packetIn(packet.type);
 
   L3_handlePacket(packet);
 
+  // Cut-through: a frame only relayed here is forwarded with its payload as
+  // received, without parsing it
+  if (L1_isRelayOnly(packet))
+  {
+    packet.raw_size = rx_size - rx_index;
+    packet.payload = malloc(packet.raw_size);
+    memcpy(packet.payload, rx_frame + rx_index, packet.raw_size);
+    rx_payload = packet.payload;
+
+    L2_relayPacket(packet);
+
+    last_receive_timestamp = millis();
+    lpl_packetReceived();
+
+    L1_printPacket(packet, 0);
+
+    if (packet.payload == rx_payload)
+      L1_freePayload(packet);
+    rx_payload = NULL;
+
+    if (ROUTEDISCOVERY)
+      route_check();
+
+    return ret_ok;
+  }
+
   switch (packet.type)
   {
   case payload_msg:
   {
-    uint8_t message_size = LoRa.read();
+    uint8_t message_size = L1_read();
 
     char *message = (char *)malloc(message_size + 1);
     int i;
     for (i = 0; i < message_size; i++)
     {
-      *(message + i) = (char)LoRa.read();
+      *(message + i) = (char)L1_read();
     }
     *(message + i) = 0;
 
     packet.payload = L2_setPayloadMessage(message);
+    rx_payload = packet.payload;
+    if (group_isAddress(packet.receiver))
+      ((payload_message_struct *)packet.payload)->group_tag = L1_read();
 
     free(message);
 
@@ -274,31 +641,149 @@ return_type L1_receive()
   break;
   case payload_ack:
   {
-    uint32_t message_crc;
-    LoRa.readBytes((uint8_t *)&message_crc, 4);
+    uint32_t packet_id;
+    L1_readBytes((uint8_t *)&packet_id, 4);
 
-    packet.payload = L2_setPayloadacknowledgment(message_crc);
+    uint8_t nodes[MAXNODES];
+    uint8_t nodes_count = L1_read();
+    if (nodes_count > MAXNODES)
+      nodes_count = MAXNODES;
+    L1_readBytes(nodes, nodes_count);
+
+    packet.payload = L2_setPayloadacknowledgment(packet_id, nodes, nodes_count);
+    rx_payload = packet.payload;
 
     L2_handleacknowledgment(packet);
   }
   break;
   case payload_ann:
   {
-    uint8_t name_size = LoRa.read();
-
-    char *name = (char *)malloc(name_size + 1);
-    int i;
-    for (i = 0; i < name_size; i++)
+    uint16_t name_version;
+    uint16_t wake_offset = 0;
+    L1_readBytes((uint8_t *)&name_version, 2);
+    uint8_t flags = L1_read();
+    uint16_t groups;
+    L1_readBytes((uint8_t *)&groups, 2);
+    uint8_t load = L1_read();
+    if (flags & ANNOUNCELOWPOWER)
+      L1_readBytes((uint8_t *)&wake_offset, 2);
+    int16_t x = 0, y = 0;
+    if (flags & ANNOUNCEPOSITION)
     {
-      *(name + i) = (char)LoRa.read();
+      L1_readBytes((uint8_t *)&x, 2);
+      L1_readBytes((uint8_t *)&y, 2);
     }
-    *(name + i) = 0;
 
-    packet.payload = L2_setPayloadAnnounce(name, name_size);
+    uint8_t report[2 * NEIGHBOURREPORT];
+    uint8_t report_count = L1_read();
+    if (report_count > NEIGHBOURREPORT)
+      report_count = NEIGHBOURREPORT;
+    L1_readBytes(report, 2 * report_count);
+
+    packet.payload = L2_setPayloadAnnounce(name_version, flags, wake_offset, groups, load, x, y);
+    rx_payload = packet.payload;
+
+    if (packet.sender == packet.last_node && packet.hops == 0)
+    {
+      neighbour_handleReport(packet.sender, report, report_count);
+      neighbour_handleLoad(packet.sender, load);
+    }
 
     L2_handleAnnounce(packet);
+  }
+  break;
+  case payload_name_req:
+  {
+    packet.payload = NULL;
 
-    free(name);
+    L2_handleNameRequest(packet);
+  }
+  break;
+  case payload_name:
+  {
+    uint16_t name_version;
+    L1_readBytes((uint8_t *)&name_version, 2);
+    uint8_t name_size = L1_read();
+    if (name_size > 15)
+      name_size = 15;
+
+    char name[16];
+    L1_readBytes((uint8_t *)name, name_size);
+    name[name_size] = 0;
+
+    packet.payload = L2_setPayloadName(name_version, name);
+    rx_payload = packet.payload;
+
+    L2_handleName(packet);
+  }
+  break;
+  case payload_rreq:
+  case payload_rrep:
+  {
+    uint16_t name_version;
+    L1_readBytes((uint8_t *)&name_version, 2);
+    int16_t x = 0, y = 0;
+    if (GEOENABLED)
+    {
+      L1_readBytes((uint8_t *)&x, 2);
+      L1_readBytes((uint8_t *)&y, 2);
+    }
+
+    packet.payload = L2_setPayloadRoute(name_version, x, y);
+    rx_payload = packet.payload;
+
+    if (packet.type == payload_rreq)
+      L2_handleRouteRequest(packet);
+    else
+      L2_handleRouteReply(packet);
+  }
+  break;
+  case payload_ota_summary:
+  {
+    uint16_t version, pages, complete;
+    uint32_t profile_crc;
+    L1_readBytes((uint8_t *)&version, 2);
+    L1_readBytes((uint8_t *)&profile_crc, 4);
+    L1_readBytes((uint8_t *)&pages, 2);
+    L1_readBytes((uint8_t *)&complete, 2);
+
+    packet.payload = L2_setPayloadOtaSummary(version, profile_crc, pages, complete);
+    rx_payload = packet.payload;
+
+    L2_handleOtaSummary(packet);
+  }
+  break;
+  case payload_ota_request:
+  {
+    uint16_t version, page;
+    uint32_t missing;
+    L1_readBytes((uint8_t *)&version, 2);
+    L1_readBytes((uint8_t *)&page, 2);
+    L1_readBytes((uint8_t *)&missing, 4);
+
+    packet.payload = L2_setPayloadOtaRequest(version, page, missing);
+    rx_payload = packet.payload;
+
+    L2_handleOtaRequest(packet);
+  }
+  break;
+  case payload_ota_data:
+  {
+    uint16_t version, page;
+    L1_readBytes((uint8_t *)&version, 2);
+    L1_readBytes((uint8_t *)&page, 2);
+    uint8_t packet_number = L1_read();
+    uint8_t data_size = L1_read();
+    if (data_size > OTAPACKETSIZE)
+      data_size = OTAPACKETSIZE;
+
+    uint8_t data[OTAPACKETSIZE];
+    L1_readBytes(data, data_size);
+
+    packet.payload = L2_setPayloadOtaData(version, page, packet_number, data, data_size);
+    rx_payload = packet.payload;
+
+    L2_handleOtaData(packet);
   }
   break;
   default:
@@ -306,13 +791,64 @@ return_type L1_receive()
   }
 
   last_receive_timestamp = millis();
+  lpl_packetReceived();
+
+  L1_printPacket(packet, 0);
+
+  // Payloads not queued for relaying are freed here
+  if (packet.payload == rx_payload)
+    L1_freePayload(packet);
+  rx_payload = NULL;
 
-  Serial.printf("--- Received ");
-  L1_printPacket(packet);
+  // The packets held for the routes just found are queued
+  if (ROUTEDISCOVERY)
+    route_check();
 
   return ret_ok;
 }
 
+/**
+ * @brief    Returns if a received frame is only relayed by this node: a
+ *           unicast frame to another node. Names are cached and merged
+ *           acknowledgments are merged again by the relays, so they are
+ *           parsed
+ * 
+ * @param    packet: Received packet, header only
+ * @return   bool 1 if the payload does not need to be parsed
+ */
+bool L1_isRelayOnly(pack_struct packet)
+{
+  if (packet.next_node != NODENUMBER || packet.sender == NODENUMBER || packet.ttl <= 1)
+    return 0;
+
+  if (packet.receiver == 0 || packet.receiver == NODENUMBER || packet.receiver > MAXNODES || bridge_isProxy(packet.receiver))
+    return 0;
+
+  if (packet.type == payload_ack)
+    return rx_index + 4 >= rx_size || rx_frame[rx_index + 4] == 0;
+
+  return packet.type == payload_msg || packet.type == payload_name_req;
+}
+
+/**
+ * @brief    Frees the payload of a packet
+ * 
+ * @param    packet: Packet
+ */
+void L1_freePayload(pack_struct packet)
+{
+  if (packet.payload == NULL)
+    return;
+
+  if (packet.raw_size == 0 && packet.type == payload_msg)
+    free(((payload_message_struct *)packet.payload)->message_ptr);
+
+  else if (packet.raw_size == 0 && packet.type == payload_name)
+    free(((payload_name_struct *)packet.payload)->name_ptr);
+
+  free(packet.payload);
+}
+
 /**
  * @brief    Empties the LoRa input buffer
  * 
@@ -328,55 +864,84 @@ void L1_emptyBuffer()
 }
 
 /**
- * @brief    Prints packet's information
+ * @brief    Reads a byte of the received frame
  * 
- * @param    packet: Packet to be printed
+ * @return   uint8_t byte, 0 after the end of the frame
  */
-void L1_printPacket(pack_struct packet)
+uint8_t L1_read()
 {
+  if (rx_index >= rx_size)
+    return 0;
+  return rx_frame[rx_index++];
+}
 
-  switch (packet.type)
-  {
-  case payload_msg:
-    Serial.printf("message packet ---\n");
-    break;
+/**
+ * @brief    Reads bytes of the received frame, zeroes after the end of the
+ *           frame
+ * 
+ * @param    buffer: Output buffer
+ * @param    length: Number of bytes
+ */
+void L1_readBytes(uint8_t *buffer, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+    buffer[i] = L1_read();
+}
 
-  case payload_ack:
-    Serial.printf("acknowledgment packet: ---\n");
-    break;
+/**
+ * @brief    Logs packet's information (debug level)
+ * 
+ * @param    packet: Packet to be logged
+ * @param    sent: 1 if the packet has been sent, 0 if received
+ */
+void L1_printPacket(pack_struct packet, bool sent)
+{
+  if (sent)
+    LOG_DEBUG("Sent packet type %d id %x ttl %d", packet.type, packet.id, packet.ttl);
+  else
+    LOG_DEBUG("Received packet type %d id %x ttl %d rssi %d", packet.type, packet.id, packet.ttl, packet.rssi);
+  LOG_DEBUG("  receiver %d sender %d last node %d next node %d", packet.receiver, packet.sender, packet.last_node, packet.next_node);
 
-  case payload_ann:
-    Serial.printf("announce packet ---\n");
-    break;
+  if (packet.raw_size)
+  {
+    LOG_DEBUG("  relayed payload %d bytes", packet.raw_size);
+    return;
   }
 
-  Serial.printf("TTL: %d\n", packet.ttl);
-  Serial.printf("Receiver: %d\n", packet.receiver);
-  Serial.printf("Sender: %d\n", packet.sender);
-  Serial.printf("Last node: %d\n", packet.last_node);
-  Serial.printf("Next node: %d\n", packet.next_node);
-  Serial.printf("id: %zu\n", packet.id);
-  Serial.printf("RSSI: %d\n", packet.rssi);
-
   switch (packet.type)
   {
   case payload_msg:
-  {
-    payload_message_struct *payload_message = (payload_message_struct *)packet.payload;
-    Serial.printf("Message: %s\n", payload_message->message_ptr);
-  }
-  break;
+    LOG_DEBUG_TEXT(((payload_message_struct *)packet.payload)->message_ptr, "  message:");
+    break;
   case payload_ack:
-  {
-    payload_acknowledgment_struct *payload_acknowledgment = (payload_acknowledgment_struct *)packet.payload;
-    Serial.printf("Packet id: %x\n", payload_acknowledgment->packet_id);
-  }
-  break;
+    LOG_DEBUG("  packet id: %x nodes %d", ((payload_acknowledgment_struct *)packet.payload)->packet_id,
+              ((payload_acknowledgment_struct *)packet.payload)->nodes_count);
+    break;
   case payload_ann:
-  {
-    payload_announce_struct *payload_announce = (payload_announce_struct *)packet.payload;
-    Serial.printf("Name: %s\n", payload_announce->name_ptr);
-  }
+    LOG_DEBUG("  name version: %x flags %x wake offset %d load %d", ((payload_announce_struct *)packet.payload)->name_version,
+              ((payload_announce_struct *)packet.payload)->flags, ((payload_announce_struct *)packet.payload)->wake_offset,
+              ((payload_announce_struct *)packet.payload)->load);
+    break;
+  case payload_name:
+    LOG_DEBUG_TEXT(((payload_name_struct *)packet.payload)->name_ptr, "  name version %x:", ((payload_name_struct *)packet.payload)->name_version);
+    break;
+  case payload_rreq:
+  case payload_rrep:
+    LOG_DEBUG("  name version: %x", ((payload_route_struct *)packet.payload)->name_version);
+    break;
+  case payload_ota_summary:
+    LOG_DEBUG("  version %d pages %d complete %d crc %x", ((payload_ota_summary_struct *)packet.payload)->version,
+              ((payload_ota_summary_struct *)packet.payload)->pages, ((payload_ota_summary_struct *)packet.payload)->complete,
+              ((payload_ota_summary_struct *)packet.payload)->profile_crc);
+    break;
+  case payload_ota_request:
+    LOG_DEBUG("  version %d page %d missing %x", ((payload_ota_request_struct *)packet.payload)->version,
+              ((payload_ota_request_struct *)packet.payload)->page, ((payload_ota_request_struct *)packet.payload)->missing);
+    break;
+  case payload_ota_data:
+    LOG_DEBUG("  version %d page %d packet %d size %d", ((payload_ota_data_struct *)packet.payload)->version,
+              ((payload_ota_data_struct *)packet.payload)->page, ((payload_ota_data_struct *)packet.payload)->packet,
+              ((payload_ota_data_struct *)packet.payload)->size);
+    break;
   }
-  Serial.printf("\n\n");
 }
\ No newline at end of file
@@ -18,10 +18,16 @@
 #include "L2.h"
 #include "L3.h"
 #include "message.h"
+#include "crypto.h"
+#include "group.h"
+#include "gateway.h"
+#include "bridge.h"
+#include "route.h"
+#include "congestion.h"
+#include "ota.h"
 #include "display.h"
-
-// Private functions
-return_type L2_relayPacket(pack_struct packet);
+#include "metrics.h"
+#include "log.h"
 
 // Imported variables
 extern char node_name[16];
@@ -40,15 +46,38 @@ return_type L2_handleMessage(pack_struct packet)
 {
   if (packet.sender != NODENUMBER && (packet.next_node == NODENUMBER || packet.next_node == BROADCASTADDR))
   {
-    if (packet.receiver == NODENUMBER || packet.receiver == BROADCASTADDR)
+    // Group messages are relayed by the other nodes too
+    if (group_isAddress(packet.receiver) && group_checkDuplicate(packet.sender, packet.id))
+    {
+      metrics_drop(ret_receive_duplicate);
+      return ret_receive_duplicate;
+    }
+
+    // Members of another name with the same group address only relay
+    if (packet.receiver == NODENUMBER || packet.receiver == BROADCASTADDR ||
+        (group_isMember(packet.receiver) && group_checkTag(packet.receiver, ((payload_message_struct *)packet.payload)->group_tag)))
     {
       if (packet.receiver == BROADCASTADDR && message_checkDuplicate(packet.sender, packet.id) == ret_message_found)
+      {
+        metrics_drop(ret_receive_duplicate);
         return ret_receive_duplicate;
+      }
 
-      message_save(NODENUMBER, packet.sender, ((payload_message_struct *)packet.payload)->message_ptr, packet.id);
-      L2_sendacknowledgment(packet.sender, packet.id);
+      message_save(packet.receiver, packet.sender, ((payload_message_struct *)packet.payload)->message_ptr, packet.id);
+      gateway_messageReceived(packet.sender, packet.receiver, packet.id, ((payload_message_struct *)packet.payload)->message_ptr);
 
-      message_printLastN(5);
+      // Acknowledgments of many receivers are merged on the way back, the
+      // farthest receivers answer first. The acknowledgment goes as far as
+      // the message came.
+      if (packet.receiver == NODENUMBER)
+        L2_sendacknowledgment(packet.sender, packet.id, NULL, 0, L3_getPathTTL(packet.hops));
+      else
+      {
+        uint8_t node = NODENUMBER;
+        group_addAck(packet.sender, packet.id, &node, 1, L3_getPathTTL(packet.hops), GROUPACKMS * packet.ttl + random(GROUPACKMS / 4));
+      }
+
+      LOG_INFO_TEXT(((payload_message_struct *)packet.payload)->message_ptr, "Message %x from %d:", packet.id, packet.sender);
 
       display_printLastMessage(((payload_message_struct *)packet.payload)->message_ptr, packet.sender);
     }
@@ -71,20 +100,38 @@ return_type L2_handleacknowledgment(pack_struct packet)
 {
   if (packet.sender != NODENUMBER && (packet.next_node == NODENUMBER || packet.next_node == BROADCASTADDR))
   {
+    payload_acknowledgment_struct *payload_acknowledgment = (payload_acknowledgment_struct *)packet.payload;
+
     if (packet.receiver == NODENUMBER)
     {
-      message_saveAck(packet.sender, ((payload_acknowledgment_struct *)packet.payload)->packet_id);
-      int acks = message_getAckNum(packet.sender, ((payload_acknowledgment_struct *)packet.payload)->packet_id);
-      int node_number;
+      // A merged acknowledgment lists the nodes, a plain one is from its sender
+      uint8_t *nodes = payload_acknowledgment->nodes;
+      uint8_t nodes_count = payload_acknowledgment->nodes_count;
+      if (nodes_count == 0)
+      {
+        nodes = &packet.sender;
+        nodes_count = 1;
+      }
+
+      // The window grows once per message, not once per node
+      congestion_acknowledged(payload_acknowledgment->packet_id);
 
-      for (int i = 0; i < acks; i++)
+      for (int i = 0; i < nodes_count; i++)
       {
-        node_number = message_getAckNode(packet.sender, ((payload_acknowledgment_struct *)packet.payload)->packet_id, i);
-        Serial.printf("Message received by %s\n\n", L3_getNodeName(node_number));
+        if (message_saveAck(nodes[i], payload_acknowledgment->packet_id) == ret_ok)
+        {
+          LOG_INFO_TEXT(L3_getNodeName(nodes[i]), "Message %x received by", payload_acknowledgment->packet_id);
+          gateway_ackReceived(nodes[i], payload_acknowledgment->packet_id);
+        }
       }
     }
 
-    if (packet.receiver != NODENUMBER && packet.ttl > 1)
+    // A merged acknowledgment is merged again on the way, with the hops it
+    // has left
+    else if (payload_acknowledgment->nodes_count > 0 && packet.ttl > 1)
+      group_addAck(packet.receiver, payload_acknowledgment->packet_id, payload_acknowledgment->nodes, payload_acknowledgment->nodes_count, packet.ttl - 1, GROUPACKMS);
+
+    else if (packet.ttl > 1)
     {
       L2_relayPacket(packet);
     }
@@ -103,8 +150,10 @@ return_type L2_handleAnnounce(pack_struct packet)
   if (packet.receiver == BROADCASTADDR && packet.sender != NODENUMBER)
   {
     L3_handleAnnounce(packet);
+    bridge_export(packet);
 
-    if (packet.ttl > 1)
+    // With on-demand routes the announces only reach the neighbours
+    if (packet.ttl > 1 && !(((payload_announce_struct *)packet.payload)->flags & ANNOUNCENEIGHBOURS))
     {
       L2_relayPacket(packet);
     }
@@ -113,6 +162,153 @@ return_type L2_handleAnnounce(pack_struct packet)
   return ret_error;
 }
 
+/**
+ * @brief    Handles a received node name request packet
+ * 
+ * @param    packet: Packet to be handled
+ * @return   return_type status
+ */
+return_type L2_handleNameRequest(pack_struct packet)
+{
+  if (packet.sender != NODENUMBER && (packet.next_node == NODENUMBER || packet.next_node == BROADCASTADDR))
+  {
+    if (packet.receiver == NODENUMBER)
+      L2_sendName(packet.sender);
+
+    if (packet.receiver != NODENUMBER && packet.ttl > 1)
+    {
+      L2_relayPacket(packet);
+    }
+    return ret_ok;
+  }
+  return ret_error;
+}
+
+/**
+ * @brief    Handles a received node name packet
+ * 
+ *           Names are cached by every node they pass through, relays
+ *           included, so a single reply fills the cache of the whole path.
+ * 
+ * @param    packet: Packet to be handled
+ * @return   return_type status
+ */
+return_type L2_handleName(pack_struct packet)
+{
+  if (packet.sender != NODENUMBER && (packet.next_node == NODENUMBER || packet.next_node == BROADCASTADDR))
+  {
+    L3_handleName(packet);
+    bridge_export(packet);
+
+    if (packet.receiver != NODENUMBER && packet.ttl > 1)
+    {
+      L2_relayPacket(packet);
+    }
+    return ret_ok;
+  }
+  return ret_error;
+}
+
+/**
+ * @brief    Handles a received route request packet: the first copy is
+ *           answered by the node requested and relayed by the others
+ * 
+ * @param    packet: Packet to be handled
+ * @return   return_type status
+ */
+return_type L2_handleRouteRequest(pack_struct packet)
+{
+  if (packet.sender == NODENUMBER || packet.next_node != BROADCASTADDR)
+    return ret_error;
+
+  if (route_checkDuplicate(packet.sender, packet.id))
+  {
+    metrics_drop(ret_receive_duplicate);
+    return ret_receive_duplicate;
+  }
+
+  L3_handleRoute(packet);
+
+  if (packet.receiver == NODENUMBER)
+    L2_sendRouteReply(packet.sender);
+
+  else if (packet.ttl > 1)
+  {
+    L2_relayPacket(packet);
+  }
+  return ret_ok;
+}
+
+/**
+ * @brief    Handles a received route reply packet, relayed towards the node
+ *           that requested the route
+ * 
+ * @param    packet: Packet to be handled
+ * @return   return_type status
+ */
+return_type L2_handleRouteReply(pack_struct packet)
+{
+  if (packet.sender != NODENUMBER && packet.next_node == NODENUMBER)
+  {
+    L3_handleRoute(packet);
+
+    if (packet.receiver != NODENUMBER && packet.ttl > 1)
+    {
+      L2_relayPacket(packet);
+    }
+    return ret_ok;
+  }
+  return ret_error;
+}
+
+/**
+ * @brief    Handles a received firmware summary packet, for the neighbours
+ *           only
+ * 
+ * @param    packet: Packet to be handled
+ * @return   return_type status
+ */
+return_type L2_handleOtaSummary(pack_struct packet)
+{
+  if (packet.sender == NODENUMBER || packet.next_node != BROADCASTADDR)
+    return ret_error;
+
+  ota_handleSummary(packet);
+  return ret_ok;
+}
+
+/**
+ * @brief    Handles a received firmware page request packet, overheard by
+ *           the neighbours waiting for the same page
+ * 
+ * @param    packet: Packet to be handled
+ * @return   return_type status
+ */
+return_type L2_handleOtaRequest(pack_struct packet)
+{
+  if (packet.sender == NODENUMBER || packet.next_node != BROADCASTADDR)
+    return ret_error;
+
+  ota_handleRequest(packet);
+  return ret_ok;
+}
+
+/**
+ * @brief    Handles a received firmware data packet, kept by every
+ *           neighbour waiting for its page
+ * 
+ * @param    packet: Packet to be handled
+ * @return   return_type status
+ */
+return_type L2_handleOtaData(pack_struct packet)
+{
+  if (packet.sender == NODENUMBER || packet.next_node != BROADCASTADDR)
+    return ret_error;
+
+  ota_handleData(packet);
+  return ret_ok;
+}
+
 /**
  * @brief    Relays a packet
  * 
@@ -121,17 +317,36 @@ return_type L2_handleAnnounce(pack_struct packet)
  */
 return_type L2_relayPacket(pack_struct original_packet)
 {
-  if (original_packet.receiver == 0 || original_packet.receiver == NODENUMBER || (original_packet.receiver > MAXNODES && original_packet.receiver != BROADCASTADDR))
+  if (original_packet.receiver == 0 || original_packet.receiver == NODENUMBER ||
+      (original_packet.receiver > MAXNODES && original_packet.receiver != BROADCASTADDR && !group_isAddress(original_packet.receiver)))
     return ret_send_error;
 
   if (original_packet.ttl == 0)
     return ret_ttl_error;
 
+  // Low-power listening leaves sleep between channel samples and do not relay
+  if (LPLENABLED)
+    return ret_error;
+
   pack_struct packet = original_packet;
 
   packet.ttl--;
+  if (packet.hops < TTLMAX)
+    packet.hops++;
   packet.last_node = NODENUMBER;
-  packet.next_node = L3_getNextNode(original_packet.receiver);
+
+  // Group packets go only towards the branches with members
+  if (group_isAddress(original_packet.receiver))
+  {
+    packet.next_node = L3_getGroupNextNode(original_packet.receiver, original_packet.sender, original_packet.last_node, packet.ttl);
+    if (packet.next_node == 0)
+      return ret_ok;
+  }
+  // Route requests are flooded
+  else if (original_packet.type == payload_rreq)
+    packet.next_node = BROADCASTADDR;
+  else
+    L3_setNextNode(&packet, original_packet.last_node);
 
   return L1_enqueue_outPacket(packet);
 }
@@ -141,35 +356,65 @@ return_type L2_relayPacket(pack_struct original_packet)
  * 
  * @param    receiver: Receiver node
  * @param    message: Pointer to message to be sent
+ * @param    ttl: Hops the message can go, 0 for the known route to the
+ *           receiver or the default TTL
  * @return   return_type status
  */
-return_type L2_sendMessage(uint8_t receiver, char *message)
+return_type L2_sendMessage(uint8_t receiver, char *message, uint8_t ttl)
 {
   int message_size = strlen(message);
 
   if (message_size == 0 || message_size > 161)
     return ret_send_size_error;
 
-  if (receiver == 0 || receiver == NODENUMBER || (receiver > MAXNODES && receiver != BROADCASTADDR))
+  if (receiver == 0 || receiver == NODENUMBER || (receiver > MAXNODES && receiver != BROADCASTADDR && !group_isAddress(receiver)))
     return ret_send_error;
 
+  // Refused messages are not saved, the sender tries again later
+  return_type ret = congestion_check(receiver);
+  if (ret != ret_ok)
+  {
+    metrics_drop(ret);
+    return ret;
+  }
+
   pack_struct packet;
 
-  packet.ttl = TTL;
+  packet.ttl = ttl == 0 ? L3_getTTL(receiver) : ttl < TTLMAX ? ttl : TTLMAX;
   packet.receiver = receiver;
   packet.sender = NODENUMBER;
   packet.last_node = NODENUMBER;
-  packet.next_node = L3_getNextNode(receiver);
-  packet.id = millis();
+  packet.id = crypto_newId();
   packet.type = payload_msg;
+  packet.hops = 0;
+  packet.raw_size = 0;
+  packet.perimeter = 0;
+  packet.target.valid = 0;
+  L3_setNextNode(&packet, NODENUMBER);
+
+  // The group branches are pruned on the TTL chosen
+  if (group_isAddress(receiver))
+    packet.next_node = L3_getGroupNextNode(receiver, NODENUMBER, NODENUMBER, packet.ttl);
 
   packet.payload = L2_setPayloadMessage(message);
+  ((payload_message_struct *)packet.payload)->group_tag = group_getTag(receiver);
 
   message_save(packet.receiver, NODENUMBER, ((payload_message_struct *)packet.payload)->message_ptr, packet.id);
 
-  message_printLastN(5);
+  LOG_INFO_TEXT(message, "Message %x to %d:", packet.id, receiver);
 
-  return L1_enqueue_outPacket(packet);
+  // No group member in reach, the message is only kept here
+  if (packet.next_node == 0 && group_isAddress(receiver))
+  {
+    free(((payload_message_struct *)packet.payload)->message_ptr);
+    free(packet.payload);
+    return ret_ok;
+  }
+
+  ret = L1_enqueue_outPacket(packet);
+  if (ret == ret_ok)
+    congestion_sent(packet.receiver, packet.id);
+  return ret;
 }
 
 /**
@@ -177,24 +422,33 @@ return_type L2_sendMessage(uint8_t receiver, char *message)
  * 
  * @param    receiver: Receiver node
  * @param    packet_id: Packet id
+ * @param    nodes: Nodes that received the message (merged group
+ *           acknowledgment), NULL for this node only
+ * @param    nodes_count: Number of nodes
+ * @param    ttl: Hops the acknowledgment can go, 0 for the known route to
+ *           the receiver or the default TTL
  * @return   return_type status
  */
-return_type L2_sendacknowledgment(uint8_t receiver, uint32_t packet_id)
+return_type L2_sendacknowledgment(uint8_t receiver, uint32_t packet_id, const uint8_t *nodes, uint8_t nodes_count, uint8_t ttl)
 {
   if (receiver == 0 || receiver == NODENUMBER || (receiver > MAXNODES && receiver != BROADCASTADDR))
     return ret_send_error;
 
   pack_struct packet;
 
-  packet.ttl = TTL;
+  packet.ttl = ttl == 0 ? L3_getTTL(receiver) : ttl < TTLMAX ? ttl : TTLMAX;
   packet.receiver = receiver;
   packet.sender = NODENUMBER;
   packet.last_node = NODENUMBER;
-  packet.next_node = L3_getNextNode(receiver);
-  packet.id = millis();
+  packet.id = crypto_newId();
   packet.type = payload_ack;
+  packet.hops = 0;
+  packet.raw_size = 0;
+  packet.perimeter = 0;
+  packet.target.valid = 0;
+  L3_setNextNode(&packet, NODENUMBER);
 
-  packet.payload = L2_setPayloadacknowledgment(packet_id);
+  packet.payload = L2_setPayloadacknowledgment(packet_id, nodes, nodes_count);
 
   return L1_enqueue_outPacket(packet);
 }
@@ -205,23 +459,246 @@ return_type L2_sendacknowledgment(uint8_t receiver, uint32_t packet_id)
  * @return   return_type status
  */
 return_type L2_sendAnnounce()
+{
+  pack_struct packet;
+
+  packet.ttl = TTL;
+  packet.receiver = BROADCASTADDR;
+  packet.sender = NODENUMBER;
+  packet.last_node = NODENUMBER;
+  packet.next_node = BROADCASTADDR;
+  packet.id = crypto_newId();
+  packet.type = payload_ann;
+  packet.hops = 0;
+  packet.raw_size = 0;
+  packet.perimeter = 0;
+  packet.target.valid = 0;
+
+  uint8_t flags = (LPLENABLED ? ANNOUNCELOWPOWER : 0) | (ROUTEDISCOVERY ? ANNOUNCENEIGHBOURS : 0) | (GEOENABLED ? ANNOUNCEPOSITION : 0);
+  packet.payload = L2_setPayloadAnnounce(L3_getNameVersion(NODENUMBER), flags, 0, group_getMemberships(), 0, GEOX, GEOY);
+
+  return L1_enqueue_outPacket(packet);
+}
+
+/**
+ * @brief    Sends a node name request packet
+ * 
+ * @param    receiver: Node whose name is requested
+ * @return   return_type status
+ */
+return_type L2_sendNameRequest(uint8_t receiver)
+{
+  if (receiver == 0 || receiver == NODENUMBER || receiver > MAXNODES)
+    return ret_send_error;
+
+  pack_struct packet;
+
+  packet.ttl = L3_getTTL(receiver);
+  packet.receiver = receiver;
+  packet.sender = NODENUMBER;
+  packet.last_node = NODENUMBER;
+  packet.id = crypto_newId();
+  packet.type = payload_name_req;
+  packet.hops = 0;
+  packet.raw_size = 0;
+  packet.perimeter = 0;
+  packet.target.valid = 0;
+  L3_setNextNode(&packet, NODENUMBER);
+
+  packet.payload = NULL;
+
+  return L1_enqueue_outPacket(packet);
+}
+
+/**
+ * @brief    Sends the node name packet
+ * 
+ * @param    receiver: Receiver node, BROADCASTADDR after a name change
+ * @return   return_type status
+ */
+return_type L2_sendName(uint8_t receiver)
 {
   int name_size = strlen(node_name);
 
   if (name_size == 0 || name_size > 15)
     return ret_send_size_error;
 
+  if (receiver == 0 || receiver == NODENUMBER || (receiver > MAXNODES && receiver != BROADCASTADDR))
+    return ret_send_error;
+
+  pack_struct packet;
+
+  packet.ttl = L3_getTTL(receiver);
+  packet.receiver = receiver;
+  packet.sender = NODENUMBER;
+  packet.last_node = NODENUMBER;
+  packet.id = crypto_newId();
+  packet.type = payload_name;
+  packet.hops = 0;
+  packet.raw_size = 0;
+  packet.perimeter = 0;
+  packet.target.valid = 0;
+  L3_setNextNode(&packet, NODENUMBER);
+
+  packet.payload = L2_setPayloadName(L3_getNameVersion(NODENUMBER), node_name);
+
+  return L1_enqueue_outPacket(packet);
+}
+
+/**
+ * @brief    Sends a route request packet, flooded to find the node
+ * 
+ * @param    receiver: Node whose route is requested
+ * @return   return_type status
+ */
+return_type L2_sendRouteRequest(uint8_t receiver)
+{
+  if (receiver == 0 || receiver == NODENUMBER || receiver > MAXNODES)
+    return ret_send_error;
+
   pack_struct packet;
 
   packet.ttl = TTL;
+  packet.receiver = receiver;
+  packet.sender = NODENUMBER;
+  packet.last_node = NODENUMBER;
+  packet.next_node = BROADCASTADDR;
+  packet.id = crypto_newId();
+  packet.type = payload_rreq;
+  packet.hops = 0;
+  packet.raw_size = 0;
+  packet.perimeter = 0;
+  packet.target.valid = 0;
+
+  packet.payload = L2_setPayloadRoute(L3_getNameVersion(NODENUMBER), GEOX, GEOY);
+
+  // Copies relayed back to this node are not relayed again
+  route_checkDuplicate(packet.sender, packet.id);
+
+  return L1_enqueue_outPacket(packet);
+}
+
+/**
+ * @brief    Sends a route reply packet, on the route the request came from
+ * 
+ * @param    receiver: Node that requested the route
+ * @return   return_type status
+ */
+return_type L2_sendRouteReply(uint8_t receiver)
+{
+  if (receiver == 0 || receiver == NODENUMBER || receiver > MAXNODES)
+    return ret_send_error;
+
+  pack_struct packet;
+
+  packet.ttl = L3_getTTL(receiver);
+  packet.receiver = receiver;
+  packet.sender = NODENUMBER;
+  packet.last_node = NODENUMBER;
+  packet.id = crypto_newId();
+  packet.type = payload_rrep;
+  packet.hops = 0;
+  packet.raw_size = 0;
+  packet.perimeter = 0;
+  packet.target.valid = 0;
+  L3_setNextNode(&packet, NODENUMBER);
+
+  packet.payload = L2_setPayloadRoute(L3_getNameVersion(NODENUMBER), GEOX, GEOY);
+
+  return L1_enqueue_outPacket(packet);
+}
+
+/**
+ * @brief    Sends a firmware summary packet to the neighbours
+ * 
+ * @param    version: Image version, 0 if none
+ * @param    profile_crc: Profile CRC32
+ * @param    pages: Pages of the image, profile included
+ * @param    complete: Pages received in order
+ * @return   return_type status
+ */
+return_type L2_sendOtaSummary(uint16_t version, uint32_t profile_crc, uint16_t pages, uint16_t complete)
+{
+  pack_struct packet;
+
+  packet.ttl = 1;
   packet.receiver = BROADCASTADDR;
   packet.sender = NODENUMBER;
   packet.last_node = NODENUMBER;
   packet.next_node = BROADCASTADDR;
-  packet.id = millis();
-  packet.type = payload_ann;
+  packet.id = crypto_newId();
+  packet.type = payload_ota_summary;
+  packet.hops = 0;
+  packet.raw_size = 0;
+  packet.perimeter = 0;
+  packet.target.valid = 0;
+
+  packet.payload = L2_setPayloadOtaSummary(version, profile_crc, pages, complete);
+
+  return L1_enqueue_outPacket(packet);
+}
+
+/**
+ * @brief    Sends a firmware page request packet, broadcast to the
+ *           neighbours so the ones waiting for the same page hear it
+ * 
+ * @param    receiver: Neighbour asked for the page
+ * @param    version: Image version
+ * @param    page: Page, 0 for the profile
+ * @param    missing: Packets requested, bit n for packet n
+ * @return   return_type status
+ */
+return_type L2_sendOtaRequest(uint8_t receiver, uint16_t version, uint16_t page, uint32_t missing)
+{
+  if (receiver == 0 || receiver == NODENUMBER || receiver > MAXNODES)
+    return ret_send_error;
+
+  pack_struct packet;
+
+  packet.ttl = 1;
+  packet.receiver = receiver;
+  packet.sender = NODENUMBER;
+  packet.last_node = NODENUMBER;
+  packet.next_node = BROADCASTADDR;
+  packet.id = crypto_newId();
+  packet.type = payload_ota_request;
+  packet.hops = 0;
+  packet.raw_size = 0;
+  packet.perimeter = 0;
+  packet.target.valid = 0;
+
+  packet.payload = L2_setPayloadOtaRequest(version, page, missing);
+
+  return L1_enqueue_outPacket(packet);
+}
+
+/**
+ * @brief    Sends a firmware data packet to the neighbours
+ * 
+ * @param    version: Image version
+ * @param    page: Page, 0 for the profile
+ * @param    packet_number: Packet of the page
+ * @param    data: Packet data
+ * @param    size: Data size, at most OTAPACKETSIZE (bytes)
+ * @return   return_type status
+ */
+return_type L2_sendOtaData(uint16_t version, uint16_t page, uint8_t packet_number, const uint8_t *data, uint8_t size)
+{
+  pack_struct packet;
+
+  packet.ttl = 1;
+  packet.receiver = BROADCASTADDR;
+  packet.sender = NODENUMBER;
+  packet.last_node = NODENUMBER;
+  packet.next_node = BROADCASTADDR;
+  packet.id = crypto_newId();
+  packet.type = payload_ota_data;
+  packet.hops = 0;
+  packet.raw_size = 0;
+  packet.perimeter = 0;
+  packet.target.valid = 0;
 
-  packet.payload = L2_setPayloadAnnounce(node_name, name_size);
+  packet.payload = L2_setPayloadOtaData(version, page, packet_number, data, size);
 
   return L1_enqueue_outPacket(packet);
 }
@@ -241,6 +718,7 @@ void *L2_setPayloadMessage(char *message)
   payload_message->message_size = message_size;
   payload_message->message_ptr = (char *)malloc(message_size + 1);
   strcpy(payload_message->message_ptr, message);
+  payload_message->group_tag = 0;
 
   return payload_message;
 }
@@ -249,14 +727,19 @@ void *L2_setPayloadMessage(char *message)
  * @brief    Sets packet payload as acknowledgment
  * 
  * @param    packet_id: Pointer to message to be sent
+ * @param    nodes: Nodes that received the message, NULL for the sender only
+ * @param    nodes_count: Number of nodes
  * @return   void* payload pointer
  */
-void *L2_setPayloadacknowledgment(uint32_t packet_id)
+void *L2_setPayloadacknowledgment(uint32_t packet_id, const uint8_t *nodes, uint8_t nodes_count)
 {
   payload_acknowledgment_struct *payload_acknowledgment;
   payload_acknowledgment = (payload_acknowledgment_struct *)malloc(sizeof(payload_acknowledgment_struct));
 
   payload_acknowledgment->packet_id = packet_id;
+  payload_acknowledgment->nodes_count = nodes_count;
+  if (nodes_count)
+    memcpy(payload_acknowledgment->nodes, nodes, nodes_count);
 
   return payload_acknowledgment;
 }
@@ -264,18 +747,138 @@ void *L2_setPayloadacknowledgment(uint32_t packet_id)
 /**
  * @brief    Sets packet payload as network announce
  * 
- * @param    name: Pointer to node name
- * @param    name_size: Name length
+ * @param    name_version: Node name version
+ * @param    flags: Announce flags
+ * @param    wake_offset: Time to the next channel sample of a low-power
+ *           listening leaf (ms)
+ * @param    groups: Joined groups
+ * @param    load: Send queue occupancy of the sender (%)
+ * @param    x: Position east of the network origin, with ANNOUNCEPOSITION
+ * @param    y: Position north of the network origin, with ANNOUNCEPOSITION
  * @return   void* payload pointer
  */
-void *L2_setPayloadAnnounce(char *name, uint8_t name_size)
+void *L2_setPayloadAnnounce(uint16_t name_version, uint8_t flags, uint16_t wake_offset, uint16_t groups, uint8_t load, int16_t x, int16_t y)
 {
   payload_announce_struct *payload_announce;
   payload_announce = (payload_announce_struct *)malloc(sizeof(payload_announce_struct));
 
-  payload_announce->name_size = name_size;
-  payload_announce->name_ptr = (char *)malloc(name_size + 1);
-  strcpy(payload_announce->name_ptr, name);
+  payload_announce->name_version = name_version;
+  payload_announce->flags = flags;
+  payload_announce->wake_offset = wake_offset;
+  payload_announce->groups = groups;
+  payload_announce->load = load;
+  payload_announce->x = x;
+  payload_announce->y = y;
 
   return payload_announce;
+}
+
+/**
+ * @brief    Sets packet payload as node name
+ * 
+ * @param    name_version: Node name version
+ * @param    name: Pointer to node name
+ * @return   void* payload pointer
+ */
+void *L2_setPayloadName(uint16_t name_version, char *name)
+{
+  payload_name_struct *payload_name;
+  payload_name = (payload_name_struct *)malloc(sizeof(payload_name_struct));
+  int name_size = strlen(name);
+
+  payload_name->name_version = name_version;
+  payload_name->name_size = name_size;
+  payload_name->name_ptr = (char *)malloc(name_size + 1);
+  strcpy(payload_name->name_ptr, name);
+
+  return payload_name;
+}
+
+/**
+ * @brief    Sets packet payload as route request or route reply
+ * 
+ * @param    name_version: Node name version
+ * @param    x: Position east of the network origin, with GEOENABLED
+ * @param    y: Position north of the network origin, with GEOENABLED
+ * @return   void* payload pointer
+ */
+void *L2_setPayloadRoute(uint16_t name_version, int16_t x, int16_t y)
+{
+  payload_route_struct *payload_route;
+  payload_route = (payload_route_struct *)malloc(sizeof(payload_route_struct));
+
+  payload_route->name_version = name_version;
+  payload_route->x = x;
+  payload_route->y = y;
+
+  return payload_route;
+}
+
+/**
+ * @brief    Sets packet payload as firmware summary
+ * 
+ * @param    version: Image version, 0 if none
+ * @param    profile_crc: Profile CRC32
+ * @param    pages: Pages of the image, profile included
+ * @param    complete: Pages received in order
+ * @return   void* payload pointer
+ */
+void *L2_setPayloadOtaSummary(uint16_t version, uint32_t profile_crc, uint16_t pages, uint16_t complete)
+{
+  payload_ota_summary_struct *payload_summary;
+  payload_summary = (payload_ota_summary_struct *)malloc(sizeof(payload_ota_summary_struct));
+
+  payload_summary->version = version;
+  payload_summary->profile_crc = profile_crc;
+  payload_summary->pages = pages;
+  payload_summary->complete = complete;
+
+  return payload_summary;
+}
+
+/**
+ * @brief    Sets packet payload as firmware page request
+ * 
+ * @param    version: Image version
+ * @param    page: Page, 0 for the profile
+ * @param    missing: Packets requested, bit n for packet n
+ * @return   void* payload pointer
+ */
+void *L2_setPayloadOtaRequest(uint16_t version, uint16_t page, uint32_t missing)
+{
+  payload_ota_request_struct *payload_request;
+  payload_request = (payload_ota_request_struct *)malloc(sizeof(payload_ota_request_struct));
+
+  payload_request->version = version;
+  payload_request->page = page;
+  payload_request->missing = missing;
+
+  return payload_request;
+}
+
+/**
+ * @brief    Sets packet payload as firmware data
+ * 
+ * @param    version: Image version
+ * @param    page: Page, 0 for the profile
+ * @param    packet_number: Packet of the page
+ * @param    data: Packet data
+ * @param    size: Data size, cut at OTAPACKETSIZE (bytes)
+ * @return   void* payload pointer
+ */
+void *L2_setPayloadOtaData(uint16_t version, uint16_t page, uint8_t packet_number, const uint8_t *data, uint8_t size)
+{
+  payload_ota_data_struct *payload_data;
+  payload_data = (payload_ota_data_struct *)malloc(sizeof(payload_ota_data_struct));
+
+  if (size > OTAPACKETSIZE)
+    size = OTAPACKETSIZE;
+
+  payload_data->version = version;
+  payload_data->page = page;
+  payload_data->packet = packet_number;
+  payload_data->size = size;
+  memcpy(payload_data->data, data, size);
+
+  return payload_data;
 }
\ No newline at end of file
@@ -15,12 +15,35 @@
 #include "L1.h"
 #include "L2.h"
 #include "L3.h"
+#include "webpage.h"
+#include "log.h"
+#include "scheduler.h"
+#include "lpl.h"
+#include "neighbour.h"
+#include "group.h"
+#include "geo.h"
+#include "rom/crc.h"
+
+#define NAMEINDEXSIZE (2 * MAXNODES)
 
 // Exported variables
 char node_name[16];
 
 // Private variables
 routing_table_struct routing_table[MAXNODES];
+uint32_t routing_version = 0;
+uint8_t name_index[NAMEINDEXSIZE];
+uint32_t name_index_version = 0xFFFFFFFF;
+
+// Private functions
+uint16_t L3_computeNameVersion(const char *name);
+uint32_t L3_hashName(const char *name);
+void L3_indexNames();
+void L3_announceTimer();
+void L3_inactiveTimer();
+int L3_getParent();
+int L3_compareLinks(uint8_t a, uint8_t b);
+return_type L3_updateRoute(pack_struct packet);
 
 /**
  * @brief    Initializes the L3 layer
@@ -29,6 +52,7 @@ routing_table_struct routing_table[MAXNODES];
 void L3_init()
 {
   memset(routing_table, 0, MAXNODES * sizeof(routing_table_struct));
+  neighbour_init();
 
   routing_table[NODENUMBER - 1].active = 1;
   if (NODENAMEOVERRIDEEN)
@@ -36,12 +60,34 @@ void L3_init()
   else
     sprintf(node_name, "Node %d", NODENUMBER);
   strcpy(routing_table[NODENUMBER - 1].name, node_name);
+  routing_table[NODENUMBER - 1].name_version = L3_computeNameVersion(node_name);
 
   L2_sendAnnounce();
 
+  scheduler_register(timer_announce, L3_announceTimer, ANNOUNCEMINS * 60000);
+  scheduler_register(timer_inactive_check, L3_inactiveTimer, INACTIVESECONDSREMOVECHECK * 1000);
+
   return;
 }
 
+/**
+ * @brief    Announce timer: sends the availability announce
+ * 
+ */
+void L3_announceTimer()
+{
+  L2_sendAnnounce();
+}
+
+/**
+ * @brief    Inactivity timer: removes the inactive nodes
+ * 
+ */
+void L3_inactiveTimer()
+{
+  L3_removeInactiveNodes();
+}
+
 /**
  * @brief    Sets node name and timestamp of this node
  * 
@@ -51,6 +97,8 @@ void L3_updateNode()
   routing_table[NODENUMBER - 1].timestamp = millis();
   routing_table[NODENUMBER - 1].active = 1;
   strcpy(routing_table[NODENUMBER - 1].name, node_name);
+  routing_table[NODENUMBER - 1].name_version = L3_computeNameVersion(node_name);
+  routing_version++;
 
   return;
 }
@@ -64,46 +112,53 @@ int L3_removeInactiveNodes()
 {
   int ret = 0;
 
+  // Low-power listening leaves hear their neighbours only in the sync windows
+  int inactive_mins = LPLENABLED ? INACTIVEMINS + LPLSYNCMINS : INACTIVEMINS;
+
   for (int i = 0; i < MAXNODES; i++)
   {
     if (i != (NODENUMBER - 1) && routing_table[i].active)
     {
-      if ((elapsedSeconds(routing_table[i].timestamp) / 60) >= INACTIVEMINS)
+      // Nodes out of reach of the announces stay as long as their route
+      int expiry_mins = ROUTEDISCOVERY && routing_table[i].hops > 0 ? ROUTEEXPIRYMINS : inactive_mins;
+      if ((elapsedSeconds(routing_table[i].timestamp) / 60) >= expiry_mins)
       {
         routing_table[i].active = 0;
-        Serial.printf("Removed node %s from routing list\n\n", L3_getNodeName(i));
+        LOG_INFO_TEXT(L3_getNodeName(i + 1), "Removed node %d from routing list:", i + 1);
 
         ret++;
       }
     }
   }
 
+  if (neighbour_removeInactive() > 0)
+    routing_version++;
+
   if (ret > 0)
+  {
+    routing_version++;
     L3_printNodes();
+  }
 
   return ret;
 }
 
 /**
- * @brief    Prints current routing table
+ * @brief    Logs current routing table (debug level)
  * 
  */
 void L3_printNodes()
 {
-  Serial.printf("--- Routing table ---\n\n");
+  LOG_DEBUG("Routing table:");
   for (int i = 0; i < MAXNODES; i++)
   {
     if (routing_table[i].active)
     {
-      Serial.printf("Name: %s\n", routing_table[i].name);
-      Serial.printf("Destination: %d\n", i + 1);
-      Serial.printf("Next hop: %d\n", routing_table[i].next_node);
-      Serial.printf("Hops: %d\n", routing_table[i].hops);
-      Serial.printf("ID: %d\n", routing_table[i].last_id);
-      Serial.printf("RSSI: %d\n", routing_table[i].rssi);
-      Serial.printf("Updated: %d seconds ago\n\n", elapsedSeconds(routing_table[i].timestamp));
+      LOG_DEBUG_TEXT(routing_table[i].name, "  destination %d next hop %d hops %d quality %d", i + 1, routing_table[i].next_node, routing_table[i].hops, neighbour_getQuality(routing_table[i].next_node));
+      LOG_DEBUG("    id %x updated %d seconds ago", routing_table[i].last_id, elapsedSeconds(routing_table[i].timestamp));
     }
   }
+  neighbour_print();
   return;
 }
 
@@ -130,7 +185,8 @@ int L3_getActive(uint8_t destination)
 }
 
 /**
- * @brief    Returns next node needed to reach destination node
+ * @brief    Returns next node needed to reach destination node, low-power
+ *           listening leaves send unknown destinations to their parent
  * 
  * @param    destination: Destination node
  * @return   int node number
@@ -139,12 +195,173 @@ int L3_getNextNode(uint8_t destination)
 {
   if (destination == BROADCASTADDR)
     return BROADCASTADDR;
+  else if (group_isAddress(destination))
+    return L3_getGroupNextNode(destination, NODENUMBER, NODENUMBER, TTL);
   else if (routing_table[destination - 1].active)
     return routing_table[destination - 1].next_node;
+  else if (LPLENABLED)
+    return L3_getParent();
   else
     return 0;
 }
 
+/**
+ * @brief    Sets the next node of a unicast packet to be sent or relayed:
+ *           the geographic one when the receiver position is known,
+ *           otherwise the one of the routing table
+ * 
+ * @param    packet: Packet, its geographic forwarding fields are updated
+ * @param    from: Node the packet came from, NODENUMBER if sent by this node
+ */
+void L3_setNextNode(pack_struct *packet, uint8_t from)
+{
+  uint8_t next_node = GEOENABLED ? geo_getNextNode(packet, from) : 0;
+  packet->next_node = next_node ? next_node : L3_getNextNode(packet->receiver);
+}
+
+/**
+ * @brief    Returns the TTL of a packet to be sent to a destination: the
+ *           hops of the known route plus TTLMARGIN, the default TTL for
+ *           broadcasts, groups and nodes without route. Geographic
+ *           forwarding can take longer paths than the routing table and
+ *           keeps the default TTL.
+ * 
+ * @param    destination: Destination node
+ * @return   uint8_t TTL
+ */
+uint8_t L3_getTTL(uint8_t destination)
+{
+  if (destination == 0 || destination > MAXNODES || GEOENABLED || !routing_table[destination - 1].active)
+    return TTL;
+
+  return L3_getPathTTL(routing_table[destination - 1].hops);
+}
+
+/**
+ * @brief    Returns the TTL of a path with a number of relays, plus
+ *           TTLMARGIN
+ * 
+ * @param    hops: Relays between the nodes
+ * @return   uint8_t TTL
+ */
+uint8_t L3_getPathTTL(int hops)
+{
+  int ttl = hops + 1 + TTLMARGIN;
+  return ttl < TTLMAX ? ttl : TTLMAX;
+}
+
+/**
+ * @brief    Returns the next node of a group packet: the only next node
+ *           towards the members, or broadcast if they are behind several
+ *           next nodes. Members reached through the node the packet came
+ *           from, or farther than the TTL, are skipped
+ * 
+ * @param    group: Group address
+ * @param    sender: Packet sender
+ * @param    last_node: Node the packet came from
+ * @param    ttl: TTL of the packet to be sent
+ * @return   int node number, 0 if no member needs the packet
+ */
+int L3_getGroupNextNode(uint8_t group, uint8_t sender, uint8_t last_node, uint8_t ttl)
+{
+  uint16_t mask = group_getMask(group);
+  int next_node = 0;
+
+  for (int i = 0; i < MAXNODES; i++)
+  {
+    if (i == NODENUMBER - 1 || i == sender - 1 || !routing_table[i].active || !(routing_table[i].groups & mask))
+      continue;
+
+    if (routing_table[i].next_node == last_node || routing_table[i].hops >= ttl)
+      continue;
+
+    if (next_node == 0)
+      next_node = routing_table[i].next_node;
+    else if (next_node != routing_table[i].next_node)
+      return BROADCASTADDR;
+  }
+  return next_node;
+}
+
+/**
+ * @brief    Returns the always-on neighbour with the best link quality,
+ *           then averaged RSSI
+ * 
+ * @return   int node number, 0 if there is none
+ */
+int L3_getParent()
+{
+  int parent = 0;
+
+  for (int i = 0; i < MAXNODES; i++)
+  {
+    if (i == NODENUMBER - 1 || !routing_table[i].active || routing_table[i].next_node != i + 1 || routing_table[i].low_power)
+      continue;
+
+    if (parent == 0 || L3_compareLinks(i + 1, parent) > 0)
+      parent = i + 1;
+  }
+  return parent;
+}
+
+/**
+ * @brief    Compares the links to two neighbours on their congestion, then
+ *           on their quality, then on their averaged RSSI
+ * 
+ * @param    a: First neighbour
+ * @param    b: Second neighbour
+ * @return   int positive if a is better, negative if b is better, 0 if equal
+ */
+int L3_compareLinks(uint8_t a, uint8_t b)
+{
+  // A congested neighbour loses against one that is not
+  bool congested = neighbour_isCongested(a);
+  if (congested != neighbour_isCongested(b))
+    return congested ? -1 : 1;
+
+  int quality = neighbour_getQuality(a) - neighbour_getQuality(b);
+
+  // Reception ratios closer than the averaging step are noise
+  if (quality > 1000 / NEIGHBOURWEIGHT || quality < -1000 / NEIGHBOURWEIGHT)
+    return quality;
+  return neighbour_getRssi(a) - neighbour_getRssi(b);
+}
+
+/**
+ * @brief    Returns if a node is a low-power listening leaf
+ * 
+ * @param    destination: Destination node
+ * @return   int state
+ */
+int L3_getLowPower(uint8_t destination)
+{
+  return routing_table[destination - 1].low_power;
+}
+
+/**
+ * @brief    Returns the time of a channel sample of a low-power neighbour,
+ *           the next ones follow every LPLINTERVALMS
+ * 
+ * @param    destination: Destination node
+ * @return   uint32_t timestamp (ms)
+ */
+uint32_t L3_getWakeReference(uint8_t destination)
+{
+  return routing_table[destination - 1].wake_reference;
+}
+
+/**
+ * @brief    Returns when the wake-up schedule of a low-power neighbour was
+ *           received
+ * 
+ * @param    destination: Destination node
+ * @return   uint32_t timestamp (ms), 0 if unknown
+ */
+uint32_t L3_getWakeSync(uint8_t destination)
+{
+  return routing_table[destination - 1].wake_sync;
+}
+
 /**
  * @brief    Returns number of hops needed to reach destination node
  * 
@@ -157,14 +374,15 @@ int L3_getHops(uint8_t destination)
 }
 
 /**
- * @brief    Returns RSSI of destination node
+ * @brief    Returns the averaged RSSI of the next node towards destination
+ *           node
  * 
  * @param    destination: Destination node
  * @return   int RSSI
  */
 int L3_getRssi(uint8_t destination)
 {
-  return routing_table[destination - 1].rssi;
+  return neighbour_getRssi(routing_table[destination - 1].next_node);
 }
 
 /**
@@ -178,6 +396,8 @@ char *L3_getNodeName(uint8_t destination)
   static char broadcast_string[10] = "Broadcast";
   if (destination == BROADCASTADDR)
     return broadcast_string;
+  else if (group_isAddress(destination))
+    return group_getName(destination);
   else
     return routing_table[destination - 1].name;
 }
@@ -190,20 +410,36 @@ char *L3_getNodeName(uint8_t destination)
  */
 int L3_getNodeNumber(char *name)
 {
-  for (int i = 0; i < MAXNODES; i++)
+  if (name_index_version != routing_version)
+    L3_indexNames();
+
+  uint32_t slot = L3_hashName(name) % NAMEINDEXSIZE;
+  for (int i = 0; i < NAMEINDEXSIZE && name_index[slot]; i++)
   {
-    if (routing_table[i].active)
-    {
-      if (strcmp(name, routing_table[i].name) == 0 && i != NODENUMBER - 1)
-        return i + 1;
-    }
+    if (strcmp(name, routing_table[name_index[slot] - 1].name) == 0)
+      return name_index[slot];
+    slot = (slot + 1) % NAMEINDEXSIZE;
   }
+
   if (strcmp(name, "Broadcast") == 0 || strcmp(name, "broadcast") == 0)
     return BROADCASTADDR;
+  else if (name[0] == '#')
+    return group_getAddress(name);
   else
     return 0;
 }
 
+/**
+ * @brief    Returns the name version of a node, 0 if the name is unknown
+ * 
+ * @param    destination: Destination node
+ * @return   uint16_t name version
+ */
+uint16_t L3_getNameVersion(uint8_t destination)
+{
+  return routing_table[destination - 1].name_version;
+}
+
 /**
  * @brief    Returns the last id associated to a node
  * 
@@ -215,6 +451,31 @@ int L3_getLastID(uint8_t destination)
   return routing_table[destination - 1].last_id;
 }
 
+/**
+ * @brief    Returns the size of the state the forwarding reads for each
+ *           known node: the position of the nodes reached geographically,
+ *           the next node, hops and last id of the routes otherwise
+ * 
+ * @return   int size (bytes)
+ */
+int L3_getRouteStateSize()
+{
+  int size = 0;
+
+  for (int i = 1; i <= MAXNODES; i++)
+  {
+    if (i == NODENUMBER || !routing_table[i - 1].active)
+      continue;
+
+    int16_t x, y;
+    if (GEOENABLED && geo_getPosition(i, &x, &y))
+      size += sizeof(x) + sizeof(y);
+    else
+      size += sizeof(routing_table[i - 1].next_node) + sizeof(routing_table[i - 1].hops) + sizeof(routing_table[i - 1].last_id);
+  }
+  return size;
+}
+
 /**
  * @brief    Handles routing table after a generic packet is received
  * 
@@ -223,21 +484,22 @@ int L3_getLastID(uint8_t destination)
  */
 return_type L3_handlePacket(pack_struct packet)
 {
-  int packet_rssi = packet.rssi;
-  int packet_hops = TTL - packet.ttl;
+  int packet_hops = packet.hops;
 
   routing_table[packet.last_node - 1].timestamp = millis();
-  routing_table[packet.last_node - 1].rssi = packet_rssi;
 
   if (packet.sender != NODENUMBER)
   {
-    if (routing_table[packet.last_node - 1].active == 0)
+    // A neighbour that does not hear this node is reached through a relay
+    if (routing_table[packet.last_node - 1].active == 0 && neighbour_isUsable(packet.last_node))
     {
       routing_table[packet.last_node - 1].active = 1;
       routing_table[packet.last_node - 1].next_node = packet.last_node;
       routing_table[packet.last_node - 1].hops = 0;
       routing_table[packet.last_node - 1].last_id = 0;
-      strcpy(routing_table[packet.last_node - 1].name, "Unknown");
+      if (routing_table[packet.last_node - 1].name_version == 0)
+        strcpy(routing_table[packet.last_node - 1].name, "Unknown");
+      routing_version++;
     }
 
     if (packet_hops > 0)
@@ -249,7 +511,9 @@ return_type L3_handlePacket(pack_struct packet)
         routing_table[packet.sender - 1].next_node = packet.last_node;
         routing_table[packet.sender - 1].hops = packet_hops;
         routing_table[packet.sender - 1].last_id = 0;
-        strcpy(routing_table[packet.sender - 1].name, "Unknown");
+        if (routing_table[packet.sender - 1].name_version == 0)
+          strcpy(routing_table[packet.sender - 1].name, "Unknown");
+        routing_version++;
       }
     }
     return ret_ok;
@@ -265,58 +529,268 @@ return_type L3_handlePacket(pack_struct packet)
  */
 return_type L3_handleAnnounce(pack_struct packet)
 {
-  int packet_rssi = packet.rssi;
-  int packet_hops = TTL - packet.ttl;
+  int packet_hops = packet.hops;
+  payload_announce_struct *payload_announce = (payload_announce_struct *)packet.payload;
+
+  routing_table[packet.sender - 1].low_power = payload_announce->flags & ANNOUNCELOWPOWER;
+  if (payload_announce->flags & ANNOUNCEPOSITION)
+    geo_setPosition(packet.sender, payload_announce->x, payload_announce->y);
+  if (routing_table[packet.sender - 1].groups != payload_announce->groups)
+  {
+    routing_table[packet.sender - 1].groups = payload_announce->groups;
+    routing_version++;
+  }
+  if (packet_hops == 0)
+  {
+    // Wake-up schedule, the offset is counted from the end of the transmission
+    if (payload_announce->flags & ANNOUNCELOWPOWER)
+    {
+      routing_table[packet.sender - 1].wake_reference = packet.timestamp + payload_announce->wake_offset;
+      routing_table[packet.sender - 1].wake_sync = packet.timestamp;
+    }
+    else
+      lpl_synced();
+  }
+
+  // Copies of the same announce only change the route
+  bool copy = packet.id == routing_table[packet.sender - 1].last_id;
+  return_type ret = L3_updateRoute(packet);
+
+  // Names are not sent with announces, ask for it only when it changed
+  if (!copy && payload_announce->name_version != routing_table[packet.sender - 1].name_version)
+    L2_sendNameRequest(packet.sender);
+
+  return ret;
+}
+
+/**
+ * @brief    Handles routing table after a route request or reply is
+ *           received: the route to its sender is the way it came, the
+ *           sender has already been added by L3_handlePacket
+ * 
+ * @param    packet: Packet to be handled
+ * @return   return_type status
+ */
+return_type L3_handleRoute(pack_struct packet)
+{
+  payload_route_struct *payload_route = (payload_route_struct *)packet.payload;
+
+  if (packet.sender == 0 || packet.sender > MAXNODES)
+    return ret_error;
+
+  bool copy = packet.id == routing_table[packet.sender - 1].last_id;
+
+  // Route requests and replies also tell where their sender is
+  if (GEOENABLED)
+    geo_setPosition(packet.sender, payload_route->x, payload_route->y);
+
+  return_type ret = L3_updateRoute(packet);
+
+  if (!copy && packet.receiver == NODENUMBER && payload_route->name_version != routing_table[packet.sender - 1].name_version)
+    L2_sendNameRequest(packet.sender);
+
+  return ret;
+}
+
+/**
+ * @brief    Updates the route to the sender of a flooded packet, the
+ *           copies of the same packet are compared on their hops and links
+ * 
+ * @param    packet: Packet received
+ * @return   return_type status
+ */
+return_type L3_updateRoute(pack_struct packet)
+{
+  int packet_hops = packet.hops;
 
   int current_hops = routing_table[packet.sender - 1].hops;
-  int current_rssi = routing_table[packet.sender - 1].rssi;
+  int current_next_node = routing_table[packet.sender - 1].next_node;
+  bool usable = neighbour_isUsable(packet.last_node);
+  bool current_usable = routing_table[packet.sender - 1].active && neighbour_isUsable(current_next_node);
 
-  strncpy(routing_table[packet.sender - 1].name, ((payload_announce_struct *)packet.payload)->name_ptr, ((payload_announce_struct *)packet.payload)->name_size);
-  routing_table[packet.sender - 1].name[((payload_announce_struct *)packet.payload)->name_size] = 0;
+  return_type ret;
 
+  // Links are compared on their averaged quality, unusable links only when
+  // there is nothing better
   if (packet.id == routing_table[packet.sender - 1].last_id)
   {
-    if (packet_hops < current_hops || (packet_hops == current_hops && packet_rssi > current_rssi))
+    if (packet.last_node != current_next_node &&
+        ((usable && !current_usable) ||
+         (usable == current_usable && (packet_hops < current_hops || (packet_hops == current_hops && L3_compareLinks(packet.last_node, current_next_node) > 0)))))
     {
-      routing_table[packet.sender - 1].rssi = packet_rssi;
       routing_table[packet.sender - 1].next_node = packet.last_node;
       routing_table[packet.sender - 1].hops = packet_hops;
+      routing_version++;
       return ret_routing_better;
     }
     else
       return ret_routing_worse;
   }
+  else if (!usable && current_usable && packet.last_node != current_next_node)
+  {
+    // Keep the current route, a better copy can still arrive
+    routing_table[packet.sender - 1].last_id = packet.id;
+    ret = ret_routing_worse;
+  }
   else
   {
-    routing_table[packet.sender - 1].rssi = packet_rssi;
     routing_table[packet.sender - 1].last_id = packet.id;
     routing_table[packet.sender - 1].next_node = packet.last_node;
     routing_table[packet.sender - 1].hops = packet_hops;
-    return ret_routing_updated;
+    if (packet_hops != current_hops || packet.last_node != current_next_node)
+      routing_version++;
+    ret = ret_routing_updated;
   }
+
+  return ret;
 }
 
 /**
- * @brief    Creates a string containg active nodes (webserver)
+ * @brief    Updates the name cache after a node name packet is received
  * 
- * @return   String active nodes
+ * @param    packet: Packet to be handled
+ * @return   return_type status
  */
-String L3_getStringNodeList()
+return_type L3_handleName(pack_struct packet)
 {
-  String list = "";
+  payload_name_struct *payload_name = (payload_name_struct *)packet.payload;
+
+  if (packet.sender == 0 || packet.sender > MAXNODES || payload_name->name_size > 15)
+    return ret_error;
+
+  if (routing_table[packet.sender - 1].name_version == payload_name->name_version &&
+      strcmp(routing_table[packet.sender - 1].name, payload_name->name_ptr) == 0)
+    return ret_ok;
+
+  strcpy(routing_table[packet.sender - 1].name, payload_name->name_ptr);
+  routing_table[packet.sender - 1].name_version = payload_name->name_version;
+  routing_version++;
+
+  return ret_routing_updated;
+}
+
+/**
+ * @brief    Renders an active node as a list item (webserver)
+ * 
+ * @param    index: Routing table index
+ * @param    arg: Unused
+ * @param    buffer: Output buffer
+ * @param    size: Output buffer size
+ * @return   int item length, 0 if skipped, -1 after the last node
+ */
+int L3_fillNodeItem(int index, uint32_t arg, char *buffer, size_t size)
+{
+  if (index >= MAXNODES)
+    return -1;
+
+  if (!routing_table[index].active || index == NODENUMBER - 1)
+    return 0;
+
+  int length = webpage_append(buffer, size, 0, "<li><b>%s</b>", routing_table[index].name);
+  if (routing_table[index].hops > 0)
+    length = webpage_append(buffer, size, length, " via %s", L3_getNodeName(routing_table[index].next_node));
+
+  if (routing_table[index].low_power)
+    length = webpage_append(buffer, size, length, " (low power)");
+
+  return webpage_append(buffer, size, length, " | RSSI: %d | Link: %d%% | Hops: %d | %ds ago </li>",
+                        L3_getRssi(index + 1), neighbour_getQuality(routing_table[index].next_node) / 10,
+                        routing_table[index].hops, elapsedSeconds(routing_table[index].timestamp));
+}
+
+/**
+ * @brief    Renders an active node as a JSON object (webserver API)
+ * 
+ * @param    index: Routing table index
+ * @param    arg: Unused
+ * @param    buffer: Output buffer
+ * @param    size: Output buffer size
+ * @return   int item length, 0 if skipped, -1 after the last node
+ */
+int L3_fillNodeJson(int index, uint32_t arg, char *buffer, size_t size)
+{
+  if (index >= MAXNODES)
+    return -1;
+
+  if (!routing_table[index].active || index == NODENUMBER - 1)
+    return 0;
+
+  int length = webpage_append(buffer, size, 0, "{\"node\":%d,\"name\":", index + 1);
+  length = webpage_appendJson(buffer, size, length, routing_table[index].name);
+  length = webpage_append(buffer, size, length, ",\"next\":%d,\"via\":", routing_table[index].next_node);
+  length = webpage_appendJson(buffer, size, length, L3_getNodeName(routing_table[index].next_node));
+
+  uint8_t next_node = routing_table[index].next_node;
+  length = webpage_append(buffer, size, length, ",\"rssi\":%d,\"snr\":%d,\"prr\":%d,\"reverse_prr\":%d,\"link\":%d,\"load\":%d",
+                          neighbour_getRssi(next_node), neighbour_getSnr(next_node), neighbour_getPrr(next_node),
+                          neighbour_getReversePrr(next_node), neighbour_getQuality(next_node), neighbour_getLoad(next_node));
+
+  return webpage_append(buffer, size, length, ",\"hops\":%d,\"age\":%d,\"low_power\":%s}",
+                        routing_table[index].hops, elapsedSeconds(routing_table[index].timestamp),
+                        routing_table[index].low_power ? "true" : "false");
+}
+
+/**
+ * @brief    Returns the routing table version, incremented on every change
+ * 
+ * @return   uint32_t version
+ */
+uint32_t L3_getVersion()
+{
+  return routing_version;
+}
+
+/**
+ * @brief    Computes the version tag of a node name
+ * 
+ *           The version is a checksum of the name, so it is the same after
+ *           a reboot and changes with the name. 0 means unknown name.
+ * 
+ * @param    name: Pointer to node name
+ * @return   uint16_t name version
+ */
+uint16_t L3_computeNameVersion(const char *name)
+{
+  uint16_t version = crc16_le(0, (const uint8_t *)name, strlen(name));
+  return version ? version : 1;
+}
+
+/**
+ * @brief    Hashes a node name for the name index (FNV-1a)
+ * 
+ * @param    name: Pointer to node name
+ * @return   uint32_t hash
+ */
+uint32_t L3_hashName(const char *name)
+{
+  uint32_t hash = 2166136261u;
+  while (*name)
+  {
+    hash ^= (uint8_t)*name++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief    Rebuilds the name to node number index from the routing table
+ * 
+ */
+void L3_indexNames()
+{
+  memset(name_index, 0, sizeof(name_index));
+
   for (int i = 0; i < MAXNODES; i++)
   {
     if (routing_table[i].active && i != NODENUMBER - 1)
     {
-      list += "<li><b>" + String(routing_table[i].name) + "</b>";
-      if (routing_table[i].hops > 0)
-      {
-        list += " via " + String(L3_getNodeName(routing_table[i].next_node));
-      }
-
-      list += " | RSSI: " + String(routing_table[i].rssi) + " | Hops: " + String(routing_table[i].hops) +
-              +" | " + String(elapsedSeconds(routing_table[i].timestamp)) + "s ago </li>";
+      uint32_t slot = L3_hashName(routing_table[i].name) % NAMEINDEXSIZE;
+      while (name_index[slot])
+        slot = (slot + 1) % NAMEINDEXSIZE;
+      name_index[slot] = i + 1;
     }
   }
-  return list;
+
+  name_index_version = routing_version;
+  return;
 }
\ No newline at end of file
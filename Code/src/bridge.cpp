@@ -0,0 +1,523 @@
+/**
+ * @file     bridge.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Mesh bridge.
+ *           The last BRIDGEPROXIES node numbers stand for the nodes of the
+ *           other meshes: a proxy is given to a (mesh, node) pair when its
+ *           first packet comes from the backhaul, and the bridge sends that
+ *           packet in its mesh with the proxy as sender. Packets from local
+ *           nodes to a proxy are sent over the backhaul to the real node,
+ *           announces and names of local nodes are sent to every mesh.
+ *           Packets from the backhaul get a new id from the sequence of the
+ *           bridge, so the ids of a proxy always grow, even when it stood
+ *           for another node before, and the replay check holds. The ids of
+ *           the last BRIDGECACHE messages are kept, and the acknowledgments
+ *           sent back to their sender carry the id of its mesh.
+ *           Datagram (sent to every peer, encrypted with the network key,
+ *           header bytes after the first are the CCM nonce): version (1),
+ *           source mesh, destination mesh (0 for all), sender, receiver
+ *           (BROADCASTADDR for announces and names), packet id (uint32),
+ *           type, payload, tag. Payloads: message size and text,
+ *           acknowledged packet id (uint32), announce name version
+ *           (uint16), node name version (uint16), size and name.
+ *           Packets from a proxy are never sent back to the backhaul, so
+ *           every bridge needs to be a peer of the others. Packets from the
+ *           backhaul are sent in the mesh at most BRIDGERATE per minute, and
+ *           only while the queue is less than half full.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include <WiFiUdp.h>
+#include "config.h"
+#include "typedefs.h"
+#include "bridge.h"
+#include "L1.h"
+#include "L2.h"
+#include "L3.h"
+#include "crypto.h"
+#include "metrics.h"
+#include "scheduler.h"
+#include "log.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <WiFi.h>
+#endif
+
+#if BRIDGEPROXIES >= MAXNODES
+#error "Bridge proxies need to leave node numbers to the local nodes"
+#endif
+
+#define BRIDGEVERSION 1  // Datagram format version
+#define BRIDGEMAXPEERS 8 // Other bridges
+
+// Imported variables
+extern int L1_outBuffer_left;
+
+// Private variables
+static WiFiUDP udp;
+static char peers_hosts[BRIDGEMAXPEERS][40];
+static uint16_t peers_ports[BRIDGEMAXPEERS];
+static int peers_count = 0;
+static bridge_proxy_struct proxies[BRIDGEPROXIES];
+static bridge_packet_struct recent[BRIDGECACHE];
+static int recent_index = 0;
+static bridge_message_struct messages[BRIDGECACHE];
+static int messages_index = 0;
+static uint32_t tokens = 0;
+static uint32_t tokens_timestamp = 0;
+
+// Private functions
+void bridge_import(uint8_t *datagram, size_t size);
+uint8_t bridge_getProxy(uint8_t mesh, uint8_t node);
+bool bridge_checkDuplicate(uint8_t mesh, uint8_t sender, uint8_t type, uint32_t id);
+bool bridge_takeToken();
+
+// Functions
+
+/**
+ * @brief    Reads the peers, opens the backhaul socket and joins the
+ *           backhaul Wi-Fi network
+ * 
+ */
+void bridge_init()
+{
+  memset(proxies, 0, sizeof(proxies));
+  memset(recent, 0, sizeof(recent));
+  recent_index = 0;
+  memset(messages, 0, sizeof(messages));
+  messages_index = 0;
+  peers_count = 0;
+
+  if (!BRIDGEENABLED)
+    return;
+
+  char peers[BRIDGEMAXPEERS * 48];
+  strncpy(peers, BRIDGEPEERS, sizeof(peers) - 1);
+  peers[sizeof(peers) - 1] = 0;
+
+  for (char *peer = strtok(peers, ","); peer != NULL && peers_count < BRIDGEMAXPEERS; peer = strtok(NULL, ","))
+  {
+    char *port = strchr(peer, ':');
+    if (port == NULL || port - peer >= (int)sizeof(peers_hosts[0]))
+      continue;
+
+    *port = 0;
+    strcpy(peers_hosts[peers_count], peer);
+    peers_ports[peers_count] = atoi(port + 1);
+    peers_count++;
+  }
+
+#ifdef ARDUINO_ARCH_ESP32
+  if (strlen(BRIDGESSID) > 0)
+  {
+    WiFi.mode(WIFIENABLED ? WIFI_AP_STA : WIFI_STA);
+    WiFi.begin(BRIDGESSID, BRIDGEPASSWORD);
+  }
+#endif
+
+  udp.begin(BRIDGEPORT);
+  tokens = BRIDGEBURST * 60000;
+  tokens_timestamp = millis();
+  scheduler_register(timer_bridge, bridge_poll, BRIDGEPOLLMS);
+
+  LOG_INFO("Bridge of mesh %d, %d peers", BRIDGEMESH, peers_count);
+  return;
+}
+
+/**
+ * @brief    Handles the datagrams received from the backhaul
+ * 
+ */
+void bridge_poll()
+{
+  uint8_t datagram[256];
+
+  while (udp.parsePacket() > 0)
+  {
+    int size = udp.read(datagram, sizeof(datagram));
+    if (size > 0)
+      bridge_import(datagram, size);
+  }
+  return;
+}
+
+/**
+ * @brief    Returns if a node number stands for a node of another mesh
+ * 
+ * @param    node: Node number
+ * @return   bool 1 if proxy
+ */
+bool bridge_isProxy(uint8_t node)
+{
+  return BRIDGEENABLED && node > MAXNODES - BRIDGEPROXIES && node <= MAXNODES;
+}
+
+/**
+ * @brief    Sends a packet to the other meshes if needed: packets to a
+ *           proxy, and the first copy of the announces and names of the
+ *           local nodes
+ * 
+ * @param    packet: Packet
+ * @return   bool 1 if the packet is only for the other meshes
+ */
+bool bridge_export(pack_struct packet)
+{
+  if (!BRIDGEENABLED || bridge_isProxy(packet.sender) || packet.raw_size)
+    return 0;
+
+  uint8_t mesh = 0;
+  uint8_t receiver = packet.receiver;
+  bool proxy = bridge_isProxy(receiver);
+
+  if (proxy)
+  {
+    bridge_proxy_struct *entry = &proxies[receiver - (MAXNODES - BRIDGEPROXIES) - 1];
+    if (entry->mesh == 0 || packet.type == payload_ann || packet.type == payload_rreq || packet.type == payload_rrep)
+    {
+      metrics_drop(ret_send_error);
+      return 1;
+    }
+    mesh = entry->mesh;
+    receiver = entry->node;
+  }
+  else if (receiver != BROADCASTADDR || (packet.type != payload_ann && packet.type != payload_name))
+    return 0;
+
+  // Announces and names are exported when handled and again when relayed
+  if (bridge_checkDuplicate(BRIDGEMESH, packet.sender, packet.type, packet.id))
+    return proxy;
+
+  uint8_t datagram[256];
+  size_t size = 0;
+
+  datagram[size++] = BRIDGEVERSION;
+  datagram[size++] = BRIDGEMESH;
+  datagram[size++] = mesh;
+  datagram[size++] = packet.sender;
+  datagram[size++] = receiver;
+  memcpy(datagram + size, &packet.id, 4);
+  size += 4;
+  datagram[size++] = packet.type;
+
+  switch (packet.type)
+  {
+  case payload_msg:
+  {
+    payload_message_struct *payload = (payload_message_struct *)packet.payload;
+    datagram[size++] = payload->message_size;
+    memcpy(datagram + size, payload->message_ptr, payload->message_size);
+    size += payload->message_size;
+  }
+  break;
+  case payload_ack:
+  {
+    // The acknowledged message came from the backhaul with another id
+    uint32_t packet_id = ((payload_acknowledgment_struct *)packet.payload)->packet_id;
+    int i = 0;
+    while (i < BRIDGECACHE && (messages[i].id != packet_id || messages[i].remote_id == 0))
+      i++;
+    if (i == BRIDGECACHE)
+    {
+      metrics_drop(ret_send_error);
+      return proxy;
+    }
+    memcpy(datagram + size, &messages[i].remote_id, 4);
+    size += 4;
+  }
+  break;
+  case payload_ann:
+    memcpy(datagram + size, &((payload_announce_struct *)packet.payload)->name_version, 2);
+    size += 2;
+    break;
+  case payload_name:
+  {
+    payload_name_struct *payload = (payload_name_struct *)packet.payload;
+    memcpy(datagram + size, &payload->name_version, 2);
+    size += 2;
+    datagram[size++] = payload->name_size;
+    memcpy(datagram + size, payload->name_ptr, payload->name_size);
+    size += payload->name_size;
+  }
+  break;
+  default:
+    break;
+  }
+
+  if (crypto_sealDatagram(datagram, &size) != ret_ok)
+    return proxy;
+
+  for (int i = 0; i < peers_count; i++)
+  {
+    udp.beginPacket(peers_hosts[i], peers_ports[i]);
+    udp.write(datagram, size);
+    udp.endPacket();
+  }
+
+  metrics_packetOut(packet.type, 0);
+  LOG_DEBUG("Bridged packet type %d id %x to mesh %d node %d", packet.type, packet.id, mesh, receiver);
+  return proxy;
+}
+
+/**
+ * @brief    Sends a datagram from the backhaul in the mesh
+ * 
+ * @param    datagram: Datagram
+ * @param    size: Datagram size
+ */
+void bridge_import(uint8_t *datagram, size_t size)
+{
+  if (size < BRIDGEHEADER || datagram[0] != BRIDGEVERSION || crypto_openDatagram(datagram, &size) != ret_ok)
+  {
+    metrics_drop(ret_receive_auth_error);
+    return;
+  }
+
+  uint8_t mesh = datagram[1];
+  pack_struct packet;
+  // The nodes of the other meshes are one hop behind the bridge
+  packet.ttl = TTL - 1;
+  packet.hops = 1;
+  packet.sender = datagram[3];
+  packet.receiver = datagram[4];
+  memcpy(&packet.id, datagram + 5, 4);
+  packet.type = datagram[9];
+  packet.payload = NULL;
+  packet.raw_size = 0;
+  packet.perimeter = 0;
+  packet.target.valid = 0;
+  packet.rssi = 0;
+  packet.timestamp = millis();
+
+  if (mesh == BRIDGEMESH || (datagram[2] != 0 && datagram[2] != BRIDGEMESH) || packet.type >= payload_count)
+    return;
+
+  if (bridge_checkDuplicate(mesh, packet.sender, packet.type, packet.id))
+  {
+    metrics_drop(ret_receive_duplicate);
+    return;
+  }
+
+  // Only local nodes can be reached from the other meshes
+  bool broadcast = packet.receiver == BROADCASTADDR;
+  if (!broadcast && (packet.receiver == 0 || packet.receiver > MAXNODES || bridge_isProxy(packet.receiver)))
+  {
+    metrics_drop(ret_send_error);
+    return;
+  }
+
+  if (!bridge_takeToken())
+  {
+    metrics_drop(ret_bridge_limited);
+    return;
+  }
+
+  packet.sender = bridge_getProxy(mesh, packet.sender);
+  if (packet.sender == 0)
+  {
+    metrics_drop(ret_buffer_full);
+    return;
+  }
+
+  // A proxy can stand for another node than before, its ids come from this
+  // bridge so that they are newer than the ones already received
+  uint32_t remote_id = packet.id;
+  packet.id = crypto_newId();
+  if (packet.type == payload_msg)
+  {
+    messages[messages_index].id = packet.id;
+    messages[messages_index].remote_id = remote_id;
+    messages_index = (messages_index + 1) % BRIDGECACHE;
+  }
+
+  uint8_t *payload = datagram + BRIDGEHEADER;
+  size -= BRIDGEHEADER;
+
+  switch (packet.type)
+  {
+  case payload_msg:
+  {
+    char message[256];
+    uint8_t message_size = size > 0 && payload[0] < size ? payload[0] : 0;
+    memcpy(message, payload + 1, message_size);
+    message[message_size] = 0;
+    packet.payload = L2_setPayloadMessage(message);
+  }
+  break;
+  case payload_ack:
+  {
+    uint32_t packet_id = 0;
+    if (size >= 4)
+      memcpy(&packet_id, payload, 4);
+    packet.payload = L2_setPayloadacknowledgment(packet_id, NULL, 0);
+  }
+  break;
+  case payload_ann:
+  {
+    uint16_t name_version = 0;
+    if (size >= 2)
+      memcpy(&name_version, payload, 2);
+    packet.payload = L2_setPayloadAnnounce(name_version, 0, 0, 0, 0, 0, 0);
+  }
+  break;
+  case payload_name:
+  {
+    char name[16];
+    uint16_t name_version = 0;
+    uint8_t name_size = 0;
+    if (size >= 3)
+    {
+      memcpy(&name_version, payload, 2);
+      name_size = payload[2] < size - 3 ? payload[2] : size - 3;
+      if (name_size > 15)
+        name_size = 15;
+      memcpy(name, payload + 3, name_size);
+    }
+    name[name_size] = 0;
+    packet.payload = L2_setPayloadName(name_version, name);
+  }
+  break;
+  default:
+    break;
+  }
+
+  metrics_packetIn(packet.type);
+
+  // Packets for this node are handled here, the others are sent in the mesh
+  if (packet.receiver == NODENUMBER)
+  {
+    packet.last_node = NODENUMBER;
+    packet.next_node = NODENUMBER;
+
+    switch (packet.type)
+    {
+    case payload_msg:
+      L2_handleMessage(packet);
+      break;
+    case payload_ack:
+      L2_handleacknowledgment(packet);
+      break;
+    case payload_name_req:
+      L2_handleNameRequest(packet);
+      break;
+    case payload_name:
+      L2_handleName(packet);
+      break;
+    default:
+      break;
+    }
+    L1_freePayload(packet);
+    return;
+  }
+
+  packet.last_node = NODENUMBER;
+  if (broadcast)
+    packet.next_node = BROADCASTADDR;
+  else
+  {
+    packet.ttl = L3_getTTL(packet.receiver);
+    L3_setNextNode(&packet, NODENUMBER);
+  }
+  if (packet.next_node == 0)
+  {
+    L1_freePayload(packet);
+    metrics_drop(ret_send_error);
+    return;
+  }
+
+  L1_enqueue_outPacket(packet);
+  return;
+}
+
+/**
+ * @brief    Returns the proxy of a node of another mesh, a new one if the
+ *           node has none
+ * 
+ * @param    mesh: Mesh id
+ * @param    node: Node number in its mesh
+ * @return   uint8_t proxy node number, 0 if there is no free one
+ */
+uint8_t bridge_getProxy(uint8_t mesh, uint8_t node)
+{
+  uint32_t now = millis();
+  int slot = (mesh * 31 + node) % BRIDGEPROXIES;
+  int free = -1;
+
+  // The same node gets the same proxy after a restart, unless it collides
+  for (int i = 0; i < BRIDGEPROXIES; i++)
+  {
+    bridge_proxy_struct *entry = &proxies[(slot + i) % BRIDGEPROXIES];
+    if (entry->mesh == mesh && entry->node == node)
+    {
+      entry->timestamp = now;
+      return MAXNODES - BRIDGEPROXIES + 1 + (slot + i) % BRIDGEPROXIES;
+    }
+
+    if (free < 0 && (entry->mesh == 0 || now - entry->timestamp > INACTIVEMINS * 60000))
+      free = (slot + i) % BRIDGEPROXIES;
+  }
+
+  if (free < 0)
+    return 0;
+
+  proxies[free].mesh = mesh;
+  proxies[free].node = node;
+  proxies[free].timestamp = now;
+  LOG_INFO("Bridge proxy %d for node %d of mesh %d", MAXNODES - BRIDGEPROXIES + 1 + free, node, mesh);
+  return MAXNODES - BRIDGEPROXIES + 1 + free;
+}
+
+/**
+ * @brief    Checks if a packet was already forwarded, and remembers it
+ * 
+ * @param    mesh: Mesh id of the sender
+ * @param    sender: Sender node in its mesh
+ * @param    type: Packet type
+ * @param    id: Packet id
+ * @return   bool 1 if duplicate
+ */
+bool bridge_checkDuplicate(uint8_t mesh, uint8_t sender, uint8_t type, uint32_t id)
+{
+  for (int i = 0; i < BRIDGECACHE; i++)
+  {
+    if (recent[i].mesh == mesh && recent[i].sender == sender && recent[i].type == type && recent[i].id == id)
+      return 1;
+  }
+
+  recent[recent_index].mesh = mesh;
+  recent[recent_index].sender = sender;
+  recent[recent_index].type = type;
+  recent[recent_index].id = id;
+  recent_index = (recent_index + 1) % BRIDGECACHE;
+  return 0;
+}
+
+/**
+ * @brief    Takes a token of the backhaul to radio rate limit (token
+ *           bucket of BRIDGEBURST packets, refilled with BRIDGERATE per
+ *           minute) and checks that the queue has room for local traffic
+ * 
+ * @return   bool 1 if the packet can be sent
+ */
+bool bridge_takeToken()
+{
+  uint32_t now = millis();
+  // The elapsed time is cut to a full bucket, the product would overflow
+  // after a long time without packets
+  uint32_t elapsed = now - tokens_timestamp;
+  if (elapsed > (BRIDGEBURST * 60000 + BRIDGERATE - 1) / BRIDGERATE)
+    elapsed = (BRIDGEBURST * 60000 + BRIDGERATE - 1) / BRIDGERATE;
+  tokens += elapsed * BRIDGERATE;
+  tokens_timestamp = now;
+  if (tokens > BRIDGEBURST * 60000)
+    tokens = BRIDGEBURST * 60000;
+
+  if (tokens < 60000 || L1_outBuffer_left > L1BUFFER / 2)
+    return 0;
+
+  tokens -= 60000;
+  return 1;
+}
@@ -0,0 +1,210 @@
+/**
+ * @file     congestion.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Congestion control.
+ *           Every unicast message sent by this node takes a place in the
+ *           window until its acknowledgment arrives. An acknowledgment
+ *           widens the window by one message for every window of
+ *           acknowledgments, a message without acknowledgment after
+ *           CONGESTIONTIMEOUTSECS halves it, once for the messages sent
+ *           before the last decrease. Messages beyond the window are
+ *           refused, so under overload the queues do not fill with messages
+ *           whose acknowledgments are then dropped on the way back.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "congestion.h"
+#include "group.h"
+#include "scheduler.h"
+#include "log.h"
+
+// Imported variables
+extern int L1_outBuffer_left;
+
+// Private variables
+static congestion_message_struct flight[CONGESTIONMAXWINDOW];
+static int flight_count = 0;
+static int window = 0; // Window (1/16 messages)
+static uint32_t decrease_timestamp = 0;
+
+// Private functions
+void congestion_timer();
+void congestion_armTimer();
+
+// Functions
+
+/**
+ * @brief    Initializes the congestion window
+ * 
+ */
+void congestion_init()
+{
+  memset(flight, 0, sizeof(flight));
+  flight_count = 0;
+  window = CONGESTIONWINDOW * 16;
+  decrease_timestamp = millis();
+
+  scheduler_register(timer_congestion, congestion_timer, 0);
+  return;
+}
+
+/**
+ * @brief    Checks if a message of this node can be sent now
+ * 
+ * @param    receiver: Receiver node, group or broadcast address
+ * @return   return_type ret_ok, ret_buffer_full if the send queue is
+ *           full, ret_congested if the window is full
+ */
+return_type congestion_check(uint8_t receiver)
+{
+  if (L1_outBuffer_left >= L1BUFFER)
+    return ret_buffer_full;
+
+  // Group and broadcast messages are acknowledged by an unknown number of
+  // nodes, only the send queue limits them
+  if (receiver == BROADCASTADDR || group_isAddress(receiver))
+    return ret_ok;
+
+  if (flight_count >= window / 16)
+    return ret_congested;
+  return ret_ok;
+}
+
+/**
+ * @brief    Adds a unicast message of this node to the window
+ * 
+ * @param    receiver: Receiver node
+ * @param    id: Packet id
+ */
+void congestion_sent(uint8_t receiver, uint32_t id)
+{
+  if (receiver == BROADCASTADDR || group_isAddress(receiver) || flight_count == CONGESTIONMAXWINDOW)
+    return;
+
+  flight[flight_count].id = id;
+  flight[flight_count].sent = millis();
+  flight_count++;
+
+  if (!scheduler_isSet(timer_congestion))
+    congestion_armTimer();
+}
+
+/**
+ * @brief    Removes an acknowledged message from the window and widens it
+ * 
+ * @param    id: Packet id of the message
+ */
+void congestion_acknowledged(uint32_t id)
+{
+  for (int i = 0; i < flight_count; i++)
+  {
+    if (flight[i].id != id)
+      continue;
+
+    memmove(&flight[i], &flight[i + 1], (--flight_count - i) * sizeof(congestion_message_struct));
+
+    // One message more for every window of acknowledgments
+    window += 256 / window > 0 ? 256 / window : 1;
+    if (window > CONGESTIONMAXWINDOW * 16)
+      window = CONGESTIONMAXWINDOW * 16;
+
+    congestion_armTimer();
+    return;
+  }
+}
+
+/**
+ * @brief    Returns the send queue occupancy
+ * 
+ * @return   uint8_t occupancy (%)
+ */
+uint8_t congestion_getLoad()
+{
+  return L1_outBuffer_left * 100 / L1BUFFER;
+}
+
+/**
+ * @brief    Returns the congestion window
+ * 
+ * @return   int unicast messages that can wait for their acknowledgment
+ */
+int congestion_getWindow()
+{
+  return window / 16;
+}
+
+/**
+ * @brief    Returns the unicast messages that can be sent now
+ * 
+ * @return   int number of messages
+ */
+int congestion_getRoom()
+{
+  int queue_room = L1BUFFER - L1_outBuffer_left;
+  int window_room = window / 16 - flight_count;
+  int room = queue_room < window_room ? queue_room : window_room;
+  return room > 0 ? room : 0;
+}
+
+/**
+ * @brief    Returns the time until a place in the window is freed, by
+ *           acknowledgment or timeout at the latest
+ * 
+ * @return   uint32_t time (ms), 0 if the window is not full
+ */
+uint32_t congestion_getWait()
+{
+  if (flight_count < window / 16 || flight_count == 0)
+    return 0;
+
+  int32_t wait = flight[0].sent + CONGESTIONTIMEOUTSECS * 1000 - millis();
+  return wait > 0 ? wait : 0;
+}
+
+/**
+ * @brief    Congestion timer: removes the messages without
+ *           acknowledgment and halves the window, once for the messages
+ *           sent before the last decrease
+ * 
+ */
+void congestion_timer()
+{
+  uint32_t now = millis();
+
+  // The messages are in sending order, the oldest first
+  while (flight_count > 0 && now - flight[0].sent >= CONGESTIONTIMEOUTSECS * 1000)
+  {
+    if ((int32_t)(flight[0].sent - decrease_timestamp) >= 0)
+    {
+      window = window / 2 > 16 ? window / 2 : 16;
+      decrease_timestamp = now;
+      LOG_DEBUG("Message %x not acknowledged, window %d", flight[0].id, window / 16);
+    }
+
+    memmove(&flight[0], &flight[1], --flight_count * sizeof(congestion_message_struct));
+  }
+
+  congestion_armTimer();
+}
+
+/**
+ * @brief    Arms the congestion timer on the oldest message
+ * 
+ */
+void congestion_armTimer()
+{
+  if (flight_count == 0)
+  {
+    scheduler_cancel(timer_congestion);
+    return;
+  }
+
+  int32_t wait = flight[0].sent + CONGESTIONTIMEOUTSECS * 1000 - millis();
+  scheduler_set(timer_congestion, wait > 0 ? wait : 0);
+}
@@ -0,0 +1,233 @@
+/**
+ * @file     crypto.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Packet encryption and packet ids.
+ *           The payload is encrypted and authenticated with AES-CCM (mbed
+ *           TLS, on the ESP32 it runs on the AES accelerator). The CCM nonce
+ *           is the header after the network id: a forged or changed header
+ *           fails authentication, and every hop sends a different nonce
+ *           because TTL and last node change. The tag is appended to the
+ *           frame.
+ *           Packet ids are a boot epoch kept in the non-volatile storage
+ *           (high 16 bits) and a sequence number (low 16 bits), so the
+ *           nonces are not reused after a reboot. Packets with an id older
+ *           than the last CRYPTOWINDOW ids received from the same node are
+ *           replays, duplicates inside the window are left to L2 and L3.
+ *           A node without accepted packets for INACTIVEMINS is forgotten,
+ *           so a node whose storage was erased and restarted from epoch 1
+ *           is accepted again.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include <Preferences.h>
+#include "config.h"
+#include "typedefs.h"
+#include "crypto.h"
+#include "log.h"
+#include "mbedtls/ccm.h"
+
+#ifndef CRYPTOKEY
+#if CRYPTOENABLED || BRIDGEENABLED
+#error "CRYPTOENABLED and BRIDGEENABLED need CRYPTOKEY, the network key of this deployment"
+#endif
+#define CRYPTOKEY 0 // Not used
+#endif
+
+// Private variables
+static mbedtls_ccm_context ccm;
+static crypto_peer_struct peers[MAXNODES];
+static uint32_t epoch = 0;
+static uint32_t sequence = 0;
+static uint32_t last_id = 0;
+
+// Private functions
+void crypto_newEpoch();
+return_type crypto_encrypt(uint8_t *frame, size_t header, size_t *size);
+return_type crypto_decrypt(uint8_t *frame, size_t header, size_t *size);
+
+// Functions
+
+/**
+ * @brief    Sets the network key and starts a new packet id epoch
+ * 
+ */
+void crypto_init()
+{
+  const uint8_t key[16] = {CRYPTOKEY};
+
+  mbedtls_ccm_init(&ccm);
+  if (mbedtls_ccm_setkey(&ccm, MBEDTLS_CIPHER_ID_AES, key, 128) != 0)
+    LOG_ERROR("Error setting the network key");
+
+  memset(peers, 0, sizeof(peers));
+  crypto_newEpoch();
+}
+
+/**
+ * @brief    Returns a new packet id
+ * 
+ * @return   uint32_t packet id
+ */
+uint32_t crypto_newId()
+{
+  if (sequence == 0xFFFF)
+    crypto_newEpoch();
+
+  last_id = epoch << 16 | ++sequence;
+  return last_id;
+}
+
+/**
+ * @brief    Returns the last packet id
+ * 
+ * @return   uint32_t packet id
+ */
+uint32_t crypto_getLastId()
+{
+  return last_id;
+}
+
+/**
+ * @brief    Encrypts the payload of a frame and appends the tag
+ * 
+ * @param    frame: Frame, with room for CRYPTOTAG more bytes
+ * @param    size: Frame size, updated
+ * @return   return_type status
+ */
+return_type crypto_seal(uint8_t *frame, size_t *size)
+{
+  if (!CRYPTOENABLED)
+    return ret_ok;
+
+  return crypto_encrypt(frame, L1HEADER, size);
+}
+
+/**
+ * @brief    Authenticates and decrypts a received frame and checks that it
+ *           is not a replay
+ * 
+ * @param    frame: Frame
+ * @param    size: Frame size, updated without the tag
+ * @return   return_type status
+ */
+return_type crypto_open(uint8_t *frame, size_t *size)
+{
+  if (!CRYPTOENABLED)
+    return ret_ok;
+
+  return_type ret = crypto_decrypt(frame, L1HEADER, size);
+  if (ret != ret_ok)
+    return ret;
+
+  uint8_t sender = frame[3];
+  uint32_t id;
+  memcpy(&id, frame + 6, 4);
+  if (sender == 0 || sender > MAXNODES || sender == NODENUMBER)
+    return ret_ok;
+
+  crypto_peer_struct *peer = &peers[sender - 1];
+  uint32_t now = millis();
+  if (peer->valid && now - peer->timestamp >= INACTIVEMINS * 60000UL)
+    peer->valid = 0; // Offline node, it may have restarted from an older epoch
+
+  int32_t age = peer->last_id - id;
+  if (peer->valid && age >= CRYPTOWINDOW)
+    return ret_receive_replay;
+
+  if (!peer->valid || age < 0)
+  {
+    peer->last_id = id;
+    peer->valid = 1;
+  }
+  peer->timestamp = now;
+  return ret_ok;
+}
+
+/**
+ * @brief    Encrypts the payload of a bridge datagram and appends the tag,
+ *           datagrams are always encrypted
+ * 
+ * @param    datagram: Datagram, with room for CRYPTOTAG more bytes
+ * @param    size: Datagram size, updated
+ * @return   return_type status
+ */
+return_type crypto_sealDatagram(uint8_t *datagram, size_t *size)
+{
+  return crypto_encrypt(datagram, BRIDGEHEADER, size);
+}
+
+/**
+ * @brief    Authenticates and decrypts a bridge datagram, the duplicates
+ *           are dropped by the bridge
+ * 
+ * @param    datagram: Datagram
+ * @param    size: Datagram size, updated without the tag
+ * @return   return_type status
+ */
+return_type crypto_openDatagram(uint8_t *datagram, size_t *size)
+{
+  return crypto_decrypt(datagram, BRIDGEHEADER, size);
+}
+
+/**
+ * @brief    Encrypts the data after a header and appends the tag, the
+ *           header after its first byte is the nonce
+ * 
+ * @param    frame: Header and data, with room for CRYPTOTAG more bytes
+ * @param    header: Header size
+ * @param    size: Frame size, updated
+ * @return   return_type status
+ */
+return_type crypto_encrypt(uint8_t *frame, size_t header, size_t *size)
+{
+  if (*size < header || *size + CRYPTOTAG > 255)
+    return ret_send_size_error;
+
+  size_t length = *size - header;
+  if (mbedtls_ccm_encrypt_and_tag(&ccm, length, frame + 1, header - 1, NULL, 0, frame + header, frame + header, frame + *size, CRYPTOTAG) != 0)
+    return ret_error;
+
+  *size += CRYPTOTAG;
+  return ret_ok;
+}
+
+/**
+ * @brief    Authenticates and decrypts the data after a header
+ * 
+ * @param    frame: Header, data and tag
+ * @param    header: Header size
+ * @param    size: Frame size, updated without the tag
+ * @return   return_type status
+ */
+return_type crypto_decrypt(uint8_t *frame, size_t header, size_t *size)
+{
+  if (*size < header + CRYPTOTAG)
+    return ret_receive_auth_error;
+
+  size_t length = *size - header - CRYPTOTAG;
+  if (mbedtls_ccm_auth_decrypt(&ccm, length, frame + 1, header - 1, NULL, 0, frame + header, frame + header, frame + header + length, CRYPTOTAG) != 0)
+    return ret_receive_auth_error;
+
+  *size -= CRYPTOTAG;
+  return ret_ok;
+}
+
+/**
+ * @brief    Starts a new packet id epoch and saves it
+ * 
+ */
+void crypto_newEpoch()
+{
+  Preferences preferences;
+
+  preferences.begin("crypto");
+  epoch = (preferences.getUInt("epoch", 0) + 1) & 0xFFFF;
+  preferences.putUInt("epoch", epoch);
+  preferences.end();
+
+  sequence = 0;
+}
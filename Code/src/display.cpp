@@ -4,7 +4,13 @@
  * @version  1.0
  * @date     09-08-2020
  * 
- * @brief    Display functions
+ * @brief    Display functions.
+ *           Received messages are queued and shown by the refresh timer,
+ *           so packet handling never waits on the display. The screen is
+ *           composed in a frame buffer and only the characters that differ
+ *           from what is shown are sent over I2C. The inbox shows the last
+ *           messages under a status bar (send queue and airtime of the last
+ *           minute), and scrolls while they do not fit.
  */
 
 // Include libraries
@@ -13,19 +19,49 @@
 #include "typedefs.h"
 #include "display.h"
 #include "L3.h"
+#include "metrics.h"
+#include "scheduler.h"
 #include <SPI.h>
 #include <U8x8lib.h>
 
-U8X8_SSD1306_128X64_NONAME_SW_I2C u8x8(I2CSCL, I2CSDA, LCDRESET);
+#define DISPLAYROWS 8     // Text rows
+#define DISPLAYCOLUMNS 16 // Text columns
+
+U8X8_SSD1306_128X64_NONAME_HW_I2C u8x8(LCDRESET, I2CSCL, I2CSDA);
 
 // Imported variables
 extern char node_name[16];
 extern char wifi_ssid[20];
+extern int L1_outBuffer_left;
 
 // Exported variables
-uint32_t display_standby_timer = 0;
 bool display_flag_screenOn = 0;
 
+// Private variables
+static display_message_struct events[DISPLAYEVENTS];
+static int events_head = 0;
+static int events_count = 0;
+static display_message_struct inbox[DISPLAYINBOX];
+static int inbox_head = 0;
+static int inbox_count = 0;
+static int inbox_scroll = 0;
+static char frame[DISPLAYROWS][DISPLAYCOLUMNS + 1];
+static bool frame_inverse[DISPLAYROWS];
+static char shown[DISPLAYROWS][DISPLAYCOLUMNS + 1];
+static bool shown_inverse[DISPLAYROWS];
+static uint32_t airtime_mark = 0;
+static uint32_t airtime_mark_timestamp = 0;
+static uint32_t airtime_last = 0;
+static uint32_t airtime_last_timestamp = 0;
+
+// Private functions
+void display_refresh();
+void display_turnOn();
+void display_renderStatus();
+void display_renderInbox();
+void display_setRow(int row, const char *text, bool inverse);
+void display_flush();
+
 // Functions
 
 /**
@@ -34,9 +70,21 @@ bool display_flag_screenOn = 0;
  */
 void display_init()
 {
+  u8x8.setBusClock(DISPLAYI2CHZ);
   u8x8.begin();
   u8x8.setFont(u8x8_font_artossans8_r);
   u8x8.setFlipMode(0);
+  u8x8.clear();
+
+  for (int row = 0; row < DISPLAYROWS; row++)
+  {
+    display_setRow(row, "", 0);
+    memcpy(shown[row], frame[row], sizeof(shown[row]));
+    shown_inverse[row] = 0;
+  }
+
+  scheduler_register(timer_display_standby, display_turnOff, 0);
+  scheduler_register(timer_display_refresh, display_refresh, 0);
 }
 
 /**
@@ -46,6 +94,7 @@ void display_init()
 void display_turnOff()
 {
   display_flag_screenOn = false;
+  scheduler_cancel(timer_display_refresh);
   u8x8.setPowerSave(1);
 }
 
@@ -58,59 +107,213 @@ void display_printWelcome()
   char string[17];
   sprintf(string, "Node number: %-2d", NODENUMBER);
 
-  u8x8.clear();
-  u8x8.drawString(0, 0, "LoRaMessenger");
-  u8x8.drawString(0, 3, string);
-  if (WIFIENABLED)
+  for (int row = 0; row < DISPLAYROWS; row++)
+    display_setRow(row, "", 0);
+  display_setRow(0, "LoRaMessenger", 0);
+  display_setRow(3, string, 0);
+#if WIFIENABLED
+  display_setRow(5, "Wi-Fi hotspot:", 0);
+  display_setRow(6, wifi_ssid, 0);
+#else
+  display_setRow(5, "Node name:", 0);
+  display_setRow(6, L3_getNodeName(NODENUMBER), 0);
+#endif
+
+  display_flush();
+  display_turnOn();
+}
+
+/**
+ * @brief    Queues a received message for the inbox, the display is
+ *           refreshed once for a burst of messages
+ * 
+ * @param    message: Message
+ * @param    sender_node: Sender node number
+ */
+void display_printLastMessage(const char *message, uint8_t sender_node)
+{
+#if LOWPOWER
+  // Nobody reads a relay display, keep it off
+  return;
+#endif
+
+  if (events_count == DISPLAYEVENTS)
   {
-    u8x8.drawString(0, 5, "Wi-Fi hotspot:");
-    u8x8.drawString(0, 6, wifi_ssid);
+    events_head = (events_head + 1) % DISPLAYEVENTS;
+    events_count--;
   }
-  else
+
+  display_message_struct *event = &events[(events_head + events_count) % DISPLAYEVENTS];
+  event->sender = sender_node;
+  strncpy(event->text, message, DISPLAYTEXT);
+  event->text[DISPLAYTEXT] = 0;
+  events_count++;
+
+  if (scheduler_getRemaining(timer_display_refresh) > DISPLAYREFRESHMS || !scheduler_isSet(timer_display_refresh))
+    scheduler_set(timer_display_refresh, DISPLAYREFRESHMS);
+}
+
+/**
+ * @brief    Refresh timer: moves the queued messages to the inbox, then
+ *           redraws the status bar and the inbox
+ * 
+ */
+void display_refresh()
+{
+  if (events_count > 0)
   {
-    u8x8.drawString(0, 5, "Node name:");
-    u8x8.drawString(0, 6, L3_getNodeName(NODENUMBER));
+    while (events_count > 0)
+    {
+      inbox[inbox_head] = events[events_head];
+      inbox_head = (inbox_head + 1) % DISPLAYINBOX;
+      if (inbox_count < DISPLAYINBOX)
+        inbox_count++;
+      events_head = (events_head + 1) % DISPLAYEVENTS;
+      events_count--;
+    }
+    inbox_scroll = 0;
+    display_turnOn();
   }
+  else
+    inbox_scroll++;
+
+  if (!display_flag_screenOn || inbox_count == 0)
+    return;
+
+  display_renderStatus();
+  display_renderInbox();
+  display_flush();
+  scheduler_set(timer_display_refresh, DISPLAYSTATUSMS);
+}
 
+/**
+ * @brief    Turns on the display until the standby time
+ * 
+ */
+void display_turnOn()
+{
   display_flag_screenOn = true;
-  display_standby_timer = millis();
+  scheduler_set(timer_display_standby, DISPLAYSTBYSECS * 1000);
   u8x8.setPowerSave(0);
 }
 
 /**
- * @brief    Prints last message received
+ * @brief    Composes the status bar: packets in the send queue and
+ *           airtime percentage over the last minute or two
  * 
- * @param    message: Pointer to message to be printed
- * @param    sender_node: Sender node number
  */
-void display_printLastMessage(char *message, uint8_t sender_node)
+void display_renderStatus()
 {
-  char sender_name[16];
-  char message_str[17];
+  uint32_t now = millis();
+  uint32_t airtime = metrics_get(metric_airtime_ms);
 
-  strcpy(sender_name, L3_getNodeName(sender_node));
+  // The window starts at the previous mark, one to two minutes ago
+  if (now - airtime_last_timestamp >= 60000)
+  {
+    airtime_mark = airtime_last;
+    airtime_mark_timestamp = airtime_last_timestamp;
+    airtime_last = airtime;
+    airtime_last_timestamp = now;
+  }
 
-  int message_length = strlen(message);
+  uint32_t elapsed = now - airtime_mark_timestamp;
+  uint32_t permille = elapsed > 0 ? (uint64_t)(airtime - airtime_mark) * 1000 / elapsed : 0;
+  if (permille > 999)
+    permille = 999;
 
-  if (message_length > 48)
-    message_length = 48;
+  char string[32];
+  snprintf(string, sizeof(string), "Q%2d/%-2d  Air%2d.%d%%", L1_outBuffer_left, L1BUFFER, (int)permille / 10, (int)permille % 10);
+  display_setRow(0, string, 1);
+}
 
-  u8x8.clear();
-  u8x8.drawString(0, 0, "Message from:");
-  u8x8.drawString(0, 1, sender_name);
+/**
+ * @brief    Composes the inbox: the newest message first, each one with
+ *           the sender name and up to three lines of text. When the
+ *           messages do not fit, each refresh scrolls down one line and
+ *           the inbox starts again from the top after the last one.
+ * 
+ */
+void display_renderInbox()
+{
+  static char lines[DISPLAYINBOX * 4][DISPLAYCOLUMNS + 1];
+  int lines_count = 0;
 
-  strncpy(message_str, message, 16);
-  u8x8.drawString(0, 4, message_str);
-  for (int i = 1; i < 3; i++)
+  for (int i = 1; i <= inbox_count; i++)
   {
-    if (message_length > (16 * i))
+    display_message_struct *message = &inbox[(inbox_head - i + DISPLAYINBOX) % DISPLAYINBOX];
+    char *name = L3_getNodeName(message->sender);
+    if (strlen(name) > 0)
+      snprintf(lines[lines_count++], DISPLAYCOLUMNS + 1, ">%s", name);
+    else
+      snprintf(lines[lines_count++], DISPLAYCOLUMNS + 1, ">Node %d", message->sender);
+
+    int length = strlen(message->text);
+    for (int offset = 0; offset < length; offset += DISPLAYCOLUMNS)
     {
-      strncpy(message_str, message + (16 * i), 16);
-      u8x8.drawString(0, 4 + i, message_str);
+      strncpy(lines[lines_count], message->text + offset, DISPLAYCOLUMNS);
+      lines[lines_count++][DISPLAYCOLUMNS] = 0;
     }
   }
 
-  display_flag_screenOn = true;
-  display_standby_timer = millis();
-  u8x8.setPowerSave(0);
+  if (inbox_scroll > lines_count - (DISPLAYROWS - 1))
+    inbox_scroll = 0;
+
+  for (int row = 1; row < DISPLAYROWS; row++)
+  {
+    int line = inbox_scroll + row - 1;
+    display_setRow(row, line < lines_count ? lines[line] : "", 0);
+  }
+}
+
+/**
+ * @brief    Writes a row of the frame buffer, padded with spaces
+ * 
+ * @param    row: Row
+ * @param    text: Text, cut at the row width
+ * @param    inverse: 1 for inverse video
+ */
+void display_setRow(int row, const char *text, bool inverse)
+{
+  size_t length = strnlen(text, DISPLAYCOLUMNS);
+
+  memcpy(frame[row], text, length);
+  memset(frame[row] + length, ' ', DISPLAYCOLUMNS - length);
+  frame[row][DISPLAYCOLUMNS] = 0;
+  frame_inverse[row] = inverse;
+}
+
+/**
+ * @brief    Draws the characters of the frame buffer that differ from the
+ *           display, one run per row
+ * 
+ */
+void display_flush()
+{
+  for (int row = 0; row < DISPLAYROWS; row++)
+  {
+    int first = 0;
+    int last = DISPLAYCOLUMNS - 1;
+
+    if (frame_inverse[row] == shown_inverse[row])
+    {
+      while (first < DISPLAYCOLUMNS && frame[row][first] == shown[row][first])
+        first++;
+      if (first == DISPLAYCOLUMNS)
+        continue;
+      while (frame[row][last] == shown[row][last])
+        last--;
+    }
+
+    char run[DISPLAYCOLUMNS + 1];
+    memcpy(run, frame[row] + first, last - first + 1);
+    run[last - first + 1] = 0;
+
+    u8x8.setInverseFont(frame_inverse[row]);
+    u8x8.drawString(first, row, run);
+
+    memcpy(shown[row] + first, run, last - first + 1);
+    shown_inverse[row] = frame_inverse[row];
+  }
+
+  u8x8.setInverseFont(0);
 }
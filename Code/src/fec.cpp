@@ -0,0 +1,287 @@
+/**
+ * @file     fec.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Forward error correction.
+ *           Systematic Reed-Solomon code over GF(256) (polynomial 0x11D,
+ *           first root 1) shortened to the frame size. Decoding computes
+ *           the syndromes, finds the error locator with Berlekamp-Massey,
+ *           the error positions with a Chien search and the values with
+ *           Forney's formula. Coded frames are sent without the radio CRC,
+ *           a CRC16 before the parity bytes rejects wrong corrections.
+ *           The link frame error rate comes from the neighbour table: the
+ *           reception ratio the neighbour reports for this node, or the one
+ *           measured here until it reports.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "fec.h"
+#include "neighbour.h"
+#include "log.h"
+#include "rom/crc.h"
+
+#if FECPARITY % 2 || FECPARITY > 32
+#error "FECPARITY needs to be even and at most 32"
+#endif
+
+// Private variables
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t generator[FECPARITY + 1];
+static bool links[MAXNODES];
+
+/**
+ * @brief    Multiplies two elements of GF(256)
+ * 
+ */
+static inline uint8_t fec_multiply(uint8_t a, uint8_t b)
+{
+  if (a == 0 || b == 0)
+    return 0;
+  return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+/**
+ * @brief    Checks the CRC16 at the end of a decoded frame
+ * 
+ * @return   int frame size without CRC16, -1 if wrong
+ */
+static int fec_checkCrc(uint8_t *frame, int size)
+{
+  uint16_t crc = crc16_le(0, frame, size - 2);
+  if (frame[size - 2] != (uint8_t)crc || frame[size - 1] != (uint8_t)(crc >> 8))
+    return -1;
+  return size - 2;
+}
+
+// Functions
+
+/**
+ * @brief    Initializes the GF(256) tables and the generator polynomial
+ * 
+ */
+void fec_init()
+{
+  uint16_t x = 1;
+  for (int i = 0; i < 255; i++)
+  {
+    gf_exp[i] = x;
+    gf_log[x] = i;
+    x <<= 1;
+    if (x & 0x100)
+      x ^= 0x11D;
+  }
+  for (int i = 255; i < 512; i++)
+    gf_exp[i] = gf_exp[i - 255];
+
+  // g(x) = (x + a^0)(x + a^1)...(x + a^(FECPARITY - 1)), lowest degree first
+  memset(generator, 0, sizeof(generator));
+  generator[0] = 1;
+  for (int i = 0; i < FECPARITY; i++)
+  {
+    for (int j = i + 1; j > 0; j--)
+      generator[j] = generator[j - 1] ^ fec_multiply(generator[j], gf_exp[i]);
+    generator[0] = fec_multiply(generator[0], gf_exp[i]);
+  }
+
+  memset(links, 0, sizeof(links));
+  return;
+}
+
+/**
+ * @brief    Appends the CRC16 and the parity bytes to a frame
+ * 
+ * @param    frame: Frame, with room for FECPARITY + 2 more bytes
+ * @param    size: Frame size
+ * @return   int coded frame size, -1 if the frame is too long
+ */
+int fec_encode(uint8_t *frame, int size)
+{
+  if (size + 2 + FECPARITY > 255)
+    return -1;
+
+  uint16_t crc = crc16_le(0, frame, size);
+  frame[size++] = crc;
+  frame[size++] = crc >> 8;
+
+  uint8_t parity[FECPARITY] = {0};
+  for (int i = 0; i < size; i++)
+  {
+    uint8_t feedback = frame[i] ^ parity[FECPARITY - 1];
+    for (int j = FECPARITY - 1; j > 0; j--)
+      parity[j] = parity[j - 1] ^ fec_multiply(feedback, generator[j]);
+    parity[0] = fec_multiply(feedback, generator[0]);
+  }
+
+  for (int j = 0; j < FECPARITY; j++)
+    frame[size + j] = parity[FECPARITY - 1 - j];
+  return size + FECPARITY;
+}
+
+/**
+ * @brief    Corrects a coded frame in place
+ * 
+ * @param    frame: Coded frame
+ * @param    size: Coded frame size
+ * @param    corrected: Number of corrected bytes
+ * @return   int frame size without CRC16 and parity, -1 if it cannot be
+ *           corrected
+ */
+int fec_decode(uint8_t *frame, int size, int *corrected)
+{
+  *corrected = 0;
+  if (size <= FECPARITY + 2 || size > 255)
+    return -1;
+
+  // Most frames arrive clean: the CRC16 and the first syndrome (the XOR of
+  // the bytes) are checked before the full decoding
+  uint8_t parity = 0;
+  for (int j = 0; j < size; j++)
+    parity ^= frame[j];
+  int ret = fec_checkCrc(frame, size - FECPARITY);
+  if (parity == 0 && ret >= 0)
+    return ret;
+
+  // Syndromes S_i = r(a^i)
+  uint8_t syndromes[FECPARITY];
+  bool clean = 1;
+  for (int i = 0; i < FECPARITY; i++)
+  {
+    uint8_t s = 0;
+    for (int j = 0; j < size; j++)
+      s = fec_multiply(s, gf_exp[i]) ^ frame[j];
+    syndromes[i] = s;
+    clean &= s == 0;
+  }
+  if (clean)
+    return -1;
+
+  // Error locator (Berlekamp-Massey)
+  uint8_t locator[FECPARITY + 1] = {1};
+  uint8_t previous[FECPARITY + 1] = {1};
+  uint8_t temp[FECPARITY + 1];
+  int errors = 0, shift = 1;
+  uint8_t previous_discrepancy = 1;
+
+  for (int n = 0; n < FECPARITY; n++)
+  {
+    uint8_t discrepancy = syndromes[n];
+    for (int i = 1; i <= errors; i++)
+      discrepancy ^= fec_multiply(locator[i], syndromes[n - i]);
+
+    if (discrepancy == 0)
+    {
+      shift++;
+      continue;
+    }
+
+    uint8_t coefficient = gf_exp[gf_log[discrepancy] + 255 - gf_log[previous_discrepancy]];
+    memcpy(temp, locator, sizeof(locator));
+    for (int i = shift; i <= FECPARITY; i++)
+      locator[i] ^= fec_multiply(coefficient, previous[i - shift]);
+
+    if (2 * errors <= n)
+    {
+      errors = n + 1 - errors;
+      memcpy(previous, temp, sizeof(previous));
+      previous_discrepancy = discrepancy;
+      shift = 1;
+    }
+    else
+      shift++;
+  }
+  if (errors > FECPARITY / 2)
+    return -1;
+
+  // Error evaluator: S(x) * locator(x) mod x^FECPARITY
+  uint8_t evaluator[FECPARITY] = {0};
+  for (int i = 0; i < FECPARITY; i++)
+  {
+    for (int j = 0; j <= i && j <= errors; j++)
+      evaluator[i] ^= fec_multiply(locator[j], syndromes[i - j]);
+  }
+
+  // Chien search over the frame positions and Forney's formula
+  int found = 0;
+  for (int position = 0; position < size; position++)
+  {
+    int power = size - 1 - position;
+    int inverse = (255 - power) % 255;
+
+    uint8_t value = 0;
+    for (int i = errors; i >= 0; i--)
+      value = fec_multiply(value, gf_exp[inverse]) ^ locator[i];
+    if (value != 0)
+      continue;
+
+    uint8_t numerator = 0;
+    for (int i = FECPARITY - 1; i >= 0; i--)
+      numerator = fec_multiply(numerator, gf_exp[inverse]) ^ evaluator[i];
+
+    uint8_t denominator = 0;
+    for (int i = errors - (errors % 2 == 0); i >= 1; i -= 2)
+      denominator ^= fec_multiply(locator[i], gf_exp[(inverse * (i - 1)) % 255]);
+    if (denominator == 0)
+      return -1;
+
+    // e = X * evaluator(X^-1) / locator'(X^-1)
+    if (numerator != 0)
+      frame[position] ^= fec_multiply(gf_exp[power], gf_exp[gf_log[numerator] + 255 - gf_log[denominator]]);
+    found++;
+  }
+  if (found != errors)
+    return -1;
+
+  *corrected = found;
+  return fec_checkCrc(frame, size - FECPARITY);
+}
+
+/**
+ * @brief    Returns if frames to a node are coded, broadcasts never are:
+ *           they are most of the airtime and every neighbour would pay for
+ *           the weakest link. Coding is turned on and off with hysteresis
+ *           on the link frame error rate
+ * 
+ * @param    next_node: Next node
+ * @return   bool 1 if coded
+ */
+bool fec_linkEnabled(uint8_t next_node)
+{
+  if (!FECENABLED || next_node == 0 || next_node > MAXNODES || !neighbour_getActive(next_node))
+    return 0;
+
+  uint16_t error_rate = fec_getLinkErrorRate(next_node);
+  bool *enabled = &links[next_node - 1];
+
+  if (!*enabled && error_rate >= FECONPERMILLE)
+  {
+    *enabled = 1;
+    LOG_INFO("FEC on for link to node %d, frame error rate %d/1000", next_node, error_rate);
+  }
+  else if (*enabled && error_rate <= FECOFFPERMILLE)
+  {
+    *enabled = 0;
+    LOG_INFO("FEC off for link to node %d, frame error rate %d/1000", next_node, error_rate);
+  }
+  return *enabled;
+}
+
+/**
+ * @brief    Returns the frame error rate of a link
+ * 
+ * @param    node: Neighbour node
+ * @return   uint16_t frame error rate (1/1000)
+ */
+uint16_t fec_getLinkErrorRate(uint8_t node)
+{
+  if (!neighbour_getActive(node))
+    return 0;
+
+  int reverse_prr = neighbour_getReversePrr(node);
+  return 1000 - (reverse_prr >= 0 ? reverse_prr : neighbour_getPrr(node));
+}
\ No newline at end of file
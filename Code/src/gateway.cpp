@@ -0,0 +1,533 @@
+/**
+ * @file     gateway.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Serial gateway.
+ *           Frames are COBS encoded between two 0 bytes, so they can be
+ *           told apart from the log lines sharing the serial port:
+ *           0, COBS(type, sequence number, data, CRC16 of type to data), 0.
+ *           Every command is answered by a frame with type
+ *           command + gateway_reply, the same sequence number and a
+ *           return_type status as first data byte. Replies:
+ *           - gateway_send: status, unicast messages that can be sent
+ *             now, then return_type (1 byte) and packet id (uint32) for
+ *             each message sent. The messages that do not fit the reply,
+ *             and the ones after a message refused by the full queue or
+ *             the congestion window, are not sent.
+ *           - gateway_nodes: status, next node to ask for (0 at the end),
+ *             then for each node: node, hops, next node, RSSI (int8), link
+ *             quality (%), flags (bit 0: low-power leaf), name size, name.
+ *           - gateway_stats: status, metrics snapshot (see metrics.cpp).
+ *           - gateway_stream: status.
+ *           - gateway_conversations: status, next peer to ask for (0 at
+ *             the end), then for each conversation: peer, messages
+ *             (uint16), unread messages (uint16), newest message number
+ *             (uint32).
+ *           - gateway_thread: status, cursor of the next page (uint32, 0
+ *             at the end), unread messages (uint16) before the command,
+ *             then for each message, newest first: number (uint32),
+ *             sender, receiver, packet id (uint32), acknowledgments, size,
+ *             text. The cursor of the first page is 0.
+ *           - gateway_ota: status, image bytes received (uint32). The
+ *             parts are sent in order, the first one (offset 0) starts
+ *             the upload and carries the image signature, the last one
+ *             stages the image.
+ *           The single character m still asks for the metrics snapshot
+ *           until the first 0 byte is received.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "gateway.h"
+#include "L1.h"
+#include "L2.h"
+#include "L3.h"
+#include "message.h"
+#include "crypto.h"
+#include "congestion.h"
+#include "ota.h"
+#include "neighbour.h"
+#include "metrics.h"
+#include "log.h"
+#include "rom/crc.h"
+
+static_assert(GATEWAYFRAME >= METRICSSNAPSHOT + 5, "Gateway frames need to fit the metrics snapshot");
+
+// Private variables
+static uint8_t rx_buffer[GATEWAYFRAME + GATEWAYFRAME / 254 + 1];
+static size_t rx_size = 0;
+static bool rx_started = 0;
+static bool rx_overflow = 0;
+static uint8_t frame[GATEWAYFRAME];
+static uint8_t encoded[GATEWAYFRAME + GATEWAYFRAME / 254 + 3];
+static bool streaming = 0;
+
+// Private functions
+void gateway_handleFrame();
+size_t gateway_handleSend(const uint8_t *data, size_t size, uint8_t *reply);
+size_t gateway_handleNodes(const uint8_t *data, size_t size, uint8_t *reply);
+size_t gateway_handleConversations(const uint8_t *data, size_t size, uint8_t *reply);
+size_t gateway_handleThread(const uint8_t *data, size_t size, uint8_t *reply);
+size_t gateway_handleOta(const uint8_t *data, size_t size, uint8_t *reply);
+void gateway_write(uint8_t type, uint8_t sequence, size_t size);
+size_t gateway_encode(const uint8_t *input, size_t size, uint8_t *output);
+int gateway_decode(uint8_t *buffer, size_t size);
+
+// Functions
+
+/**
+ * @brief    Initializes the serial gateway
+ * 
+ */
+void gateway_init()
+{
+  rx_size = 0;
+  rx_started = 0;
+  rx_overflow = 0;
+  streaming = 0;
+  return;
+}
+
+/**
+ * @brief    Reads the serial port and handles the complete frames
+ * 
+ */
+void gateway_poll()
+{
+  while (Serial.available())
+  {
+    int c = Serial.read();
+    if (c < 0)
+      break;
+
+    // Before the first frame, single character commands
+    if (!rx_started)
+    {
+      if (c == 0)
+        rx_started = 1;
+      else if (c == 'm')
+        metrics_printSnapshot();
+      continue;
+    }
+
+    if (c == 0)
+    {
+      if (rx_size > 0 && !rx_overflow)
+        gateway_handleFrame();
+      rx_size = 0;
+      rx_overflow = 0;
+    }
+    else if (rx_size == sizeof(rx_buffer))
+      rx_overflow = 1;
+    else
+      rx_buffer[rx_size++] = c;
+  }
+  return;
+}
+
+/**
+ * @brief    Streams a received message to the host
+ * 
+ * @param    sender: Sender node
+ * @param    receiver: Receiver node, broadcast or group address
+ * @param    packet_id: Packet id
+ * @param    message: Message
+ */
+void gateway_messageReceived(uint8_t sender, uint8_t receiver, uint32_t packet_id, const char *message)
+{
+  if (!streaming)
+    return;
+
+  uint8_t *data = frame + 2;
+  size_t size = strlen(message);
+  if (size > GATEWAYFRAME - 11)
+    size = GATEWAYFRAME - 11;
+
+  data[0] = sender;
+  data[1] = receiver;
+  memcpy(data + 2, &packet_id, 4);
+  data[6] = size;
+  memcpy(data + 7, message, size);
+  gateway_write(gateway_message, 0, size + 7);
+  return;
+}
+
+/**
+ * @brief    Streams a received acknowledgment to the host
+ * 
+ * @param    node: Node that received the message
+ * @param    packet_id: Packet id of the message
+ */
+void gateway_ackReceived(uint8_t node, uint32_t packet_id)
+{
+  if (!streaming)
+    return;
+
+  uint8_t *data = frame + 2;
+  data[0] = node;
+  memcpy(data + 1, &packet_id, 4);
+  gateway_write(gateway_ack, 0, 5);
+  return;
+}
+
+/**
+ * @brief    Decodes and handles the frame in the receive buffer
+ * 
+ */
+void gateway_handleFrame()
+{
+  int size = gateway_decode(rx_buffer, rx_size);
+  if (size < 4)
+    return;
+
+  uint16_t crc;
+  memcpy(&crc, rx_buffer + size - 2, 2);
+  if (crc != crc16_le(0, rx_buffer, size - 2))
+  {
+    LOG_WARN("Gateway frame CRC error");
+    return;
+  }
+
+  uint8_t type = rx_buffer[0];
+  uint8_t sequence = rx_buffer[1];
+  const uint8_t *data = rx_buffer + 2;
+  size -= 4;
+
+  uint8_t *reply = frame + 2;
+  size_t reply_size = 1;
+  reply[0] = ret_ok;
+
+  switch (type)
+  {
+  case gateway_send:
+    reply_size = gateway_handleSend(data, size, reply);
+    break;
+  case gateway_nodes:
+    reply_size = gateway_handleNodes(data, size, reply);
+    break;
+  case gateway_conversations:
+    reply_size = gateway_handleConversations(data, size, reply);
+    break;
+  case gateway_thread:
+    reply_size = gateway_handleThread(data, size, reply);
+    break;
+  case gateway_ota:
+    reply_size = gateway_handleOta(data, size, reply);
+    break;
+  case gateway_stats:
+    reply_size += metrics_fillSnapshot(reply + 1);
+    break;
+  case gateway_stream:
+    streaming = size > 0 && data[0];
+    break;
+  default:
+    reply[0] = ret_error;
+    break;
+  }
+
+  gateway_write(type + gateway_reply, sequence, reply_size);
+  return;
+}
+
+/**
+ * @brief    Sends a batch of messages
+ * 
+ * @param    data: Messages (receiver, size, text, repeated)
+ * @param    size: Data size
+ * @param    reply: Reply data
+ * @return   size_t reply size
+ */
+size_t gateway_handleSend(const uint8_t *data, size_t size, uint8_t *reply)
+{
+  size_t index = 0;
+  size_t reply_size = 2;
+
+  while (index + 2 <= size && reply_size + 5 <= GATEWAYFRAME - 4)
+  {
+    uint8_t receiver = data[index];
+    uint8_t message_size = data[index + 1];
+    index += 2;
+    if (index + message_size > size)
+    {
+      reply[0] = ret_send_size_error;
+      break;
+    }
+
+    char message[256];
+    memcpy(message, data + index, message_size);
+    message[message_size] = 0;
+    index += message_size;
+
+    return_type ret = L2_sendMessage(receiver, message, 0);
+    uint32_t packet_id = ret == ret_ok ? crypto_getLastId() : 0;
+    reply[reply_size] = ret;
+    memcpy(reply + reply_size + 1, &packet_id, 4);
+    reply_size += 5;
+
+    // The messages keep their order
+    if (ret == ret_buffer_full || ret == ret_congested)
+      break;
+  }
+
+  reply[1] = congestion_getRoom();
+  return reply_size;
+}
+
+/**
+ * @brief    Lists the active nodes, from a node number on
+ * 
+ * @param    data: First node
+ * @param    size: Data size
+ * @param    reply: Reply data
+ * @return   size_t reply size
+ */
+size_t gateway_handleNodes(const uint8_t *data, size_t size, uint8_t *reply)
+{
+  int node = size > 0 && data[0] > 0 ? data[0] : 1;
+  size_t reply_size = 2;
+
+  reply[1] = 0;
+  for (; node <= MAXNODES; node++)
+  {
+    if (node == NODENUMBER || !L3_getActive(node))
+      continue;
+
+    char *name = L3_getNodeName(node);
+    uint8_t name_size = strlen(name);
+    if (reply_size + 7 + name_size > GATEWAYFRAME - 4)
+    {
+      reply[1] = node;
+      break;
+    }
+
+    uint8_t *item = reply + reply_size;
+    item[0] = node;
+    item[1] = L3_getHops(node);
+    item[2] = L3_getNextNode(node);
+    int rssi = L3_getRssi(node);
+    item[3] = (int8_t)(rssi < -128 ? -128 : rssi);
+    item[4] = neighbour_getQuality(item[2]) / 10;
+    item[5] = L3_getLowPower(node) ? 1 : 0;
+    item[6] = name_size;
+    memcpy(item + 7, name, name_size);
+    reply_size += 7 + name_size;
+  }
+
+  return reply_size;
+}
+
+/**
+ * @brief    Lists the conversations, from a peer on
+ * 
+ * @param    data: First peer
+ * @param    size: Data size
+ * @param    reply: Reply data
+ * @return   size_t reply size
+ */
+size_t gateway_handleConversations(const uint8_t *data, size_t size, uint8_t *reply)
+{
+  int peer = size > 0 ? data[0] : 0;
+  size_t reply_size = 2;
+
+  reply[1] = 0;
+  while ((peer = message_getNextConversation(peer)) >= 0)
+  {
+    if (reply_size + 9 > GATEWAYFRAME - 4)
+    {
+      reply[1] = peer;
+      break;
+    }
+
+    const conversation_struct *conversation = message_getConversation(peer);
+    message_struct *newest;
+    message_getThread(peer, 0, &newest, 1);
+
+    uint8_t *item = reply + reply_size;
+    item[0] = peer;
+    memcpy(item + 1, &conversation->count, 2);
+    memcpy(item + 3, &conversation->unread, 2);
+    memcpy(item + 5, &newest->number, 4);
+    reply_size += 9;
+    peer++;
+  }
+
+  return reply_size;
+}
+
+/**
+ * @brief    Returns a page of a conversation
+ * 
+ * @param    data: Peer, cursor (uint32), 1 to mark the conversation read
+ * @param    size: Data size
+ * @param    reply: Reply data
+ * @return   size_t reply size
+ */
+size_t gateway_handleThread(const uint8_t *data, size_t size, uint8_t *reply)
+{
+  if (size < 5)
+  {
+    reply[0] = ret_error;
+    return 1;
+  }
+
+  uint8_t peer = data[0];
+  uint32_t before;
+  memcpy(&before, data + 1, 4);
+
+  uint16_t unread = message_getConversation(peer)->unread;
+  if (size > 5 && data[5])
+    message_markRead(peer);
+
+  message_struct *messages[MESSAGEPAGE + 1];
+  int count = message_getThread(peer, before, messages, MESSAGEPAGE + 1);
+  size_t reply_size = 7;
+  int i;
+
+  for (i = 0; i < count && i < MESSAGEPAGE; i++)
+  {
+    uint8_t message_size = strlen(messages[i]->message);
+    if (reply_size + 12 + message_size > GATEWAYFRAME - 4)
+      break;
+
+    uint8_t *item = reply + reply_size;
+    memcpy(item, &messages[i]->number, 4);
+    item[4] = messages[i]->sender;
+    item[5] = messages[i]->receiver;
+    memcpy(item + 6, &messages[i]->id, 4);
+    item[10] = message_countAcks(messages[i]);
+    item[11] = message_size;
+    memcpy(item + 12, messages[i]->message, message_size);
+    reply_size += 12 + message_size;
+  }
+
+  uint32_t next = i < count && i > 0 ? messages[i - 1]->number : 0;
+  memcpy(reply + 1, &next, 4);
+  memcpy(reply + 5, &unread, 2);
+  return reply_size;
+}
+
+/**
+ * @brief    Writes a part of a firmware image
+ * 
+ * @param    data: Version (uint16), image size (uint32), offset (uint32),
+ *           image signature (OTASIGNATURE bytes, first part only), bytes
+ * @param    size: Data size
+ * @param    reply: Reply data
+ * @return   size_t reply size
+ */
+size_t gateway_handleOta(const uint8_t *data, size_t size, uint8_t *reply)
+{
+  if (size < 10)
+  {
+    reply[0] = ret_error;
+    return 1;
+  }
+
+  uint16_t version;
+  uint32_t image_size, offset;
+  memcpy(&version, data, 2);
+  memcpy(&image_size, data + 2, 4);
+  memcpy(&offset, data + 6, 4);
+
+  size_t header = offset == 0 ? 10 + OTASIGNATURE : 10;
+  if (size < header)
+  {
+    reply[0] = ret_error;
+    return 1;
+  }
+
+  reply[0] = ota_upload(version, image_size, offset, offset == 0 ? data + 10 : NULL, data + header, size - header);
+  uint32_t received = reply[0] == ret_ok ? offset + size - header : 0;
+  memcpy(reply + 1, &received, 4);
+  return 5;
+}
+
+/**
+ * @brief    Writes a frame on the serial port
+ * 
+ * @param    type: Frame type
+ * @param    sequence: Sequence number of the command answered, 0 if none
+ * @param    size: Data size, the data is already at frame + 2
+ */
+void gateway_write(uint8_t type, uint8_t sequence, size_t size)
+{
+  frame[0] = type;
+  frame[1] = sequence;
+  size += 2;
+
+  uint16_t crc = crc16_le(0, frame, size);
+  memcpy(frame + size, &crc, 2);
+  size += 2;
+
+  encoded[0] = 0;
+  size = gateway_encode(frame, size, encoded + 1) + 1;
+  encoded[size++] = 0;
+  Serial.write(encoded, size);
+  return;
+}
+
+/**
+ * @brief    COBS encodes a buffer
+ * 
+ * @param    input: Data
+ * @param    size: Data size
+ * @param    output: Encoded data, at least size + size / 254 + 1 bytes
+ * @return   size_t encoded size
+ */
+size_t gateway_encode(const uint8_t *input, size_t size, uint8_t *output)
+{
+  size_t code_index = 0;
+  size_t index = 1;
+  uint8_t code = 1;
+
+  for (size_t i = 0; i < size; i++)
+  {
+    if (input[i] != 0)
+    {
+      output[index++] = input[i];
+      code++;
+    }
+
+    if (input[i] == 0 || code == 0xFF)
+    {
+      output[code_index] = code;
+      code = 1;
+      code_index = index++;
+    }
+  }
+
+  output[code_index] = code;
+  return index;
+}
+
+/**
+ * @brief    COBS decodes a buffer in place
+ * 
+ * @param    buffer: Encoded data, without the 0 delimiters
+ * @param    size: Encoded size
+ * @return   int decoded size, -1 if the data is not valid
+ */
+int gateway_decode(uint8_t *buffer, size_t size)
+{
+  size_t read = 0;
+  size_t write = 0;
+
+  while (read < size)
+  {
+    uint8_t code = buffer[read++];
+    if (code == 0 || read + code - 1 > size)
+      return -1;
+
+    for (int i = 1; i < code; i++)
+      buffer[write++] = buffer[read++];
+
+    if (code < 0xFF && read < size)
+      buffer[write++] = 0;
+  }
+
+  return write;
+}
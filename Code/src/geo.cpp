@@ -0,0 +1,274 @@
+/**
+ * @file     geo.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Geographic forwarding.
+ *           Nodes are fixed installations: each one has a position (GEOX,
+ *           GEOY) sent in its announces, route requests and route replies.
+ *           The sender puts the receiver position in the packet, so the
+ *           relays only need the positions of their neighbours. In greedy
+ *           mode the packet goes to the usable neighbour with the best
+ *           progress towards the receiver, weighted by the link quality and
+ *           the load of the neighbour.
+ *           A node with no neighbour closer than itself is at the edge of a
+ *           void: the packet switches to perimeter mode and walks the faces
+ *           of the planar (Gabriel) subgraph of the links with the
+ *           right-hand rule, until it reaches a node closer to the receiver
+ *           than where perimeter mode started. That distance is carried in
+ *           the packet. The face change of GPSR is left out, a packet that
+ *           walks a whole face is stopped by the TTL.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "geo.h"
+#include "neighbour.h"
+#include "log.h"
+
+// Private variables
+static geo_position_struct positions[MAXNODES];
+
+// Private functions
+float geo_distance(const geo_position_struct *a, const geo_position_struct *b);
+float geo_bearing(const geo_position_struct *from, const geo_position_struct *to);
+bool geo_isNeighbour(uint8_t node);
+bool geo_isPlanarLink(uint8_t node);
+uint8_t geo_getGreedyNode(const geo_position_struct *target);
+uint8_t geo_getPerimeterNode(float reference);
+
+// Functions
+
+/**
+ * @brief    Initializes the position table with the position of this node
+ * 
+ */
+void geo_init()
+{
+  memset(positions, 0, sizeof(positions));
+  if (GEOENABLED)
+    geo_setPosition(NODENUMBER, GEOX, GEOY);
+  return;
+}
+
+/**
+ * @brief    Sets the position of a node, after its announce or route
+ *           request or reply
+ * 
+ * @param    node: Node number
+ * @param    x: Position east of the network origin (GEOUNITM)
+ * @param    y: Position north of the network origin (GEOUNITM)
+ */
+void geo_setPosition(uint8_t node, int16_t x, int16_t y)
+{
+  if (node == 0 || node > MAXNODES)
+    return;
+
+  positions[node - 1].x = x;
+  positions[node - 1].y = y;
+  positions[node - 1].valid = 1;
+}
+
+/**
+ * @brief    Returns the position of a node
+ * 
+ * @param    node: Node number
+ * @param    x: Position east of the network origin (GEOUNITM)
+ * @param    y: Position north of the network origin (GEOUNITM)
+ * @return   bool 1 if the position is known
+ */
+bool geo_getPosition(uint8_t node, int16_t *x, int16_t *y)
+{
+  if (node == 0 || node > MAXNODES || !positions[node - 1].valid)
+    return 0;
+
+  *x = positions[node - 1].x;
+  *y = positions[node - 1].y;
+  return 1;
+}
+
+/**
+ * @brief    Returns the next node of a unicast packet towards its receiver.
+ *           A packet without receiver position gets the one known here
+ * 
+ * @param    packet: Packet, its perimeter mode distance is updated
+ * @param    from: Node the packet came from, NODENUMBER if sent by this node
+ * @return   uint8_t node number, 0 if the receiver position is not known
+ */
+uint8_t geo_getNextNode(pack_struct *packet, uint8_t from)
+{
+  const geo_position_struct *self = &positions[NODENUMBER - 1];
+
+  if (!packet->target.valid && packet->receiver >= 1 && packet->receiver <= MAXNODES && positions[packet->receiver - 1].valid)
+  {
+    packet->target = positions[packet->receiver - 1];
+    packet->perimeter = 0;
+  }
+
+  if (!GEOENABLED || !packet->target.valid || !self->valid)
+    return 0;
+
+  float distance = geo_distance(self, &packet->target);
+
+  // Back to greedy mode once closer than where perimeter mode started
+  if (packet->perimeter && distance < packet->perimeter)
+    packet->perimeter = 0;
+
+  if (packet->perimeter == 0)
+  {
+    uint8_t next_node = geo_getGreedyNode(&packet->target);
+    if (next_node)
+      return next_node;
+
+    packet->perimeter = distance < 1 ? 1 : distance > GEOUNKNOWN - 1 ? GEOUNKNOWN - 1 : (uint16_t)distance;
+    LOG_DEBUG("Perimeter mode to %d at distance %d", packet->receiver, packet->perimeter);
+
+    // The first face is the one crossed by the line to the receiver
+    return geo_getPerimeterNode(geo_bearing(self, &packet->target));
+  }
+
+  // The next link counterclockwise from the one the packet came on
+  if (from == NODENUMBER || from == 0 || from > MAXNODES || !positions[from - 1].valid)
+    return geo_getPerimeterNode(geo_bearing(self, &packet->target));
+  return geo_getPerimeterNode(geo_bearing(self, &positions[from - 1]));
+}
+
+/**
+ * @brief    Returns the number of positions known
+ * 
+ * @return   int positions count
+ */
+int geo_countPositions()
+{
+  int count = 0;
+  for (int i = 0; i < MAXNODES; i++)
+    count += positions[i].valid;
+  return count;
+}
+
+/**
+ * @brief    Returns the distance between two positions
+ * 
+ * @param    a: Position
+ * @param    b: Position
+ * @return   float distance (GEOUNITM)
+ */
+float geo_distance(const geo_position_struct *a, const geo_position_struct *b)
+{
+  float dx = (float)b->x - a->x;
+  float dy = (float)b->y - a->y;
+  return sqrtf(dx * dx + dy * dy);
+}
+
+/**
+ * @brief    Returns the bearing from a position to another
+ * 
+ * @param    from: Position
+ * @param    to: Position
+ * @return   float angle counterclockwise from east (rad)
+ */
+float geo_bearing(const geo_position_struct *from, const geo_position_struct *to)
+{
+  return atan2f((float)to->y - from->y, (float)to->x - from->x);
+}
+
+/**
+ * @brief    Returns if a node is a usable neighbour with a known position
+ * 
+ * @param    node: Node number
+ * @return   bool 1 if it can be the next node
+ */
+bool geo_isNeighbour(uint8_t node)
+{
+  return node != NODENUMBER && positions[node - 1].valid && neighbour_isUsable(node);
+}
+
+/**
+ * @brief    Returns if the link to a neighbour belongs to the Gabriel
+ *           graph: no other neighbour is inside the circle whose diameter
+ *           is the link. The graph has no crossing links
+ * 
+ * @param    node: Neighbour node number
+ * @return   bool 1 if the link is kept
+ */
+bool geo_isPlanarLink(uint8_t node)
+{
+  geo_position_struct middle;
+  middle.x = ((int32_t)positions[NODENUMBER - 1].x + positions[node - 1].x) / 2;
+  middle.y = ((int32_t)positions[NODENUMBER - 1].y + positions[node - 1].y) / 2;
+  float radius = geo_distance(&positions[NODENUMBER - 1], &positions[node - 1]) / 2;
+
+  for (int i = 1; i <= MAXNODES; i++)
+  {
+    if (i != node && geo_isNeighbour(i) && geo_distance(&middle, &positions[i - 1]) < radius)
+      return 0;
+  }
+  return 1;
+}
+
+/**
+ * @brief    Returns the usable neighbour with the best expected progress
+ *           towards a position: the distance it gains times its link
+ *           quality and the free part of its send queue, so long, lossy
+ *           or congested links are not always preferred
+ * 
+ * @param    target: Receiver position
+ * @return   uint8_t node number, 0 if no neighbour is closer than this node
+ */
+uint8_t geo_getGreedyNode(const geo_position_struct *target)
+{
+  uint8_t next_node = 0;
+  float distance = geo_distance(&positions[NODENUMBER - 1], target);
+  float best = 0;
+
+  for (int i = 1; i <= MAXNODES; i++)
+  {
+    if (!geo_isNeighbour(i))
+      continue;
+
+    float progress = distance - geo_distance(&positions[i - 1], target);
+    float score = progress * neighbour_getQuality(i) * (101 - neighbour_getLoad(i));
+    if (progress > 0 && score > best)
+    {
+      best = score;
+      next_node = i;
+    }
+  }
+  return next_node;
+}
+
+/**
+ * @brief    Right-hand rule: returns the planar neighbour reached first
+ *           turning counterclockwise from a bearing
+ * 
+ * @param    reference: Bearing to start from (rad)
+ * @return   uint8_t node number, 0 if no usable neighbour has a position
+ */
+uint8_t geo_getPerimeterNode(float reference)
+{
+  uint8_t next_node = 0;
+  float best = 0;
+
+  for (int i = 1; i <= MAXNODES; i++)
+  {
+    if (!geo_isNeighbour(i) || !geo_isPlanarLink(i))
+      continue;
+
+    // The link the packet came on is the last choice (full turn)
+    float angle = geo_bearing(&positions[NODENUMBER - 1], &positions[i - 1]) - reference;
+    while (angle <= 0.0001f)
+      angle += 2 * PI;
+    while (angle > 2 * PI + 0.0001f)
+      angle -= 2 * PI;
+
+    if (next_node == 0 || angle < best)
+    {
+      best = angle;
+      next_node = i;
+    }
+  }
+  return next_node;
+}
@@ -0,0 +1,337 @@
+/**
+ * @file     group.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Group channels.
+ *           Group addresses are the CRC16 of the group name modulo
+ *           GROUPCOUNT, so two names can share an address and its members.
+ *           Group messages carry a tag, other bits of the same CRC16, and
+ *           members of a name with another tag ignore them.
+ *           Group packets are relayed by every node on the way to the
+ *           members, a small cache of the last packets drops the copies
+ *           received from several relays.
+ *           A member does not acknowledge a group or broadcast message
+ *           right away: it waits GROUPACKMS for every hop left to the end of
+ *           the TTL, the members farther away answer first. Acknowledgments
+ *           going to the same sender for the same message are merged by
+ *           every node on the way into one packet with the list of nodes,
+ *           which keeps the hops left of the merged ones.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "group.h"
+#include "L2.h"
+#include "L3.h"
+#include "scheduler.h"
+#include "log.h"
+#include "rom/crc.h"
+
+#define GROUPACKNODES (255 - L1HEADER - GEOHEADER - 5 - CRYPTOTAG) // Nodes of an acknowledgment that fit a frame with every optional field
+
+#if MAXNODES >= GROUPADDR || GROUPCOUNT > 16
+#error "Group addresses need to be after the node numbers, at most 16 groups"
+#endif
+
+// Private variables
+static char names[GROUPCOUNT][16];
+static uint16_t memberships = 0;
+static group_packet_struct recent[GROUPCACHE];
+static int recent_index = 0;
+static group_ack_struct pending[GROUPACKPENDING];
+
+// Private functions
+void group_ackTimer();
+void group_armAckTimer();
+
+// Functions
+
+/**
+ * @brief    Initializes the group memberships and acknowledgments
+ * 
+ */
+void group_init()
+{
+  memset(names, 0, sizeof(names));
+  memberships = 0;
+  memset(recent, 0, sizeof(recent));
+  memset(pending, 0, sizeof(pending));
+
+  scheduler_register(timer_group_ack, group_ackTimer, 0);
+  return;
+}
+
+/**
+ * @brief    Returns if an address is a group address
+ * 
+ * @param    address: Address
+ * @return   bool 1 if group
+ */
+bool group_isAddress(uint8_t address)
+{
+  return address >= GROUPADDR && address < GROUPADDR + GROUPCOUNT;
+}
+
+/**
+ * @brief    Returns the address of a group name
+ * 
+ * @param    name: Group name, starting with #
+ * @return   uint8_t group address, 0 if not a group name
+ */
+uint8_t group_getAddress(const char *name)
+{
+  if (name[0] != '#' || name[1] == 0)
+    return 0;
+  return GROUPADDR + crc16_le(0, (const uint8_t *)name, strlen(name)) % GROUPCOUNT;
+}
+
+/**
+ * @brief    Returns the tag of a joined group, the CRC16 of its name divided
+ *           by GROUPCOUNT
+ * 
+ * @param    address: Group address
+ * @return   uint8_t tag (1-255), 0 if not joined
+ */
+uint8_t group_getTag(uint8_t address)
+{
+  if (!group_isMember(address))
+    return 0;
+
+  const char *name = names[address - GROUPADDR];
+  return crc16_le(0, (const uint8_t *)name, strlen(name)) / GROUPCOUNT % 255 + 1;
+}
+
+/**
+ * @brief    Checks if a group message is for the joined group name, and
+ *           not for another name with the same address
+ * 
+ * @param    address: Group address
+ * @param    tag: Tag of the message, 0 if its sender did not know it
+ * @return   bool 1 if for the joined name
+ */
+bool group_checkTag(uint8_t address, uint8_t tag)
+{
+  return tag == 0 || tag == group_getTag(address);
+}
+
+/**
+ * @brief    Returns the membership bit of a group address
+ * 
+ * @param    address: Group address
+ * @return   uint16_t bit mask, 0 if not a group address
+ */
+uint16_t group_getMask(uint8_t address)
+{
+  if (!group_isAddress(address))
+    return 0;
+  return 1 << (address - GROUPADDR);
+}
+
+/**
+ * @brief    Joins a group and announces the membership
+ * 
+ * @param    name: Group name, starting with #
+ * @return   return_type status
+ */
+return_type group_join(const char *name)
+{
+  uint8_t address = group_getAddress(name);
+
+  if (address == 0 || strlen(name) > 15)
+    return ret_error;
+
+  if (group_isMember(address))
+  {
+    if (strcmp(names[address - GROUPADDR], name) == 0)
+      return ret_ok;
+
+    LOG_WARN_TEXT(names[address - GROUPADDR], "Group address %d already used by", address);
+    return ret_error;
+  }
+
+  strcpy(names[address - GROUPADDR], name);
+  memberships |= group_getMask(address);
+  L3_updateNode();
+  L2_sendAnnounce();
+  LOG_INFO_TEXT(name, "Joined group");
+
+  return ret_ok;
+}
+
+/**
+ * @brief    Returns if this node is a member of a group
+ * 
+ * @param    address: Group address
+ * @return   bool 1 if member
+ */
+bool group_isMember(uint8_t address)
+{
+  return memberships & group_getMask(address);
+}
+
+/**
+ * @brief    Returns the groups joined by this node
+ * 
+ * @return   uint16_t bit mask, bit n for group address GROUPADDR + n
+ */
+uint16_t group_getMemberships()
+{
+  return memberships;
+}
+
+/**
+ * @brief    Returns the name of a group address
+ * 
+ * @param    address: Group address
+ * @return   char* group name, "Group n" if not joined
+ */
+char *group_getName(uint8_t address)
+{
+  static char unknown[16];
+
+  if (group_isMember(address))
+    return names[address - GROUPADDR];
+
+  sprintf(unknown, "Group %d", address - GROUPADDR + 1);
+  return unknown;
+}
+
+/**
+ * @brief    Checks if a group packet was already received, and remembers it
+ * 
+ * @param    sender: Packet sender
+ * @param    id: Packet id
+ * @return   bool 1 if duplicate
+ */
+bool group_checkDuplicate(uint8_t sender, uint32_t id)
+{
+  for (int i = 0; i < GROUPCACHE; i++)
+  {
+    if (recent[i].sender == sender && recent[i].id == id)
+      return 1;
+  }
+
+  recent[recent_index].sender = sender;
+  recent[recent_index].id = id;
+  recent_index = (recent_index + 1) % GROUPCACHE;
+  return 0;
+}
+
+/**
+ * @brief    Adds nodes to the acknowledgment of a message, sent when the
+ *           delay expires together with the nodes added in the meantime
+ * 
+ * @param    receiver: Message sender, receiver of the acknowledgment
+ * @param    packet_id: Message id
+ * @param    nodes: Nodes that received the message
+ * @param    count: Number of nodes
+ * @param    ttl: Acknowledgment TTL, the largest of the merged ones is kept
+ * @param    delay: Time before sending, if it is the first one (ms)
+ */
+void group_addAck(uint8_t receiver, uint32_t packet_id, const uint8_t *nodes, uint8_t count, uint8_t ttl, uint32_t delay)
+{
+  group_ack_struct *ack = NULL;
+
+  for (int i = 0; i < GROUPACKPENDING && ack == NULL; i++)
+  {
+    if (pending[i].count && pending[i].receiver == receiver && pending[i].packet_id == packet_id)
+      ack = &pending[i];
+  }
+
+  if (ack == NULL)
+  {
+    for (int i = 0; i < GROUPACKPENDING && ack == NULL; i++)
+    {
+      if (pending[i].count == 0)
+        ack = &pending[i];
+    }
+
+    // No room to wait: the acknowledgment goes right away
+    if (ack == NULL)
+    {
+      L2_sendacknowledgment(receiver, packet_id, nodes, count, ttl);
+      return;
+    }
+
+    ack->receiver = receiver;
+    ack->packet_id = packet_id;
+    ack->deadline = millis() + delay;
+    ack->ttl = 0;
+  }
+
+  if (ttl > ack->ttl)
+    ack->ttl = ttl;
+
+  for (int i = 0; i < count; i++)
+  {
+    bool found = 0;
+    for (int j = 0; j < ack->count && !found; j++)
+      found = ack->nodes[j] == nodes[i];
+    if (found)
+      continue;
+
+    // A full acknowledgment is sent and the next nodes start a new one
+    if (ack->count >= GROUPACKNODES || ack->count >= MAXNODES)
+    {
+      L2_sendacknowledgment(ack->receiver, ack->packet_id, ack->nodes, ack->count, ack->ttl);
+      ack->count = 0;
+    }
+    ack->nodes[ack->count++] = nodes[i];
+  }
+
+  group_armAckTimer();
+  return;
+}
+
+/**
+ * @brief    Acknowledgment timer: sends the merged acknowledgments whose
+ *           delay expired
+ * 
+ */
+void group_ackTimer()
+{
+  uint32_t now = millis();
+
+  for (int i = 0; i < GROUPACKPENDING; i++)
+  {
+    if (pending[i].count && (int32_t)(pending[i].deadline - now) <= 0)
+    {
+      LOG_DEBUG("Acknowledging message %x to %d for %d nodes", pending[i].packet_id, pending[i].receiver, pending[i].count);
+      L2_sendacknowledgment(pending[i].receiver, pending[i].packet_id, pending[i].nodes, pending[i].count, pending[i].ttl);
+      pending[i].count = 0;
+    }
+  }
+
+  group_armAckTimer();
+}
+
+/**
+ * @brief    Arms the acknowledgment timer on the first deadline
+ * 
+ */
+void group_armAckTimer()
+{
+  uint32_t now = millis();
+  bool armed = 0;
+  int32_t wait = 0;
+
+  for (int i = 0; i < GROUPACKPENDING; i++)
+  {
+    if (pending[i].count == 0)
+      continue;
+
+    int32_t remaining = pending[i].deadline - now;
+    if (!armed || remaining < wait)
+      wait = remaining;
+    armed = 1;
+  }
+
+  if (!armed)
+    scheduler_cancel(timer_group_ack);
+  else
+    scheduler_set(timer_group_ack, wait > 0 ? wait : 0);
+}
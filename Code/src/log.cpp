@@ -0,0 +1,142 @@
+/**
+ * @file     log.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Deferred logging.
+ *           Records are queued by log_write() and printed on the serial
+ *           port by log_drain(), called from a low priority task.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "log.h"
+#include "metrics.h"
+
+// Private variables
+static log_record_struct log_buffer[LOGBUFFER];
+static int log_front = 0;
+static int log_rear = 0;
+static uint32_t log_dropped = 0;
+
+#ifdef ARDUINO_ARCH_ESP32
+static portMUX_TYPE log_mux = portMUX_INITIALIZER_UNLOCKED;
+#define LOG_LOCK() portENTER_CRITICAL(&log_mux)
+#define LOG_UNLOCK() portEXIT_CRITICAL(&log_mux)
+#else
+#define LOG_LOCK()
+#define LOG_UNLOCK()
+#endif
+
+static const char log_levels[] = {' ', 'E', 'W', 'I', 'D'};
+
+// Private functions
+void log_task(void *parameter);
+
+// Functions
+
+/**
+ * @brief    Starts the log drain task
+ * 
+ */
+void log_init()
+{
+#ifdef ARDUINO_ARCH_ESP32
+  xTaskCreatePinnedToCore(log_task, "log", 3072, NULL, 1, NULL, 0);
+#endif
+  return;
+}
+
+/**
+ * @brief    Queues a log record, use the LOG_ macros instead
+ * 
+ * @param    level: Log level
+ * @param    format: printf format (string literal, integer conversions only)
+ * @param    text: Text printed after the arguments, can be NULL
+ * @param    arg0-3: Format arguments
+ */
+void log_write(uint8_t level, const char *format, const char *text, uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3)
+{
+  LOG_LOCK();
+  int next = (log_rear + 1) % LOGBUFFER;
+  if (next == log_front)
+  {
+    log_dropped++;
+    LOG_UNLOCK();
+    metrics_count(metric_log_drops);
+    return;
+  }
+
+  log_record_struct *record = &log_buffer[log_rear];
+  record->timestamp = millis();
+  record->format = format;
+  record->level = level;
+  record->args[0] = arg0;
+  record->args[1] = arg1;
+  record->args[2] = arg2;
+  record->args[3] = arg3;
+  if (text != NULL)
+  {
+    strncpy(record->text, text, LOGTEXTSIZE - 1);
+    record->text[LOGTEXTSIZE - 1] = 0;
+  }
+  else
+    record->text[0] = 0;
+
+  log_rear = next;
+  LOG_UNLOCK();
+  return;
+}
+
+/**
+ * @brief    Prints all queued log records
+ * 
+ * @return   int number of printed records
+ */
+int log_drain()
+{
+  int ret = 0;
+  char line[128];
+
+  while (1)
+  {
+    log_record_struct record;
+    uint32_t dropped;
+
+    LOG_LOCK();
+    if (log_front == log_rear)
+    {
+      LOG_UNLOCK();
+      break;
+    }
+    record = log_buffer[log_front];
+    log_front = (log_front + 1) % LOGBUFFER;
+    dropped = log_dropped;
+    log_dropped = 0;
+    LOG_UNLOCK();
+
+    if (dropped)
+      Serial.printf("[%8u] W %u log records dropped\n", record.timestamp, dropped);
+
+    snprintf(line, sizeof(line), record.format, record.args[0], record.args[1], record.args[2], record.args[3]);
+    Serial.printf("[%8u] %c %s %s\n", record.timestamp, log_levels[record.level], line, record.text);
+    ret++;
+  }
+  return ret;
+}
+
+/**
+ * @brief    Log drain task
+ * 
+ */
+void log_task(void *parameter)
+{
+  while (1)
+  {
+    log_drain();
+    delay(LOGDRAINMS);
+  }
+}
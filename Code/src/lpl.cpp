@@ -0,0 +1,332 @@
+/**
+ * @file     lpl.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Low-power listening.
+ *           A leaf keeps the SX127x asleep and runs a CAD every
+ *           LPLINTERVALMS, CAD done is signalled on DIO0 like RX done so
+ *           it also wakes the CPU from light sleep. Every LPLSYNCMINS the
+ *           leaf receives continuously until it hears an always-on
+ *           neighbour announce, to keep its routes and parent fresh.
+ *           Senders wait for the sample of a low-power neighbour and cover
+ *           it with the preamble, widened by the allowed clock drift.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "lpl.h"
+#include "L3.h"
+#include "scheduler.h"
+#include "log.h"
+#include <LoRa.h>
+
+// Imported variables
+extern uint8_t spreading_factor;
+
+// Private variables
+static volatile bool cad_detected = 0;
+static bool listening = 0;
+static bool syncing = 0;
+static bool receiving = 0;
+static uint32_t receive_start = 0;
+static uint32_t receive_ms = 0;
+static uint32_t samples = 0;
+
+// Private functions
+void lpl_sampleTimer();
+void lpl_cadTimer();
+void lpl_listenTimer();
+void lpl_syncTimer();
+void lpl_onCadDone(boolean detected);
+void lpl_listen(uint32_t duration);
+int32_t lpl_wakeWait(uint8_t node, uint32_t *guard);
+long lpl_symbols(uint32_t duration);
+
+// Functions
+
+/**
+ * @brief    Initializes low-power listening on leaf nodes: starts the
+ *           channel sampling and the first sync window
+ * 
+ */
+void lpl_init()
+{
+  if (!LPLENABLED)
+    return;
+
+  LoRa.onCadDone(lpl_onCadDone);
+
+  scheduler_register(timer_lpl_sample, lpl_sampleTimer, LPLINTERVALMS);
+  scheduler_register(timer_lpl_cad, lpl_cadTimer, 0);
+  scheduler_register(timer_lpl_listen, lpl_listenTimer, 0);
+  scheduler_register(timer_lpl_sync, lpl_syncTimer, LPLSYNCMINS * 60000);
+
+  lpl_syncTimer();
+  return;
+}
+
+/**
+ * @brief    Puts the radio back in receive mode, leaf nodes put it to
+ *           sleep outside of the receive windows
+ * 
+ */
+void lpl_radioReceive()
+{
+  if (!LPLENABLED)
+    LoRa.receive();
+  else if (listening)
+  {
+    if (!receiving)
+    {
+      receiving = 1;
+      receive_start = millis();
+    }
+    LoRa.receive();
+  }
+  else
+  {
+    lpl_radioStandby();
+    LoRa.sleep();
+  }
+  return;
+}
+
+/**
+ * @brief    Accounts the end of a receive period, called before the radio
+ *           leaves receive mode
+ * 
+ */
+void lpl_radioStandby()
+{
+  if (receiving)
+  {
+    receiving = 0;
+    receive_ms += millis() - receive_start;
+  }
+  return;
+}
+
+/**
+ * @brief    Closes the receive window opened by a CAD after a packet is
+ *           received, sync windows stay open
+ * 
+ */
+void lpl_packetReceived()
+{
+  if (!LPLENABLED || !listening || syncing)
+    return;
+
+  scheduler_cancel(timer_lpl_listen);
+  lpl_listenTimer();
+  return;
+}
+
+/**
+ * @brief    Closes the sync window, called when an always-on neighbour
+ *           announce is received
+ * 
+ */
+void lpl_synced()
+{
+  if (!LPLENABLED || !syncing)
+    return;
+
+  LOG_DEBUG("Low-power listening: synchronized");
+  scheduler_cancel(timer_lpl_listen);
+  lpl_listenTimer();
+  return;
+}
+
+/**
+ * @brief    Returns the time to wait before sending to a node: a
+ *           low-power neighbour with a known schedule is reached just
+ *           before its next channel sample
+ * 
+ * @param    next_node: Next node
+ * @return   uint32_t time (ms)
+ */
+uint32_t lpl_sendDelay(uint8_t next_node)
+{
+  uint32_t guard;
+  int32_t wait = lpl_wakeWait(next_node, &guard);
+
+  if (wait < 0 || (uint32_t)wait <= guard)
+    return 0;
+  return wait - guard;
+}
+
+/**
+ * @brief    Returns the preamble length needed to reach a node: it covers
+ *           the next channel sample of a low-power neighbour with its
+ *           guard time, or a whole sampling interval if the schedule is
+ *           unknown
+ * 
+ * @param    next_node: Next node
+ * @return   long preamble length (symbols)
+ */
+long lpl_preambleLength(uint8_t next_node)
+{
+  if (next_node == 0 || next_node > MAXNODES || !L3_getLowPower(next_node))
+    return LORAPREAMBLE;
+
+  uint32_t guard;
+  int32_t wait = lpl_wakeWait(next_node, &guard);
+
+  if (wait < 0)
+    return lpl_symbols(LPLINTERVALMS + LPLCADMS);
+  return lpl_symbols(wait + guard + LPLCADMS);
+}
+
+/**
+ * @brief    Returns the time from the end of a transmission to the next
+ *           channel sample of this node, sent with the announces
+ * 
+ * @param    airtime: Transmission time (ms)
+ * @return   uint16_t time (ms), 0 on always-on nodes
+ */
+uint16_t lpl_getWakeOffset(uint32_t airtime)
+{
+  if (!LPLENABLED)
+    return 0;
+
+  return (scheduler_getRemaining(timer_lpl_sample) + LPLINTERVALMS - airtime % LPLINTERVALMS) % LPLINTERVALMS;
+}
+
+/**
+ * @brief    Returns the time spent receiving or sampling the channel since
+ *           boot
+ * 
+ * @return   uint32_t time (ms)
+ */
+uint32_t lpl_getReceiveMs()
+{
+  uint32_t total = receive_ms + samples * LPLCADMS;
+
+  if (receiving)
+    total += millis() - receive_start;
+  return total;
+}
+
+/**
+ * @brief    Sample timer: starts a channel activity detection, skipped
+ *           while a receive window is open
+ * 
+ */
+void lpl_sampleTimer()
+{
+  if (listening)
+    return;
+
+  samples++;
+  LoRa.channelActivityDetection();
+}
+
+/**
+ * @brief    Callback function after a channel activity detection (interrupt)
+ * 
+ * @param    detected: 1 if a preamble was detected
+ */
+void lpl_onCadDone(boolean detected)
+{
+  cad_detected = detected;
+  scheduler_set(timer_lpl_cad, 0);
+  scheduler_wake();
+}
+
+/**
+ * @brief    CAD timer: opens a receive window long enough for the longest
+ *           preamble and a frame if a preamble was detected, otherwise the
+ *           radio goes back to sleep
+ * 
+ */
+void lpl_cadTimer()
+{
+  if (listening)
+    return;
+
+  if (cad_detected)
+    lpl_listen(LPLINTERVALMS + LPLRXMS);
+  else
+    LoRa.sleep();
+}
+
+/**
+ * @brief    Listen timer: closes the receive or sync window
+ * 
+ */
+void lpl_listenTimer()
+{
+  listening = 0;
+  syncing = 0;
+  lpl_radioReceive();
+}
+
+/**
+ * @brief    Sync timer: opens a receive window as long as the announce
+ *           interval
+ * 
+ */
+void lpl_syncTimer()
+{
+  syncing = 1;
+  lpl_listen(ANNOUNCEMINS * 60000 + LPLRXMS);
+}
+
+/**
+ * @brief    Opens a receive window
+ * 
+ * @param    duration: Window length (ms)
+ */
+void lpl_listen(uint32_t duration)
+{
+  listening = 1;
+  scheduler_set(timer_lpl_listen, duration);
+  lpl_radioReceive();
+}
+
+/**
+ * @brief    Returns the time left before the next channel sample of a
+ *           low-power neighbour and the guard time needed around it
+ * 
+ * @param    node: Neighbour node
+ * @param    guard: Guard time (ms)
+ * @return   int32_t time (ms), -1 if the node is always on or its schedule
+ *           is unknown or too old
+ */
+int32_t lpl_wakeWait(uint8_t node, uint32_t *guard)
+{
+  if (node == 0 || node > MAXNODES || !L3_getLowPower(node) || L3_getWakeSync(node) == 0)
+    return -1;
+
+  uint32_t now = millis();
+  *guard = LPLGUARDMS + (uint64_t)(now - L3_getWakeSync(node)) * LPLDRIFTPPM / 1000000;
+  if (*guard >= LPLINTERVALMS / 2)
+    return -1;
+
+  int32_t wait = (int32_t)(L3_getWakeReference(node) - now) % LPLINTERVALMS;
+  if (wait < 0)
+    wait += LPLINTERVALMS;
+  return wait;
+}
+
+/**
+ * @brief    Converts a preamble duration to symbols (125 kHz bandwidth)
+ * 
+ * @param    duration: Preamble duration (ms)
+ * @return   long preamble length (symbols)
+ */
+long lpl_symbols(uint32_t duration)
+{
+  uint32_t symbol = (1 << spreading_factor) * 8;
+  long symbols = (uint64_t)duration * 1000 / symbol + 1;
+
+  if (symbols < LORAPREAMBLE)
+    return LORAPREAMBLE;
+  if (symbols > 65535)
+    return 65535;
+  return symbols;
+}
\ No newline at end of file
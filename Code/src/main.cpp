@@ -17,20 +17,24 @@
 #include "message.h"
 #include "display.h"
 #include "webserver.h"
+#include "metrics.h"
+#include "log.h"
+#include "scheduler.h"
+#include "power.h"
+#include "lpl.h"
+#include "crypto.h"
+#include "group.h"
+#include "route.h"
+#include "congestion.h"
+#include "ota.h"
+#include "geo.h"
+#include "gateway.h"
+#include "bridge.h"
 
 // Imported variables
-extern int L1_outBuffer_left;
 extern bool L1_flag_received;
-extern bool display_flag_screenOn;
-
-extern uint32_t display_standby_timer;
 
 // Global variables
-uint32_t announce_mins = INACTIVEMINS * 60000;
-uint32_t announce_timer = 0;
-uint32_t announce_remove_seconds_check = INACTIVESECONDSREMOVECHECK * 1000;
-uint32_t announce_remove_timer = 0;
-uint32_t display_standby_secs = DISPLAYSTBYSECS * 1000;
 uint8_t showmessages = SHOWNMESSAGES;
 uint8_t tx_dbm = TXDBM;
 uint8_t spreading_factor = SPREADINGFACTOR;
@@ -44,26 +48,46 @@ uint8_t spreading_factor = SPREADINGFACTOR;
 void setup()
 {
   Serial.begin(115200);
+  log_init();
+  scheduler_init(NULL);
+  power_init();
+  crypto_init();
 
   L1_init();
+  lpl_init();
 
   L3_init();
+  geo_init();
+  group_init();
+  route_init();
+  congestion_init();
+  ota_init();
 
   message_init();
 
-  if (WIFIENABLED)
-    webserver_init();
+#if WIFIENABLED
+  webserver_init();
+#endif
+  bridge_init();
 
   display_init();
   display_printWelcome();
+
+  gateway_init();
+#if SERIALPOLLMS
+  scheduler_register(timer_serial, gateway_poll, SERIALPOLLMS);
+#endif
 }
 
 /**
- * @brief    LoRaMessenger main loop
+ * @brief    LoRaMessenger main loop: handles received packets, runs the
+ *           expired timers and sleeps until the next one or an interrupt
  * 
  */
 void loop()
 {
+  power_wake();
+
   // Packet received
   if (L1_flag_received)
   {
@@ -71,31 +95,6 @@ void loop()
     L1_receive();
   }
 
-  // Webserver
-  if (WIFIENABLED)
-    webserver_loop();
-
-  // Packet ready to send
-  if (L1_outBuffer_left)
-    L1_send_outPacket();
-
-  // Send announce to network
-  if ((millis() - announce_timer) > announce_mins)
-  {
-    announce_timer = millis();
-    L2_sendAnnounce();
-  }
-
-  // Check for inactive nodes
-  if ((millis() - announce_remove_timer) > announce_remove_seconds_check)
-  {
-    announce_remove_timer = millis();
-    L3_removeInactiveNodes();
-  }
-
-  // Turn off display
-  if ((millis() - display_standby_timer) > display_standby_secs)
-  {
-    display_turnOff();
-  }
+  scheduler_run();
+  scheduler_sleep();
 }
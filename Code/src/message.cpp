@@ -4,7 +4,12 @@
  * @version  1.0
  * @date     09-08-2020
  * 
- * @brief    Messages list functions
+ * @brief    Messages list functions.
+ *           Messages are kept in a ring and indexed twice: by conversation,
+ *           a list per peer from the newest message to the oldest, and by
+ *           sender and packet id, a hash table for the acknowledgments and
+ *           the duplicate check. A message has a number in save order,
+ *           used as cursor to page through a conversation.
  */
 
 // Include libraries
@@ -15,15 +20,32 @@
 #include "L2.h"
 #include "L3.h"
 #include "message.h"
+#include "group.h"
+#include "webpage.h"
+#include "metrics.h"
+#include "log.h"
 #include "rom/crc.h"
 
+static_assert((MESSAGEHASH & (MESSAGEHASH - 1)) == 0, "MESSAGEHASH needs to be a power of 2");
+
 // Private
 message_struct message_list[KEEPNMESSAGES];
 int write_index_msg = 0;
+uint32_t message_update = 0;
+uint32_t message_number = 0;
+conversation_struct conversations[256];
+int16_t message_hash[MESSAGEHASH];
 
 // Imported variables
 extern uint8_t showmessages;
 
+// Private functions
+uint8_t message_getPeer(uint8_t receiver, uint8_t sender);
+int message_getHash(uint8_t sender, uint32_t id);
+void message_unlink(int slot);
+int message_getThreadStart(uint8_t peer, uint32_t before);
+int message_fillJson(message_struct *message, char *buffer, size_t size);
+
 // Functions
 
 /**
@@ -36,8 +58,21 @@ void message_init()
   {
     memset(&message_list[i], 0, sizeof(message_struct));
     message_list[i].message = NULL;
+    message_list[i].thread_prev = -1;
+    message_list[i].thread_next = -1;
+    message_list[i].hash_next = -1;
+  }
+
+  for (int i = 0; i < 256; i++)
+  {
+    conversations[i].newest = -1;
+    conversations[i].count = 0;
+    conversations[i].unread = 0;
   }
 
+  for (int i = 0; i < MESSAGEHASH; i++)
+    message_hash[i] = -1;
+
   return;
 }
 
@@ -52,13 +87,43 @@ void message_init()
  */
 return_type message_save(uint8_t receiver, uint8_t sender, char *message, uint32_t id)
 {
-  message_list[write_index_msg].sender = sender;
-  message_list[write_index_msg].receiver = receiver;
-  message_list[write_index_msg].id = id;
-  message_list[write_index_msg].acks = 0;
+  int slot = write_index_msg;
+  message_struct *saved = &message_list[slot];
+
+  // The oldest message is dropped from its conversation and bucket
+  if (saved->message != NULL)
+    message_unlink(slot);
+
+  saved->sender = sender;
+  saved->receiver = receiver;
+  saved->id = id;
+  saved->update = ++message_update;
+  saved->number = ++message_number;
+  memset(saved->acks, 0, sizeof(saved->acks));
+
+  saved->message = (char *)realloc(saved->message, strlen(message) + 1);
+  strcpy(saved->message, message);
+
+  // Newest message of the conversation
+  uint8_t peer = message_getPeer(receiver, sender);
+  conversation_struct *conversation = &conversations[peer];
+  saved->peer = peer;
+  saved->thread_prev = conversation->newest;
+  saved->thread_next = -1;
+  if (conversation->newest >= 0)
+    message_list[conversation->newest].thread_next = slot;
+  conversation->newest = slot;
+  conversation->count++;
+
+  // Writing in a conversation reads it
+  if (sender == NODENUMBER)
+    conversation->unread = 0;
+  else
+    conversation->unread++;
 
-  message_list[write_index_msg].message = (char *)realloc(message_list[write_index_msg].message, strlen(message) + 1);
-  strcpy(message_list[write_index_msg].message, message);
+  int hash = message_getHash(sender, id);
+  saved->hash_next = message_hash[hash];
+  message_hash[hash] = slot;
 
   if (write_index_msg == KEEPNMESSAGES - 1)
     write_index_msg = 0;
@@ -70,40 +135,28 @@ return_type message_save(uint8_t receiver, uint8_t sender, char *message, uint32
 /**
  * @brief    Saves an acknowledgment into messages list
  * 
- * @param    sender: Message sender
+ * @param    sender: Node that received the message
  * @param    id: Message id
  * @return   return_type status
  */
 return_type message_saveAck(uint8_t sender, uint32_t id)
 {
-  return_type ret;
-  for (int i = 0; i < KEEPNMESSAGES; i++)
-  {
-    ret = ret_message_not_found;
-    bool already_saved = 0;
+  if (sender == 0 || sender > MAXNODES)
+    return ret_error;
 
-    if (message_list[i].receiver == sender || message_list[i].receiver == BROADCASTADDR)
-    {
-      if (message_list[i].id == id)
-      {
+  message_struct *message = message_find(NODENUMBER, id);
 
-        for (int j = 0; j < MAXNODES - 1; j++)
-        {
-          if (message_list[i].acks_nodes[j] == sender)
-          {
-            already_saved = 1;
-          }
-        }
-        if (!already_saved)
-        {
-          message_list[i].acks_nodes[message_list[i].acks] = sender;
-          message_list[i].acks++;
-          ret = ret_ok;
-        }
-      }
-    }
-  }
-  return ret;
+  if (message == NULL ||
+      (message->receiver != sender && message->receiver != BROADCASTADDR && !group_isAddress(message->receiver)))
+    return ret_message_not_found;
+
+  uint32_t bit = 1UL << ((sender - 1) % 32);
+  if (message->acks[(sender - 1) / 32] & bit)
+    return ret_message_found;
+
+  message->acks[(sender - 1) / 32] |= bit;
+  message->update = ++message_update;
+  return ret_ok;
 }
 
 /**
@@ -111,20 +164,19 @@ return_type message_saveAck(uint8_t sender, uint32_t id)
  * 
  * @param    sender: Message sender
  * @param    id: Message id
- * @param    ack_number: acknowledgment list index
- * @return   uint8_t node number
+ * @param    ack_number: acknowledgment list index, in node order
+ * @return   uint8_t node number, 0 if not found
  */
 uint8_t message_getAckNode(uint8_t sender, uint32_t id, uint8_t ack_number)
 {
-  uint8_t ret = 0;
-  for (int i = 0; i < KEEPNMESSAGES; i++)
-  {
-    if (message_list[i].receiver == sender && message_list[i].id == id)
-    {
-      ret = message_list[i].acks_nodes[ack_number];
-    }
-  }
-  return ret;
+  message_struct *message = message_find(sender, id);
+  if (message == NULL)
+    return 0;
+
+  int node = message_getNextAck(message, 0);
+  for (int i = 0; i < ack_number && node > 0; i++)
+    node = message_getNextAck(message, node);
+  return node;
 }
 
 /**
@@ -136,20 +188,66 @@ uint8_t message_getAckNode(uint8_t sender, uint32_t id, uint8_t ack_number)
  */
 uint8_t message_getAckNum(uint8_t sender, uint32_t id)
 {
-  for (int i = 0; i < KEEPNMESSAGES; i++)
+  message_struct *message = message_find(sender, id);
+  return message != NULL ? message_countAcks(message) : 0;
+}
+
+/**
+ * @brief    Returns the number of nodes that received a message
+ * 
+ * @param    message: Message
+ * @return   uint8_t acknowledgments number
+ */
+uint8_t message_countAcks(const message_struct *message)
+{
+  int count = 0;
+  for (int i = 0; i < (MAXNODES + 31) / 32; i++)
+    count += __builtin_popcount(message->acks[i]);
+  return count;
+}
+
+/**
+ * @brief    Returns the next node that received a message
+ * 
+ * @param    message: Message
+ * @param    node: Previous node, 0 for the first one
+ * @return   int node number, 0 after the last one
+ */
+int message_getNextAck(const message_struct *message, int node)
+{
+  // Bit node is the one of the next node number
+  for (int word = node / 32; word < (MAXNODES + 31) / 32; word++)
   {
-    if (message_list[i].receiver == sender && message_list[i].id == id)
-    {
-      return message_list[i].acks;
-    }
+    uint32_t bits = message->acks[word];
+    if (word == node / 32)
+      bits &= ~(uint32_t)((1UL << (node % 32)) - 1);
+    if (bits != 0)
+      return word * 32 + __builtin_ctz(bits) + 1;
   }
   return 0;
 }
 
 /**
- * @brief    Prints the last n messages
+ * @brief    Finds a kept message
  * 
- * @param    number: Number of messages to print
+ * @param    sender: Message sender
+ * @param    id: Message id
+ * @return   message_struct* message, NULL if not found
+ */
+message_struct *message_find(uint8_t sender, uint32_t id)
+{
+  for (int slot = message_hash[message_getHash(sender, id)]; slot >= 0; slot = message_list[slot].hash_next)
+  {
+    if (message_list[slot].sender == sender && message_list[slot].id == id)
+      return &message_list[slot];
+  }
+  return NULL;
+}
+
+/**
+ * @brief    Logs the last n messages (debug level)
+ * 
+ * @param    number: Number of messages to log
  */
 void message_printLastN(int number)
 {
@@ -163,7 +261,7 @@ void message_printLastN(int number)
   else
     read_position = read_position - number;
 
-  Serial.printf("--- Last %d messages ---\n", number);
+  LOG_DEBUG("Last %d messages:", number);
   for (int i = 0; i < number; i++)
   {
 
@@ -172,18 +270,11 @@ void message_printLastN(int number)
 
     if (message_list[read_position].message != NULL)
     {
-      char receiver_name[16];
-      char sender_name[16];
-
-      strcpy(receiver_name, L3_getNodeName(message_list[read_position].receiver));
-      strcpy(sender_name, L3_getNodeName(message_list[read_position].sender));
-
-      Serial.printf("%s->%s: %s\n", sender_name, receiver_name, message_list[read_position].message);
+      LOG_DEBUG_TEXT(message_list[read_position].message, "  %d->%d:", message_list[read_position].sender, message_list[read_position].receiver);
     }
     read_position++;
   }
 
-  Serial.printf("\n");
   return;
 }
 
@@ -196,64 +287,348 @@ void message_printLastN(int number)
  */
 int message_checkDuplicate(uint8_t sender, uint32_t id)
 {
-  for (int i = 0; i < KEEPNMESSAGES; i++)
+  if (message_find(sender, id) != NULL)
   {
-    if (message_list[i].sender == sender && message_list[i].id == id)
-    {
-      return ret_message_found;
-    }
+    metrics_count(metric_duplicates);
+    return ret_message_found;
   }
   return ret_message_not_found;
 }
 
 /**
- * @brief    Creates a string containg the message list (webserver)
+ * @brief    Renders one of the last shown messages as a list item (webserver),
+ *           of all the conversations or of one
  * 
- * @return   String message list
+ * @param    index: Message number, from the oldest shown
+ * @param    peer: Conversation, 0 for all
+ * @param    buffer: Output buffer
+ * @param    size: Output buffer size
+ * @return   int item length, 0 if skipped, -1 after the last message
  */
-String message_getStringMessageList()
+int message_fillMessageItem(int index, uint32_t peer, char *buffer, size_t size)
 {
-  int read_position = write_index_msg;
   int number = showmessages;
 
-  String list = "";
-
   if (number > KEEPNMESSAGES)
     number = KEEPNMESSAGES;
 
-  if (read_position - number < 0)
-    read_position = KEEPNMESSAGES + read_position - number;
+  message_struct *message;
+  if (peer > 0)
+  {
+    if (number > conversations[peer & 0xFF].count)
+      number = conversations[peer & 0xFF].count;
+    if (index >= number)
+      return -1;
+
+    int slot = conversations[peer & 0xFF].newest;
+    for (int i = number - 1; i > index; i--)
+      slot = message_list[slot].thread_prev;
+    message = &message_list[slot];
+  }
   else
-    read_position = read_position - number;
-
-  for (int i = 0; i < number; i++)
   {
+    if (index >= number)
+      return -1;
 
-    if (read_position == KEEPNMESSAGES)
-      read_position = 0;
+    int read_position = write_index_msg - number + index;
+    if (read_position < 0)
+      read_position += KEEPNMESSAGES;
+    message = &message_list[read_position];
+  }
 
-    if (message_list[read_position].message != NULL)
-    {
-      char receiver_name[16];
-      char sender_name[16];
+  if (message->message == NULL)
+    return 0;
 
-      strcpy(receiver_name, L3_getNodeName(message_list[read_position].receiver));
-      strcpy(sender_name, L3_getNodeName(message_list[read_position].sender));
+  int length = webpage_append(buffer, size, 0, "<li id=m%d_%u><b>%s -> ", message->sender, message->id, L3_getNodeName(message->sender));
+  length = webpage_append(buffer, size, length, "%s:</b> %s", L3_getNodeName(message->receiver), message->message);
 
-      list += "<li><b>" + String(sender_name) + " -> " + String(receiver_name) + ":</b> " + String(message_list[read_position].message);
-      if (message_list[read_position].acks)
+  // The nodes that do not fit the line are left out, the item stays closed
+  int node = message_getNextAck(message, 0);
+  if (node > 0)
+  {
+    length = webpage_append(buffer, size, length, "<br>Received by: ");
+    for (bool first = 1; node > 0; node = message_getNextAck(message, node), first = 0)
+    {
+      const char *name = L3_getNodeName(node);
+      if (!webpage_fits(size, length, strlen(name) + 2, strlen(", &hellip;</li>")))
       {
-        list += "<br>Received by:";
-        for (int i = 0; i < message_list[read_position].acks; i++)
-        {
-          if (i > 0)
-            list += ",";
-          list += " " + String(L3_getNodeName(message_list[read_position].acks_nodes[i]));
-        }
+        length = webpage_append(buffer, size, length, first ? "&hellip;" : ", &hellip;");
+        break;
       }
+      length = webpage_append(buffer, size, length, first ? "%s" : ", %s", name);
     }
-    list += "</li>";
-    read_position++;
   }
-  return list;
+
+  return webpage_append(buffer, size, length, "</li>");
+}
+
+/**
+ * @brief    Renders a message updated after a given update number as a
+ *           JSON object (webserver API), from the oldest kept message
+ * 
+ * @param    index: Message number, from the oldest kept
+ * @param    since: Update number, older messages are skipped
+ * @param    buffer: Output buffer
+ * @param    size: Output buffer size
+ * @return   int item length, 0 if skipped, -1 after the last message
+ */
+int message_fillMessageJson(int index, uint32_t since, char *buffer, size_t size)
+{
+  if (index >= KEEPNMESSAGES)
+    return -1;
+
+  message_struct *message = &message_list[(write_index_msg + index) % KEEPNMESSAGES];
+  if (message->message == NULL || message->update <= since)
+    return 0;
+
+  return message_fillJson(message, buffer, size);
+}
+
+/**
+ * @brief    Renders a page of a conversation as JSON objects (webserver
+ *           API), newest first
+ * 
+ * @param    index: Message number in the page
+ * @param    arg: Conversation and cursor (see message_getThreadArg)
+ * @param    buffer: Output buffer
+ * @param    size: Output buffer size
+ * @return   int item length, -1 after the last message
+ */
+int message_fillThreadJson(int index, uint32_t arg, char *buffer, size_t size)
+{
+  if (index >= MESSAGEPAGE)
+    return -1;
+
+  // The cursor keeps the low bits of the message number, enough for the
+  // messages still kept
+  uint32_t before = arg >> 8;
+  if (before > 0)
+    before = message_number - ((message_number - before) & 0xFFFFFF);
+
+  int slot = message_getThreadStart(arg & 0xFF, before);
+  for (int i = 0; i < index && slot >= 0; i++)
+    slot = message_list[slot].thread_prev;
+
+  if (slot < 0)
+    return -1;
+  return message_fillJson(&message_list[slot], buffer, size);
+}
+
+/**
+ * @brief    Packs a conversation and a cursor into a renderer argument
+ * 
+ * @param    peer: Conversation
+ * @param    before: Number of the last message received, 0 for the newest
+ * @return   uint32_t renderer argument
+ */
+uint32_t message_getThreadArg(uint8_t peer, uint32_t before)
+{
+  return (before & 0xFFFFFF) << 8 | peer;
+}
+
+/**
+ * @brief    Renders a conversation as a list item (webserver)
+ * 
+ * @param    index: Peer
+ * @param    arg: Unused
+ * @param    buffer: Output buffer
+ * @param    size: Output buffer size
+ * @return   int item length, 0 if skipped, -1 after the last conversation
+ */
+int message_fillConversationItem(int index, uint32_t arg, char *buffer, size_t size)
+{
+  if (index > 255)
+    return -1;
+
+  if (conversations[index].count == 0)
+    return 0;
+
+  int length = webpage_append(buffer, size, 0, "<li><a href=/?peer=%d>%s</a> | %d messages", index, L3_getNodeName(index), conversations[index].count);
+  if (conversations[index].unread > 0)
+    length = webpage_append(buffer, size, length, " | <b>%d unread</b>", conversations[index].unread);
+
+  return webpage_append(buffer, size, length, "</li>");
+}
+
+/**
+ * @brief    Returns the messages of a conversation, newest first
+ * 
+ * @param    peer: Node, group or broadcast address
+ * @param    before: Cursor, only the messages saved before it are returned,
+ *           0 for the newest
+ * @param    messages: Output messages
+ * @param    count: Largest number of messages
+ * @return   int number of messages, the number of the last one is the
+ *           cursor of the next page
+ */
+int message_getThread(uint8_t peer, uint32_t before, message_struct **messages, int count)
+{
+  int number = 0;
+
+  for (int slot = message_getThreadStart(peer, before); slot >= 0 && number < count; slot = message_list[slot].thread_prev)
+    messages[number++] = &message_list[slot];
+
+  return number;
+}
+
+/**
+ * @brief    Returns the next conversation, from a peer on
+ * 
+ * @param    peer: First peer
+ * @return   int peer, -1 if none
+ */
+int message_getNextConversation(int peer)
+{
+  for (; peer < 256; peer++)
+  {
+    if (conversations[peer].count > 0)
+      return peer;
+  }
+  return -1;
+}
+
+/**
+ * @brief    Returns a conversation
+ * 
+ * @param    peer: Node, group or broadcast address
+ * @return   conversation_struct* conversation
+ */
+const conversation_struct *message_getConversation(uint8_t peer)
+{
+  return &conversations[peer];
+}
+
+/**
+ * @brief    Marks the messages of a conversation as read
+ * 
+ * @param    peer: Node, group or broadcast address
+ */
+void message_markRead(uint8_t peer)
+{
+  conversations[peer].unread = 0;
+}
+
+/**
+ * @brief    Returns the last update number, incremented when a message
+ *           is saved or acknowledged
+ * 
+ * @return   uint32_t update number
+ */
+uint32_t message_getUpdate()
+{
+  return message_update;
+}
+
+/**
+ * @brief    Returns the conversation of a message: the other node, or the
+ *           group or broadcast address
+ * 
+ * @param    receiver: Message receiver
+ * @param    sender: Message sender
+ * @return   uint8_t peer
+ */
+uint8_t message_getPeer(uint8_t receiver, uint8_t sender)
+{
+  if (sender == NODENUMBER || receiver == BROADCASTADDR || group_isAddress(receiver))
+    return receiver;
+  return sender;
+}
+
+/**
+ * @brief    Returns the hash bucket of a message
+ * 
+ * @param    sender: Message sender
+ * @param    id: Message id
+ * @return   int bucket
+ */
+int message_getHash(uint8_t sender, uint32_t id)
+{
+  return (id ^ id >> 16 ^ sender * 31) & (MESSAGEHASH - 1);
+}
+
+/**
+ * @brief    Removes the oldest message from its conversation and bucket
+ * 
+ * @param    slot: Message list index
+ */
+void message_unlink(int slot)
+{
+  message_struct *message = &message_list[slot];
+  conversation_struct *conversation = &conversations[message->peer];
+
+  if (message->thread_next >= 0)
+    message_list[message->thread_next].thread_prev = -1;
+  if (conversation->newest == slot)
+    conversation->newest = -1;
+  conversation->count--;
+
+  // The unread messages are the newest ones
+  if (conversation->unread > conversation->count)
+    conversation->unread = conversation->count;
+
+  int16_t *next = &message_hash[message_getHash(message->sender, message->id)];
+  while (*next >= 0 && *next != slot)
+    next = &message_list[*next].hash_next;
+  if (*next == slot)
+    *next = message->hash_next;
+  return;
+}
+
+/**
+ * @brief    Returns the first message of a conversation page
+ * 
+ * @param    peer: Node, group or broadcast address
+ * @param    before: Cursor, 0 for the newest message
+ * @return   int message list index, -1 if none
+ */
+int message_getThreadStart(uint8_t peer, uint32_t before)
+{
+  // The message of the cursor leads to the page in one step
+  if (before > 0 && before <= message_number && message_number - before < KEEPNMESSAGES)
+  {
+    message_struct *message = &message_list[(before - 1) % KEEPNMESSAGES];
+    if (message->number == before && message->peer == peer)
+      return message->thread_prev;
+  }
+
+  int slot = conversations[peer].newest;
+  while (before > 0 && slot >= 0 && message_list[slot].number >= before)
+    slot = message_list[slot].thread_prev;
+  return slot;
+}
+
+/**
+ * @brief    Renders a message as a JSON object
+ * 
+ * @param    message: Message
+ * @param    buffer: Output buffer
+ * @param    size: Output buffer size
+ * @return   int length
+ */
+int message_fillJson(message_struct *message, char *buffer, size_t size)
+{
+  int length = webpage_append(buffer, size, 0, "{\"update\":%u,\"number\":%u,\"peer\":%d,\"id\":%u,\"sender\":%d,\"receiver\":%d,\"from\":",
+                              message->update, message->number, message->peer, message->id, message->sender, message->receiver);
+  length = webpage_appendJson(buffer, size, length, L3_getNodeName(message->sender));
+  length = webpage_append(buffer, size, length, ",\"to\":");
+  length = webpage_appendJson(buffer, size, length, L3_getNodeName(message->receiver));
+  length = webpage_append(buffer, size, length, ",\"text\":");
+  length = webpage_appendJson(buffer, size, length, message->message);
+  length = webpage_append(buffer, size, length, ",\"acks\":[");
+
+  // The nodes that do not fit the line are left out, the object stays closed
+  for (int node = message_getNextAck(message, 0), first = 1; node > 0; node = message_getNextAck(message, node), first = 0)
+  {
+    const char *name = L3_getNodeName(node);
+    if (!webpage_fits(size, length, webpage_jsonSize(name) + 1, strlen(",\"\\u2026\"]}")))
+    {
+      length = webpage_append(buffer, size, length, first ? "\"\\u2026\"" : ",\"\\u2026\"");
+      break;
+    }
+    if (!first)
+      length = webpage_append(buffer, size, length, ",");
+    length = webpage_appendJson(buffer, size, length, name);
+  }
+
+  return webpage_append(buffer, size, length, "]}");
 }
\ No newline at end of file
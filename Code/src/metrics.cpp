@@ -0,0 +1,329 @@
+/**
+ * @file     metrics.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Runtime metrics: counters and histograms updated by the
+ *           protocol stack, exported as Prometheus text or binary snapshot.
+ *           Counters are updated with atomic operations, so they can be read
+ *           from the webserver task while the main loop updates them.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "metrics.h"
+#include "webpage.h"
+#include "power.h"
+#include "rom/crc.h"
+
+// Imported variables
+extern int L1_outBuffer_left;
+
+// Private variables
+static uint32_t counters[metric_counters_count];
+static uint32_t queue_depth_max = 0;
+
+static const uint32_t relay_latency_bounds[METRICSBUCKETS] = {50, 100, 250, 500, 1000, 2000, 5000, 10000, 30000, 60000};
+static const uint32_t airtime_bounds[METRICSBUCKETS] = {10, 20, 40, 80, 160, 320, 640, 1280, 2560, 5120};
+
+static metrics_histogram_struct relay_latency = {relay_latency_bounds};
+static metrics_histogram_struct airtime = {airtime_bounds};
+
+static const char *const payload_names[payload_count] = {"msg", "ack", "ann", "name_req", "name", "rreq", "rrep", "ota_summary", "ota_request", "ota_data"};
+
+static const char *const return_names[ret_count] = {
+    "ok", "error", "buffer_empty", "buffer_full", "send_duty_error", "send_anticollision_error",
+    "send_wake_wait", "send_error", "send_size_error", "receive_netid_error", "receive_wrong_node", "receive_duplicate",
+    "receive_fec_error", "receive_auth_error", "receive_replay",
+    "ttl_error", "routing_worse", "routing_better", "routing_updated", "message_not_found", "message_found",
+    "bridge_limited", "no_route", "congested"};
+
+// Private functions
+void metrics_observe(metrics_histogram_struct *histogram, uint32_t value);
+int metrics_appendSeries(char *buffer, size_t size, const char *name, const char *type, const char *label, const char *label_value, uint32_t value);
+int metrics_appendHistogram(char *buffer, size_t size, const char *name, metrics_histogram_struct *histogram, int line);
+
+// Functions
+
+/**
+ * @brief    Increments a counter
+ * 
+ * @param    counter: Counter to be incremented
+ */
+void metrics_count(int counter)
+{
+  __atomic_add_fetch(&counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief    Adds a value to a counter
+ * 
+ * @param    counter: Counter to be updated
+ * @param    value: Value to be added
+ */
+void metrics_add(int counter, uint32_t value)
+{
+  __atomic_add_fetch(&counters[counter], value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief    Counts a received packet
+ * 
+ * @param    type: Packet payload type
+ */
+void metrics_packetIn(uint8_t type)
+{
+  if (type < payload_count)
+    metrics_count(metric_packets_in + type);
+}
+
+/**
+ * @brief    Counts a sent packet and its airtime
+ * 
+ * @param    type: Packet payload type
+ * @param    duration: Transmission duration (ms)
+ */
+void metrics_packetOut(uint8_t type, uint32_t duration)
+{
+  if (type < payload_count)
+    metrics_count(metric_packets_out + type);
+  metrics_add(metric_airtime_ms, duration);
+  metrics_observe(&airtime, duration);
+}
+
+/**
+ * @brief    Counts a dropped packet
+ * 
+ * @param    reason: Drop reason
+ */
+void metrics_drop(return_type reason)
+{
+  if (reason < ret_count)
+    metrics_count(metric_drops + reason);
+}
+
+/**
+ * @brief    Tracks the sending queue high watermark
+ * 
+ * @param    depth: Current queue depth
+ */
+void metrics_queueDepth(int depth)
+{
+  if ((uint32_t)depth > queue_depth_max)
+    queue_depth_max = depth;
+}
+
+/**
+ * @brief    Records the time between receiving and relaying a packet
+ * 
+ * @param    latency: Relay latency (ms)
+ */
+void metrics_relayLatency(uint32_t latency)
+{
+  metrics_observe(&relay_latency, latency);
+}
+
+/**
+ * @brief    Returns a counter value
+ * 
+ * @param    counter: Counter to be read
+ * @return   uint32_t counter value
+ */
+uint32_t metrics_get(int counter)
+{
+  return __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief    Renders a line of the Prometheus text export (webserver)
+ * 
+ * @param    index: Line number
+ * @param    arg: Unused
+ * @param    buffer: Output buffer
+ * @param    size: Output buffer size
+ * @return   int line length, 0 if skipped, -1 after the last line
+ */
+int metrics_fillPrometheus(int index, uint32_t arg, char *buffer, size_t size)
+{
+  if (index < payload_count)
+    return metrics_appendSeries(buffer, size, "packets_in_total", index == 0 ? "counter" : NULL, "type", payload_names[index], metrics_get(metric_packets_in + index));
+  index -= payload_count;
+
+  if (index < payload_count)
+    return metrics_appendSeries(buffer, size, "packets_out_total", index == 0 ? "counter" : NULL, "type", payload_names[index], metrics_get(metric_packets_out + index));
+  index -= payload_count;
+
+  if (index < ret_count)
+  {
+    if (index == ret_ok)
+      return 0;
+    return metrics_appendSeries(buffer, size, "drops_total", index == ret_ok + 1 ? "counter" : NULL, "reason", return_names[index], metrics_get(metric_drops + index));
+  }
+  index -= ret_count;
+
+  switch (index)
+  {
+  case 0:
+    return metrics_appendSeries(buffer, size, "airtime_ms_total", "counter", NULL, NULL, metrics_get(metric_airtime_ms));
+  case 1:
+    return metrics_appendSeries(buffer, size, "duplicates_total", "counter", NULL, NULL, metrics_get(metric_duplicates));
+  case 2:
+    return metrics_appendSeries(buffer, size, "queue_depth", "gauge", NULL, NULL, L1_outBuffer_left);
+  case 3:
+    return metrics_appendSeries(buffer, size, "queue_depth_max", "gauge", NULL, NULL, queue_depth_max);
+  case 4:
+    return metrics_appendSeries(buffer, size, "heap_free_bytes", "gauge", NULL, NULL, ESP.getFreeHeap());
+  case 5:
+    return metrics_appendSeries(buffer, size, "heap_largest_block_bytes", "gauge", NULL, NULL, ESP.getMaxAllocHeap());
+  case 6:
+    return metrics_appendSeries(buffer, size, "uptime_seconds", "gauge", NULL, NULL, millis() / 1000);
+  case 7:
+    return metrics_appendSeries(buffer, size, "log_drops_total", "counter", NULL, NULL, metrics_get(metric_log_drops));
+  case 8:
+    return metrics_appendSeries(buffer, size, "power_wakeups_total", "counter", NULL, NULL, power_getWakeups());
+  case 9:
+    return metrics_appendSeries(buffer, size, "power_awake_ms_total", "counter", NULL, NULL, power_getAwakeMs());
+  case 10:
+    return metrics_appendSeries(buffer, size, "power_estimate_mah_per_day", "gauge", NULL, NULL, power_getMahPerDay());
+  case 11:
+    return metrics_appendSeries(buffer, size, "fec_frames_in_total", "counter", NULL, NULL, metrics_get(metric_fec_frames_in));
+  case 12:
+    return metrics_appendSeries(buffer, size, "fec_frames_out_total", "counter", NULL, NULL, metrics_get(metric_fec_frames_out));
+  case 13:
+    return metrics_appendSeries(buffer, size, "fec_corrected_bytes_total", "counter", NULL, NULL, metrics_get(metric_fec_corrected_bytes));
+  }
+  index -= 14;
+
+  if (index < METRICSBUCKETS + 3)
+    return metrics_appendHistogram(buffer, size, "relay_latency_ms", &relay_latency, index);
+  index -= METRICSBUCKETS + 3;
+
+  if (index < METRICSBUCKETS + 3)
+    return metrics_appendHistogram(buffer, size, "tx_airtime_ms", &airtime, index);
+
+  return -1;
+}
+
+/**
+ * @brief    Fills a binary metrics snapshot
+ * 
+ *           Format (little endian): "LM", version (1 byte), counters number
+ *           (1 byte), histogram buckets number (1 byte), counters (uint32),
+ *           queue depth, queue depth max, free heap, largest heap block,
+ *           uptime (uint32), relay latency and airtime histograms (buckets,
+ *           count, sum as uint32), CRC32 of everything before it.
+ * 
+ * @param    buffer: Output buffer, at least METRICSSNAPSHOT bytes
+ * @return   int snapshot size
+ */
+int metrics_fillSnapshot(uint8_t *buffer)
+{
+  uint8_t header[5] = {'L', 'M', 1, metric_counters_count, METRICSBUCKETS + 1};
+  uint32_t gauges[5] = {(uint32_t)L1_outBuffer_left, queue_depth_max, ESP.getFreeHeap(), ESP.getMaxAllocHeap(), millis() / 1000};
+  uint32_t values[metric_counters_count];
+  metrics_histogram_struct *histograms[2] = {&relay_latency, &airtime};
+  int size = 0;
+
+  for (int i = 0; i < metric_counters_count; i++)
+    values[i] = metrics_get(i);
+
+  memcpy(buffer + size, header, sizeof(header));
+  size += sizeof(header);
+  memcpy(buffer + size, values, sizeof(values));
+  size += sizeof(values);
+  memcpy(buffer + size, gauges, sizeof(gauges));
+  size += sizeof(gauges);
+  for (int i = 0; i < 2; i++)
+  {
+    uint32_t histogram[METRICSBUCKETS + 3];
+    for (int j = 0; j < METRICSBUCKETS + 1; j++)
+      histogram[j] = __atomic_load_n(&histograms[i]->buckets[j], __ATOMIC_RELAXED);
+    histogram[METRICSBUCKETS + 1] = __atomic_load_n(&histograms[i]->count, __ATOMIC_RELAXED);
+    histogram[METRICSBUCKETS + 2] = __atomic_load_n(&histograms[i]->sum, __ATOMIC_RELAXED);
+
+    memcpy(buffer + size, histogram, sizeof(histogram));
+    size += sizeof(histogram);
+  }
+
+  uint32_t crc = crc32_le(0, buffer, size);
+  memcpy(buffer + size, &crc, 4);
+  return size + 4;
+}
+
+/**
+ * @brief    Writes a binary metrics snapshot on the serial port
+ * 
+ */
+void metrics_printSnapshot()
+{
+  uint8_t snapshot[METRICSSNAPSHOT];
+  Serial.write(snapshot, metrics_fillSnapshot(snapshot));
+  return;
+}
+
+/**
+ * @brief    Adds a value to a histogram
+ * 
+ * @param    histogram: Histogram to be updated
+ * @param    value: Observed value
+ */
+void metrics_observe(metrics_histogram_struct *histogram, uint32_t value)
+{
+  int bucket = 0;
+  while (bucket < METRICSBUCKETS && value > histogram->bounds[bucket])
+    bucket++;
+
+  __atomic_add_fetch(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&histogram->sum, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief    Renders a Prometheus series, preceded by its type if given
+ * 
+ * @return   int line length
+ */
+int metrics_appendSeries(char *buffer, size_t size, const char *name, const char *type, const char *label, const char *label_value, uint32_t value)
+{
+  int length = 0;
+  if (type != NULL)
+    length = webpage_append(buffer, size, length, "# TYPE loramessenger_%s %s\n", name, type);
+
+  if (label != NULL)
+    return webpage_append(buffer, size, length, "loramessenger_%s{%s=\"%s\"} %u\n", name, label, label_value, value);
+  else
+    return webpage_append(buffer, size, length, "loramessenger_%s %u\n", name, value);
+}
+
+/**
+ * @brief    Renders a line of a Prometheus histogram: type and buckets,
+ *           +Inf bucket, sum, count
+ * 
+ * @return   int line length
+ */
+int metrics_appendHistogram(char *buffer, size_t size, const char *name, metrics_histogram_struct *histogram, int line)
+{
+  int length = 0;
+
+  if (line <= METRICSBUCKETS)
+  {
+    uint32_t cumulative = 0;
+    for (int i = 0; i <= line; i++)
+      cumulative += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+
+    if (line == 0)
+      length = webpage_append(buffer, size, length, "# TYPE loramessenger_%s histogram\n", name);
+
+    if (line < METRICSBUCKETS)
+      return webpage_append(buffer, size, length, "loramessenger_%s_bucket{le=\"%u\"} %u\n", name, histogram->bounds[line], cumulative);
+    else
+      return webpage_append(buffer, size, length, "loramessenger_%s_bucket{le=\"+Inf\"} %u\n", name, cumulative);
+  }
+  else if (line == METRICSBUCKETS + 1)
+    return webpage_append(buffer, size, length, "loramessenger_%s_sum %u\n", name, __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED));
+  else
+    return webpage_append(buffer, size, length, "loramessenger_%s_count %u\n", name, __atomic_load_n(&histogram->count, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,377 @@
+/**
+ * @file     neighbour.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Neighbour table.
+ *           Every authenticated frame updates the statistics of the node
+ *           that transmitted it (last node), relayed frames included. RSSI
+ *           and SNR are averaged over NEIGHBOURWEIGHT frames. The packet
+ *           reception ratio is averaged over the packets originated by the
+ *           neighbour: their ids are sequence numbers, a gap counts as lost
+ *           packets. The announces carry the reception ratio of each
+ *           neighbour, so the other end knows how well it is heard. The link
+ *           quality is the product of the two ratios: a link heard only in
+ *           one direction has a low quality and is not used for routing.
+ *           The announces also carry the send queue occupancy of the
+ *           neighbour, a congested neighbour is avoided as next hop.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "neighbour.h"
+#include "log.h"
+
+// Private variables
+static neighbour_struct neighbours[MAXNODES];
+
+// Private functions
+void neighbour_sample(neighbour_struct *neighbour, bool received);
+int neighbour_average(int average, int sample);
+
+// Functions
+
+/**
+ * @brief    Initializes the neighbour table
+ * 
+ */
+void neighbour_init()
+{
+  memset(neighbours, 0, sizeof(neighbours));
+  return;
+}
+
+/**
+ * @brief    Updates the statistics of the node that transmitted a frame
+ * 
+ * @param    packet: Received packet
+ * @param    snr: Signal to noise ratio of the frame (dB)
+ */
+void neighbour_handlePacket(pack_struct packet, float snr)
+{
+  if (packet.last_node == 0 || packet.last_node > MAXNODES || packet.last_node == NODENUMBER)
+    return;
+
+  neighbour_struct *neighbour = &neighbours[packet.last_node - 1];
+  uint32_t now = millis();
+
+  if (!neighbour->active)
+  {
+    memset(neighbour, 0, sizeof(neighbour_struct));
+    neighbour->active = 1;
+    neighbour->rssi = packet.rssi * 16;
+    neighbour->snr = snr * 16;
+    neighbour->prr = 1000;
+    neighbour->reverse_prr = -1;
+    neighbour->since = now;
+    LOG_INFO("New neighbour %d, rssi %d", packet.last_node, packet.rssi);
+  }
+  else
+  {
+    neighbour->rssi = neighbour_average(neighbour->rssi, packet.rssi * 16);
+    neighbour->snr = neighbour_average(neighbour->snr, snr * 16);
+  }
+  neighbour->timestamp = now;
+
+  // Only the packets originated by the neighbour carry its sequence numbers
+  if (packet.sender != packet.last_node || packet.hops != 0)
+    return;
+
+  // A new epoch (reboot) restarts the sequence numbers
+  if (neighbour->sequence_valid && (packet.id >> 16) == (neighbour->last_id >> 16))
+  {
+    int32_t gap = packet.id - neighbour->last_id;
+    if (gap <= 0)
+      return;
+
+    // Low-power listening leaves sleep through most of the packets
+    if (!LPLENABLED)
+    {
+      for (int32_t missed = gap > NEIGHBOURMAXGAP ? NEIGHBOURMAXGAP : gap - 1; missed > 0; missed--)
+        neighbour_sample(neighbour, 0);
+    }
+    neighbour_sample(neighbour, 1);
+  }
+
+  neighbour->last_id = packet.id;
+  neighbour->sequence_valid = 1;
+  return;
+}
+
+/**
+ * @brief    Reads the reception ratio of this node from the report in a
+ *           neighbour announce. A complete report without this node means
+ *           the neighbour does not hear it, unless the neighbour is so new
+ *           that no announce of this node was sent since
+ * 
+ * @param    node: Neighbour node
+ * @param    report: Node and reception ratio (1/250) pairs
+ * @param    count: Number of pairs
+ */
+void neighbour_handleReport(uint8_t node, const uint8_t *report, uint8_t count)
+{
+  if (node == 0 || node > MAXNODES || !neighbours[node - 1].active)
+    return;
+
+  neighbour_struct *neighbour = &neighbours[node - 1];
+  int prr = -1;
+
+  for (int i = 0; i < count; i++)
+  {
+    if (report[2 * i] == NODENUMBER)
+      prr = report[2 * i + 1] * 4;
+  }
+
+  if (prr < 0 && (count >= NEIGHBOURREPORT || millis() - neighbour->since < ANNOUNCEMINS * 60000))
+    return;
+  if (prr < 0)
+    prr = 0;
+
+  if (neighbour->reverse_prr >= NEIGHBOURMINPRR && prr < NEIGHBOURMINPRR)
+    LOG_INFO("Neighbour %d hears this node %d/1000", node, prr);
+
+  neighbour->reverse_prr = prr;
+  neighbour->reverse_timestamp = millis();
+  return;
+}
+
+/**
+ * @brief    Stores the send queue occupancy reported in a neighbour
+ *           announce
+ * 
+ * @param    node: Neighbour node
+ * @param    load: Send queue occupancy (%)
+ */
+void neighbour_handleLoad(uint8_t node, uint8_t load)
+{
+  if (node == 0 || node > MAXNODES || !neighbours[node - 1].active)
+    return;
+
+  if (neighbours[node - 1].load < CONGESTIONLOAD && load >= CONGESTIONLOAD)
+    LOG_INFO("Neighbour %d congested, queue %d%%", node, load);
+
+  neighbours[node - 1].load = load;
+  neighbours[node - 1].load_timestamp = millis();
+  return;
+}
+
+/**
+ * @brief    Writes the reception ratio report sent with the announces
+ * 
+ * @param    report: Output buffer, 2 * NEIGHBOURREPORT bytes
+ * @return   uint8_t number of node and reception ratio (1/250) pairs
+ */
+uint8_t neighbour_fillReport(uint8_t *report)
+{
+  uint8_t count = 0;
+
+  for (int i = 0; i < MAXNODES && count < NEIGHBOURREPORT; i++)
+  {
+    if (!neighbours[i].active)
+      continue;
+
+    report[2 * count] = i + 1;
+    report[2 * count + 1] = neighbours[i].prr / 4;
+    count++;
+  }
+  return count;
+}
+
+/**
+ * @brief    Removes the neighbours not heard for INACTIVEMINS
+ * 
+ * @return   int number of removed neighbours
+ */
+int neighbour_removeInactive()
+{
+  int ret = 0;
+
+  // Low-power listening leaves hear their neighbours only in the sync windows
+  uint32_t inactive_ms = (LPLENABLED ? INACTIVEMINS + LPLSYNCMINS : INACTIVEMINS) * 60000;
+
+  for (int i = 0; i < MAXNODES; i++)
+  {
+    if (neighbours[i].active && millis() - neighbours[i].timestamp >= inactive_ms)
+    {
+      neighbours[i].active = 0;
+      LOG_INFO("Removed neighbour %d", i + 1);
+      ret++;
+    }
+  }
+  return ret;
+}
+
+/**
+ * @brief    Returns if a node is a neighbour
+ * 
+ * @param    node: Node
+ * @return   int state
+ */
+int neighbour_getActive(uint8_t node)
+{
+  if (node == 0 || node > MAXNODES)
+    return 0;
+  return neighbours[node - 1].active;
+}
+
+/**
+ * @brief    Returns the averaged RSSI of a neighbour
+ * 
+ * @param    node: Neighbour node
+ * @return   int RSSI (dBm), 0 if not a neighbour
+ */
+int neighbour_getRssi(uint8_t node)
+{
+  if (!neighbour_getActive(node))
+    return 0;
+  return (neighbours[node - 1].rssi - 8) / 16;
+}
+
+/**
+ * @brief    Returns the averaged SNR of a neighbour
+ * 
+ * @param    node: Neighbour node
+ * @return   int SNR (dB), 0 if not a neighbour
+ */
+int neighbour_getSnr(uint8_t node)
+{
+  if (!neighbour_getActive(node))
+    return 0;
+  return neighbours[node - 1].snr / 16;
+}
+
+/**
+ * @brief    Returns the packet reception ratio from a neighbour
+ * 
+ * @param    node: Neighbour node
+ * @return   uint16_t reception ratio (1/1000), 0 if not a neighbour
+ */
+uint16_t neighbour_getPrr(uint8_t node)
+{
+  if (!neighbour_getActive(node))
+    return 0;
+  return neighbours[node - 1].prr;
+}
+
+/**
+ * @brief    Returns the reception ratio of this node reported by a
+ *           neighbour
+ * 
+ * @param    node: Neighbour node
+ * @return   int reception ratio (1/1000), -1 if unknown or too old
+ */
+int neighbour_getReversePrr(uint8_t node)
+{
+  if (!neighbour_getActive(node))
+    return -1;
+
+  neighbour_struct *neighbour = &neighbours[node - 1];
+  if (neighbour->reverse_prr < 0 || millis() - neighbour->reverse_timestamp >= INACTIVEMINS * 60000)
+    return -1;
+  return neighbour->reverse_prr;
+}
+
+/**
+ * @brief    Returns the quality of the link to a neighbour: the product of
+ *           the reception ratios in both directions, or the one measured
+ *           here until the neighbour reports
+ * 
+ * @param    node: Neighbour node
+ * @return   uint16_t link quality (1/1000), 0 if not a neighbour
+ */
+uint16_t neighbour_getQuality(uint8_t node)
+{
+  if (!neighbour_getActive(node))
+    return 0;
+
+  int reverse_prr = neighbour_getReversePrr(node);
+  if (reverse_prr < 0)
+    return neighbours[node - 1].prr;
+  return (uint32_t)neighbours[node - 1].prr * reverse_prr / 1000;
+}
+
+/**
+ * @brief    Returns if the link to a neighbour can carry relayed traffic
+ * 
+ * @param    node: Neighbour node
+ * @return   bool 1 if the link quality is at least NEIGHBOURMINPRR
+ */
+bool neighbour_isUsable(uint8_t node)
+{
+  return neighbour_getQuality(node) >= NEIGHBOURMINPRR;
+}
+
+/**
+ * @brief    Returns the send queue occupancy reported by a neighbour
+ * 
+ * @param    node: Neighbour node
+ * @return   int occupancy (%), 0 if unknown or too old
+ */
+int neighbour_getLoad(uint8_t node)
+{
+  if (!neighbour_getActive(node))
+    return 0;
+
+  neighbour_struct *neighbour = &neighbours[node - 1];
+  if (millis() - neighbour->load_timestamp >= INACTIVEMINS * 60000)
+    return 0;
+  return neighbour->load;
+}
+
+/**
+ * @brief    Returns if a neighbour reported a congested send queue
+ * 
+ * @param    node: Neighbour node
+ * @return   bool 1 if the occupancy is at least CONGESTIONLOAD
+ */
+bool neighbour_isCongested(uint8_t node)
+{
+  return neighbour_getLoad(node) >= CONGESTIONLOAD;
+}
+
+/**
+ * @brief    Logs the neighbour table (debug level)
+ * 
+ */
+void neighbour_print()
+{
+  LOG_DEBUG("Neighbour table:");
+  for (int i = 0; i < MAXNODES; i++)
+  {
+    if (neighbours[i].active)
+    {
+      LOG_DEBUG("  neighbour %d rssi %d snr %d prr %d", i + 1, neighbour_getRssi(i + 1), neighbour_getSnr(i + 1), neighbours[i].prr);
+      LOG_DEBUG("    reverse prr %d heard %d seconds ago", neighbour_getReversePrr(i + 1), (millis() - neighbours[i].timestamp) / 1000);
+    }
+  }
+  return;
+}
+
+/**
+ * @brief    Adds a sample to the packet reception ratio of a neighbour
+ * 
+ * @param    neighbour: Neighbour
+ * @param    received: 1 if the packet was received
+ */
+void neighbour_sample(neighbour_struct *neighbour, bool received)
+{
+  neighbour->prr = neighbour_average(neighbour->prr, received ? 1000 : 0);
+}
+
+/**
+ * @brief    Moves an average 1 / NEIGHBOURWEIGHT of the way to a sample,
+ *           rounded away from the average so that it reaches the sample
+ *           instead of stalling NEIGHBOURWEIGHT - 1 units short
+ * 
+ * @param    average: Average
+ * @param    sample: New sample
+ * @return   int new average
+ */
+int neighbour_average(int average, int sample)
+{
+  int diff = sample - average;
+  return average + (diff + (diff > 0 ? NEIGHBOURWEIGHT - 1 : -(NEIGHBOURWEIGHT - 1))) / NEIGHBOURWEIGHT;
+}
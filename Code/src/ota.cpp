@@ -0,0 +1,1035 @@
+/**
+ * @file     ota.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Firmware distribution (Deluge).
+ *           The image is split into pages of one flash sector, sent in
+ *           packets of OTAPACKETSIZE bytes. Page 0 is the profile: image
+ *           size and, for each page, the version of the image that last
+ *           changed it (version vector) and its CRC32. Every node sends
+ *           summaries (version, profile CRC, pages received in order) on a
+ *           trickle timer: the interval doubles while the neighbours agree
+ *           and starts again from the shortest one when a summary differs.
+ *           A node that hears a neighbour with more pages requests the
+ *           missing packets of its next page, the neighbour broadcasts them
+ *           and every node waiting for that page keeps them. A complete page
+ *           is checked against its CRC and written to the OTA partition.
+ *           Pages that did not change since the image a node already has
+ *           are copied from it instead of being received. The complete
+ *           image is set as boot partition and the node restarts on it
+ *           after OTAREBOOTSECS. The distribution only sends when the send
+ *           queue is empty, within OTASHARE of the duty cycle.
+ *           The profile carries the SHA-256 hash of the image and the
+ *           ECDSA signature of version, size and hash, checked with
+ *           OTAPUBLICKEY: a profile with a wrong signature is refused and
+ *           the node goes back to its previous image, and an image that
+ *           does not match the hash is not staged. The page CRCs only
+ *           catch transmission errors.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "ota.h"
+#include "L1.h"
+#include "L2.h"
+#include "neighbour.h"
+#include "scheduler.h"
+#include "log.h"
+#include "rom/crc.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/ecdsa.h"
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+
+#define OTAPAGEPACKETS (OTAPAGESIZE / OTAPACKETSIZE) // Data packets per page
+#define OTAJITTERMS 2000                             // Longest random wait before a request (ms)
+#define OTABUSYMS 1000                               // Wait while the send queue is not empty (ms)
+
+#if OTAPAGESIZE % OTAPACKETSIZE || OTAPAGEPACKETS > 32
+#error "OTAPAGESIZE needs to be a multiple of OTAPACKETSIZE, with at most 32 packets per page"
+#endif
+#if OTAPROFILEHEADER + 6 * OTAMAXPAGES > OTAPAGESIZE
+#error "The profile of OTAMAXPAGES pages needs to fit a page"
+#endif
+#ifndef OTAPUBLICKEY
+#if OTAENABLED
+#error "OTAENABLED needs OTAPUBLICKEY, the public key of the image signatures"
+#endif
+#define OTAPUBLICKEY 0 // No signature is valid
+#endif
+
+// Imported variables
+extern int L1_outBuffer_left;
+
+// Private variables
+static bool enabled = 0;
+static ota_profile_struct object;                      // Image received, being received or served
+static uint8_t profile[OTAPROFILEHEADER + 6 * OTAMAXPAGES]; // Profile of the image as sent
+static uint32_t object_crc = 0;                        // Profile CRC32, from the summaries until the profile is received
+static uint16_t object_pages = 0;                      // Pages, profile included, 0 without image
+static uint16_t complete = 0;                          // Pages received in order
+static const esp_partition_t *object_partition = NULL;
+static ota_profile_struct base;                        // Previous image, source of the pages not changed
+static const esp_partition_t *base_partition = NULL;   // NULL without previous image
+static uint8_t page_buffer[OTAPAGESIZE];
+static const uint8_t public_key[65] = {OTAPUBLICKEY};
+static uint32_t refused_crc = 0; // Profile CRC32 of the last image with a wrong signature
+
+static uint32_t interval = 0; // Summary interval (ms)
+static uint32_t interval_start = 0;
+static uint32_t summary_time = 0;
+static bool summary_checked = 0;
+static uint8_t heard = 0;
+static bool summary_due = 0;
+
+static uint8_t source = 0; // Neighbour the pages are requested from, 0 if none
+static uint16_t source_complete = 0;
+static uint32_t rx_missing = 0; // Packets of the next page not received, bit n for packet n
+static uint8_t rx_retries = 0;
+static uint32_t rx_deadline = 0;
+static bool request_due = 0;
+
+static int tx_page = -1; // Page requested by the neighbours, -1 if none
+static uint32_t tx_missing = 0;
+static uint32_t next_send = 0;
+
+static bool uploading = 0;
+static uint16_t upload_version = 0;
+static uint32_t upload_size = 0;
+static uint32_t upload_offset = 0;
+static uint32_t upload_erased = 0;
+static uint32_t upload_timestamp = 0;
+static uint8_t upload_signature[OTASIGNATURE];
+
+static bool staged = 0;
+static uint32_t staged_timestamp = 0;
+
+// Private functions
+void ota_timer();
+void ota_armTimer();
+void ota_send(uint32_t now);
+void ota_resetTrickle();
+void ota_startInterval(uint32_t now);
+void ota_startObject(uint16_t version, uint32_t profile_crc, uint16_t pages);
+void ota_pageReceived();
+void ota_nextPage();
+void ota_dropObject();
+bool ota_copyPage(uint16_t page);
+return_type ota_install();
+bool ota_checkImage();
+void ota_hashImage(uint8_t *digest);
+bool ota_checkSignature(const ota_profile_struct *checked);
+void ota_abortUpload();
+size_t ota_pageBytes(uint16_t page);
+uint32_t ota_pageMask(uint16_t page);
+size_t ota_readPacket(uint16_t page, uint8_t packet, uint8_t *data);
+size_t ota_fillProfile(const ota_profile_struct *source_profile, uint8_t *buffer);
+bool ota_parseProfile(const uint8_t *buffer, size_t size, ota_profile_struct *parsed);
+
+// Functions
+
+/**
+ * @brief    Initializes the firmware distribution with the image saved
+ *           after the last one staged, if it is still in its partition
+ * 
+ */
+void ota_init()
+{
+  // Low-power listening leaves sleep through the broadcasts
+  if (!OTAENABLED || LPLENABLED)
+    return;
+  enabled = 1;
+
+  memset(&object, 0, sizeof(object));
+  object_crc = 0;
+  object_pages = 0;
+  complete = 0;
+  object_partition = NULL;
+  base_partition = NULL;
+
+  Preferences preferences;
+  preferences.begin("ota");
+  uint32_t address = preferences.getUInt("address", 0);
+  size_t size = preferences.getBytes("profile", profile, sizeof(profile));
+  preferences.end();
+
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+  const esp_partition_t *partition = address == running->address ? running : address == next->address ? next : NULL;
+
+  if (partition != NULL && ota_parseProfile(profile, size, &object))
+  {
+    object_crc = crc32_le(0, profile, size);
+    object_pages = object.pages + 1;
+    complete = object_pages;
+    object_partition = partition;
+    LOG_INFO("Firmware version %d, %d pages", object.version, object.pages);
+  }
+  else
+    memset(&object, 0, sizeof(object));
+
+  scheduler_register(timer_ota, ota_timer, 0);
+  interval = OTAADVMINSECS * 1000;
+  ota_startInterval(millis());
+  ota_armTimer();
+}
+
+/**
+ * @brief    Writes a part of a new image uploaded through the serial
+ *           gateway, in order. The first part starts the upload, the last
+ *           one stages the image and starts distributing it.
+ * 
+ * @param    version: Image version, higher than the version of this node
+ * @param    size: Image size (bytes)
+ * @param    offset: Offset of the part in the image
+ * @param    signature: Signature of the image (OTASIGNATURE bytes), only
+ *           with the first part
+ * @param    data: Part
+ * @param    length: Part size (bytes)
+ * @return   return_type status, ret_receive_auth_error if the signature
+ *           is wrong
+ */
+return_type ota_upload(uint16_t version, uint32_t size, uint32_t offset, const uint8_t *signature, const uint8_t *data, size_t length)
+{
+  if (!enabled)
+    return ret_error;
+
+  const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+
+  if (offset == 0)
+  {
+    if (version <= object.version)
+      return ret_error;
+    if (size == 0 || size > (uint32_t)OTAMAXPAGES * OTAPAGESIZE || size > partition->size)
+      return ret_send_size_error;
+    if (signature == NULL)
+      return ret_error;
+
+    // The version vector of the image comes from the previous one
+    if (object_pages > 0 && complete == object_pages)
+    {
+      base = object;
+      base_partition = object_partition;
+    }
+
+    uploading = 1;
+    upload_version = version;
+    upload_size = size;
+    upload_offset = 0;
+    upload_erased = 0;
+    source = 0;
+    request_due = 0;
+    summary_due = 0;
+    tx_page = -1;
+    staged = 0;
+    memcpy(upload_signature, signature, OTASIGNATURE);
+    LOG_INFO("Firmware version %d upload", version);
+  }
+
+  if (!uploading || version != upload_version || size != upload_size || offset != upload_offset || offset + length > size)
+    return ret_error;
+
+  while (upload_erased < offset + length)
+  {
+    if (esp_partition_erase_range(partition, upload_erased, OTAPAGESIZE) != ESP_OK)
+    {
+      ota_abortUpload();
+      return ret_error;
+    }
+    upload_erased += OTAPAGESIZE;
+  }
+
+  if (esp_partition_write(partition, offset, data, length) != ESP_OK)
+  {
+    ota_abortUpload();
+    return ret_error;
+  }
+
+  upload_offset += length;
+  upload_timestamp = millis();
+  if (upload_offset < size)
+  {
+    ota_armTimer();
+    return ret_ok;
+  }
+
+  // Pages equal to the previous image keep their version
+  uploading = 0;
+  object.version = version;
+  object.size = size;
+  object.pages = (size + OTAPAGESIZE - 1) / OTAPAGESIZE;
+  object_pages = object.pages + 1;
+  object_partition = partition;
+  ota_hashImage(object.digest);
+  memcpy(object.signature, upload_signature, OTASIGNATURE);
+  for (int i = 0; i < object.pages; i++)
+  {
+    size_t bytes = ota_pageBytes(i + 1);
+    esp_partition_read(partition, i * OTAPAGESIZE, page_buffer, bytes);
+    object.page_crcs[i] = crc32_le(0, page_buffer, bytes);
+    bool unchanged = base_partition != NULL && i < base.pages && base.page_crcs[i] == object.page_crcs[i];
+    object.page_versions[i] = unchanged ? base.page_versions[i] : version;
+  }
+  object_crc = crc32_le(0, profile, ota_fillProfile(&object, profile));
+  complete = object_pages;
+
+  return_type ret = ota_install();
+  if (ret != ret_ok)
+  {
+    memset(&object, 0, sizeof(object));
+    object_crc = 0;
+    object_pages = 0;
+    complete = 0;
+  }
+
+  ota_resetTrickle();
+  ota_armTimer();
+  return ret;
+}
+
+/**
+ * @brief    Handles a summary from a neighbour: a newer image is received,
+ *           starting from its profile, and a neighbour with more pages of
+ *           the same image becomes the source of the next page
+ * 
+ * @param    packet: Summary packet
+ */
+void ota_handleSummary(pack_struct packet)
+{
+  if (!enabled || uploading)
+    return;
+
+  payload_ota_summary_struct *summary = (payload_ota_summary_struct *)packet.payload;
+  if (refused_crc != 0 && summary->profile_crc == refused_crc)
+    return;
+
+  if (summary->version > object.version && summary->pages > 1 && summary->pages <= OTAMAXPAGES + 1 && summary->complete > 0)
+    ota_startObject(summary->version, summary->profile_crc, summary->pages);
+
+  // Same version of another image
+  if (summary->version == object.version && summary->profile_crc != object_crc)
+    return;
+
+  if (summary->version == object.version && summary->complete == complete)
+  {
+    heard++;
+    return;
+  }
+
+  ota_resetTrickle();
+
+  if (summary->version != object.version || summary->complete <= complete)
+    return;
+
+  if (packet.sender == source)
+    source_complete = summary->complete;
+
+  else if (source == 0 || neighbour_getQuality(packet.sender) > neighbour_getQuality(source))
+  {
+    source = packet.sender;
+    source_complete = summary->complete;
+    rx_retries = 0;
+    request_due = 0;
+    rx_deadline = millis() + random(OTAJITTERMS);
+  }
+  ota_armTimer();
+}
+
+/**
+ * @brief    Handles a page request: the packets requested from this node
+ *           are sent, a request for the page this node waits for delays
+ *           its own request
+ * 
+ * @param    packet: Request packet
+ */
+void ota_handleRequest(pack_struct packet)
+{
+  if (!enabled || uploading)
+    return;
+
+  payload_ota_request_struct *request = (payload_ota_request_struct *)packet.payload;
+  if (request->version != object.version)
+    return;
+
+  if (packet.receiver != NODENUMBER)
+  {
+    // The data requested by the other node is coming
+    if (request->page == complete && source != 0 && !request_due)
+      rx_deadline = millis() + OTAREQUESTSECS * 1000;
+    return;
+  }
+
+  if (request->page >= complete)
+    return;
+
+  // One page at a time, the other requests are sent again
+  if (tx_page < 0)
+  {
+    tx_page = request->page;
+    tx_missing = 0;
+  }
+  if (tx_page == request->page)
+    tx_missing |= request->missing & ota_pageMask(tx_page);
+  if (tx_missing == 0)
+    tx_page = -1;
+
+  ota_armTimer();
+}
+
+/**
+ * @brief    Handles a data packet: kept if it belongs to the next page of
+ *           this node, and not sent again if this node was sending it
+ * 
+ * @param    packet: Data packet
+ */
+void ota_handleData(pack_struct packet)
+{
+  if (!enabled || uploading)
+    return;
+
+  payload_ota_data_struct *data = (payload_ota_data_struct *)packet.payload;
+  if (data->version != object.version || data->packet >= OTAPAGEPACKETS)
+    return;
+
+  if (tx_page == data->page)
+  {
+    tx_missing &= ~(1u << data->packet);
+    if (tx_missing == 0)
+      tx_page = -1;
+  }
+
+  if (complete == object_pages || data->page != complete || !(rx_missing & (1u << data->packet)))
+    return;
+
+  size_t offset = data->packet * OTAPACKETSIZE;
+  size_t bytes = ota_pageBytes(data->page);
+  if (data->size != (bytes - offset < OTAPACKETSIZE ? bytes - offset : OTAPACKETSIZE))
+    return;
+
+  memcpy(page_buffer + offset, data->data, data->size);
+  rx_missing &= ~(1u << data->packet);
+  rx_retries = 0;
+  if (source != 0 && !request_due)
+    rx_deadline = millis() + OTAREQUESTSECS * 1000;
+
+  if (rx_missing == 0)
+    ota_pageReceived();
+
+  ota_armTimer();
+}
+
+/**
+ * @brief    Returns the version of the image of this node
+ * 
+ * @return   uint16_t version, 0 if none
+ */
+uint16_t ota_getVersion()
+{
+  return object.version;
+}
+
+/**
+ * @brief    Returns the pages of the image, profile included
+ * 
+ * @return   uint16_t pages, 0 without image
+ */
+uint16_t ota_getPages()
+{
+  return object_pages;
+}
+
+/**
+ * @brief    Returns the pages of the image received in order
+ * 
+ * @return   uint16_t pages
+ */
+uint16_t ota_getComplete()
+{
+  return complete;
+}
+
+/**
+ * @brief    Returns if the image is complete and set as boot partition
+ * 
+ * @return   bool 1 if staged
+ */
+bool ota_isStaged()
+{
+  return staged;
+}
+
+/**
+ * @brief    Distribution timer: summary interval, request timeout, pacing
+ *           of the packets, abandoned uploads and restart
+ * 
+ */
+void ota_timer()
+{
+  uint32_t now = millis();
+
+  if (uploading)
+  {
+    if (now - upload_timestamp >= OTAUPLOADSECS * 1000)
+      ota_abortUpload();
+    ota_armTimer();
+    return;
+  }
+
+  if ((int32_t)(now - (interval_start + interval)) >= 0)
+  {
+    interval = interval < OTAADVMAXSECS * 1000 / 2 ? 2 * interval : OTAADVMAXSECS * 1000;
+    ota_startInterval(now);
+  }
+
+  // Enough neighbours sent the same summary
+  if (!summary_checked && (int32_t)(now - summary_time) >= 0)
+  {
+    summary_checked = 1;
+    summary_due = heard < OTAADVREDUNDANCY;
+  }
+
+  if (source != 0 && complete < object_pages && !request_due && (int32_t)(now - rx_deadline) >= 0)
+  {
+    if (rx_retries++ < OTARETRIES)
+      request_due = 1;
+    else
+    {
+      LOG_WARN("Firmware source %d lost", source);
+      source = 0;
+      // A new image is kept only once its profile is received
+      if (complete == 0)
+        ota_dropObject();
+      ota_resetTrickle();
+    }
+  }
+
+  ota_send(now);
+
+  if (staged && OTAREBOOTSECS > 0 && now - staged_timestamp >= OTAREBOOTSECS * 1000)
+  {
+    staged = 0;
+    LOG_INFO("Restarting on firmware version %d", object.version);
+    log_drain();
+    ESP.restart();
+  }
+
+  ota_armTimer();
+}
+
+/**
+ * @brief    Arms the distribution timer on the first deadline
+ * 
+ */
+void ota_armTimer()
+{
+  uint32_t now = millis();
+  int32_t wait;
+
+  if (uploading)
+    wait = upload_timestamp + OTAUPLOADSECS * 1000 - now;
+  else
+  {
+    wait = interval_start + interval - now;
+    if (!summary_checked && (int32_t)(summary_time - now) < wait)
+      wait = summary_time - now;
+    if (source != 0 && complete < object_pages && !request_due && (int32_t)(rx_deadline - now) < wait)
+      wait = rx_deadline - now;
+    if (summary_due || request_due || tx_page >= 0)
+    {
+      // The distribution waits for the queue to empty
+      int32_t send_wait = next_send - now;
+      if (L1_outBuffer_left > 0 && send_wait < OTABUSYMS)
+        send_wait = OTABUSYMS;
+      if (send_wait < wait)
+        wait = send_wait;
+    }
+    if (staged && OTAREBOOTSECS > 0 && (int32_t)(staged_timestamp + OTAREBOOTSECS * 1000 - now) < wait)
+      wait = staged_timestamp + OTAREBOOTSECS * 1000 - now;
+  }
+
+  scheduler_set(timer_ota, wait > 0 ? wait : 0);
+}
+
+/**
+ * @brief    Sends one packet when the queue is empty and the share of the
+ *           duty cycle allows it: the data requested first, then the
+ *           request of this node, then its summary
+ * 
+ * @param    now: Current time (ms)
+ */
+void ota_send(uint32_t now)
+{
+  if ((int32_t)(now - next_send) < 0 || L1_outBuffer_left > 0)
+    return;
+
+  size_t size;
+  if (tx_page >= 0)
+  {
+    uint8_t packet = __builtin_ctz(tx_missing);
+    uint8_t data[OTAPACKETSIZE];
+    uint8_t data_size = ota_readPacket(tx_page, packet, data);
+    tx_missing &= ~(1u << packet);
+    L2_sendOtaData(object.version, tx_page, packet, data, data_size);
+    if (tx_missing == 0)
+      tx_page = -1;
+    size = 6 + data_size;
+  }
+  else if (request_due)
+  {
+    request_due = 0;
+    rx_deadline = now + OTAREQUESTSECS * 1000;
+    L2_sendOtaRequest(source, object.version, complete, rx_missing);
+    size = 8;
+  }
+  else if (summary_due)
+  {
+    summary_due = 0;
+    L2_sendOtaSummary(object.version, object_crc, object_pages, complete);
+    size = 10;
+  }
+  else
+    return;
+
+  size += L1HEADER + (GEOENABLED ? GEOHEADER : 0) + (CRYPTOENABLED ? CRYPTOTAG : 0);
+  next_send = now + L1_airtime(size) * 100 * 100 / (LORADUTY * OTASHARE);
+}
+
+/**
+ * @brief    Sends the summary sooner after a change: the interval starts
+ *           again from the shortest one
+ * 
+ */
+void ota_resetTrickle()
+{
+  if (interval == OTAADVMINSECS * 1000)
+    return;
+
+  interval = OTAADVMINSECS * 1000;
+  ota_startInterval(millis());
+}
+
+/**
+ * @brief    Starts a summary interval, the summary is sent at a random
+ *           time in its second half
+ * 
+ * @param    now: Current time (ms)
+ */
+void ota_startInterval(uint32_t now)
+{
+  interval_start = now;
+  summary_time = now + interval / 2 + random(interval / 2);
+  summary_checked = 0;
+  heard = 0;
+}
+
+/**
+ * @brief    Starts receiving a newer image, the image of this node, if
+ *           complete, is kept as source of the pages not changed
+ * 
+ * @param    version: Image version
+ * @param    profile_crc: Profile CRC32
+ * @param    pages: Pages, profile included
+ */
+void ota_startObject(uint16_t version, uint32_t profile_crc, uint16_t pages)
+{
+  if (object_pages > 0 && complete == object_pages)
+  {
+    base = object;
+    base_partition = object_partition;
+  }
+
+  memset(&object, 0, sizeof(object));
+  object.version = version;
+  object.pages = pages - 1;
+  object_crc = profile_crc;
+  object_pages = pages;
+  complete = 0;
+  object_partition = esp_ota_get_next_update_partition(NULL);
+  rx_missing = ota_pageMask(0);
+
+  source = 0;
+  request_due = 0;
+  tx_page = -1;
+  staged = 0;
+  LOG_INFO("Firmware version %d found, %d pages", version, pages - 1);
+}
+
+/**
+ * @brief    Checks the page just received and writes it, or receives it
+ *           again if its CRC does not match
+ * 
+ */
+void ota_pageReceived()
+{
+  size_t bytes = ota_pageBytes(complete);
+  uint32_t crc = crc32_le(0, page_buffer, bytes);
+  bool valid;
+
+  if (complete == 0)
+  {
+    ota_profile_struct parsed;
+    valid = crc == object_crc && ota_parseProfile(page_buffer, bytes, &parsed) && parsed.version == object.version && parsed.pages == object.pages;
+    if (valid && !ota_checkSignature(&parsed))
+    {
+      LOG_WARN("Firmware version %d not signed", object.version);
+      refused_crc = object_crc;
+      ota_dropObject();
+      return;
+    }
+    if (valid)
+    {
+      object = parsed;
+      memcpy(profile, page_buffer, bytes);
+    }
+  }
+  else
+  {
+    uint32_t offset = (complete - 1) * OTAPAGESIZE;
+    valid = crc == object.page_crcs[complete - 1] &&
+            esp_partition_erase_range(object_partition, offset, OTAPAGESIZE) == ESP_OK &&
+            esp_partition_write(object_partition, offset, page_buffer, bytes) == ESP_OK;
+  }
+
+  if (!valid)
+  {
+    LOG_WARN("Firmware page %d not valid", complete);
+    rx_missing = ota_pageMask(complete);
+    return;
+  }
+
+  LOG_DEBUG("Firmware page %d of %d received", complete, object_pages - 1);
+  complete++;
+  ota_nextPage();
+}
+
+/**
+ * @brief    Moves to the next page: the pages not changed are copied from
+ *           the previous image, the image is staged after the last page
+ * 
+ */
+void ota_nextPage()
+{
+  while (complete < object_pages && ota_copyPage(complete))
+    complete++;
+
+  request_due = 0;
+  rx_retries = 0;
+  if (complete == object_pages)
+  {
+    source = 0;
+    rx_missing = 0;
+    // A page with a forged CRC: the whole image is received again
+    if (ota_install() == ret_receive_auth_error)
+    {
+      complete = 1;
+      rx_missing = ota_pageMask(complete);
+      base_partition = NULL;
+    }
+  }
+  else
+  {
+    rx_missing = ota_pageMask(complete);
+    if (source != 0 && source_complete <= complete)
+      source = 0;
+    rx_deadline = millis() + random(OTAJITTERMS);
+  }
+
+  // The neighbours learn the new page count
+  ota_resetTrickle();
+}
+
+/**
+ * @brief    Goes back to the previous image when a new one is dropped
+ *           before its first page is written
+ * 
+ */
+void ota_dropObject()
+{
+  if (base_partition != NULL)
+  {
+    object = base;
+    object_partition = base_partition;
+    object_pages = object.pages + 1;
+    complete = object_pages;
+    object_crc = crc32_le(0, profile, ota_fillProfile(&object, profile));
+  }
+  else
+  {
+    memset(&object, 0, sizeof(object));
+    object_crc = 0;
+    object_pages = 0;
+    complete = 0;
+  }
+
+  base_partition = NULL;
+  source = 0;
+  rx_missing = 0;
+  request_due = 0;
+  ota_resetTrickle();
+}
+
+/**
+ * @brief    Copies a page from the previous image if its version did not
+ *           change since and its CRC matches
+ * 
+ * @param    page: Page, 1 for the first image page
+ * @return   bool 1 if copied
+ */
+bool ota_copyPage(uint16_t page)
+{
+  if (page == 0 || base_partition == NULL)
+    return 0;
+
+  int index = page - 1;
+  if (index >= base.pages || object.page_versions[index] > base.version || object.page_crcs[index] != base.page_crcs[index])
+    return 0;
+
+  size_t bytes = ota_pageBytes(page);
+  uint32_t offset = index * OTAPAGESIZE;
+  if (esp_partition_read(base_partition, offset, page_buffer, bytes) != ESP_OK || crc32_le(0, page_buffer, bytes) != object.page_crcs[index])
+    return 0;
+
+  // Received in place over the previous image
+  if (base_partition == object_partition)
+    return 1;
+
+  return esp_partition_erase_range(object_partition, offset, OTAPAGESIZE) == ESP_OK &&
+         esp_partition_write(object_partition, offset, page_buffer, bytes) == ESP_OK;
+}
+
+/**
+ * @brief    Checks the complete image, sets it as boot partition and saves
+ *           its profile
+ * 
+ * @return   return_type status, ret_receive_auth_error if the image does
+ *           not match its signed hash, ret_error if it is not valid
+ */
+return_type ota_install()
+{
+  if (!ota_checkImage())
+  {
+    LOG_ERROR("Firmware version %d does not match its signature", object.version);
+    return ret_receive_auth_error;
+  }
+
+  base_partition = NULL;
+
+  if (esp_ota_set_boot_partition(object_partition) != ESP_OK)
+  {
+    LOG_ERROR("Firmware version %d not valid", object.version);
+    return ret_error;
+  }
+
+  Preferences preferences;
+  preferences.begin("ota");
+  preferences.putBytes("profile", profile, OTAPROFILEHEADER + 6 * object.pages);
+  preferences.putUInt("address", object_partition->address);
+  preferences.end();
+
+  staged = 1;
+  staged_timestamp = millis();
+  LOG_INFO("Firmware version %d staged", object.version);
+  return ret_ok;
+}
+
+/**
+ * @brief    Checks the image against the hash of its profile, and the
+ *           signature of the profile
+ * 
+ * @return   bool 1 if valid
+ */
+bool ota_checkImage()
+{
+  uint8_t digest[OTADIGEST];
+  ota_hashImage(digest);
+  return memcmp(digest, object.digest, OTADIGEST) == 0 && ota_checkSignature(&object);
+}
+
+/**
+ * @brief    Computes the SHA-256 hash of the image in its partition
+ * 
+ * @param    digest: Output hash (OTADIGEST bytes)
+ */
+void ota_hashImage(uint8_t *digest)
+{
+  mbedtls_sha256_context sha;
+
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  for (uint32_t offset = 0; offset < object.size; offset += OTAPAGESIZE)
+  {
+    size_t bytes = object.size - offset < OTAPAGESIZE ? object.size - offset : OTAPAGESIZE;
+    esp_partition_read(object_partition, offset, page_buffer, bytes);
+    mbedtls_sha256_update(&sha, page_buffer, bytes);
+  }
+  mbedtls_sha256_finish(&sha, digest);
+  mbedtls_sha256_free(&sha);
+}
+
+/**
+ * @brief    Checks the signature of a profile: ECDSA P-256 of the SHA-256
+ *           hash of version (uint16), image size (uint32) and image hash
+ * 
+ * @param    checked: Profile
+ * @return   bool 1 if signed with the key of OTAPUBLICKEY
+ */
+bool ota_checkSignature(const ota_profile_struct *checked)
+{
+  uint8_t message[6 + OTADIGEST];
+  uint8_t hash[32];
+  memcpy(message, &checked->version, 2);
+  memcpy(message + 2, &checked->size, 4);
+  memcpy(message + 6, checked->digest, OTADIGEST);
+
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  mbedtls_sha256_update(&sha, message, sizeof(message));
+  mbedtls_sha256_finish(&sha, hash);
+  mbedtls_sha256_free(&sha);
+
+  mbedtls_ecp_group group;
+  mbedtls_ecp_point key;
+  mbedtls_mpi r, s;
+  mbedtls_ecp_group_init(&group);
+  mbedtls_ecp_point_init(&key);
+  mbedtls_mpi_init(&r);
+  mbedtls_mpi_init(&s);
+
+  bool valid = mbedtls_ecp_group_load(&group, MBEDTLS_ECP_DP_SECP256R1) == 0 &&
+               mbedtls_ecp_point_read_binary(&group, &key, public_key, sizeof(public_key)) == 0 &&
+               mbedtls_mpi_read_binary(&r, checked->signature, OTASIGNATURE / 2) == 0 &&
+               mbedtls_mpi_read_binary(&s, checked->signature + OTASIGNATURE / 2, OTASIGNATURE / 2) == 0 &&
+               mbedtls_ecdsa_verify(&group, hash, sizeof(hash), &key, &r, &s) == 0;
+
+  mbedtls_mpi_free(&r);
+  mbedtls_mpi_free(&s);
+  mbedtls_ecp_point_free(&key);
+  mbedtls_ecp_group_free(&group);
+  return valid;
+}
+
+/**
+ * @brief    Abandons an upload, the image being received in the partition
+ *           written is received again from its first page
+ * 
+ */
+void ota_abortUpload()
+{
+  LOG_WARN("Firmware version %d upload abandoned", upload_version);
+  uploading = 0;
+
+  if (object_partition == esp_ota_get_next_update_partition(NULL) && complete > 1)
+  {
+    complete = 1;
+    rx_missing = ota_pageMask(complete);
+  }
+  ota_resetTrickle();
+}
+
+/**
+ * @brief    Returns the size of a page
+ * 
+ * @param    page: Page, 0 for the profile
+ * @return   size_t size (bytes)
+ */
+size_t ota_pageBytes(uint16_t page)
+{
+  if (page == 0)
+    return OTAPROFILEHEADER + 6 * object.pages;
+
+  uint32_t offset = (page - 1) * OTAPAGESIZE;
+  if (object.size == 0 || offset >= object.size)
+    return 0;
+  return object.size - offset < OTAPAGESIZE ? object.size - offset : OTAPAGESIZE;
+}
+
+/**
+ * @brief    Returns the packets of a page
+ * 
+ * @param    page: Page, 0 for the profile
+ * @return   uint32_t packets, bit n for packet n
+ */
+uint32_t ota_pageMask(uint16_t page)
+{
+  size_t packets = (ota_pageBytes(page) + OTAPACKETSIZE - 1) / OTAPACKETSIZE;
+  return packets >= 32 ? 0xFFFFFFFF : (1u << packets) - 1;
+}
+
+/**
+ * @brief    Reads a packet of a page of the image of this node
+ * 
+ * @param    page: Page, 0 for the profile
+ * @param    packet: Packet
+ * @param    data: Output buffer (OTAPACKETSIZE bytes)
+ * @return   size_t packet size (bytes)
+ */
+size_t ota_readPacket(uint16_t page, uint8_t packet, uint8_t *data)
+{
+  size_t offset = packet * OTAPACKETSIZE;
+  size_t bytes = ota_pageBytes(page);
+  size_t size = bytes - offset < OTAPACKETSIZE ? bytes - offset : OTAPACKETSIZE;
+
+  if (page == 0)
+    memcpy(data, profile + offset, size);
+  else
+    esp_partition_read(object_partition, (page - 1) * OTAPAGESIZE + offset, data, size);
+  return size;
+}
+
+/**
+ * @brief    Writes a profile as sent: version, image size, pages, image
+ *           hash and signature, then version and CRC32 of each page
+ * 
+ * @param    source_profile: Profile
+ * @param    buffer: Output buffer
+ * @return   size_t size (bytes)
+ */
+size_t ota_fillProfile(const ota_profile_struct *source_profile, uint8_t *buffer)
+{
+  memcpy(buffer, &source_profile->version, 2);
+  memcpy(buffer + 2, &source_profile->size, 4);
+  memcpy(buffer + 6, &source_profile->pages, 2);
+  memcpy(buffer + 8, source_profile->digest, OTADIGEST);
+  memcpy(buffer + 8 + OTADIGEST, source_profile->signature, OTASIGNATURE);
+  for (int i = 0; i < source_profile->pages; i++)
+  {
+    memcpy(buffer + OTAPROFILEHEADER + 6 * i, &source_profile->page_versions[i], 2);
+    memcpy(buffer + OTAPROFILEHEADER + 6 * i + 2, &source_profile->page_crcs[i], 4);
+  }
+  return OTAPROFILEHEADER + 6 * source_profile->pages;
+}
+
+/**
+ * @brief    Reads a profile as sent
+ * 
+ * @param    buffer: Profile
+ * @param    size: Profile size (bytes)
+ * @param    parsed: Output profile
+ * @return   bool 1 if the profile is consistent
+ */
+bool ota_parseProfile(const uint8_t *buffer, size_t size, ota_profile_struct *parsed)
+{
+  if (size < OTAPROFILEHEADER)
+    return 0;
+
+  memcpy(&parsed->version, buffer, 2);
+  memcpy(&parsed->size, buffer + 2, 4);
+  memcpy(&parsed->pages, buffer + 6, 2);
+  if (parsed->version == 0 || parsed->pages == 0 || parsed->pages > OTAMAXPAGES || size != OTAPROFILEHEADER + 6 * (size_t)parsed->pages ||
+      parsed->size > (uint32_t)parsed->pages * OTAPAGESIZE || parsed->size <= (uint32_t)(parsed->pages - 1) * OTAPAGESIZE)
+    return 0;
+
+  memcpy(parsed->digest, buffer + 8, OTADIGEST);
+  memcpy(parsed->signature, buffer + 8 + OTADIGEST, OTASIGNATURE);
+  for (int i = 0; i < parsed->pages; i++)
+  {
+    memcpy(&parsed->page_versions[i], buffer + OTAPROFILEHEADER + 6 * i, 2);
+    memcpy(&parsed->page_crcs[i], buffer + OTAPROFILEHEADER + 6 * i + 2, 4);
+  }
+  return 1;
+}
@@ -0,0 +1,161 @@
+/**
+ * @file     power.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Power management.
+ *           The SX127x keeps receiving while the CPU light sleeps, DIO0
+ *           (RX done) wakes it up through the GPIO wake-up source, so
+ *           relaying only waits for the CPU wake-up time. Low-power
+ *           listening leaves also put the radio to sleep between channel
+ *           samples (CAD done on DIO0).
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "power.h"
+#include "scheduler.h"
+#include "metrics.h"
+#include "lpl.h"
+#include "log.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <WiFi.h>
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+#endif
+
+#if LOWPOWER && WIFIENABLED
+#error "LOWPOWER needs WIFIENABLED 0"
+#endif
+
+// Private variables
+static bool sleeping = 0;
+static uint32_t sleep_start = 0;
+static uint64_t sleep_us = 0;
+static uint32_t wakeups = 0;
+
+// Private functions
+void power_reportTimer();
+
+// Functions
+
+/**
+ * @brief    Initializes power management: in low-power mode lowers the CPU
+ *           frequency, turns off Wi-Fi and Bluetooth and enables the DIO0
+ *           wake-up
+ * 
+ */
+void power_init()
+{
+#if LOWPOWER && defined(ARDUINO_ARCH_ESP32)
+  setCpuFrequencyMhz(POWERCPUMHZ);
+  WiFi.mode(WIFI_OFF);
+  btStop();
+
+  gpio_wakeup_enable((gpio_num_t)DI0, GPIO_INTR_HIGH_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+#endif
+
+  scheduler_register(timer_power_report, power_reportTimer, POWERREPORTMINS * 60000);
+  return;
+}
+
+/**
+ * @brief    Light sleeps until the timeout or a radio interrupt. On the
+ *           host it only marks the start of the sleep, the caller advances
+ *           the clock
+ * 
+ * @param    wait: Timeout (ms)
+ */
+void power_sleep(uint32_t wait)
+{
+  sleeping = 1;
+  sleep_start = micros();
+
+#ifdef ARDUINO_ARCH_ESP32
+  Serial.flush();
+  esp_sleep_enable_timer_wakeup((uint64_t)wait * 1000);
+  esp_light_sleep_start();
+#endif
+  return;
+}
+
+/**
+ * @brief    Accounts the end of a sleep, called when the main loop runs
+ * 
+ */
+void power_wake()
+{
+  if (!sleeping)
+    return;
+
+  sleeping = 0;
+  sleep_us += micros() - sleep_start;
+  wakeups++;
+}
+
+/**
+ * @brief    Returns the number of wake-ups from light sleep
+ * 
+ * @return   uint32_t wake-ups
+ */
+uint32_t power_getWakeups()
+{
+  return wakeups;
+}
+
+/**
+ * @brief    Returns the time spent awake since boot
+ * 
+ * @return   uint32_t time (ms)
+ */
+uint32_t power_getAwakeMs()
+{
+  return millis() - (uint32_t)(sleep_us / 1000);
+}
+
+/**
+ * @brief    Estimates the daily consumption from the time spent awake,
+ *           asleep, receiving and transmitting since boot
+ * 
+ * @return   uint32_t consumption (mAh/day)
+ */
+uint32_t power_getMahPerDay()
+{
+  uint32_t total = millis();
+  if (total == 0)
+    return 0;
+
+  uint32_t asleep = sleep_us / 1000;
+  uint32_t awake = total - asleep;
+  uint32_t transmit = metrics_get(metric_airtime_ms);
+  if (transmit > total)
+    transmit = total;
+
+  // The radio receives whenever it does not transmit, unless it samples the channel
+  uint32_t receive = total - transmit;
+  if (LPLENABLED && lpl_getReceiveMs() < receive)
+    receive = lpl_getReceiveMs();
+
+  double charge = POWERAWAKEMA * (double)awake + POWERSLEEPMA * (double)asleep;
+  charge += POWERRXMA * (double)receive + POWERTXMA * (double)transmit;
+  charge += POWERRADIOSLEEPMA * (double)(total - transmit - receive);
+#if WIFIENABLED
+  charge += POWERWIFIMA * (double)total;
+#endif
+
+  return charge / total * 24 + 0.5;
+}
+
+/**
+ * @brief    Report timer: logs the estimated consumption
+ * 
+ */
+void power_reportTimer()
+{
+  LOG_INFO("Power: %u mAh/day, awake %u s, %u wake-ups", power_getMahPerDay(), power_getAwakeMs() / 1000, power_getWakeups());
+}
\ No newline at end of file
@@ -0,0 +1,259 @@
+/**
+ * @file     route.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    On-demand route discovery.
+ *           A packet to a node without route is held and a route request
+ *           is flooded with the destination as receiver. Every node relays
+ *           the first copy of a request only and learns the route back to
+ *           its sender. The destination answers with a route reply sent
+ *           back on that route, and the nodes on the way learn the route
+ *           to the destination. When the route is known, the packets held
+ *           for it are queued. Requests without reply are sent again after
+ *           a timeout doubled each time, then the held packets are dropped.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "route.h"
+#include "L1.h"
+#include "L2.h"
+#include "L3.h"
+#include "scheduler.h"
+#include "metrics.h"
+#include "log.h"
+
+// Private variables
+static route_discovery_struct pending[ROUTEPENDING];
+static pack_struct held[ROUTEHOLD];
+static int held_count = 0;
+static route_request_struct recent[ROUTECACHE];
+static int recent_index = 0;
+static uint32_t checked_version = 0;
+
+// Private functions
+void route_timer();
+void route_armTimer();
+void route_release(uint8_t destination);
+void route_drop(uint8_t destination);
+
+// Functions
+
+/**
+ * @brief    Initializes the route discovery
+ * 
+ */
+void route_init()
+{
+  memset(pending, 0, sizeof(pending));
+  held_count = 0;
+  memset(recent, 0, sizeof(recent));
+  recent_index = 0;
+  checked_version = L3_getVersion();
+
+  scheduler_register(timer_route, route_timer, 0);
+  return;
+}
+
+/**
+ * @brief    Holds a packet without route and discovers the route to its
+ *           receiver, the payload is owned by the route discovery if held
+ * 
+ * @param    packet: Packet to be sent
+ * @return   return_type status
+ */
+return_type route_hold(pack_struct packet)
+{
+  if (packet.receiver == 0 || packet.receiver == NODENUMBER || packet.receiver > MAXNODES)
+    return ret_send_error;
+
+  if (held_count == ROUTEHOLD)
+    return ret_buffer_full;
+
+  route_discovery_struct *discovery = NULL;
+  for (int i = 0; i < ROUTEPENDING && discovery == NULL; i++)
+  {
+    if (pending[i].destination == packet.receiver)
+      discovery = &pending[i];
+  }
+
+  if (discovery == NULL)
+  {
+    for (int i = 0; i < ROUTEPENDING && discovery == NULL; i++)
+    {
+      if (pending[i].destination == 0)
+        discovery = &pending[i];
+    }
+
+    if (discovery == NULL)
+      return ret_no_route;
+
+    discovery->destination = packet.receiver;
+    discovery->retries = 0;
+    discovery->deadline = millis() + ROUTETIMEOUTSECS * 1000;
+    LOG_DEBUG("Route request for %d", packet.receiver);
+    L2_sendRouteRequest(packet.receiver);
+    route_armTimer();
+  }
+
+  held[held_count++] = packet;
+  return ret_ok;
+}
+
+/**
+ * @brief    Queues the packets whose route has been found, after a routing
+ *           table change
+ * 
+ */
+void route_check()
+{
+  if (checked_version == L3_getVersion())
+    return;
+  checked_version = L3_getVersion();
+
+  for (int i = 0; i < ROUTEPENDING; i++)
+  {
+    uint8_t destination = pending[i].destination;
+    if (destination == 0 || L3_getNextNode(destination) == 0)
+      continue;
+
+    LOG_DEBUG("Route to %d found, %d retries", destination, pending[i].retries);
+    pending[i].destination = 0;
+    route_release(destination);
+  }
+
+  route_armTimer();
+}
+
+/**
+ * @brief    Checks if a route request has already been relayed
+ * 
+ * @param    sender: Request sender
+ * @param    id: Request id
+ * @return   bool 1 if duplicate
+ */
+bool route_checkDuplicate(uint8_t sender, uint32_t id)
+{
+  for (int i = 0; i < ROUTECACHE; i++)
+  {
+    if (recent[i].sender == sender && recent[i].id == id)
+      return 1;
+  }
+
+  recent[recent_index].sender = sender;
+  recent[recent_index].id = id;
+  recent_index = (recent_index + 1) % ROUTECACHE;
+  return 0;
+}
+
+/**
+ * @brief    Route timer: sends again the requests without reply, or gives
+ *           up and drops the packets held
+ * 
+ */
+void route_timer()
+{
+  uint32_t now = millis();
+
+  for (int i = 0; i < ROUTEPENDING; i++)
+  {
+    if (pending[i].destination == 0 || (int32_t)(pending[i].deadline - now) > 0)
+      continue;
+
+    if (pending[i].retries < ROUTERETRIES)
+    {
+      pending[i].retries++;
+      pending[i].deadline = now + (ROUTETIMEOUTSECS * 1000 << pending[i].retries);
+      L2_sendRouteRequest(pending[i].destination);
+    }
+    else
+    {
+      LOG_WARN("No route to %d", pending[i].destination);
+      uint8_t destination = pending[i].destination;
+      pending[i].destination = 0;
+      route_drop(destination);
+    }
+  }
+
+  route_armTimer();
+}
+
+/**
+ * @brief    Arms the route timer on the first deadline
+ * 
+ */
+void route_armTimer()
+{
+  uint32_t now = millis();
+  bool armed = 0;
+  int32_t wait = 0;
+
+  for (int i = 0; i < ROUTEPENDING; i++)
+  {
+    if (pending[i].destination == 0)
+      continue;
+
+    int32_t remaining = pending[i].deadline - now;
+    if (!armed || remaining < wait)
+      wait = remaining;
+    armed = 1;
+  }
+
+  if (!armed)
+    scheduler_cancel(timer_route);
+  else
+    scheduler_set(timer_route, wait > 0 ? wait : 0);
+}
+
+/**
+ * @brief    Queues the packets held for a destination
+ * 
+ * @param    destination: Destination node
+ */
+void route_release(uint8_t destination)
+{
+  int i = 0;
+  while (i < held_count)
+  {
+    if (held[i].receiver != destination)
+    {
+      i++;
+      continue;
+    }
+
+    // The packets keep their order
+    pack_struct packet = held[i];
+    memmove(&held[i], &held[i + 1], (--held_count - i) * sizeof(pack_struct));
+    // Packets of this node were given the default TTL without route
+    if (packet.sender == NODENUMBER && packet.hops == 0)
+      packet.ttl = L3_getTTL(destination);
+    L3_setNextNode(&packet, NODENUMBER);
+    L1_enqueue_outPacket(packet);
+  }
+}
+
+/**
+ * @brief    Drops the packets held for a destination
+ * 
+ * @param    destination: Destination node
+ */
+void route_drop(uint8_t destination)
+{
+  int i = 0;
+  while (i < held_count)
+  {
+    if (held[i].receiver != destination)
+    {
+      i++;
+      continue;
+    }
+
+    L1_freePayload(held[i]);
+    metrics_drop(ret_no_route);
+    memmove(&held[i], &held[i + 1], (--held_count - i) * sizeof(pack_struct));
+  }
+}
@@ -0,0 +1,325 @@
+/**
+ * @file     scheduler.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Timer scheduler.
+ *           Armed timers are kept in a binary min-heap ordered by deadline,
+ *           comparisons are wrap safe. On the ESP32 the main loop task
+ *           blocks on a task notification between deadlines, so the idle
+ *           task can put the CPU in light sleep.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include "config.h"
+#include "typedefs.h"
+#include "scheduler.h"
+#include "power.h"
+
+// Private variables
+static scheduler_timer_struct timers[timer_count];
+static uint8_t heap[timer_count];
+static int heap_size = 0;
+static uint32_t (*scheduler_clock)() = millis;
+
+#ifdef ARDUINO_ARCH_ESP32
+static TaskHandle_t scheduler_task = NULL;
+static portMUX_TYPE scheduler_mux = portMUX_INITIALIZER_UNLOCKED;
+#define SCHEDULER_LOCK() portENTER_CRITICAL(&scheduler_mux)
+#define SCHEDULER_UNLOCK() portEXIT_CRITICAL(&scheduler_mux)
+#else
+#define SCHEDULER_LOCK()
+#define SCHEDULER_UNLOCK()
+#endif
+
+// Private functions
+
+/**
+ * @brief    Returns 1 if heap item i expires before heap item j
+ * 
+ */
+static bool scheduler_before(int i, int j)
+{
+  return (int32_t)(timers[heap[i]].deadline - timers[heap[j]].deadline) < 0;
+}
+
+/**
+ * @brief    Swaps two heap items
+ * 
+ */
+static void scheduler_swap(int i, int j)
+{
+  uint8_t timer = heap[i];
+  heap[i] = heap[j];
+  heap[j] = timer;
+  timers[heap[i]].position = i;
+  timers[heap[j]].position = j;
+}
+
+/**
+ * @brief    Restores the heap order around item i
+ * 
+ */
+static void scheduler_fix(int i)
+{
+  while (i > 0 && scheduler_before(i, (i - 1) / 2))
+  {
+    scheduler_swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+
+  while (1)
+  {
+    int child = 2 * i + 1;
+    if (child >= heap_size)
+      break;
+    if (child + 1 < heap_size && scheduler_before(child + 1, child))
+      child++;
+    if (!scheduler_before(child, i))
+      break;
+    scheduler_swap(i, child);
+    i = child;
+  }
+}
+
+/**
+ * @brief    Removes a timer from the heap
+ * 
+ */
+static void scheduler_remove(timer_type timer)
+{
+  int i = timers[timer].position;
+  if (i < 0)
+    return;
+
+  timers[timer].position = -1;
+  heap_size--;
+  if (i == heap_size)
+    return;
+
+  heap[i] = heap[heap_size];
+  timers[heap[i]].position = i;
+  scheduler_fix(i);
+}
+
+/**
+ * @brief    Arms a timer at an absolute deadline
+ * 
+ */
+static void scheduler_insert(timer_type timer, uint32_t deadline)
+{
+  scheduler_remove(timer);
+  timers[timer].deadline = deadline;
+  timers[timer].position = heap_size;
+  heap[heap_size] = timer;
+  heap_size++;
+  scheduler_fix(heap_size - 1);
+}
+
+// Functions
+
+/**
+ * @brief    Initializes the scheduler, must be called from the main loop
+ *           task before registering timers
+ * 
+ * @param    clock: Clock function (ms), NULL for millis()
+ */
+void scheduler_init(uint32_t (*clock)())
+{
+  scheduler_clock = clock != NULL ? clock : millis;
+  heap_size = 0;
+  for (int i = 0; i < timer_count; i++)
+  {
+    timers[i].callback = NULL;
+    timers[i].position = -1;
+  }
+
+#ifdef ARDUINO_ARCH_ESP32
+  scheduler_task = xTaskGetCurrentTaskHandle();
+#endif
+  return;
+}
+
+/**
+ * @brief    Registers a timer callback, periodic timers are armed at once
+ * 
+ * @param    timer: Timer
+ * @param    callback: Function called when the timer expires
+ * @param    period: Period (ms), 0 for a one shot timer armed by scheduler_set()
+ */
+void scheduler_register(timer_type timer, scheduler_callback callback, uint32_t period)
+{
+  SCHEDULER_LOCK();
+  timers[timer].callback = callback;
+  timers[timer].period = period;
+  if (period)
+    scheduler_insert(timer, scheduler_clock() + period);
+  else
+    scheduler_remove(timer);
+  SCHEDULER_UNLOCK();
+}
+
+/**
+ * @brief    Arms a timer, replacing its current deadline
+ * 
+ * @param    timer: Timer
+ * @param    delay: Time from now (ms)
+ */
+void scheduler_set(timer_type timer, uint32_t delay)
+{
+  SCHEDULER_LOCK();
+  scheduler_insert(timer, scheduler_clock() + delay);
+  SCHEDULER_UNLOCK();
+}
+
+/**
+ * @brief    Disarms a timer
+ * 
+ * @param    timer: Timer
+ */
+void scheduler_cancel(timer_type timer)
+{
+  SCHEDULER_LOCK();
+  scheduler_remove(timer);
+  SCHEDULER_UNLOCK();
+}
+
+/**
+ * @brief    Returns if a timer is armed
+ * 
+ * @param    timer: Timer
+ * @return   bool 1 if armed
+ */
+bool scheduler_isSet(timer_type timer)
+{
+  return timers[timer].position >= 0;
+}
+
+/**
+ * @brief    Returns the time left before a timer expires
+ * 
+ * @param    timer: Timer
+ * @return   uint32_t time (ms), 0 if expired or not armed
+ */
+uint32_t scheduler_getRemaining(timer_type timer)
+{
+  int32_t left = 0;
+
+  SCHEDULER_LOCK();
+  if (timers[timer].position >= 0)
+    left = timers[timer].deadline - scheduler_clock();
+  SCHEDULER_UNLOCK();
+  return left > 0 ? left : 0;
+}
+
+/**
+ * @brief    Runs the callbacks of the expired timers. Periodic timers are
+ *           armed again before their callback, each timer runs at most
+ *           once per call
+ * 
+ */
+void scheduler_run()
+{
+  uint32_t now = scheduler_clock();
+
+  for (int i = 0; i < timer_count; i++)
+  {
+    SCHEDULER_LOCK();
+    if (heap_size == 0 || (int32_t)(timers[heap[0]].deadline - now) > 0)
+    {
+      SCHEDULER_UNLOCK();
+      return;
+    }
+
+    timer_type timer = (timer_type)heap[0];
+    if (timers[timer].period)
+    {
+      uint32_t deadline = timers[timer].deadline + timers[timer].period;
+      if ((int32_t)(deadline - now) <= 0)
+        deadline = now + timers[timer].period;
+      scheduler_insert(timer, deadline);
+    }
+    else
+      scheduler_remove(timer);
+    scheduler_callback callback = timers[timer].callback;
+    SCHEDULER_UNLOCK();
+
+    if (callback != NULL)
+      callback();
+  }
+}
+
+/**
+ * @brief    Returns the time until the next deadline
+ * 
+ * @return   uint32_t time (ms), at most SCHEDULERMAXSLEEPMS
+ */
+uint32_t scheduler_nextDeadline()
+{
+  uint32_t wait = SCHEDULERMAXSLEEPMS;
+
+  SCHEDULER_LOCK();
+  if (heap_size)
+  {
+    int32_t left = timers[heap[0]].deadline - scheduler_clock();
+    if (left < 0)
+      left = 0;
+    if ((uint32_t)left < wait)
+      wait = left;
+  }
+  SCHEDULER_UNLOCK();
+  return wait;
+}
+
+/**
+ * @brief    Sleeps until the next deadline or until scheduler_wake() is
+ *           called, in low-power mode the CPU light sleeps. On the host it
+ *           returns at once, the caller advances the clock using
+ *           scheduler_nextDeadline()
+ * 
+ */
+void scheduler_sleep()
+{
+#if LOWPOWER
+  uint32_t wait = scheduler_nextDeadline();
+  if (wait < POWERMINSLEEPMS)
+    return;
+#ifdef ARDUINO_ARCH_ESP32
+  // Interrupt received while running
+  if (ulTaskNotifyTake(pdTRUE, 0))
+    return;
+#endif
+  power_sleep(wait);
+#elif defined(ARDUINO_ARCH_ESP32)
+  uint32_t wait = scheduler_nextDeadline();
+  if (wait)
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait));
+#endif
+  return;
+}
+
+/**
+ * @brief    Wakes up the main loop, can be called from interrupts and
+ *           other tasks
+ * 
+ */
+void scheduler_wake()
+{
+#ifdef ARDUINO_ARCH_ESP32
+  if (scheduler_task == NULL)
+    return;
+
+  if (xPortInIsrContext())
+  {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(scheduler_task, &woken);
+    if (woken)
+      portYIELD_FROM_ISR();
+  }
+  else
+    xTaskNotifyGive(scheduler_task);
+#endif
+  return;
+}
\ No newline at end of file
@@ -0,0 +1,403 @@
+/**
+ * @file     webpage.cpp
+ * @author   Nicholas Polledri
+ * @version  1.0
+ * @date     09-08-2020
+ * 
+ * @brief    Web page rendering functions.
+ *           Pages are described as a list of sections, static text is kept
+ *           in PROGMEM and lists are rendered one item at a time, so a page
+ *           can be streamed in chunks with a fixed size buffer.
+ */
+
+// Include libraries
+#include <Arduino.h>
+#include <stdarg.h>
+#include "config.h"
+#include "typedefs.h"
+#include "webpage.h"
+#include "L3.h"
+#include "message.h"
+#include "metrics.h"
+#include "congestion.h"
+#include "ota.h"
+
+#define WEBPAGEJSONTAIL 24 // Room a JSON string leaves for the end of its object (bytes)
+
+// Exported variables
+char recipient[16] = "Broadcast";
+
+// Imported variables
+extern char node_name[16];
+extern uint8_t showmessages;
+extern int L1_outBuffer_left;
+
+// Private functions
+int webpage_fillNodeName(int index, uint32_t arg, char *buffer, size_t size);
+int webpage_fillRecipient(int index, uint32_t arg, char *buffer, size_t size);
+int webpage_fillScriptState(int index, uint32_t arg, char *buffer, size_t size);
+int webpage_fillStatusJson(int index, uint32_t arg, char *buffer, size_t size);
+bool webpage_nextChunk(webpage_render_struct *render);
+
+// Index page
+static const char index_head[] PROGMEM =
+    "<!DOCTYPE html><html>"
+    "<head><title>LoRaMessenger</title>"
+    "<meta name=viewport content=\"width=device-width,initial-scale=1\">"
+    "<style>article { background: #f2f2f2; padding: 1em; }"
+    "body { color: #333; font-family: Century Gothic, sans-serif; font-size: 18px; line-height: 24px; margin: 0; padding: 0; }"
+    "div { padding: 0.5em; }"
+    "h1 { margin: 0.5em 0 0 0; padding: 0; }"
+    "input { border-radius: 0; }"
+    "label { color: #333; display: block; font-style: italic; font-weight: bold; }"
+    "nav { background: #0061ff; color: #fff; display: block; font-size: 1.3em; padding: 1em; }"
+    "nav b { display: block; font-size: 1.2em; margin-bottom: 0.5em; } "
+    "textarea { width: 100%; }</style></head>"
+    "<body><nav><b>LoRaMessenger</b></nav>"
+    "<div> <form action=/rename method=post><br /><label>Node name</label>"
+    "<textarea name=nodename rows=1>";
+
+static const char index_nodes[] PROGMEM =
+    "</textarea><br /><input type=submit value=Update></form>"
+    "<form action=/join method=post><br /><label>Join group</label>"
+    "<textarea name=group rows=1>#</textarea><br /><input type=submit value=Join></form>"
+    "</div> <hr> <div><label>Online</label> <ul id=nodes style=list-style: none;>";
+
+static const char index_conversations[] PROGMEM =
+    "</ul> </div> <hr> <div><label>Conversations</label> <ul style=list-style: none;><li><a href=/>All</a></li>";
+
+static const char index_messages[] PROGMEM =
+    "</ul> </div> <hr> <div><label>Messages</label> <ul id=messages style=list-style: none;>";
+
+static const char index_send[] PROGMEM =
+    "</ul> </div> <div> <form action=/refresh method=post><input type=submit value=Refresh></form> </div> <hr>"
+    "<div> <form action=/send method=post><br /><label>Recipient</label><textarea name=message rows=1>";
+
+static const char index_tail[] PROGMEM =
+    "</textarea><br /><label>Send new message</label>"
+    "<textarea name=message></textarea><br /><label>Hops (0 automatic)</label>"
+    "<input type=number name=hops min=0 max=15 value=0><br /><input type=submit value=Send></form> </div><script>";
+
+// Live updates: messages and acknowledgments are pushed as JSON and applied
+// to the list, the node list is fetched again when the routing table changes
+static const char index_script[] PROGMEM =
+    "function h(t){var d=document.createElement('div');d.textContent=t;return d.innerHTML;}"
+    "function msg(m){if(m.update>last)last=m.update;if(peer&&m.peer!=peer)return;"
+    "var i='m'+m.sender+'_'+m.id,l=document.getElementById(i),u=document.getElementById('messages');"
+    "if(!l){l=document.createElement('li');l.id=i;u.appendChild(l);"
+    "while(u.children.length>shown)u.removeChild(u.firstChild);}"
+    "var s='<b>'+h(m.from)+' -> '+h(m.to)+':</b> '+h(m.text);"
+    "if(m.acks.length)s+='<br>Received by: '+m.acks.map(h).join(', ');l.innerHTML=s;}"
+    "function nodes(){fetch('/api/nodes').then(function(r){return r.json();}).then(function(n){"
+    "document.getElementById('nodes').innerHTML=n.map(function(x){return '<li><b>'+h(x.name)+'</b>'+"
+    "(x.hops>0?' via '+h(x.via):'')+' | RSSI: '+x.rssi+' | Link: '+Math.floor(x.link/10)+'% | Hops: '+x.hops+' | '+x.age+'s ago </li>';}).join('');});}"
+    "if(window.EventSource){var e=new EventSource('/events');"
+    "e.addEventListener('msg',function(v){msg(JSON.parse(v.data));});"
+    "e.addEventListener('nodes',nodes);"
+    "e.onopen=function(){fetch('/api/messages?since='+last).then(function(r){return r.json();})"
+    ".then(function(a){a.forEach(msg);});nodes();};}"
+    "</script></html>";
+
+// API
+static const char json_array_begin[] PROGMEM = "[";
+static const char json_array_end[] PROGMEM = "]";
+
+const webpage_section_struct webpage_index[] = {
+    {index_head, NULL},
+    {NULL, webpage_fillNodeName},
+    {index_nodes, NULL},
+    {NULL, L3_fillNodeItem},
+    {index_conversations, NULL},
+    {NULL, message_fillConversationItem},
+    {index_messages, NULL},
+    {NULL, message_fillMessageItem},
+    {index_send, NULL},
+    {NULL, webpage_fillRecipient},
+    {index_tail, NULL},
+    {NULL, webpage_fillScriptState},
+    {index_script, NULL},
+    {NULL, NULL}};
+
+const webpage_section_struct webpage_nodes[] = {
+    {json_array_begin, NULL},
+    {NULL, L3_fillNodeJson, ","},
+    {json_array_end, NULL},
+    {NULL, NULL}};
+
+const webpage_section_struct webpage_messages[] = {
+    {json_array_begin, NULL},
+    {NULL, message_fillMessageJson, ","},
+    {json_array_end, NULL},
+    {NULL, NULL}};
+
+const webpage_section_struct webpage_thread[] = {
+    {json_array_begin, NULL},
+    {NULL, message_fillThreadJson, ","},
+    {json_array_end, NULL},
+    {NULL, NULL}};
+
+const webpage_section_struct webpage_metrics[] = {
+    {NULL, metrics_fillPrometheus},
+    {NULL, NULL}};
+
+const webpage_section_struct webpage_status[] = {
+    {NULL, webpage_fillStatusJson},
+    {NULL, NULL}};
+
+// Functions
+
+/**
+ * @brief    Prepares a page to be rendered
+ * 
+ * @param    render: Render state
+ * @param    page: Page sections
+ * @param    arg: Argument passed to the item renderers
+ */
+void webpage_begin(webpage_render_struct *render, const webpage_section_struct *page, uint32_t arg)
+{
+  render->page = page;
+  render->arg = arg;
+  render->section = 0;
+  render->item = 0;
+  render->items_written = 0;
+  render->chunk = NULL;
+  render->chunk_size = 0;
+  render->chunk_offset = 0;
+  render->chunk_progmem = 0;
+  return;
+}
+
+/**
+ * @brief    Writes the next part of a page into buffer
+ * 
+ * @param    render: Render state
+ * @param    buffer: Output buffer
+ * @param    max_len: Output buffer size
+ * @return   size_t bytes written, 0 when the page is complete
+ */
+size_t webpage_fill(webpage_render_struct *render, uint8_t *buffer, size_t max_len)
+{
+  size_t written = 0;
+
+  while (written < max_len)
+  {
+    if (render->chunk_offset < render->chunk_size)
+    {
+      size_t length = render->chunk_size - render->chunk_offset;
+      if (length > max_len - written)
+        length = max_len - written;
+
+      if (render->chunk_progmem)
+        memcpy_P(buffer + written, render->chunk + render->chunk_offset, length);
+      else
+        memcpy(buffer + written, render->chunk + render->chunk_offset, length);
+
+      render->chunk_offset += length;
+      written += length;
+    }
+    else if (!webpage_nextChunk(render))
+      break;
+  }
+  return written;
+}
+
+/**
+ * @brief    Appends formatted text to a line buffer without overflowing it
+ * 
+ * @param    buffer: Line buffer
+ * @param    size: Line buffer size
+ * @param    length: Current line length
+ * @param    format: printf format
+ * @return   int new line length
+ */
+int webpage_append(char *buffer, size_t size, int length, const char *format, ...)
+{
+  if (length < 0 || (size_t)length >= size - 1)
+    return size - 1;
+
+  va_list args;
+  va_start(args, format);
+  int ret = vsnprintf(buffer + length, size - length, format, args);
+  va_end(args);
+
+  if (ret < 0)
+    return length;
+
+  length += ret;
+  if ((size_t)length > size - 1)
+    length = size - 1;
+  return length;
+}
+
+/**
+ * @brief    Appends a string to a line buffer as a quoted JSON string
+ * 
+ * @param    buffer: Line buffer
+ * @param    size: Line buffer size
+ * @param    length: Current line length
+ * @param    string: String to be escaped
+ * @return   int new line length
+ */
+int webpage_appendJson(char *buffer, size_t size, int length, const char *string)
+{
+  length = webpage_append(buffer, size, length, "\"");
+  for (; *string; string++)
+  {
+    // A long string is cut, and still closed, before the end of the object
+    char c = *string;
+    size_t escaped = c == '"' || c == '\\' ? 2 : (uint8_t)c < 0x20 ? 6 : 1;
+    if (!webpage_fits(size, length, escaped + 7, WEBPAGEJSONTAIL))
+    {
+      length = webpage_append(buffer, size, length, "\\u2026");
+      break;
+    }
+
+    if (c == '"' || c == '\\')
+      length = webpage_append(buffer, size, length, "\\%c", c);
+    else if ((uint8_t)c < 0x20)
+      length = webpage_append(buffer, size, length, "\\u%04x", c);
+    else
+      length = webpage_append(buffer, size, length, "%c", c);
+  }
+  return webpage_append(buffer, size, length, "\"");
+}
+
+/**
+ * @brief    Returns the size of a string written by webpage_appendJson
+ * 
+ * @param    string: String
+ * @return   size_t size, quotes included
+ */
+size_t webpage_jsonSize(const char *string)
+{
+  size_t size = 2;
+  for (; *string; string++)
+  {
+    char c = *string;
+    size += c == '"' || c == '\\' ? 2 : (uint8_t)c < 0x20 ? 6 : 1;
+  }
+  return size;
+}
+
+/**
+ * @brief    Returns if text fits a line buffer and leaves room for the end
+ *           of the line
+ * 
+ * @param    size: Line buffer size
+ * @param    length: Current line length
+ * @param    added: Size of the text
+ * @param    tail: Room kept for the end of the line
+ * @return   bool 1 if it fits
+ */
+bool webpage_fits(size_t size, int length, size_t added, size_t tail)
+{
+  return length >= 0 && (size_t)length + added + tail < size;
+}
+
+/**
+ * @brief    Loads the next static text or list item to be sent
+ * 
+ * @param    render: Render state
+ * @return   bool 0 if there is nothing left to render
+ */
+bool webpage_nextChunk(webpage_render_struct *render)
+{
+  while (render->page[render->section].text != NULL || render->page[render->section].fill != NULL)
+  {
+    const webpage_section_struct *section = &render->page[render->section];
+
+    if (section->text != NULL)
+    {
+      if (render->item == 0)
+      {
+        render->item++;
+        render->chunk = section->text;
+        render->chunk_size = strlen_P(section->text);
+        render->chunk_offset = 0;
+        render->chunk_progmem = 1;
+        return 1;
+      }
+    }
+    else
+    {
+      int separator_length = 0;
+      if (section->separator != NULL && render->items_written > 0)
+        separator_length = webpage_append(render->line, sizeof(render->line), 0, "%s", section->separator);
+
+      int length;
+      while ((length = section->fill(render->item, render->arg, render->line + separator_length, sizeof(render->line) - separator_length)) >= 0)
+      {
+        render->item++;
+        if (length > 0)
+        {
+          render->items_written++;
+          render->chunk = render->line;
+          render->chunk_size = separator_length + length;
+          render->chunk_offset = 0;
+          render->chunk_progmem = 0;
+          return 1;
+        }
+      }
+    }
+
+    render->section++;
+    render->item = 0;
+    render->items_written = 0;
+  }
+  return 0;
+}
+
+/**
+ * @brief    Renders the node name
+ * 
+ * @return   int item length
+ */
+int webpage_fillNodeName(int index, uint32_t arg, char *buffer, size_t size)
+{
+  if (index > 0)
+    return -1;
+  return webpage_append(buffer, size, 0, "%s", node_name);
+}
+
+/**
+ * @brief    Renders the last used recipient
+ * 
+ * @return   int item length
+ */
+int webpage_fillRecipient(int index, uint32_t arg, char *buffer, size_t size)
+{
+  if (index > 0)
+    return -1;
+  return webpage_append(buffer, size, 0, "%s", recipient);
+}
+
+/**
+ * @brief    Renders the state needed by the live update script, arg is
+ *           the conversation shown (0 for all)
+ * 
+ * @return   int item length
+ */
+int webpage_fillScriptState(int index, uint32_t arg, char *buffer, size_t size)
+{
+  if (index > 0)
+    return -1;
+  return webpage_append(buffer, size, 0, "var last=%u,shown=%d,peer=%u;", message_getUpdate(), showmessages, arg);
+}
+
+/**
+ * @brief    Renders the node status as a JSON object
+ * 
+ * @return   int item length
+ */
+int webpage_fillStatusJson(int index, uint32_t arg, char *buffer, size_t size)
+{
+  if (index > 0)
+    return -1;
+
+  int length = webpage_append(buffer, size, 0, "{\"node\":%d,\"name\":", NODENUMBER);
+  length = webpage_appendJson(buffer, size, length, node_name);
+  length = webpage_append(buffer, size, length, ",\"netid\":%d,\"uptime\":%u,\"queue\":%d,\"heap\":%u,\"update\":%u,\"routing\":%u",
+                          NETID, millis() / 1000, L1_outBuffer_left, ESP.getFreeHeap(), message_getUpdate(), L3_getVersion());
+  length = webpage_append(buffer, size, length, ",\"load\":%d,\"window\":%d,\"room\":%d", congestion_getLoad(), congestion_getWindow(), congestion_getRoom());
+  return webpage_append(buffer, size, length, ",\"firmware\":%u,\"pages\":%u,\"complete\":%u,\"staged\":%d}", ota_getVersion(), ota_getPages(), ota_getComplete(), ota_isStaged());
+}
\ No newline at end of file
@@ -17,27 +17,37 @@
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include <DNSServer.h>
+#include <memory>
 #include "L2.h"
 #include "L3.h"
 #include "message.h"
+#include "group.h"
+#include "congestion.h"
+#include "webpage.h"
+#include "scheduler.h"
 
 char wifi_ssid[20];
 
 AsyncWebServer webServer(80);
+AsyncEventSource events("/events");
 DNSServer dnsServer;
 
 // Imported variables
 extern char node_name[16];
+extern char recipient[16];
 
 // Variables
-char recipient[16] = "Broadcast";
+uint32_t pushed_message_update = 0;
+uint32_t pushed_routing_version = 0;
 
 // IP
 IPAddress ap_local_IP(1, 1, 1, 1);
 IPAddress ap_subnet(255, 255, 255, 0);
 
 // Private Functions
-String index_html();
+void webserver_sendPage(AsyncWebServerRequest *request, const char *content_type, const webpage_section_struct *page, uint32_t arg);
+void webserver_pushEvents();
+bool webserver_sendBackpressure(AsyncWebServerRequest *request, return_type ret);
 
 // Functions
 
@@ -57,13 +67,20 @@ void webserver_init()
   dnsServer.start(DNSPORT, "*", ap_local_IP);
 
   webServer.on("/", [](AsyncWebServerRequest *request) {
-    request->send(200, "text/html", index_html());
+    // A conversation is read when shown
+    uint8_t peer = 0;
+    if (request->hasParam("peer"))
+    {
+      peer = strtoul(request->getParam("peer")->value().c_str(), NULL, 10);
+      message_markRead(peer);
+    }
+    webserver_sendPage(request, "text/html", webpage_index, peer);
   });
   webServer.on("/generate_204", [](AsyncWebServerRequest *request) {
-    request->send(200, "text/html", index_html());
+    webserver_sendPage(request, "text/html", webpage_index, 0);
   });
   webServer.on("/captive-portal/api", [](AsyncWebServerRequest *request) {
-    request->send(200, "text/html", index_html());
+    webserver_sendPage(request, "text/html", webpage_index, 0);
   });
   webServer.on("/rename", HTTP_POST, [](AsyncWebServerRequest *request) {
     AsyncWebParameter *p = request->getParam(0);
@@ -73,12 +90,19 @@ void webserver_init()
       {
         strcpy(node_name, p->value().c_str());
         L3_updateNode();
-        L2_sendAnnounce();
+        L2_sendName(BROADCASTADDR);
       }
     }
     request->redirect("/");
   });
 
+  webServer.on("/join", HTTP_POST, [](AsyncWebServerRequest *request) {
+    AsyncWebParameter *p = request->getParam(0);
+    if (p->value().c_str()[0] == '#')
+      group_join(p->value().c_str());
+    request->redirect("/");
+  });
+
   webServer.on("/send", HTTP_POST, [](AsyncWebServerRequest *request) {
     {
       AsyncWebParameter *p = request->getParam(0);
@@ -92,7 +116,15 @@ void webserver_init()
       AsyncWebParameter *p = request->getParam(1);
       if (strlen(p->value().c_str()) > 0 && strlen(p->value().c_str()) < 160)
       {
-        L2_sendMessage(L3_getNodeNumber(recipient), const_cast<char *>(p->value().c_str()));
+        // Scope of the message, 0 for the known route or the default TTL
+        int hops = request->hasParam("hops", true) ? request->getParam("hops", true)->value().toInt() : 0;
+        return_type ret = L2_sendMessage(L3_getNodeNumber(recipient), const_cast<char *>(p->value().c_str()), hops > 0 && hops <= TTLMAX ? hops : 0);
+        // A refused message leaves the node as it was, the client sends it again
+        if (webserver_sendBackpressure(request, ret))
+          return;
+        // Writing to a group joins it, to receive the answers
+        if (ret == ret_ok && recipient[0] == '#')
+          group_join(recipient);
       }
     }
     request->redirect("/");
@@ -102,7 +134,43 @@ void webserver_init()
     request->redirect("/");
   });
 
+  webServer.on("/api/nodes", HTTP_GET, [](AsyncWebServerRequest *request) {
+    webserver_sendPage(request, "application/json", webpage_nodes, 0);
+  });
+  webServer.on("/api/messages", HTTP_GET, [](AsyncWebServerRequest *request) {
+    uint32_t since = 0;
+    if (request->hasParam("since"))
+      since = strtoul(request->getParam("since")->value().c_str(), NULL, 10);
+    webserver_sendPage(request, "application/json", webpage_messages, since);
+  });
+  webServer.on("/api/thread", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!request->hasParam("peer"))
+    {
+      request->send(400);
+      return;
+    }
+    uint8_t peer = strtoul(request->getParam("peer")->value().c_str(), NULL, 10);
+    uint32_t before = 0;
+    if (request->hasParam("before"))
+      before = strtoul(request->getParam("before")->value().c_str(), NULL, 10);
+    if (request->hasParam("read"))
+      message_markRead(peer);
+    webserver_sendPage(request, "application/json", webpage_thread, message_getThreadArg(peer, before));
+  });
+  webServer.on("/api/status", HTTP_GET, [](AsyncWebServerRequest *request) {
+    webserver_sendPage(request, "application/json", webpage_status, 0);
+  });
+  webServer.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+    webserver_sendPage(request, "text/plain; version=0.0.4", webpage_metrics, 0);
+  });
+
+  pushed_message_update = message_getUpdate();
+  pushed_routing_version = L3_getVersion();
+  webServer.addHandler(&events);
+
   webServer.begin();
+
+  scheduler_register(timer_webserver, webserver_loop, WEBSERVERPOLLMS);
   return;
 }
 
@@ -113,40 +181,100 @@ void webserver_init()
 void webserver_loop()
 {
   dnsServer.processNextRequest();
+  webserver_pushEvents();
 }
 
 /**
- * @brief    Creates a string containg the web page
+ * @brief    Pushes new messages, acknowledgments and routing changes
+ *           to the connected clients (Server-Sent Events)
  * 
- * @return   String 
  */
-String index_html()
+void webserver_pushEvents()
 {
-  String html = "<!DOCTYPE html><html>"
-                "<head><title>LoRaMessenger</title>"
-                "<meta name=viewport content=\"width=device-width,initial-scale=1\">"
-                "<style>article { background: #f2f2f2; padding: 1em; }"
-                "body { color: #333; font-family: Century Gothic, sans-serif; font-size: 18px; line-height: 24px; margin: 0; padding: 0; }"
-                "div { padding: 0.5em; }"
-                "h1 { margin: 0.5em 0 0 0; padding: 0; }"
-                "input { border-radius: 0; }"
-                "label { color: #333; display: block; font-style: italic; font-weight: bold; }"
-                "nav { background: #0061ff; color: #fff; display: block; font-size: 1.3em; padding: 1em; }"
-                "nav b { display: block; font-size: 1.2em; margin-bottom: 0.5em; } "
-                "textarea { width: 100%; }</style></head>"
-                "<body><nav><b>LoRaMessenger</b></nav>"
-                "<div> <form action=/rename method=post><br /><label>Node name</label>"
-                "<textarea name=nodename rows=1>" +
-                String(node_name) +
-                "</textarea><br /><input type=submit value=Update></form>"
-                "</div> <hr> <div><label>Online</label> <ul style=list-style: none;>" +
-                L3_getStringNodeList() +
-                "</ul> </div> <hr> <div><label>Messages</label> <ul style=list-style: none;>" +
-                message_getStringMessageList() +
-                "</ul> </div> <div> <form action=/refresh method=post><input type=submit value=Refresh></form> </div> <hr>"
-                "<div> <form action=/send method=post><br /><label>Recipient</label><textarea name=message rows=1>" +
-                String(recipient) +
-                "</textarea><br /><label>Send new message</label>"
-                "<textarea name=message></textarea><br /><input type=submit value=Send></form> </div> </html>";
-  return html;
+  uint32_t message_update = message_getUpdate();
+  uint32_t routing_version = L3_getVersion();
+
+  if (events.count() == 0)
+  {
+    pushed_message_update = message_update;
+    pushed_routing_version = routing_version;
+    return;
+  }
+
+  if (message_update != pushed_message_update)
+  {
+    char json[WEBLINEBUFFER];
+    int length;
+
+    for (int i = 0; (length = message_fillMessageJson(i, pushed_message_update, json, sizeof(json))) >= 0; i++)
+    {
+      if (length > 0)
+        events.send(json, "msg", message_update);
+    }
+    pushed_message_update = message_update;
+  }
+
+  if (routing_version != pushed_routing_version)
+  {
+    char version[11];
+    sprintf(version, "%u", routing_version);
+    events.send(version, "nodes", message_update);
+    pushed_routing_version = routing_version;
+  }
+}
+
+/**
+ * @brief    Sends a page as a chunked response
+ * 
+ *           The page is rendered while it is sent, so the heap used by a
+ *           request is limited to the render state whatever the history size.
+ * 
+ * @param    request: Request to be answered
+ * @param    content_type: Response content type
+ * @param    page: Page sections
+ * @param    arg: Argument passed to the item renderers
+ */
+void webserver_sendPage(AsyncWebServerRequest *request, const char *content_type, const webpage_section_struct *page, uint32_t arg)
+{
+  std::shared_ptr<webpage_render_struct> render(new webpage_render_struct);
+  webpage_begin(render.get(), page, arg);
+
+  AsyncWebServerResponse *response = request->beginChunkedResponse(content_type, [render](uint8_t *buffer, size_t max_len, size_t index) -> size_t {
+    return webpage_fill(render.get(), buffer, max_len);
+  });
+  request->send(response);
+}
+
+/**
+ * @brief    Answers a message refused by the congestion control: 429 when
+ *           the window of messages waiting for their acknowledgment is
+ *           full, 503 when the send queue is congested, with the time to
+ *           wait before sending again
+ * 
+ * @param    request: Request to be answered
+ * @param    ret: Send status
+ * @return   bool 1 if the request has been answered
+ */
+bool webserver_sendBackpressure(AsyncWebServerRequest *request, return_type ret)
+{
+  int code;
+  uint32_t retry_secs;
+
+  if (ret == ret_congested)
+  {
+    code = 429;
+    retry_secs = (congestion_getWait() + 999) / 1000;
+  }
+  else if (ret == ret_buffer_full)
+  {
+    code = 503;
+    retry_secs = CONGESTIONRETRYSECS;
+  }
+  else
+    return 0;
+
+  AsyncWebServerResponse *response = request->beginResponse(code, "text/plain", code == 429 ? "Too many messages waiting for an acknowledgment" : "Send queue full");
+  response->addHeader("Retry-After", String(retry_secs > 0 ? retry_secs : 1));
+  request->send(response);
+  return 1;
 }
\ No newline at end of file